@@ -169,6 +169,9 @@ namespace v {
         /// Get the coroutine scheduler
         CoroutineScheduler& scheduler() { return scheduler_; }
 
+        /// Get the executor that runs tasks, for code that builds its own taskflows
+        tf::Executor& executor() { return executor_; }
+
     private:
         tf::Executor       executor_;
         CoroutineScheduler scheduler_;
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <array>
+#include <defs.h>
+#include <vector>
+#include <vmath.h>
+#include <vox/store/64tree.h>
+
+namespace tf {
+    class Executor;
+}
+
+namespace v {
+
+    /// Direction a voxel face points in
+    enum class S64Face : u8 { PosX, NegX, PosY, NegY, PosZ, NegZ };
+
+    /// A quad corner packed into 32 bits: x, y and z relative to the chunk origin in
+    /// bits 0-6, 7-13 and 14-20 (0 to 64 inclusive), the S64Face in bits 21-23 and the
+    /// voxel type in the top 8 bits.
+    struct S64MeshVertex {
+        u32 bits;
+
+        static FORCEINLINE S64MeshVertex
+        pack(const glm::uvec3& pos, S64Face face, VoxelType type)
+        {
+            return { pos.x | pos.y << 7 | pos.z << 14 | static_cast<u32>(face) << 21 |
+                     static_cast<u32>(type) << 24 };
+        }
+
+        FORCEINLINE glm::uvec3 pos() const
+        {
+            return glm::uvec3(bits & 0x7f, (bits >> 7) & 0x7f, (bits >> 14) & 0x7f);
+        }
+        FORCEINLINE S64Face   face() const { return S64Face((bits >> 21) & 7); }
+        FORCEINLINE VoxelType type() const { return static_cast<VoxelType>(bits >> 24); }
+    };
+    static_assert(sizeof(S64MeshVertex) == 4);
+
+    /// The visible faces of a chunk of a Sparse64Tree, merged into quads
+    struct S64ChunkMesh {
+        /// in voxels, a multiple of S64Mesher::k_chunk_size
+        glm::uvec3 origin{ 0 };
+        /// 4 corners per quad, counter clockwise seen from outside the voxel, so a quad
+        /// draws as the triangles (0, 1, 2) and (0, 2, 3)
+        std::vector<S64MeshVertex> vertices;
+
+        FORCEINLINE usize quad_count() const { return vertices.size() / 4; }
+    };
+
+    /// Meshes a Sparse64Tree in chunks of 64^3 voxels, straight from the occupancy
+    /// masks of its bricks. Faces are culled 64 at a time by shifting each brick's
+    /// mask against itself and its neighbors, then the faces of each slice of the
+    /// chunk are packed into one 64 bit row per line, and merged greedily into the
+    /// largest rectangles of a single type, with bit scans.
+    /// A face belongs to the chunk of the voxel it bounds, so chunks can be meshed
+    /// independently. Keeps its scratch buffers between chunks, so reuse one per
+    /// thread.
+    class S64Mesher {
+    public:
+        static constexpr u32 k_chunk_size = 64;
+
+        S64Mesher();
+
+        /// Meshes the chunk at origin, a multiple of k_chunk_size, into out.
+        /// Voxels outside the tree count as air.
+        void mesh_chunk(
+            const Sparse64Tree& tree, const glm::uvec3& origin, S64ChunkMesh& out);
+
+        /// Meshes every chunk of the tree holding solid voxels, in parallel on the
+        /// executor. Chunks without visible faces are left out.
+        /// Must not be called from one of the executor's workers.
+        static std::vector<S64ChunkMesh>
+        mesh_tree(const Sparse64Tree& tree, tf::Executor& executor);
+
+    private:
+        /// bricks along a chunk's edge
+        static constexpr u32 k_bricks = k_chunk_size / 4;
+        /// the chunk's bricks plus a border of one around it
+        static constexpr u32 k_grid = k_bricks + 2;
+
+        /// A brick of the chunk or its border, pointing into the tree
+        struct Brick {
+            /// occupancy, bit idx = x | z << 2 | y << 4
+            u64 mask;
+            /// the brick's voxels, or nullptr if it's uniformly type
+            const VoxelType* voxels;
+            VoxelType        type;
+        };
+
+        /// Copies the bricks of the node overlapping the grid into it. pos and size
+        /// are in bricks.
+        void gather(const S64Node& node, const glm::ivec3& pos, u32 size);
+
+        /// Notes a type found in the chunk
+        FORCEINLINE void see_type(VoxelType type)
+        {
+            if (type_count_++ == 0)
+                first_type_ = type;
+            mixed_ |= type != first_type_;
+        }
+
+        FORCEINLINE Brick& grid(u32 x, u32 y, u32 z)
+        {
+            return grid_[x + k_grid * (z + k_grid * y)];
+        }
+
+        /// Returns the type of the voxel at pos, relative to the chunk
+        VoxelType type_at(const glm::uvec3& pos);
+
+        /// Merges the faces of one slice of the chunk, pointing along face, into quads
+        void merge_slice(S64Face face, u32 slice, S64ChunkMesh& out);
+
+        std::vector<Brick> grid_;
+        /// visible faces of the chunk's bricks, per S64Face
+        std::array<std::vector<u64>, 6> faces_;
+        /// slices holding faces, per S64Face
+        std::array<u64, 6> slices_;
+        /// brick position of grid(0, 0, 0) in the tree
+        glm::ivec3 grid_min_;
+        usize      type_count_;
+        VoxelType  first_type_;
+        bool       mixed_;
+    };
+} // namespace v
@@ -15,35 +15,140 @@
 // ALSO, air is implicitly stored. If a node doesn't exist, then it is air.
 // A node that actaully exists will always encode at least one non-air voxel.
 
+#include <algorithm>
+#include <array>
 #include <defs.h>
+#include <filesystem>
+#include <iterator>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <span>
+#include <utility>
+#include <vector>
 #include <vmath.h>
 #include <vox/aabb.h>
+#include <vox/store/stats.h>
 #include <vox/volume.h>
 
+namespace tf {
+    class Executor;
+}
+
 // TODO! change to implement VoxelVolume
 namespace v {
-    struct GS64Node {};
+    using VoxelType = u8;
+
+    class S64TreeView;
+    class S64Journal;
+    enum class S64JournalOp : u8;
+    class SparseVoxelOctree128;
+    class DenseGrid;
+
+    /// Pointer free node of a flattened Sparse64Tree, laid out for upload to the GPU.
+    /// The children of a node are stored contiguously, in child index order.
+    struct GS64Node {
+        /// Regular: which children exist. Leaf: which voxels of the brick are solid.
+        /// Zero for Empty and SingleTypeLeaf nodes.
+        u64 child_mask;
+        /// Regular: index of the first child in the node buffer.
+        /// Leaf: index of the node's brick in the brick buffer (64 voxels per brick).
+        u32 first_child;
+        /// bits 0-7: the node's S64Node::Type
+        /// bits 8-15: the voxel type filling a SingleTypeLeaf
+        u32 payload;
+    };
+    static_assert(sizeof(GS64Node) == 16);
+
+    /// A single voxel write, for batched edits
+    struct S64VoxelEdit {
+        glm::uvec3 pos;
+        VoxelType  type;
+    };
+
+    /// A ray in the local space of a Sparse64Tree, for batched raycasts.
+    /// dir doesn't need to be normalized.
+    struct S64Ray {
+        glm::vec3 origin;
+        glm::vec3 dir;
+        /// Hits further than this along the ray are ignored
+        f32 max_dist;
+    };
 
-    using S64Node_UP = std::unique_ptr<struct S64Node>;
-    using S64Node_P  = S64Node*;
-    using VoxelType  = u8;
+    /// The first solid voxel a ray ran into
+    struct S64RayHit {
+        /// Point where the ray entered the voxel
+        glm::vec3 pos;
+        /// Outward normal of the face the ray entered through.
+        /// Zero if the ray started inside the voxel.
+        glm::ivec3 normal;
+        glm::uvec3 voxel;
+        /// Distance from the ray's origin to pos
+        f32 dist;
+        /// Type of the voxel. Zero if the ray hit nothing (batched raycasts only)
+        VoxelType type;
+    };
+
+    /// A cube of voxels of a single, non air type: extent^3 voxels starting at min
+    struct S64Run {
+        glm::uvec3 min;
+        u32        extent;
+        VoxelType  type;
+    };
+
+    /// A cube of voxels summed up into one, see Sparse64Tree::voxel_at_lod
+    struct S64LodSample {
+        /// Type covering the most of the cube. Air if the cube is empty
+        VoxelType type;
+        /// Fraction of the cube that is solid, from 0 to 1
+        f32 coverage;
+    };
+
+    /// A signed distance function, type erased for Sparse64Tree::fill_sdf
+    struct S64Sdf {
+        const void* ctx;
+        /// Writes the distance at points[i] into out[i], for count points
+        void (*eval)(const void* ctx, const glm::vec3* points, f32* out, u32 count);
+        /// How fast the distance may change: |d(a) - d(b)| <= lipschitz * |a - b|
+        f32 lipschitz;
+    };
 
     struct S64Node {
-        /// the existing children
-        /// TODO!
-        /// instead of allocating 64 on every use (also with the voxel vector)
-        /// use POPCOUNT to tightly pack into a vector maybe?.
-        std::vector<S64Node_UP> children;
-        S64Node_P               parent = nullptr;
+        /// Coverage of a completely solid node, see lod_coverage
+        static constexpr u16 k_full_coverage = 1 << 15;
+
         /// for leaf node: represents which voxels in the brick exist
-        /// for non leaf: represents which children in the children array exist
+        /// for non leaf: represents which children in the children block exist
         u64 child_mask = 0;
-        /// 4x4x4 voxel brick - allocated on demand YAY!
-        std::vector<VoxelType> voxels;
-        // TODO! i still want to use a single bit boolean on the GPU to
-        // reduce mem per voxel, this is just more convenient for CPU stuff.
-        // The gpu buffer will be a simple POD type anyways, this can be resolved when
-        // flattening the tree
+        union {
+            /// Regular nodes only. The existing children, tightly packed in index order
+            /// inside a block owned by the tree's node pool. The child at index i lives
+            /// at children[POPCOUNT64(child_mask & ((1ull << i) - 1))].
+            struct {
+                S64Node* children;
+                /// log2 of the block capacity (the block holds 1 << child_cap nodes)
+                u8 child_cap;
+                /// Type covering the most of the node, and how much of the node is
+                /// solid, out of k_full_coverage. Only kept up to date while the tree
+                /// tracks its LOD, see Sparse64Tree::set_lod_tracking.
+                VoxelType lod_type;
+                u16       lod_coverage;
+                /// Edit epoch at which a child was last removed. Removed children
+                /// leave nothing behind to carry their own epoch.
+                u32 erase_epoch;
+                /// Edit epoch at which the children block was allocated. Blocks
+                /// allocated before the tree's latest snapshot are shared with it.
+                u32 block_epoch;
+            };
+            /// 4x4x4 voxel brick for Leaf nodes, stored inline.
+            /// For SingleTypeLeaf nodes only voxels[0] is meaningful.
+            // TODO! i still want to use a single bit boolean on the GPU to
+            // reduce mem per voxel, this is just more convenient for CPU stuff.
+            // The gpu buffer will be a simple POD type anyways, this can be resolved when
+            // flattening the tree
+            VoxelType voxels[64]{};
+        };
         enum class Type : u8 {
             /// No voxels exist / node is empty. In theory, this should never be used.
             /// Here for good measure.
@@ -66,13 +171,30 @@ namespace v {
         };
         /// Node type
         Type type = Type::Empty;
+        /// Edit epoch at which the contents of this node's region last changed
+        u32 epoch = 0;
 
         /// Returns the index of the child/voxel in the arrays present in the node.
-        FORCEINLINE u32 get_idx(u32 x, u32 y, u32 z) noexcept
+        static FORCEINLINE u32 get_idx(u32 x, u32 y, u32 z) noexcept
         {
             return x | (z << 2) | (y << 4);
         }
 
+        /// Returns the position of child idx inside the packed children block.
+        FORCEINLINE u32 child_slot(u32 idx) const noexcept
+        {
+            return static_cast<u32>(POPCOUNT64(child_mask & ((1ull << idx) - 1)));
+        }
+
+        /// Returns the child at index idx. The child must exist.
+        FORCEINLINE S64Node&       child(u32 idx) { return children[child_slot(idx)]; }
+        FORCEINLINE const S64Node& child(u32 idx) const
+        {
+            return children[child_slot(idx)];
+        }
+
+        FORCEINLINE bool has_child(u32 idx) const { return child_mask & (1ull << idx); }
+
         struct ChildIterator {
             u64 mask = 0;
             u32 idx  = 0;
@@ -114,7 +236,61 @@ namespace v {
             FORCEINLINE ChildIterator end() const { return ChildIterator{ 0, 0 }; }
         };
 
-        FORCEINLINE ChildRange child_indices() { return ChildRange{ child_mask }; };
+        FORCEINLINE ChildRange child_indices() const { return ChildRange{ child_mask }; };
+    };
+    static_assert(sizeof(S64Node) == 80);
+
+    /// Allocates the packed children blocks of S64Nodes.
+    /// Blocks hold a power of two number of nodes (1 to 64) and are carved out of large
+    /// slabs, so building a tree costs one heap allocation per slab instead of one per
+    /// node. Freed blocks are recycled through a free list per block size.
+    class S64NodePool {
+    public:
+        /// Number of nodes per slab. A multiple of the largest block, so blocks never
+        /// straddle two slabs.
+        static constexpr u32 slab_nodes = 4096;
+        /// Number of block sizes (1, 2, 4, ..., 64 nodes)
+        static constexpr u32 size_classes = 7;
+
+        S64NodePool()                              = default;
+        S64NodePool(const S64NodePool&)            = delete;
+        S64NodePool& operator=(const S64NodePool&) = delete;
+        S64NodePool(S64NodePool&& o) noexcept;
+        S64NodePool& operator=(S64NodePool&& o) noexcept;
+
+        /// Allocates a block of (1 << cap) default constructed nodes.
+        S64Node* alloc(u8 cap);
+
+        /// Returns a block previously allocated with the same cap to the pool.
+        void free(S64Node* block, u8 cap);
+
+        /// Releases every block at once. All nodes handed out become invalid.
+        void reset();
+
+        /// Takes over every slab and free block of other, leaving it empty. Blocks
+        /// handed out by either pool stay valid and can be freed into this one.
+        void absorb(S64NodePool&& other);
+
+        /// Bytes of slab memory currently reserved by the pool.
+        FORCEINLINE usize bytes_reserved() const
+        {
+            return slabs_.size() * slab_nodes * sizeof(S64Node);
+        }
+
+        /// Number of node slots inside blocks that are currently handed out.
+        FORCEINLINE usize slots_in_use() const { return slots_in_use_; }
+
+    private:
+        /// Hands the unused tail of the current slab to the free lists, split into
+        /// power of two blocks.
+        void retire_tail();
+
+        std::vector<std::unique_ptr<S64Node[]>> slabs_;
+        /// bump offset into the most recent slab
+        u32 slab_used_{ slab_nodes };
+        /// intrusive free lists, linked through S64Node::children of the block head
+        std::array<S64Node*, size_classes> free_{};
+        usize                              slots_in_use_{};
     };
 
     class Sparse64Tree : public VoxelVolume<Sparse64Tree, u8> {
@@ -123,7 +299,7 @@ namespace v {
 
         explicit Sparse64Tree(u8 depth) :
             bounds_(glm::vec3(0), glm::vec3(v::pow(4.f, static_cast<f32>(depth)))),
-            depth_(depth), g_nodes_(static_cast<u32>(v::pow(8.f, depth)))
+            depth_(depth)
         {}
 
         /// Constructs the smallest 64Tree that can contain the bounding box.
@@ -135,54 +311,733 @@ namespace v {
                     v::max_component(must_contain.max - must_contain.min), 4.0)))
         {}
 
+        /// Loads a tree saved with save() into memory, so it can be edited.
+        /// Allocates one block per Regular node, and reads every node of the file once.
+        explicit Sparse64Tree(const S64TreeView& view);
+
+        Sparse64Tree(Sparse64Tree&& o) noexcept;
+        Sparse64Tree& operator=(Sparse64Tree&& o) noexcept;
+
+        /// An immutable copy of a tree, see snapshot()
+        using Snapshot = std::shared_ptr<const Sparse64Tree>;
+
+        /// Returns an immutable copy of the tree as it is now, sharing every node with
+        /// it. Costs one small allocation. Later edits of the tree copy the blocks of
+        /// children they touch instead of writing into shared ones, so a snapshot can
+        /// be read from any thread (get_voxel, raycast, extract_region, runs, ...)
+        /// while the tree keeps being edited, without locking.
+        /// Blocks a snapshot still shares are kept alive until it is released, after
+        /// which the tree reuses them on its next edit. Snapshots must not outlive
+        /// the tree they were taken from.
+        Snapshot snapshot();
+
         /// Returns the bounding box that this tree occupies in it's local object space.
         /// The box will always be properly oriented.
         /// One vertex (min) will always be the origin, such that the other vertex (max)
         /// will always be in the positive octant.
         FORCEINLINE const AABB& bounding_box() const { return bounds_; };
 
+        /// The root node, for code walking the nodes directly (meshing, flattening
+        /// for the GPU). Any edit may invalidate the nodes below it.
+        FORCEINLINE const S64Node& root() const { return root_; }
+
         VoxelType voxel_at(const glm::vec3& pos) const;
 
         VoxelType get_voxel(u32 x, u32 y, u32 z) const;
         VoxelType get_voxel(const glm::ivec3& pos) const;
 
+        /// Sums up the cube of 4^level voxels holding pos into one sample: level 0 is
+        /// the voxel itself, level 1 its brick, and so on up to the whole tree. Stops at
+        /// the node of that size, so coarse queries never reach the bricks while the
+        /// tree tracks its LOD. Otherwise the node's subtree is summed up on the spot.
+        /// Above the bricks the type is the majority of the children's types, weighted
+        /// by how solid they are.
+        S64LodSample voxel_at_lod(const glm::uvec3& pos, u32 level) const;
+
+        /// Keeps a representative type and coverage in every Regular node, for
+        /// voxel_at_lod. Edits refresh the nodes they changed on their way out, which
+        /// sums up the children of each of them again, so edits get slower. Costs no
+        /// memory. Turning it on sums up the whole tree, writing to every node, so it
+        /// must not race with readers of snapshots.
+        void set_lod_tracking(bool enabled);
+        FORCEINLINE bool lod_tracking() const { return lod_tracking_; }
+
+        /// Returns the first solid voxel along the ray within max_dist, if any.
+        /// Walks the tree with a DDA over the 4x4x4 cells of each node, so empty cells
+        /// are skipped at whatever level they are empty, and a SingleTypeLeaf stops the
+        /// ray as soon as it's entered.
+        std::optional<S64RayHit> raycast(
+            const glm::vec3& origin, const glm::vec3& dir,
+            f32 max_dist = std::numeric_limits<f32>::max()) const;
+
+        /// Casts many rays at once, writing the result of rays[i] into hits[i]
+        /// (hits must be at least as large as rays). Rays that miss get a type of 0.
+        /// Rays pointing into the same octant are traced together in packets of 8, in
+        /// the order given, and a node is only visited once per packet. Keep coherent
+        /// rays next to each other (e.g. a camera's rays in screen tiles).
+        void raycast(std::span<const S64Ray> rays, std::span<S64RayHit> hits) const;
+
+        /// Copies a region of the tree into a dense buffer, walking the tree once.
+        /// The region is snapped outwards to whole voxels, and may stick out of the
+        /// tree (those voxels read as air). out must hold at least w * h * d voxels,
+        /// and is laid out like a brick: x fastest, then z, then y, so the voxel
+        /// (x, y, z) of the region lands at out[x + w * (z + d * y)].
+        void extract_region(const AABB& region, std::span<VoxelType> out) const;
+
         void set_voxel(u32 x, u32 y, u32 z, VoxelType type);
         void set_voxel(const glm::ivec3& pos, VoxelType type);
 
+        /// VoxelVolume access. Returns nothing outside the tree.
+        FORCEINLINE std::optional<VoxelType> get(Coord pos) const
+        {
+            const u32 extent = static_cast<u32>(bounds_.max.x);
+            if (static_cast<u32>(pos.x | pos.y | pos.z) >= extent)
+                return std::nullopt;
+            return get_voxel(pos);
+        }
+
+        /// VoxelVolume access. Returns 1 if the voxel was written, 0 if it lies outside
+        /// the tree.
+        FORCEINLINE u8 set(Coord pos, VoxelType type)
+        {
+            const u32 extent = static_cast<u32>(bounds_.max.x);
+            if (static_cast<u32>(pos.x | pos.y | pos.z) >= extent)
+                return 0;
+            set_voxel(pos, type);
+            return 1;
+        }
+
+        /// Applies many voxel writes at once, in any order. When several edits hit the
+        /// same voxel, the last one wins. Edits outside the tree are ignored.
+        /// The edits are sorted along the tree's traversal order, so every touched node
+        /// is visited, and checked for collapse, exactly once.
+        void set_voxels(std::span<const S64VoxelEdit> edits);
+
         void fill_aabb(const AABB& region, VoxelType type);
         void fill_sphere(const glm::vec3& center, f32 radius, VoxelType type);
         void fill_cylinder(
             const glm::vec3& p0, const glm::vec3& p1, f32 radius, VoxelType type);
 
-        /// Flattens the tree into an array of GPU friendly nodes.
+        // Parallel fills. The subtrees under the root's children are filled as
+        // independent tasks on the executor, and merged back into the root afterwards.
+        // The resulting tree is identical to the one the serial fills build.
+        // Must not be called from one of the executor's workers.
+
+        void fill_aabb(const AABB& region, VoxelType type, tf::Executor& executor);
+        void fill_sphere(
+            const glm::vec3& center, f32 radius, VoxelType type, tf::Executor& executor);
+        void fill_cylinder(
+            const glm::vec3& p0, const glm::vec3& p1, f32 radius, VoxelType type,
+            tf::Executor& executor);
+
+        /// Fills every voxel whose center lies where sdf(const glm::vec3&) -> f32 is
+        /// <= 0. Any shape works, as long as the distance never changes faster than
+        /// lipschitz per voxel (1 for exact distances, more for stretched or noisy
+        /// ones). A single distance at a node's center then tells whether the whole
+        /// node is inside, outside or straddling the surface, so sdf is only evaluated
+        /// per voxel in the bricks along the surface, a brick at a time.
+        template <typename Sdf>
+        void fill_sdf(const Sdf& sdf, VoxelType type, f32 lipschitz = 1.0f)
+        {
+            fill_erased_sdf(erase_sdf(sdf, lipschitz), type, nullptr);
+        }
+
+        /// Parallel fill_sdf, see above. sdf is called from many threads at once.
+        template <typename Sdf>
+        void fill_sdf(
+            const Sdf& sdf, VoxelType type, tf::Executor& executor, f32 lipschitz = 1.0f)
+        {
+            fill_erased_sdf(erase_sdf(sdf, lipschitz), type, &executor);
+        }
+
+        /// Combines other into the tree in place (see CsgOp). Walks both trees together
+        /// and stops wherever either side is missing or a SingleTypeLeaf, combining
+        /// bricks with mask operations, so the cost follows the surface of other, not
+        /// its volume: carving a tunnel touches the nodes along its walls.
+        /// Throws std::runtime_error if other doesn't have the same depth.
+        /// other may be a snapshot of this tree.
+        void apply_csg(CsgOp op, const Sparse64Tree& other);
+
+        /// Returns the current edit epoch. Every edit advances it, and every node it
+        /// changes records it.
+        FORCEINLINE u32 epoch() const { return epoch_; }
+
+        /// Records every later edit of the tree into journal, or stops recording if it
+        /// is nullptr. Fills and set_voxel calls are recorded as such, other edits as
+        /// the nodes they changed. Edits other than set_voxel take a snapshot to diff
+        /// against while they're recorded. The journal must outlive the tree, or be
+        /// detached first.
+        FORCEINLINE void        set_journal(S64Journal* journal) { journal_ = journal; }
+        FORCEINLINE S64Journal* journal() const { return journal_; }
+
+        /// Calls fn(const glm::uvec3& min, u32 extent) for each cubic region whose
+        /// contents may have changed after the epoch since. Regions never overlap,
+        /// and are as small as the tree can tell: a brick, or the node a child was
+        /// removed from.
+        /// Typical use is to remember epoch() after processing the tree, and pass it
+        /// back in next time.
+        template <typename F>
+        void for_each_changed(u32 since, F&& fn) const
+        {
+            if (root_.epoch > since)
+                changed_recursive(root_, glm::uvec3(0), init_shift_amt(), since, fn);
+        }
+
+        /// Flattens the tree into an array of GPU friendly nodes (see GS64Node) and a
+        /// buffer of leaf bricks. The root is node 0. The subtrees under the root's
+        /// children are laid out breadth first, each in its own contiguous range, and
+        /// are flattened in parallel on the executor.
+        /// Does nothing if the tree hasn't changed since the last flatten.
+        /// Must not be called from one of the executor's workers.
         // TODO! should maybe move into different place? so 64tree only worries about cpu
         // side storage? idk
-        void                         flatten() const;
-        const std::vector<GS64Node>& gpu_nodes() { return g_nodes_; };
+        void flatten(tf::Executor& executor);
 
+        const std::vector<GS64Node>&  gpu_nodes() const { return g_nodes_; };
+        const std::vector<VoxelType>& gpu_bricks() const { return g_bricks_; };
 
-        /// Destroys the contents of the entire tree
-        FORCEINLINE void clear()
+        /// Returns the number of nodes in the tree, including the root.
+        /// Walks the entire tree (for debugging)
+        usize node_count() const;
+
+        /// Returns the bytes of node storage reserved by the tree.
+        FORCEINLINE usize memory_usage() const
         {
-            clear_node(root_);
-            dirty_ = true;
+            return sizeof(*this) + pool_.bytes_reserved();
         }
 
+        /// Returns the tree's node and memory statistics. O(1), the counts are kept up
+        /// to date by every edit.
+        VoxelStoreStats stats() const;
+
+        /// Writes the tree to a file, in the pointer free layout described by
+        /// S64FileHeader, so it can be mapped back with S64TreeView. Nodes and bricks
+        /// are streamed out in batches, breadth first, so only the nodes queued but not
+        /// written yet are kept around, at most about one level of the tree. Works on
+        /// snapshots too, so a backup can be written from another thread while the tree
+        /// keeps being edited.
+        /// Throws std::runtime_error if the file can't be written.
+        void save(const std::filesystem::path& path) const;
+
+        /// Repacks every node into freshly allocated slabs, giving back the memory held
+        /// by freed blocks. The node pool otherwise keeps its high-water mark.
+        void compact();
+
+        /// Destroys the contents of the entire tree
+        void clear();
+
+        /// Reads voxels close to each other (the neighbors of a voxel, a scanline...)
+        /// without descending from the root every time. Keeps the path from the root
+        /// to the last voxel read, and only re-descends from the lowest node that also
+        /// holds the next one. Voxels outside the tree read as air.
+        /// Invalidated by any edit of the tree.
+        class Cursor {
+        public:
+            explicit Cursor(const Sparse64Tree& tree) :
+                // never written through, see EditCursor
+                tree_(const_cast<Sparse64Tree*>(&tree)),
+                root_shift_(tree.init_shift_amt()),
+                extent_(static_cast<u32>(tree.bounding_box().max.x))
+            {
+                path_[0] = &tree_->root_;
+            }
+
+            FORCEINLINE VoxelType get(u32 x, u32 y, u32 z)
+            {
+                if ((x | y | z) >= extent_)
+                    return 0;
+                descend(glm::uvec3(x, y, z));
+                return value();
+            }
+
+            FORCEINLINE VoxelType get(const glm::uvec3& pos)
+            {
+                return get(pos.x, pos.y, pos.z);
+            }
+
+        protected:
+            /// Returns the deepest level of the path that also holds pos
+            FORCEINLINE u32 shared_level(const glm::uvec3& pos) const
+            {
+                const u32 diff = (pos.x ^ pos_.x) | (pos.y ^ pos_.y) | (pos.z ^ pos_.z);
+                if (!diff)
+                    return level_;
+                // a node at level l spans the lowest root_shift - 2l + 2 bits
+                const u32 highest = 31 - CLZ(diff);
+                return std::min(level_, (root_shift_ + 1 - highest) / 2);
+            }
+
+            /// Index of the child below the node at a level, on the way to pos_
+            FORCEINLINE u32 index_at(u32 level) const
+            {
+                const u32 shift = root_shift_ - level * 2;
+                return S64Node::get_idx(
+                    (pos_.x >> shift) & 3, (pos_.y >> shift) & 3, (pos_.z >> shift) & 3);
+            }
+
+            /// Moves the path over to pos, returning the level it re-descended from
+            FORCEINLINE u32 descend(const glm::uvec3& pos)
+            {
+                const u32 from = shared_level(pos);
+                pos_           = pos;
+                level_         = from;
+
+                const S64Node* node = path_[level_];
+                while (node->type == S64Node::Type::Regular)
+                {
+                    const u32 idx = index_at(level_);
+                    if (!node->has_child(idx))
+                        break;
+                    node            = &node->child(idx);
+                    path_[++level_] = const_cast<S64Node*>(node);
+                }
+                return from;
+            }
+
+            /// The voxel at pos_, read from the end of the path
+            FORCEINLINE VoxelType value() const
+            {
+                const S64Node& node = *path_[level_];
+                switch (node.type)
+                {
+                case S64Node::Type::SingleTypeLeaf:
+                    return node.voxels[0];
+                case S64Node::Type::Leaf:
+                    {
+                        const u32 idx = index_at(level_);
+                        return node.has_child(idx) ? node.voxels[idx] : 0;
+                    }
+                default:
+                    return 0;
+                }
+            }
+
+            Sparse64Tree* tree_;
+            /// the nodes from the root (path_[0]) down to the one holding pos_
+            std::array<S64Node*, 16> path_;
+            /// deepest valid level of path_
+            u32        level_ = 0;
+            glm::uvec3 pos_{ 0 };
+            u8         root_shift_;
+            u32        extent_;
+        };
+
+        /// A Cursor that writes too. A write works like set_voxel, but only descends
+        /// from the lowest node shared with the last voxel the cursor touched, so runs
+        /// of nearby writes skip most of the tree.
+        /// Invalidated by any edit of the tree not made through the cursor, and by
+        /// snapshot().
+        class EditCursor : public Cursor {
+        public:
+            explicit EditCursor(Sparse64Tree& tree) : Cursor(tree) {}
+
+            FORCEINLINE VoxelType get(u32 x, u32 y, u32 z)
+            {
+                if ((x | y | z) >= extent_)
+                    return 0;
+                // reads don't copy blocks shared with snapshots on the way down
+                writable_ = std::min(writable_, descend(glm::uvec3(x, y, z)) + 1);
+                return value();
+            }
+
+            FORCEINLINE VoxelType get(const glm::uvec3& pos)
+            {
+                return get(pos.x, pos.y, pos.z);
+            }
+
+            /// Writes a voxel. Writes outside the tree are ignored.
+            FORCEINLINE void set(u32 x, u32 y, u32 z, VoxelType type)
+            {
+                if ((x | y | z) >= extent_)
+                    return;
+                const glm::uvec3 pos(x, y, z);
+                const u32        from = std::min(shared_level(pos), writable_ - 1);
+                pos_                  = pos;
+                level_    = tree_->write_voxel(path_.data(), from, pos, type);
+                writable_ = level_ + 1;
+            }
+
+            FORCEINLINE void set(const glm::uvec3& pos, VoxelType type)
+            {
+                set(pos.x, pos.y, pos.z, type);
+            }
+
+        private:
+            /// number of leading nodes of the path known not to be shared with a
+            /// snapshot
+            u32 writable_ = 1;
+        };
+
+        /// Lets several threads edit the tree at once. Every subtree under the root's
+        /// children has a lock and a node pool of its own, so writes landing in
+        /// different subtrees never wait for each other. The root itself is only
+        /// touched by the constructor and commit(), which prune and collapse it.
+        /// The tree must not be used directly, nor snapshotted, until commit(). Thread
+        /// safe, except for the constructor and commit().
+        class ConcurrentEdit {
+        public:
+            explicit ConcurrentEdit(Sparse64Tree& tree);
+            ~ConcurrentEdit() { commit(); }
+
+            ConcurrentEdit(const ConcurrentEdit&)            = delete;
+            ConcurrentEdit& operator=(const ConcurrentEdit&) = delete;
+
+            /// Reads a voxel, including the writes of other threads. Voxels outside
+            /// the tree read as air.
+            VoxelType get_voxel(u32 x, u32 y, u32 z);
+
+            /// Writes a voxel like set_voxel. Writes outside the tree are ignored.
+            void set_voxel(u32 x, u32 y, u32 z, VoxelType type);
+
+            /// Merges the subtrees back into the tree and ends the session, after
+            /// which the edit must not be used. Later calls, and the destructor, do
+            /// nothing.
+            void commit();
+
+        private:
+            /// a child of the root, padded so neighboring locks don't share a cache
+            /// line
+            struct alignas(64) Subtree {
+                std::mutex mutex;
+                /// the root's child, or the one in added_ if the root doesn't have it
+                S64Node* node;
+            };
+
+            Sparse64Tree*              tree_;
+            std::unique_ptr<Subtree[]> subtrees_;
+            /// children missing from the root, built off to the side until commit()
+            std::array<S64Node, 64> added_{};
+            /// the node pool, counts and retired blocks of each subtree
+            std::vector<Sparse64Tree> scratch_;
+            /// the tree's journal, which records the whole session at commit()
+            S64Journal*               journal_ = nullptr;
+            Snapshot                  before_;
+            u32                       since_{};
+            u32                       prev_epoch_{};
+            u8                        root_shift_;
+            u32                       extent_;
+            bool                      open_ = true;
+        };
+
+        /// Forward iterator over the non air parts of the tree, as S64Runs.
+        /// A SingleTypeLeaf is a single run, and every solid voxel of a brick is a run of
+        /// extent 1, so a walk costs time proportional to the number of nodes, not to
+        /// the volume they cover. Runs come in tree order and never overlap.
+        /// Invalidated by any edit of the tree.
+        class RunIterator {
+        public:
+            using value_type        = S64Run;
+            using difference_type   = std::ptrdiff_t;
+            using iterator_category = std::forward_iterator_tag;
+
+            RunIterator() = default;
+            explicit RunIterator(const Sparse64Tree& tree);
+
+            FORCEINLINE const S64Run& operator*() const { return run_; }
+            FORCEINLINE const S64Run* operator->() const { return &run_; }
+
+            FORCEINLINE RunIterator& operator++()
+            {
+                advance();
+                return *this;
+            }
+
+            FORCEINLINE RunIterator operator++(int)
+            {
+                RunIterator prev = *this;
+                advance();
+                return prev;
+            }
+
+            /// Iterators are equal if they're on the same run. All past the end
+            /// iterators have a run extent of 0.
+            FORCEINLINE bool operator==(const RunIterator& o) const
+            {
+                return run_.extent == o.run_.extent && run_.min == o.run_.min;
+            }
+
+        private:
+            /// A node being walked: cells of 1 << shift_amt voxels, the ones in
+            /// remaining still to go. For Regular nodes next is the child of the
+            /// lowest remaining cell.
+            struct Frame {
+                const S64Node* node;
+                const S64Node* next;
+                u64            remaining;
+                glm::uvec3     pos;
+                u8             shift_amt;
+            };
+
+            /// Moves to the next run, or past the end
+            void advance();
+
+            // a tree is at most 15 levels deep, as voxel coordinates are 32 bit
+            std::array<Frame, 16> stack_;
+            u32                   depth_{};
+            S64Run                run_{};
+        };
+
+        struct RunRange {
+            const Sparse64Tree*     tree;
+            FORCEINLINE RunIterator begin() const { return RunIterator(*tree); }
+            FORCEINLINE RunIterator end() const { return {}; }
+        };
+
+        /// Forward iterator over every non air voxel of the tree, as (position, type).
+        /// Walks the runs of RunIterator, expanding each into its voxels (x fastest,
+        /// then z, then y). Invalidated by any edit of the tree.
+        class Iterator {
+        public:
+            using value_type        = std::pair<Coord, VoxelType>;
+            using difference_type   = std::ptrdiff_t;
+            using iterator_category = std::forward_iterator_tag;
+
+            Iterator() = default;
+            explicit Iterator(const Sparse64Tree& tree) : runs_(tree) {}
+
+            FORCEINLINE value_type operator*() const
+            {
+                return { Coord(runs_->min + offset_), runs_->type };
+            }
+
+            FORCEINLINE Iterator& operator++()
+            {
+                const u32 extent = runs_->extent;
+                if (++offset_.x < extent)
+                    return *this;
+                offset_.x = 0;
+                if (++offset_.z < extent)
+                    return *this;
+                offset_.z = 0;
+                if (++offset_.y < extent)
+                    return *this;
+                offset_.y = 0;
+                ++runs_;
+                return *this;
+            }
+
+            FORCEINLINE Iterator operator++(int)
+            {
+                Iterator prev = *this;
+                ++*this;
+                return prev;
+            }
+
+            FORCEINLINE bool operator==(const Iterator& o) const
+            {
+                return runs_ == o.runs_ && offset_ == o.offset_;
+            }
+
+        private:
+            RunIterator runs_;
+            glm::uvec3  offset_{ 0 };
+        };
+
+        /// Every non air voxel of the tree, see Iterator
+        FORCEINLINE Iterator begin() const { return Iterator(*this); }
+        FORCEINLINE Iterator end() const { return {}; }
+
+        /// Every run of non air voxels of the tree, see RunIterator
+        FORCEINLINE RunRange runs() const { return RunRange{ this }; }
+
     private:
-        S64Node_UP root_{ nullptr };
-        AABB       bounds_;
-        u8         depth_;
+        S64NodePool pool_;
+        /// The root node. An Empty root means the whole tree is air.
+        S64Node root_{};
+        AABB    bounds_;
+        u8      depth_;
+
+        /// advanced by every edit, see epoch()
+        u32 epoch_{};
+
+        /// epoch of the root when the flat gpu buffers were built
+        u32                    flat_epoch_{};
+        std::vector<GS64Node>  g_nodes_;
+        std::vector<VoxelType> g_bricks_;
+
+        /// Number of nodes of each S64Node::Type in the tree (the Empty count is
+        /// meaningless). Changed through set_type and clear_node only.
+        std::array<usize, 4> type_counts_{};
+        u64                  collapses_{};
+        u64                  expansions_{};
+
+        bool lod_tracking_{};
+        /// epoch at which the LOD of the nodes was last refreshed
+        u32 lod_epoch_{};
+
+        template <typename Sdf>
+        static S64Sdf erase_sdf(const Sdf& sdf, f32 lipschitz)
+        {
+            // the batch loop is instantiated for each sdf, so it inlines (and can
+            // vectorize) the distance function
+            auto eval = [](const void* ctx, const glm::vec3* points, f32* out, u32 count)
+            {
+                const Sdf& f = *static_cast<const Sdf*>(ctx);
+                for (u32 i = 0; i < count; ++i)
+                    out[i] = f(points[i]);
+            };
+            return { std::addressof(sdf), eval, lipschitz };
+        }
+
+        void fill_erased_sdf(const S64Sdf& sdf, VoxelType type, tf::Executor* executor);
 
-        /// whether the flat gpu node buffer needs rebuilding
-        bool                  dirty_{};
-        std::vector<GS64Node> g_nodes_;
+        // The fills behind both the serial and the parallel overloads: clipping, the
+        // journal entry, then fill_root on the executor if there is one.
 
-        // TODO! move utilities to struct S64Node? does this make sense even
-        /// Recursively destroys nodes
-        void clear_node(S64Node_UP& node);
+        void fill_aabb_impl(const AABB& region, VoxelType type, tf::Executor* executor);
+        void fill_sphere_impl(
+            const glm::vec3& center, f32 radius, VoxelType type, tf::Executor* executor);
+        void fill_cylinder_impl(
+            const glm::vec3& p0, const glm::vec3& p1, f32 radius, VoxelType type,
+            tf::Executor* executor);
+
+        /// Returns the representative type of a node, and its coverage out of
+        /// S64Node::k_full_coverage. Regular nodes are read from their LOD fields while
+        /// tracking, and summed up from their children otherwise.
+        std::pair<VoxelType, u32> node_lod(const S64Node& node) const;
+
+        /// Recomputes the LOD fields of a Regular node, and of the Regular nodes under
+        /// it that changed since the last refresh (all of them if all is set).
+        void refresh_lod(S64Node& node, bool all);
+
+        /// Brings the LOD of the tree up to date after an edit, if it's tracked
+        FORCEINLINE void update_lod()
+        {
+            if (lod_tracking_ && root_.epoch > lod_epoch_ &&
+                root_.type == S64Node::Type::Regular)
+                refresh_lod(root_, false);
+            lod_epoch_ = epoch_;
+        }
+
+        /// A children block dropped by the tree while a snapshot may still read it
+        struct RetiredBlock {
+            S64Node* block;
+            u8       cap;
+            /// edit epoch it was dropped at
+            u32 epoch;
+        };
+
+        /// A whole node pool dropped by clear() or compact() while snapshots were alive
+        struct RetiredPool {
+            S64NodePool pool;
+            u32         epoch;
+        };
+
+        /// Snapshots handed out that may still be alive
+        std::vector<std::weak_ptr<const Sparse64Tree>> snapshots_;
+        /// epoch of the newest live snapshot. Blocks allocated at or before it are
+        /// shared and must be copied before they are written. 0 if there are none.
+        u32 frozen_epoch_{};
+        /// in the order they were dropped
+        std::vector<RetiredBlock> retired_;
+        std::vector<RetiredPool>  retired_pools_;
+
+        /// see set_journal()
+        S64Journal* journal_ = nullptr;
+
+        /// Forgets released snapshots, and hands back the blocks and pools only they
+        /// were still reading.
+        void collect_snapshots();
+
+        /// Drops every block of the pool at once, keeping it alive for any snapshot
+        /// that still reads it.
+        void retire_pool();
+
+        /// Returns a children block to the pool, or retires it if a snapshot shares
+        /// it.
+        FORCEINLINE void free_block(S64Node* block, u8 cap, u32 block_epoch)
+        {
+            if (block_epoch <= frozen_epoch_)
+                retired_.push_back({ block, cap, epoch_ });
+            else
+                pool_.free(block, cap);
+        }
+
+        /// Gives a Regular node a children block of its own if it shares one with a
+        /// snapshot, so the children can be written.
+        void make_writable(S64Node& node);
+
+        /// Changes the type of a node, keeping the per type node counts up to date
+        FORCEINLINE void set_type(S64Node& node, S64Node::Type type)
+        {
+            --type_counts_[static_cast<u8>(node.type)];
+            ++type_counts_[static_cast<u8>(type)];
+            node.type = type;
+        }
+
+        /// Recursively returns the node's children to the pool, making it Empty.
+        void clear_node(S64Node& node);
+
+        /// Recursively returns the children blocks under a node to the pool, without
+        /// writing to the node, which may be shared with a snapshot.
+        void release_children(const S64Node& node);
+
+        /// Writes a single voxel like set_voxel, descending from path[start]. path[0]
+        /// must be the root and path[0..start] the nodes on the way to pos, all
+        /// writable. Fills in the rest of the path, and returns the deepest level of it
+        /// that is still valid after the write pruned and collapsed nodes.
+        u32 write_voxel(
+            S64Node** path, u32 start, const glm::uvec3& pos, VoxelType type);
+
+        /// The part of write_voxel that walks the tree, leaving out the epoch and LOD
+        /// bookkeeping. Nodes above path[top] are neither written nor pruned, so a
+        /// caller owning only the subtree under path[top] can use it.
+        u32 write_path(
+            S64Node** path, u32 top, u32 start, const glm::uvec3& pos, VoxelType type);
+
+        /// Runs edit, recording it into the journal: put writes the op's parameters,
+        /// and write_changes() what it overwrote. The edits edit is made of aren't
+        /// recorded on their own. Only call with a journal.
+        template <typename Edit, typename Put>
+        void journaled(S64JournalOp op, Edit&& edit, Put&& put);
+
+        /// Writes the undo records of an edit made since the epoch into the journal,
+        /// diffing against before, a snapshot taken at that epoch. A Restore also gets
+        /// records of what the edit wrote, in front.
+        void write_changes(S64JournalOp op, const Sparse64Tree& before, u32 since);
+
+        /// Writes records that turn the contents of have into those of want, two nodes
+        /// at the same place of the tree and of a snapshot. Nodes of the tree that
+        /// haven't changed since the epoch are skipped, want_current tells which side
+        /// the tree is.
+        void write_diff(
+            const S64Node& want, const S64Node& have, bool want_current,
+            const glm::uvec3& pos, u8 shift_amt, u32 since) const;
+
+        /// Recursively builds node from node idx of a saved tree
+        void load_node(S64Node& node, const S64TreeView& view, u32 idx);
+
+        /// Recursively copies src, which may belong to another tree, into an Empty node.
+        void clone_node(S64Node& node, const S64Node& src);
+
+        /// Combines other into node, both at the same place of their trees.
+        /// Returns true if any voxel of the node changed.
+        bool csg_recursive(S64Node& node, const S64Node& other, u8 shift_amt, CsgOp op);
+
+        /// Recursively moves the node's children into blocks allocated from pool.
+        static void repack_node(S64Node& node, S64NodePool& pool, u32 epoch);
 
         /// Fills an entire node with a single type. Very fast.
-        void fill_node(S64Node_UP& node, VoxelType t);
+        void fill_node(S64Node& node, VoxelType t);
+
+        /// Converts a SingleTypeLeaf back into an equivalent node with explicit
+        /// contents: a full brick at the leaf level, or 64 filled children above it.
+        void expand_node(S64Node& node, u8 shift_amt);
+
+        /// Makes room for child idx in a Regular node and returns it (Empty).
+        /// Invalidates references to the node's other children.
+        S64Node& insert_child(S64Node& node, u32 idx);
+
+        /// Destroys child idx of a Regular node.
+        /// Invalidates references to the node's other children.
+        void erase_child(S64Node& node, u32 idx);
+
+        /// Writes type into every voxel of a leaf level node selected by mask.
+        /// Returns true if any voxel changed.
+        bool write_brick(S64Node& node, u64 mask, VoxelType type);
+
+        /// Turns an Empty node into a Regular one without children.
+        void make_regular(S64Node& node);
 
         /// Returns the starting shift amount for tree traversal
         FORCEINLINE u8 init_shift_amt() const
@@ -202,36 +1057,107 @@ namespace v {
         /// Checks if a node contains any voxels
         bool is_node_empty(const S64Node& node) const;
 
-        /// Attempts to convert a Leaf node to SingleTypeLeaf if all voxels are the same
-        void try_collapse_to_single_type(S64Node_UP& node);
-
-        /// Checks if a Regular node should be collapsed (all children empty)
-        bool should_collapse_regular(S64Node_UP& node);
-
-        /// Geometric tests
-        static bool aabb_contains_aabb(const AABB& outer, const AABB& inner);
-        static bool aabb_intersects_aabb(const AABB& a, const AABB& b);
-        static bool
-        aabb_inside_sphere(const AABB& box, const glm::vec3& center, f32 radius);
-        static bool
-        aabb_intersects_sphere(const AABB& box, const glm::vec3& center, f32 radius);
-        static bool aabb_inside_cylinder(
-            const AABB& box, const glm::vec3& p0, const glm::vec3& p1, f32 radius,
-            const glm::vec3& axis, f32 length);
-        static bool aabb_intersects_cylinder(
-            const AABB& box, const glm::vec3& p0, const glm::vec3& p1, f32 radius,
-            const glm::vec3& axis, f32 length);
-
-        /// Hierarchical fill helpers
-        void fill_aabb_recursive(
-            S64Node_UP& node, const glm::uvec3& node_pos, u8 shift_amt,
-            const AABB& region, VoxelType type);
-        void fill_sphere_recursive(
-            S64Node_UP& node, const glm::uvec3& node_pos, u8 shift_amt,
-            const glm::vec3& center, f32 radius, VoxelType type);
-        void fill_cylinder_recursive(
-            S64Node_UP& node, const glm::uvec3& node_pos, u8 shift_amt,
-            const glm::vec3& p0, const glm::vec3& p1, f32 radius, const glm::vec3& axis,
-            f32 length, VoxelType type);
+        /// Collapses a node into a SingleTypeLeaf if it is completely filled with a
+        /// single type (a full uniform brick, or 64 identical SingleTypeLeaf children),
+        /// and turns a Regular node without children into an Empty one.
+        /// Returns true if the node changed.
+        bool try_collapse(S64Node& node);
+
+        /// Applies batched edits that all land inside node, grouped by brick.
+        /// An edit is packed as path << 8 | type, where path holds the child index taken
+        /// at each level (6 bits per level, the leaf level in the lowest bits).
+        /// Returns true if any voxel of the node changed.
+        bool
+        set_voxels_recursive(S64Node& node, u8 shift_amt, std::span<const u64> edits);
+
+        /// Hierarchical fill shared by every shape. Shape decides how nodes overlap the
+        /// filled volume and which voxels of a brick it covers.
+        /// Returns true if any voxel of the node changed.
+        template <typename Shape>
+        bool fill_recursive(
+            S64Node& node, const glm::uvec3& node_pos, u8 shift_amt, const Shape& shape,
+            VoxelType type);
+
+        /// Fills the whole tree with the shape, fanning the root's children out on the
+        /// executor if there is one.
+        template <typename Shape>
+        void fill_root(const Shape& shape, VoxelType type, tf::Executor* executor);
+
+        /// Turns the root into a writable Regular node, so its children can be edited
+        /// in place by several scratch trees at once.
+        void split_root();
+
+        /// Returns a scratch tree for editing some of this tree's nodes off to the side:
+        /// it stamps the same epoch, and copies blocks shared with snapshots.
+        Sparse64Tree make_scratch() const;
+
+        /// Takes over the pool, counts and retired blocks of a scratch tree.
+        void absorb_scratch(Sparse64Tree& ctx);
+
+        /// Prunes the root's emptied children, adds the non Empty ones of added, and
+        /// collapses the root, once scratch trees are done editing under it.
+        /// changed[idx] tells whether child idx changed.
+        void merge_root(
+            std::array<S64Node, 64>& added, const std::array<u8, 64>& changed,
+            u32 prev_epoch);
+
+        template <typename F>
+        void changed_recursive(
+            const S64Node& node, const glm::uvec3& node_pos, u8 shift_amt, u32 since,
+            F& fn) const
+        {
+            // leaves changed as a whole, and a removed child could have been anywhere
+            if (node.type != S64Node::Type::Regular || node.erase_epoch > since)
+            {
+                fn(node_pos, 1u << (shift_amt + 2));
+                return;
+            }
+
+            const u32 child_size = 1u << shift_amt;
+            u32       slot       = 0;
+            for (u32 idx : node.child_indices())
+            {
+                const S64Node& child = node.children[slot++];
+                if (child.epoch <= since)
+                    continue;
+
+                // idx = x | z << 2 | y << 4
+                glm::uvec3 child_pos =
+                    node_pos + glm::uvec3(idx & 3, idx >> 4, (idx >> 2) & 3) * child_size;
+                changed_recursive(child, child_pos, shift_amt - 2, since, fn);
+            }
+        }
     };
+
+    /// Node by node CSG between trees of the same depth, see Sparse64Tree::apply_csg.
+    /// Copies a first, so the cost includes a's node count. Trees of different depths
+    /// fall back to VolumeOpImpl::csg_voxelwise.
+    template <>
+    Sparse64Tree VolumeOpImpl::csg<Sparse64Tree, Sparse64Tree, Sparse64Tree>(
+        CsgOp op, const Sparse64Tree& a, const Sparse64Tree& b);
+
+    // The conversions to and from the other stores are declared here rather than in a
+    // shared header, so no caller can instantiate the voxel by voxel default for them.
+    // They are defined in convert.cpp.
+
+    /// Copies the part of the tree inside the octree's 128^3 voxels. Uniform nodes
+    /// become one fill_box each, bricks are written voxel by voxel through a cursor.
+    template <>
+    SparseVoxelOctree128
+    VolumeOpImpl::to<Sparse64Tree, SparseVoxelOctree128>(const Sparse64Tree& f);
+
+    /// Builds a tree of depth 4 from the octree. Leaves of a brick or more become one
+    /// fill_aabb each, smaller ones a single batch of set_voxels.
+    template <>
+    Sparse64Tree
+    VolumeOpImpl::to<SparseVoxelOctree128, Sparse64Tree>(const SparseVoxelOctree128& f);
+
+    /// Copies the whole tree into a grid of its size with extract_region.
+    template <>
+    DenseGrid VolumeOpImpl::to<Sparse64Tree, DenseGrid>(const Sparse64Tree& f);
+
+    /// Builds the smallest tree holding the grid, 16^3 voxels at a time: uniform blocks
+    /// become one fill_aabb each, the rest batches of set_voxels.
+    template <>
+    Sparse64Tree VolumeOpImpl::to<DenseGrid, Sparse64Tree>(const DenseGrid& f);
 } // namespace v
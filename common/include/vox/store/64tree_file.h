@@ -0,0 +1,97 @@
+#pragma once
+
+#include <defs.h>
+#include <filesystem>
+#include <span>
+#include <vox/aabb.h>
+#include <vox/store/64tree.h>
+
+namespace v {
+
+    /// Header of a Sparse64Tree file, see Sparse64Tree::save.
+    /// The file is the tree flattened into the same GS64Node and brick formats as the
+    /// gpu buffers: the header, then node_count GS64Nodes starting at nodes_offset,
+    /// then brick_count bricks of 64 voxels starting at bricks_offset. Nodes are in
+    /// one breadth first order over the whole tree (the root is node 0, and the
+    /// children of a node are contiguous), so the node order differs from flatten's,
+    /// which gives each of the root's children its own range. Nothing in it is a
+    /// pointer, so it can be mapped and read in place. Everything is little endian.
+    struct S64FileHeader {
+        static constexpr u32 k_magic = 0x54343653; // "S64T"
+        /// Bumped whenever the layout changes. Files of other versions are rejected.
+        static constexpr u32 k_version = 1;
+
+        u32 magic;
+        u32 version;
+        /// depth of the tree, see Sparse64Tree(u8)
+        u32 depth;
+        u32 reserved;
+        u64 node_count;
+        u64 brick_count;
+        /// byte offsets from the start of the file, aligned to 16 bytes
+        u64 nodes_offset;
+        u64 bricks_offset;
+    };
+    static_assert(sizeof(S64FileHeader) == 48);
+
+    /// A read only Sparse64Tree file, mapped into memory and read in place.
+    /// Opening it only checks the header, so the cost is the same for any file size,
+    /// and pages are read from disk as they are touched. The contents past the header
+    /// are trusted, so only open files written by Sparse64Tree::save.
+    /// To edit the tree, load it with Sparse64Tree(const S64TreeView&).
+    class S64TreeView {
+    public:
+        /// Maps the file. Throws std::runtime_error if it can't be mapped or isn't a
+        /// Sparse64Tree file of the current version.
+        explicit S64TreeView(const std::filesystem::path& path);
+        ~S64TreeView();
+
+        S64TreeView(const S64TreeView&)            = delete;
+        S64TreeView& operator=(const S64TreeView&) = delete;
+        S64TreeView(S64TreeView&& o) noexcept;
+        S64TreeView& operator=(S64TreeView&& o) noexcept;
+
+        FORCEINLINE u8 depth() const { return static_cast<u8>(header().depth); }
+
+        /// Same as the bounding box of the tree that was saved
+        FORCEINLINE AABB bounding_box() const
+        {
+            return AABB(glm::vec3(0), glm::vec3(v::pow(4.f, static_cast<f32>(depth()))));
+        }
+
+        VoxelType get_voxel(u32 x, u32 y, u32 z) const;
+
+        /// The flattened nodes, laid out like Sparse64Tree::gpu_nodes. Can be uploaded
+        /// straight from the mapping.
+        FORCEINLINE std::span<const GS64Node> nodes() const
+        {
+            return { reinterpret_cast<const GS64Node*>(data_ + header().nodes_offset),
+                     header().node_count };
+        }
+
+        /// The bricks of the Leaf nodes, 64 voxels each, laid out like
+        /// Sparse64Tree::gpu_bricks.
+        FORCEINLINE std::span<const VoxelType> bricks() const
+        {
+            return { reinterpret_cast<const VoxelType*>(data_ + header().bricks_offset),
+                     header().brick_count * 64 };
+        }
+
+    private:
+        FORCEINLINE const S64FileHeader& header() const
+        {
+            return *reinterpret_cast<const S64FileHeader*>(data_);
+        }
+
+        /// Unmaps the file, leaving the view empty
+        void unmap();
+
+        const std::byte* data_ = nullptr;
+        usize            size_ = 0;
+#ifdef _WIN32
+        /// file and file mapping handles
+        void* file_    = nullptr;
+        void* mapping_ = nullptr;
+#endif
+    };
+} // namespace v
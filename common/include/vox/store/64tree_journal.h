@@ -0,0 +1,113 @@
+#pragma once
+
+#include <defs.h>
+#include <vector>
+#include <vmath.h>
+#include <vox/store/64tree.h>
+
+namespace v {
+
+    /// Kinds of entries in an S64Journal
+    enum class S64JournalOp : u8 {
+        /// A run of set_voxel calls (EditCursor writes included)
+        Points,
+        FillAabb,
+        FillSphere,
+        FillCylinder,
+        Clear,
+        /// Any other edit (set_voxels, fill_sdf, apply_csg, a ConcurrentEdit), stored as
+        /// the contents of the nodes it changed
+        Restore,
+    };
+
+    /// An append-only log of the edits made to a Sparse64Tree, see
+    /// Sparse64Tree::set_journal. It can be replayed on another tree (a client, a
+    /// save), cut back to a checkpoint, and inverted to undo the edits after one.
+    ///
+    /// Every entry is an op byte, a u32 payload size and the payload. Fills are stored
+    /// by their parameters, so a sphere costs a few bytes at any radius, and runs of
+    /// set_voxel calls share an entry, each position delta coded against the previous
+    /// one as zigzag varints. Entries also carry what they overwrote, as records of
+    /// the nodes that changed: a uniform node as a single run, a brick as a mask and
+    /// the voxels it selects. without_undo() drops that part for replication.
+    /// Everything is little endian.
+    class S64Journal {
+    public:
+        S64Journal() = default;
+
+        /// Wraps the bytes() of another journal, e.g. received over the network.
+        explicit S64Journal(std::vector<u8> bytes) : bytes_(std::move(bytes)) {}
+
+        FORCEINLINE const std::vector<u8>& bytes() const { return bytes_; }
+        FORCEINLINE bool                   empty() const { return bytes_.empty(); }
+
+        /// Ends the current entry, and returns the position of the next one, for
+        /// truncate(), undo() and the other calls taking a checkpoint.
+        usize checkpoint();
+
+        /// Drops every entry after the checkpoint.
+        void truncate(usize checkpoint);
+
+        FORCEINLINE void clear() { truncate(0); }
+
+        /// Applies the entries from the checkpoint on to tree, in order. tree should
+        /// hold what the journaled tree held at the checkpoint.
+        /// Throws std::runtime_error if the journal is malformed.
+        void replay(Sparse64Tree& tree, usize from = 0) const;
+
+        /// Returns a journal that undoes the entries after the checkpoint, newest
+        /// first, when replayed on the tree they were recorded from. Runs of set_voxel
+        /// calls can be inverted again, everything else comes without undo data.
+        /// Throws std::runtime_error if an entry has no undo data.
+        S64Journal inverse(usize from = 0) const;
+
+        /// Returns the entries after the checkpoint without their undo data, which
+        /// replicas don't need.
+        S64Journal without_undo(usize from = 0) const;
+
+        /// Reverts tree to what it held at the checkpoint, and truncates the journal
+        /// there. The reverting edits aren't recorded, if tree records into this
+        /// journal.
+        void undo(Sparse64Tree& tree, usize checkpoint);
+
+    private:
+        friend class Sparse64Tree;
+
+        /// set in the op byte of entries recorded without undo data
+        static constexpr u8    k_no_undo  = 0x80;
+        static constexpr usize k_no_entry = ~usize(0);
+
+        /// Appends a voxel write, to the open run of set_voxel calls if there is one
+        void record_point(const glm::uvec3& pos, VoxelType type, VoxelType old);
+
+        /// Starts an entry, ending the open run of set_voxel calls. Returns its offset
+        /// for end_entry().
+        usize begin_entry(S64JournalOp op, u8 flags = 0);
+        FORCEINLINE void end_entry(usize entry) { end_size(entry + 1); }
+
+        /// Starts a u32 size of what follows, returning its offset for end_size()
+        usize begin_size();
+        void  end_size(usize at);
+
+        /// Starts a list of records, which delta code their positions from the origin
+        FORCEINLINE void begin_records() { last_record_ = glm::uvec3(0); }
+
+        /// Appends a record of a whole node of 4 << shift_amt voxels holding type
+        void put_run(const glm::uvec3& pos, u8 shift_amt, VoxelType type);
+
+        /// Appends a record of the voxels of a brick selected by mask, in index order
+        void put_brick(const glm::uvec3& pos, u64 mask, const VoxelType* voxels);
+
+        void put_u8(u8 val) { bytes_.push_back(val); }
+        void put_f32(f32 val);
+        void put_vec3(const glm::vec3& val);
+        void put_varint(u32 val);
+        void put_delta(const glm::uvec3& pos, glm::uvec3& last);
+
+        std::vector<u8> bytes_;
+        /// offset of the open run of set_voxel calls
+        usize      points_entry_ = k_no_entry;
+        glm::uvec3 last_point_{ 0 };
+        glm::uvec3 last_record_{ 0 };
+    };
+} // namespace v
@@ -5,12 +5,70 @@
 #pragma once
 
 #include <defs.h>
+#include <span>
+#include <vector>
 #include <vmath.h>
 #include <vox/aabb.h>
 #include <vox/volume.h>
 
 namespace v {
-    class DenseGrid : public VoxelVolume <DenseGrid, u8> {
+    /// A box of voxels stored one byte each, starting at the origin like the other
+    /// stores. Laid out like Sparse64Tree::extract_region: x fastest, then z, then y,
+    /// so the voxel (x, y, z) is voxels()[x + size.x * (z + size.z * y)].
+    class DenseGrid : public VoxelVolume<DenseGrid, u8> {
+    public:
+        DenseGrid() = default;
 
+        explicit DenseGrid(const glm::uvec3& size) :
+            size_(size), voxels_(static_cast<usize>(size.x) * size.y * size.z)
+        {}
+
+        /// Constructs the smallest grid that can contain the bounding box.
+        /// Translation of the box does not matter.
+        explicit DenseGrid(const AABB& must_contain) :
+            DenseGrid(glm::uvec3(glm::ceil(must_contain.max - must_contain.min)))
+        {}
+
+        FORCEINLINE const glm::uvec3& size() const { return size_; }
+        FORCEINLINE AABB bounding_box() const
+        {
+            return AABB(glm::vec3(0), glm::vec3(size_));
+        }
+
+        FORCEINLINE std::span<VoxelType>       voxels() { return voxels_; }
+        FORCEINLINE std::span<const VoxelType> voxels() const { return voxels_; }
+
+        FORCEINLINE usize index(u32 x, u32 y, u32 z) const
+        {
+            return x + size_.x * (z + static_cast<usize>(size_.z) * y);
+        }
+
+        /// VoxelVolume access. Returns nothing outside the grid.
+        FORCEINLINE std::optional<VoxelType> get(Coord pos) const
+        {
+            if (!contains(pos))
+                return std::nullopt;
+            return voxels_[index(pos.x, pos.y, pos.z)];
+        }
+
+        /// VoxelVolume access. Returns 1 if the voxel was written, 0 if it lies outside
+        /// the grid.
+        FORCEINLINE u8 set(Coord pos, VoxelType type)
+        {
+            if (!contains(pos))
+                return 0;
+            voxels_[index(pos.x, pos.y, pos.z)] = type;
+            return 1;
+        }
+
+    private:
+        FORCEINLINE bool contains(Coord pos) const
+        {
+            return static_cast<u32>(pos.x) < size_.x &&
+                static_cast<u32>(pos.y) < size_.y && static_cast<u32>(pos.z) < size_.z;
+        }
+
+        glm::uvec3             size_{ 0 };
+        std::vector<VoxelType> voxels_;
     };
-}
+} // namespace v
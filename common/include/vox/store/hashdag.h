@@ -1,22 +1,936 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
 #include <defs.h>
+#include <iterator>
+#include <optional>
+#include <span>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include <vmath.h>
+#include <vox/aabb.h>
+#include <vox/store/stats.h>
+#include <vox/volume.h>
+
+namespace tf {
+    class Executor;
+}
 
 namespace v {
-    /// A Hashmap + Sparse Directed Acyclic Graph structure based on
-    /// https://github.com/Phyronnaz/HashDAG
-    /// Paper: https://onlinelibrary.wiley.com/doi/full/10.1111/cgf.13916
+    /// The node tables of an HDAG: an octree of extent 2^depth whose identical subtrees
+    /// are stored once. Every level has its own hash table of nodes, keyed by their
+    /// contents, so a node is looked up before it is added and two equal subtrees
+    /// always end up as the same pointer. The bottom two levels of the octree are
+    /// merged into 4x4x4 leaves holding only a 64 bit occupancy mask, which is where
+    /// most of the deduplication happens in natural scenes.
+    ///
+    /// Nodes are stored as u32 words in the page pool of their level. Each bucket of a
+    /// level's table owns a chain of pages that new nodes are bump allocated into, so a
+    /// lookup only scans the pages of one bucket, and a node pointer is just the index
+    /// of its first word in the pool.
+    ///   interior node: child mask (bits 0-7), the number of solid voxels below it
+    ///                  (one word, two above 1024^3 voxels), then one pointer per
+    ///                  existing child
+    ///   leaf:          the low and high words of the occupancy mask
+    ///
+    /// Nodes are never changed once added. Edits copy the path from the root down to
+    /// what they touch and swap in the new root, leaving the nodes they replaced
+    /// unreachable. Those are reclaimed by an incremental mark and compact collection.
+    /// Marking runs in small steps between edits, from the root the collection started
+    /// with. Old nodes an edit finds again are marked from too, while nodes added
+    /// since the start are kept without being traced, as edits only build them out of
+    /// nodes that are marked or new. Once everything is marked, the live nodes of each
+    /// level are rehashed into fresh tables, from the leaves up, in parallel if an
+    /// executor is given.
+    class HDAGNodes {
+    public:
+        /// Pointer to no node, an empty subtree
+        static constexpr u32 k_empty = ~0u;
+        /// Words per page, including the link to the bucket's next page
+        static constexpr u32 k_page_words = 128;
+        /// log2 of the most buckets a level has. Levels near the root, which hold few
+        /// nodes, have fewer.
+        static constexpr u32 k_max_bucket_bits = 14;
+        /// Deepest tree supported, limited by the 64 bit keys batched edits sort by
+        static constexpr u8 k_max_depth = 21;
+        /// Automatic collections start once the tables hold this many times the nodes
+        /// the last collection left, and at least k_gc_min_nodes
+        static constexpr usize k_gc_growth    = 2;
+        static constexpr usize k_gc_min_nodes = 1 << 14;
+        /// Nodes an automatic collection marks for every node an edit adds, so it ends
+        /// well before the tables double again
+        static constexpr usize k_gc_work = 4;
+
+        explicit HDAGNodes(u8 depth);
+
+        FORCEINLINE u8  depth() const { return depth_; }
+        FORCEINLINE u32 extent() const { return 1u << depth_; }
+        FORCEINLINE u32 leaf_level() const { return depth_ - 2; }
+
+        FORCEINLINE u32  root() const { return root_; }
+        FORCEINLINE void set_root(u32 root) { root_ = root; }
+
+        /// Child i of an interior node, or k_empty
+        FORCEINLINE u32 child(u32 level, u32 ptr, u32 i) const
+        {
+            const u32* node = &levels_[level].words[ptr];
+            if (!((node[0] >> i) & 1))
+                return k_empty;
+            const u32 before = std::popcount(node[0] & ((1u << i) - 1));
+            return node[1 + count_words(level) + before];
+        }
+
+        /// Children of an interior node, k_empty where it has none
+        FORCEINLINE std::array<u32, 8> children(u32 level, u32 ptr) const
+        {
+            std::array<u32, 8> kids;
+            kids.fill(k_empty);
+            if (ptr == k_empty)
+                return kids;
+            const u32* node = &levels_[level].words[ptr];
+            u32        next = 1 + count_words(level);
+            for (u32 m = node[0]; m; m &= m - 1)
+                kids[std::countr_zero(m)] = node[next++];
+            return kids;
+        }
+
+        FORCEINLINE u64 leaf_mask(u32 ptr) const
+        {
+            const u32* node = &levels_[leaf_level()].words[ptr];
+            return node[0] | static_cast<u64>(node[1]) << 32;
+        }
+
+        /// Solid voxels below the node
+        FORCEINLINE u64 voxel_count(u32 level, u32 ptr) const
+        {
+            if (ptr == k_empty)
+                return 0;
+            if (level == leaf_level())
+                return std::popcount(leaf_mask(ptr));
+            const u32* node = &levels_[level].words[ptr];
+            return count_words(level) == 1 ? node[1]
+                                           : node[1] | static_cast<u64>(node[2]) << 32;
+        }
+
+        /// Returns the leaf with this occupancy, adding it if needed.
+        /// k_empty if mask is zero.
+        u32 make_leaf(u64 mask);
+        /// Returns the interior node of the level with these children, adding it if
+        /// needed. k_empty if every child is.
+        u32 make_interior(u32 level, const std::array<u32, 8>& kids);
+        /// The node of the level whose whole region is solid
+        u32 full(u32 level);
+
+        /// Drops every node, releasing the memory of the node tables
+        void clear();
+
+        /// Nodes stored in the tables, including the ones edits replaced
+        usize node_count() const;
+        /// Distinct nodes reachable from the root
+        usize live_node_count() const;
+        VoxelStoreStats stats() const;
+
+        FORCEINLINE bool gc_running() const { return gc_.running; }
+        /// Starts a collection from the current root, if none is running
+        void gc_start();
+        /// Marks up to budget nodes, then compacts the tables if nothing is left to
+        /// mark. Returns whether the collection is still running.
+        /// The compaction runs on the executor if there is one, which must not be
+        /// called from one of its workers.
+        bool gc_step(usize budget, tf::Executor* executor);
+
+        /// Whether pace_gc runs collections. On by default.
+        FORCEINLINE void set_auto_gc(bool enabled) { auto_gc_ = enabled; }
+        /// Called after every edit. Starts a collection once the tables have grown
+        /// enough, and advances a running one by the nodes added since the last call.
+        /// Returns whether a collection finished.
+        bool pace_gc();
+
+    private:
+        /// Head of a chain of pages. The first word of each page links to the next one.
+        struct Bucket {
+            u32 first = k_empty;
+            u32 last  = k_empty;
+            /// words used in the last page, including the link
+            u32 used = 0;
+        };
+
+        /// The nodes of one level of the octree
+        struct Level {
+            std::vector<u32>    words;
+            std::vector<Bucket> buckets;
+            usize               nodes         = 0;
+            usize               pointer_words = 0;
+        };
+
+        /// State of a running collection
+        struct Gc {
+            bool running = false;
+            /// Words each level held when the collection started. Nodes past them were
+            /// added since, and are live.
+            std::vector<usize> snapshot;
+            /// One bit per word of the snapshot, set at the first word of live nodes
+            std::vector<std::vector<u64>> marks;
+            /// Marked nodes whose children aren't marked yet, per level
+            std::vector<std::vector<u32>> pending;
+        };
+
+        /// Words holding the voxel count of the level's interior nodes
+        FORCEINLINE u32 count_words(u32 level) const
+        {
+            return 3u * (depth_ - level) < 32 ? 1 : 2;
+        }
+
+        /// Size of a node of the level whose first word is word
+        FORCEINLINE u32 node_words(u32 level, u32 word) const
+        {
+            if (level == leaf_level())
+                return 2;
+            return 1 + count_words(level) + std::popcount(word);
+        }
+
+        /// Calls fn(ptr) for every node stored in the bucket, in pool order
+        template <typename Fn>
+        void for_each_in_bucket(u32 level, const Bucket& bucket, Fn&& fn) const
+        {
+            const Level& lv = levels_[level];
+            for (u32 page = bucket.first; page != k_empty; page = lv.words[page])
+            {
+                const u32 end = page + (page == bucket.last ? bucket.used : k_page_words);
+                for (u32 at = page + 1; at < end;)
+                {
+                    // interior nodes never have a zero mask, so a zero word pads the
+                    // end of a page the next node didn't fit in
+                    if (level != leaf_level() && !lv.words[at])
+                        break;
+                    const u32 size = node_words(level, lv.words[at]);
+                    if (size > end - at)
+                        break;
+                    fn(at);
+                    at += size;
+                }
+            }
+        }
+
+        u32 find_or_add(u32 level, std::span<const u32> words);
 
+        /// Marks the node live, and queues its children to be marked
+        void shade(u32 level, u32 ptr);
 
+        /// Rehashes the live nodes into fresh tables, from the leaves up
+        void compact(tf::Executor* executor);
+
+        std::vector<Level> levels_;
+        /// full(level) once it was added, k_empty before, or once a collection found
+        /// nothing using it
+        std::vector<u32> full_;
+        Gc               gc_;
+        /// Nodes ever added, and how many of them pace_gc has seen
+        usize added_ = 0;
+        usize paced_ = 0;
+        /// Nodes the last collection left
+        usize live_after_gc_ = 0;
+        u32   root_          = k_empty;
+        u8    depth_;
+        bool  auto_gc_ = true;
+    };
+
+    /// The types of an HDAG's solid voxels, in the order a depth first traversal meets
+    /// them: children in child index order, then the voxels of each leaf in bit order.
+    /// Stored as runs of a single type, grouped into blocks of at most k_block_runs
+    /// runs, so an edit only decodes and re-encodes the blocks it touches.
     template <typename T>
-    struct HDAGNode {
-        T val;
+    class HDAGAttributes {
+    public:
+        static constexpr u32 k_block_runs = 256;
+        /// Most types a block holds, so run ends fit in 32 bits
+        static constexpr u64 k_block_types = 1ull << 31;
+
+        /// Replaces erase types starting at index at with insert copies of value.
+        /// Indices are taken before any splice of the same batch is applied.
+        struct Splice {
+            u64 at;
+            u64 erase;
+            u64 insert;
+            T   value;
+        };
+
+        FORCEINLINE u64   size() const { return size_; }
+        FORCEINLINE usize block_count() const { return blocks_.size(); }
+
+        usize run_count() const
+        {
+            usize count = 0;
+            for (const Block& block : blocks_)
+                count += block.values.size();
+            return count;
+        }
+
+        /// Type at index i, which must be below size()
+        T at(u64 i) const
+        {
+            const usize b =
+                std::upper_bound(starts_.begin(), starts_.end(), i) - starts_.begin() - 1;
+            const Block& block = blocks_[b];
+            const auto   run   = std::upper_bound(
+                block.ends.begin(), block.ends.end(), static_cast<u32>(i - starts_[b]));
+            return block.values[run - block.ends.begin()];
+        }
+
+        void clear()
+        {
+            std::vector<Block>().swap(blocks_);
+            std::vector<u64>().swap(starts_);
+            size_ = 0;
+        }
+
+        /// Appends count copies of value
+        void push(T value, u64 count)
+        {
+            while (count)
+            {
+                const usize blocks = blocks_.size();
+                const u64   n      = push_into(blocks_, value, count);
+                if (blocks_.size() != blocks)
+                    starts_.push_back(size_);
+                size_ += n;
+                count -= n;
+            }
+        }
+
+        /// Applies splices sorted by index. Splices at the same index apply in the
+        /// order given. Nearby splices are grouped, and each group decodes the blocks
+        /// it spans once.
+        void apply(std::span<const Splice> splices)
+        {
+            std::vector<Run> old;
+            std::vector<Run> out;
+            usize            first_touched = blocks_.size();
+            // blocks from here on haven't been touched, and keep their old starts
+            usize search = 0;
+            i64   growth = 0;
+
+            for (usize s = 0; s < splices.size();)
+            {
+                usize b = std::upper_bound(
+                              starts_.begin() + search, starts_.end(), splices[s].at) -
+                    starts_.begin();
+                b = b > search ? b - 1 : search;
+
+                usize     end       = b;
+                const u64 old_start = b < blocks_.size() ? starts_[b] : size_;
+                u64       old_end   = old_start;
+                auto      take_block = [&]
+                {
+                    const Block& block = blocks_[end++];
+                    for (usize r = 0; r < block.values.size(); ++r)
+                        append_run(old, block.values[r], block.run_length(r));
+                    old_end += block.size();
+                };
+                old.clear();
+                out.clear();
+                if (b < blocks_.size())
+                    take_block();
+
+                // copies, or drops, old types up to index target
+                usize r     = 0;
+                u64   taken = 0;
+                u64   pos   = old_start;
+                auto  walk  = [&](u64 target, bool keep)
+                {
+                    while (pos < target)
+                    {
+                        const u64 n = std::min(old[r].length - taken, target - pos);
+                        if (keep)
+                            append_run(out, old[r].value, n);
+                        pos += n;
+                        taken += n;
+                        if (taken == old[r].length)
+                        {
+                            ++r;
+                            taken = 0;
+                        }
+                    }
+                };
+
+                for (; s < splices.size(); ++s)
+                {
+                    const Splice& sp = splices[s];
+                    // splices starting in the next block join the group
+                    if (sp.at > old_end && end < blocks_.size() &&
+                        sp.at < old_end + blocks_[end].size())
+                        take_block();
+                    if (sp.at > old_end)
+                        break;
+                    while (sp.at + sp.erase > old_end)
+                        take_block();
+                    walk(sp.at, true);
+                    walk(sp.at + sp.erase, false);
+                    append_run(out, sp.value, sp.insert);
+                }
+                walk(old_end, true);
+
+                std::vector<Block> fresh;
+                u64                fresh_size = 0;
+                for (const Run& run : out)
+                    for (u64 left = run.length; left;)
+                    {
+                        const u64 n = push_into(fresh, run.value, left);
+                        left -= n;
+                        fresh_size += n;
+                    }
+
+                if (fresh.size() == end - b)
+                    std::ranges::move(fresh, blocks_.begin() + b);
+                else
+                {
+                    blocks_.erase(blocks_.begin() + b, blocks_.begin() + end);
+                    blocks_.insert(
+                        blocks_.begin() + b, std::make_move_iterator(fresh.begin()),
+                        std::make_move_iterator(fresh.end()));
+                    starts_.erase(starts_.begin() + b, starts_.begin() + end);
+                    starts_.insert(starts_.begin() + b, fresh.size(), 0);
+                }
+                growth += static_cast<i64>(fresh_size - (old_end - old_start));
+                first_touched = std::min(first_touched, b);
+                search        = b + fresh.size();
+            }
+
+            size_ += growth;
+            update_starts(first_touched);
+        }
+
+        /// Re-encodes the stream into full blocks, if edits left it fragmented
+        void repack()
+        {
+            if (blocks_.size() <= 2 * (run_count() / k_block_runs + 1))
+                return;
+
+            std::vector<Block> packed;
+            for (const Block& block : blocks_)
+                for (usize r = 0; r < block.values.size(); ++r)
+                    for (u64 left = block.run_length(r); left;)
+                        left -= push_into(packed, block.values[r], left);
+            blocks_ = std::move(packed);
+            starts_.resize(blocks_.size());
+            update_starts(0);
+        }
+
+        usize reserved_bytes() const
+        {
+            usize bytes =
+                blocks_.capacity() * sizeof(Block) + starts_.capacity() * sizeof(u64);
+            for (const Block& block : blocks_)
+                bytes += block.values.capacity() * sizeof(T) +
+                    block.ends.capacity() * sizeof(u32);
+            return bytes;
+        }
+
+    private:
+        struct Run {
+            T   value;
+            u64 length;
+        };
+
+        struct Block {
+            std::vector<T> values;
+            /// End of each run, counted from the block's first type
+            std::vector<u32> ends;
+
+            FORCEINLINE u64 size() const { return ends.empty() ? 0 : ends.back(); }
+            FORCEINLINE u64 run_length(usize r) const
+            {
+                return ends[r] - (r ? ends[r - 1] : 0);
+            }
+        };
+
+        static FORCEINLINE void append_run(std::vector<Run>& runs, T value, u64 length)
+        {
+            if (!length)
+                return;
+            if (!runs.empty() && runs.back().value == value)
+                runs.back().length += length;
+            else
+                runs.push_back({ value, length });
+        }
+
+        /// Appends up to count copies of value to the last block, or to a new one if
+        /// it's full. Returns how many were appended.
+        static u64 push_into(std::vector<Block>& blocks, T value, u64 count)
+        {
+            if (blocks.empty() || blocks.back().size() == k_block_types ||
+                (blocks.back().values.back() != value &&
+                 blocks.back().values.size() == k_block_runs))
+                blocks.emplace_back();
+
+            Block&    block = blocks.back();
+            const u64 n     = std::min(count, k_block_types - block.size());
+            if (!block.values.empty() && block.values.back() == value)
+                block.ends.back() += static_cast<u32>(n);
+            else
+            {
+                block.ends.push_back(static_cast<u32>(block.size() + n));
+                block.values.push_back(value);
+            }
+            return n;
+        }
+
+        void update_starts(usize from)
+        {
+            u64 start = from ? starts_[from - 1] + blocks_[from - 1].size() : 0;
+            for (usize b = from; b < blocks_.size(); ++b)
+            {
+                starts_[b] = start;
+                start += blocks_[b].size();
+            }
+        }
+
+        std::vector<Block> blocks_;
+        /// Index of the first type of each block
+        std::vector<u64> starts_;
+        u64              size_ = 0;
     };
 
+    /// A Hashmap + Sparse Directed Acyclic Graph structure based on
+    /// https://github.com/Phyronnaz/HashDAG
+    /// Paper: https://onlinelibrary.wiley.com/doi/full/10.1111/cgf.13916
+    ///
+    /// The geometry lives in HDAGNodes, deduplicated whatever the types are. The types
+    /// of the solid voxels live next to it in an HDAGAttributes stream. A voxel's type
+    /// is found by counting the solid voxels before it in traversal order, which the
+    /// counts stored in interior nodes turn into a walk down a single path.
     template <typename T>
-    class HDAG {
+    class HDAG : public VoxelVolume<HDAG<T>, T> {
     public:
-        // rough scaffold for now
-        void insert();
+        using VoxelType = T;
+
+        /// A single voxel write, for batched edits
+        struct Edit {
+            glm::uvec3 pos;
+            T          type;
+        };
+
+        static constexpr u32 k_empty     = HDAGNodes::k_empty;
+        static constexpr u8  k_max_depth = HDAGNodes::k_max_depth;
+
+        explicit HDAG(u8 depth) : nodes_(depth) {}
+
+        /// Constructs the smallest HDAG that can contain the bounding box.
+        /// Translation of the box does not matter.
+        explicit HDAG(const AABB& must_contain) :
+            HDAG(static_cast<u8>(std::max(
+                2, v::ceil_log(
+                       v::max_component(must_contain.max - must_contain.min), 2.0))))
+        {}
+
+        FORCEINLINE u8  depth() const { return nodes_.depth(); }
+        FORCEINLINE u32 extent() const { return nodes_.extent(); }
+        FORCEINLINE AABB bounding_box() const
+        {
+            return AABB(glm::vec3(0), glm::vec3(static_cast<f32>(extent())));
+        }
+
+        /// Pointer to the root node. Two HDAGs of the same depth hold the same geometry
+        /// exactly when their roots are equal, as long as they share their node tables,
+        /// which is the case for the roots one HDAG has had between two collections.
+        FORCEINLINE u32 root() const { return nodes_.root(); }
+
+        FORCEINLINE bool is_empty() const { return root() == k_empty; }
+
+        /// VoxelVolume access. Returns nothing outside the HDAG.
+        std::optional<T> get(Coord pos) const
+        {
+            if (!contains(pos))
+                return std::nullopt;
+            u64       index = 0;
+            const u32 leaf  = find(pos.x, pos.y, pos.z, index, nullptr);
+            if (leaf == k_empty)
+                return T{};
+            const u64 mask = nodes_.leaf_mask(leaf);
+            const u64 bit  = 1ull << brick_index(pos.x, pos.y, pos.z);
+            if (!(mask & bit))
+                return T{};
+            return attributes_.at(index + std::popcount(mask & (bit - 1)));
+        }
+
+        /// VoxelVolume access. Writing T{} clears the voxel.
+        /// Returns 1 if the voxel was written, 0 if it lies outside the HDAG.
+        u8 set(Coord pos, T type)
+        {
+            if (!contains(pos))
+                return 0;
+
+            std::array<u32, k_max_depth> path;
+            u64                          index = 0;
+            u32       ptr  = find(pos.x, pos.y, pos.z, index, path.data());
+            const u64 old  = ptr == k_empty ? 0 : nodes_.leaf_mask(ptr);
+            const u64 bit  = 1ull << brick_index(pos.x, pos.y, pos.z);
+            const u64 mask = type != T{} ? old | bit : old & ~bit;
+            index += std::popcount(old & (bit - 1));
+
+            if (mask == old)
+            {
+                // only the type can change
+                if ((old & bit) && attributes_.at(index) != type)
+                {
+                    splice(index, 1, 1, type);
+                    apply_splices();
+                }
+                return 1;
+            }
+
+            splice(index, (old & bit) ? 1 : 0, (mask & bit) ? 1 : 0, type);
+            ptr = nodes_.make_leaf(mask);
+            for (u32 level = nodes_.leaf_level(); level-- > 0;)
+            {
+                auto kids = nodes_.children(level, path[level]);
+                kids[child_index(pos.x, pos.y, pos.z, depth() - 1 - level)] = ptr;
+                ptr = nodes_.make_interior(level, kids);
+            }
+            nodes_.set_root(ptr);
+            apply_splices();
+            return 1;
+        }
+
+        bool is_solid(u32 x, u32 y, u32 z) const
+        {
+            u32 ptr = nodes_.root();
+            for (u32 level = 0; level < nodes_.leaf_level() && ptr != k_empty; ++level)
+                ptr = nodes_.child(level, ptr, child_index(x, y, z, depth() - 1 - level));
+            if (ptr == k_empty)
+                return false;
+            return (nodes_.leaf_mask(ptr) >> brick_index(x, y, z)) & 1;
+        }
+
+        /// Applies many voxel writes at once, in any order. When several edits hit the
+        /// same voxel, the last one wins. Edits outside the HDAG are ignored.
+        /// The edits are sorted in traversal order, so each node on their paths is
+        /// copied once, and the attribute stream is spliced in one pass.
+        void set_voxels(std::span<const Edit> edits)
+        {
+            std::vector<std::pair<u64, u32>> keyed;
+            keyed.reserve(edits.size());
+            for (u32 i = 0; i < edits.size(); ++i)
+            {
+                const glm::uvec3& p = edits[i].pos;
+                if ((p.x | p.y | p.z) < extent())
+                    keyed.emplace_back(traversal_key(p.x, p.y, p.z), i);
+            }
+            // ties keep their order in edits, so the last write is applied last
+            std::ranges::sort(keyed);
+            if (keyed.empty())
+                return;
+            nodes_.set_root(edit_at(0, nodes_.root(), keyed, edits, 0));
+            apply_splices();
+        }
+
+        /// Fills the voxels overlapping the region with type, or clears them if type is
+        /// T{}. Nodes inside the region are replaced by the shared full (or empty) node
+        /// of their level, so the cost follows the region's surface.
+        void fill_aabb(const AABB& region, T type)
+        {
+            const glm::vec3 lo = glm::max(glm::floor(region.min), glm::vec3(0));
+            const glm::vec3 hi =
+                glm::min(glm::ceil(region.max), glm::vec3(static_cast<f32>(extent())));
+            if (lo.x >= hi.x || lo.y >= hi.y || lo.z >= hi.z)
+                return;
+            nodes_.set_root(fill_at(
+                0, nodes_.root(), glm::uvec3(0), glm::uvec3(lo), glm::uvec3(hi), type,
+                0));
+            apply_splices();
+        }
+
+        /// Replaces the contents of the HDAG with fn(const Coord&) -> T for every voxel,
+        /// building it bottom up without copying any path. Calls fn extent^3 times.
+        template <typename Fn>
+        void fill(Fn&& fn)
+        {
+            attributes_.clear();
+            nodes_.set_root(build_at(0, glm::uvec3(0), fn));
+            if (nodes_.pace_gc())
+                attributes_.repack();
+        }
+
+        /// Drops every voxel, releasing the memory of the node tables and attributes.
+        void clear()
+        {
+            nodes_.clear();
+            attributes_.clear();
+        }
+
+        /// Nodes stored in the tables, including the ones edits replaced
+        FORCEINLINE usize node_count() const { return nodes_.node_count(); }
+        /// Distinct nodes reachable from the root
+        FORCEINLINE usize live_node_count() const { return nodes_.live_node_count(); }
+        FORCEINLINE const HDAGAttributes<T>& attributes() const { return attributes_; }
+
+        VoxelStoreStats stats() const
+        {
+            VoxelStoreStats stats = nodes_.stats();
+            stats.reserved_bytes += attributes_.reserved_bytes();
+            return stats;
+        }
+
+        // Collecting the nodes edits replaced. Edits start and advance collections on
+        // their own unless set_auto_gc(false) was called, these are for collecting on
+        // a schedule instead, e.g. a few steps per tick.
+
+        FORCEINLINE bool gc_running() const { return nodes_.gc_running(); }
+        FORCEINLINE void set_auto_gc(bool enabled) { nodes_.set_auto_gc(enabled); }
+        FORCEINLINE void gc_start() { nodes_.gc_start(); }
+
+        /// Marks up to budget nodes, and compacts the tables once nothing is left to
+        /// mark. Returns whether the collection is still running.
+        bool gc_step(usize budget) { return finish_gc(nodes_.gc_step(budget, nullptr)); }
+
+        /// Same, running the compaction on the executor.
+        /// Must not be called from one of the executor's workers.
+        bool gc_step(usize budget, tf::Executor& executor)
+        {
+            return finish_gc(nodes_.gc_step(budget, &executor));
+        }
+
+        /// Runs a whole collection at once
+        void collect()
+        {
+            nodes_.gc_start();
+            gc_step(~usize(0));
+        }
+
+        void collect(tf::Executor& executor)
+        {
+            nodes_.gc_start();
+            gc_step(~usize(0), executor);
+        }
 
     private:
+        using Splice = typename HDAGAttributes<T>::Splice;
+
+        FORCEINLINE bool contains(Coord pos) const
+        {
+            return static_cast<u32>(pos.x | pos.y | pos.z) < extent();
+        }
+
+        /// Index of the child holding the voxel, below a node whose children are
+        /// 2^shift voxels wide
+        static FORCEINLINE u32 child_index(u32 x, u32 y, u32 z, u32 shift)
+        {
+            return ((x >> shift) & 1) | ((y >> shift) & 1) << 1 | ((z >> shift) & 1) << 2;
+        }
+
+        /// Bit of the voxel in its leaf's mask, laid out like S64Node::get_idx
+        static FORCEINLINE u32 brick_index(u32 x, u32 y, u32 z)
+        {
+            return (x & 3) | (z & 3) << 2 | (y & 3) << 4;
+        }
+
+        /// Sort key of a voxel along the traversal order: its child index at every
+        /// level from the root down, then its bit in the leaf
+        FORCEINLINE u64 traversal_key(u32 x, u32 y, u32 z) const
+        {
+            u64 key = 0;
+            for (u32 shift = depth(); shift-- > 2;)
+                key = key << 3 | child_index(x, y, z, shift);
+            return key << 6 | brick_index(x, y, z);
+        }
+
+        static FORCEINLINE glm::uvec3 child_offset(u32 i)
+        {
+            return glm::uvec3(i & 1, (i >> 1) & 1, i >> 2);
+        }
+
+        /// Walks down to the leaf holding the voxel, adding the solid voxels of the
+        /// subtrees before it to index. Fills path with the node of every level above,
+        /// if given. Returns k_empty if there is no leaf.
+        u32 find(u32 x, u32 y, u32 z, u64& index, u32* path) const
+        {
+            u32 ptr = nodes_.root();
+            for (u32 level = 0; level < nodes_.leaf_level(); ++level)
+            {
+                if (path)
+                    path[level] = ptr;
+                if (ptr == k_empty)
+                    continue;
+                const auto kids = nodes_.children(level, ptr);
+                const u32  i    = child_index(x, y, z, depth() - 1 - level);
+                for (u32 j = 0; j < i; ++j)
+                    index += nodes_.voxel_count(level + 1, kids[j]);
+                ptr = kids[i];
+            }
+            return ptr;
+        }
+
+        /// Queues a splice of the attribute stream, merging it into the previous one
+        /// when they touch
+        void splice(u64 at, u64 erase, u64 insert, T value)
+        {
+            if (!erase && !insert)
+                return;
+            if (!splices_.empty())
+            {
+                Splice& last = splices_.back();
+                if (last.at + last.erase == at &&
+                    (!insert || !last.insert || last.value == value))
+                {
+                    if (!last.insert)
+                        last.value = value;
+                    last.erase += erase;
+                    last.insert += insert;
+                    return;
+                }
+            }
+            splices_.push_back({ at, erase, insert, value });
+        }
+
+        void apply_splices()
+        {
+            attributes_.apply(splices_);
+            splices_.clear();
+            if (nodes_.pace_gc())
+                attributes_.repack();
+        }
+
+        bool finish_gc(bool running)
+        {
+            if (!running)
+                attributes_.repack();
+            return running;
+        }
+
+        u32 edit_at(
+            u32 level, u32 ptr, std::span<const std::pair<u64, u32>> keyed,
+            std::span<const Edit> edits, u64 base)
+        {
+            if (level == nodes_.leaf_level())
+            {
+                const u64 old  = ptr == k_empty ? 0 : nodes_.leaf_mask(ptr);
+                u64       mask = old;
+                for (usize k = 0; k < keyed.size(); ++k)
+                {
+                    // a later edit of the same voxel wins
+                    if (k + 1 < keyed.size() && keyed[k + 1].first == keyed[k].first)
+                        continue;
+                    const T   type = edits[keyed[k].second].type;
+                    const u64 bit  = 1ull << (keyed[k].first & 63);
+                    mask           = type != T{} ? mask | bit : mask & ~bit;
+                    splice(
+                        base + std::popcount(old & (bit - 1)), (old & bit) ? 1 : 0,
+                        type != T{} ? 1 : 0, type);
+                }
+                return mask == old ? ptr : nodes_.make_leaf(mask);
+            }
+
+            auto      kids    = nodes_.children(level, ptr);
+            const u32 shift   = 6 + 3 * (nodes_.leaf_level() - 1 - level);
+            bool      changed = false;
+            u32       next    = 0;
+            for (auto it = keyed.begin(); it != keyed.end();)
+            {
+                const u32 i   = (it->first >> shift) & 7;
+                auto      end = std::find_if(
+                    it, keyed.end(),
+                    [&](const auto& k) { return ((k.first >> shift) & 7) != i; });
+                // attribute indices are taken before the edit, so count the old kids
+                for (; next < i; ++next)
+                    base += nodes_.voxel_count(level + 1, kids[next]);
+                const u64 count = nodes_.voxel_count(level + 1, kids[i]);
+                const u32 kid   = edit_at(level + 1, kids[i], { it, end }, edits, base);
+                changed |= kid != kids[i];
+                kids[i] = kid;
+                base += count;
+                next = i + 1;
+                it   = end;
+            }
+            return changed ? nodes_.make_interior(level, kids) : ptr;
+        }
+
+        u32 fill_at(
+            u32 level, u32 ptr, const glm::uvec3& pos, const glm::uvec3& lo,
+            const glm::uvec3& hi, T type, u64 base)
+        {
+            const u32        size = extent() >> level;
+            const glm::uvec3 end  = pos + size;
+            if (lo.x >= end.x || lo.y >= end.y || lo.z >= end.z || hi.x <= pos.x ||
+                hi.y <= pos.y || hi.z <= pos.z)
+                return ptr;
+            if (lo.x <= pos.x && lo.y <= pos.y && lo.z <= pos.z && end.x <= hi.x &&
+                end.y <= hi.y && end.z <= hi.z)
+            {
+                const u64 volume = static_cast<u64>(size) * size * size;
+                splice(
+                    base, nodes_.voxel_count(level, ptr), type != T{} ? volume : 0, type);
+                return type != T{} ? nodes_.full(level) : k_empty;
+            }
+
+            if (level == nodes_.leaf_level())
+            {
+                const glm::uvec3 from = glm::max(lo, pos);
+                const glm::uvec3 to   = glm::min(hi, end);
+                u64              bits = 0;
+                for (u32 y = from.y; y < to.y; ++y)
+                    for (u32 z = from.z; z < to.z; ++z)
+                        for (u32 x = from.x; x < to.x; ++x)
+                            bits |= 1ull << brick_index(x, y, z);
+
+                const u64 old  = ptr == k_empty ? 0 : nodes_.leaf_mask(ptr);
+                const u64 mask = type != T{} ? old | bits : old & ~bits;
+                for (u64 m = bits; m; m &= m - 1)
+                {
+                    const u64 bit = m & -m;
+                    splice(
+                        base + std::popcount(old & (bit - 1)), (old & bit) ? 1 : 0,
+                        type != T{} ? 1 : 0, type);
+                }
+                return mask == old ? ptr : nodes_.make_leaf(mask);
+            }
+
+            auto      kids    = nodes_.children(level, ptr);
+            const u32 half    = size / 2;
+            bool      changed = false;
+            for (u32 i = 0; i < 8; ++i)
+            {
+                const u64 count = nodes_.voxel_count(level + 1, kids[i]);
+                const u32 kid   = fill_at(
+                    level + 1, kids[i], pos + child_offset(i) * half, lo, hi, type, base);
+                changed |= kid != kids[i];
+                kids[i] = kid;
+                base += count;
+            }
+            return changed ? nodes_.make_interior(level, kids) : ptr;
+        }
+
+        template <typename Fn>
+        u32 build_at(u32 level, const glm::uvec3& pos, Fn& fn)
+        {
+            if (level == nodes_.leaf_level())
+            {
+                u64 mask = 0;
+                for (u32 i = 0; i < 64; ++i)
+                {
+                    const Coord p(
+                        pos.x + (i & 3), pos.y + (i >> 4), pos.z + ((i >> 2) & 3));
+                    if (const T type = fn(p); type != T{})
+                    {
+                        mask |= 1ull << i;
+                        attributes_.push(type, 1);
+                    }
+                }
+                return nodes_.make_leaf(mask);
+            }
+
+            std::array<u32, 8> kids;
+            const u32          half = extent() >> (level + 1);
+            for (u32 i = 0; i < 8; ++i)
+                kids[i] = build_at(level + 1, pos + child_offset(i) * half, fn);
+            return nodes_.make_interior(level, kids);
+        }
+
+        HDAGNodes         nodes_;
+        HDAGAttributes<T> attributes_;
+        /// Splices of the edit in progress, kept to reuse their memory
+        std::vector<Splice> splices_;
     };
 } // namespace v
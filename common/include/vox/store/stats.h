@@ -0,0 +1,70 @@
+#pragma once
+
+#include <defs.h>
+#include <profile.h>
+
+namespace v {
+
+    /// Memory and structure statistics of a voxel store. Stores keep these up to date
+    /// as they are edited, so reading them is O(1).
+    struct VoxelStoreStats {
+        /// Nodes that point to children
+        usize interior_nodes;
+        /// Nodes that store a brick of voxels
+        usize brick_nodes;
+        /// Nodes filled entirely with a single voxel type
+        usize uniform_nodes;
+        /// Bytes of voxel data held in bricks
+        usize brick_bytes;
+        /// Bytes spent on child pointers, and on child slots that are allocated but
+        /// unused
+        usize pointer_bytes;
+        /// Bytes of node storage reserved by the store
+        usize reserved_bytes;
+        /// Times a node merged into a uniform node
+        u64 collapses;
+        /// Times a uniform node was split back into children
+        u64 expansions;
+
+        FORCEINLINE usize node_count() const
+        {
+            return interior_nodes + brick_nodes + uniform_nodes;
+        }
+
+        /// Sums the stats of many stores, e.g. every loaded chunk
+        FORCEINLINE VoxelStoreStats& operator+=(const VoxelStoreStats& o)
+        {
+            interior_nodes += o.interior_nodes;
+            brick_nodes += o.brick_nodes;
+            uniform_nodes += o.uniform_nodes;
+            brick_bytes += o.brick_bytes;
+            pointer_bytes += o.pointer_bytes;
+            reserved_bytes += o.reserved_bytes;
+            collapses += o.collapses;
+            expansions += o.expansions;
+            return *this;
+        }
+    };
+} // namespace v
+
+/// Publishes a VoxelStoreStats as profiler plots. prefix must be a string literal, as
+/// the profiler identifies plots by the address of their name. stats is not evaluated
+/// when profiling is disabled.
+#ifdef TRACY_ENABLE
+    #define V_PROFILE_PLOT_STORE_STATS(prefix, stats)                               \
+        do                                                                          \
+        {                                                                           \
+            const ::v::VoxelStoreStats& v_stats_ = (stats);                         \
+            V_PROFILE_PLOT(prefix " interior nodes", (i64)v_stats_.interior_nodes); \
+            V_PROFILE_PLOT(prefix " brick nodes", (i64)v_stats_.brick_nodes);       \
+            V_PROFILE_PLOT(prefix " uniform nodes", (i64)v_stats_.uniform_nodes);   \
+            V_PROFILE_PLOT(prefix " brick bytes", (i64)v_stats_.brick_bytes);       \
+            V_PROFILE_PLOT(prefix " pointer bytes", (i64)v_stats_.pointer_bytes);   \
+            V_PROFILE_PLOT(prefix " reserved bytes", (i64)v_stats_.reserved_bytes); \
+            V_PROFILE_PLOT(prefix " collapses", (i64)v_stats_.collapses);           \
+            V_PROFILE_PLOT(prefix " expansions", (i64)v_stats_.expansions);         \
+        }                                                                           \
+        while (0)
+#else
+    #define V_PROFILE_PLOT_STORE_STATS(prefix, stats)
+#endif
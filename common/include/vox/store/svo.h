@@ -5,31 +5,42 @@
 
 #pragma once
 
+#include <algorithm>
 #include <array>
 #include <cstddef>
 #include <defs.h>
 #include <memory>
+#include <span>
+#include <stdexcept>
 #include <utility>
+#include <vector>
+#include <vox/store/stats.h>
+#include <vox/volume.h>
 
 namespace v {
+    class DenseGrid;
 
     /// A compact sparse voxel octree supporting 128^3 voxels.
     /// - Value type is `u16` (0 treated as empty)
     /// - Root covers a 128 cube; depth is 7 (since 2^7 = 128)
     /// - Automatically collapses homogeneous internal nodes into leaves
-    class SparseVoxelOctree128 {
+    /// - Nodes live in a pool owned by the tree and link to their children by 32-bit
+    ///   index, so clearing (or destroying) a chunk frees one array instead of every
+    ///   node one by one
+    class SparseVoxelOctree128 : public VoxelVolume<SparseVoxelOctree128, u16> {
     public:
         using voxel_t                  = u16;
         static constexpr i32 size      = 128;
         static constexpr i32 max_depth = 7; // 2^7 = 128
+        /// voxels in a dense copy of the tree, see fill_from_dense
+        static constexpr usize dense_size = static_cast<usize>(size) * size * size;
 
         SparseVoxelOctree128() = default;
-        ~SparseVoxelOctree128() { clear(); }
 
         /// Returns the voxel value at local coordinates [0,127]^3
         voxel_t get(i32 x, i32 y, i32 z) const
         {
-            if (!root_)
+            if (root_ == k_null)
                 return 0;
             return get_at_node(root_, max_depth, x, y, z);
         }
@@ -38,7 +49,7 @@ namespace v {
         /// Automatically creates/removes nodes and collapses when possible
         void set(i32 x, i32 y, i32 z, voxel_t v)
         {
-            if (!root_ && v == 0)
+            if (root_ == k_null && v == 0)
             {
                 // writing empty into empty tree: nothing to do
                 return;
@@ -47,205 +58,533 @@ namespace v {
             root_ = set_at_node(root_, max_depth, x, y, z, v);
         }
 
-        /// Clear the entire tree to empty
+        /// VoxelVolume access. Returns nothing outside the tree.
+        FORCEINLINE std::optional<voxel_t> get(Coord pos) const
+        {
+            if (static_cast<u32>(pos.x | pos.y | pos.z) >= static_cast<u32>(size))
+                return std::nullopt;
+            return get(pos.x, pos.y, pos.z);
+        }
+
+        /// VoxelVolume access. Returns 1 if the voxel was written, 0 if it lies outside
+        /// the tree.
+        FORCEINLINE u8 set(Coord pos, voxel_t v)
+        {
+            if (static_cast<u32>(pos.x | pos.y | pos.z) >= static_cast<u32>(size))
+                return 0;
+            set(pos.x, pos.y, pos.z, v);
+            return 1;
+        }
+
+        FORCEINLINE AABB bounding_box() const
+        {
+            return AABB(glm::vec3(0), glm::vec3(static_cast<f32>(size)));
+        }
+
+        /// Calls fn(x, y, z, extent, value) for every non empty leaf, a cube of extent^3
+        /// voxels of value starting at (x, y, z), in depth first order.
+        template <typename Fn>
+        void for_each_leaf(Fn&& fn) const
+        {
+            for_each_leaf_at(root_, max_depth, 0, 0, 0, fn);
+        }
+
+        /// Fills the box [x0, x1) * [y0, y1) * [z0, z1) of local coordinates with v,
+        /// clipped to the tree. Nodes inside the box are replaced whole, so the cost
+        /// follows the box's surface rather than its volume.
+        void fill_box(i32 x0, i32 y0, i32 z0, i32 x1, i32 y1, i32 z1, voxel_t v)
+        {
+            const Box box{ std::max(x0, 0),    std::max(y0, 0),    std::max(z0, 0),
+                           std::min(x1, size), std::min(y1, size), std::min(z1, size) };
+            if (box.x0 >= box.x1 || box.y0 >= box.y1 || box.z0 >= box.z1)
+                return;
+
+            root_ = fill_at_node(root_, max_depth, 0, 0, 0, box, v);
+        }
+
+        /// Replaces the contents of the tree with dense_size voxels, laid out like
+        /// Sparse64Tree::extract_region: x fastest, then z, then y, so the voxel
+        /// (x, y, z) is voxels[x + size * (z + size * y)].
+        /// Builds the tree bottom up in one pass, collapsing as it goes, so uniform
+        /// regions never get nodes of their own.
+        /// Throws std::runtime_error if voxels doesn't hold dense_size voxels.
+        void fill_from_dense(std::span<const voxel_t> voxels)
+        {
+            if (voxels.size() != dense_size)
+                throw std::runtime_error("Dense SVO128 data must hold 128^3 voxels");
+
+            clear();
+            const Built root = build_dense(voxels.data(), max_depth, 0, 0, 0);
+            root_            = root.uniform ? uniform_node(root.value) : root.idx;
+        }
+
+        /// Writes every voxel of the tree into out, laid out like fill_from_dense.
+        /// Collapsed nodes fill their whole region at once.
+        /// Throws std::runtime_error if out doesn't hold dense_size voxels.
+        void decode_to_dense(std::span<voxel_t> out) const
+        {
+            if (out.size() != dense_size)
+                throw std::runtime_error("Dense SVO128 data must hold 128^3 voxels");
+
+            decode_node(root_, max_depth, 0, 0, 0, out.data());
+        }
+
+        /// Appends the tree to out in a pointerless encoding, for the network and
+        /// disk. Nodes are written depth first: a varint tag, 0 for an internal node
+        /// followed by its child mask byte and its children in index order, or the
+        /// value + 1 of a leaf. Voxels at the bottom level are their value alone.
+        void encode(std::vector<u8>& out) const { encode_node(root_, max_depth, out); }
+
+        /// Replaces the contents of the tree with one written by encode(), allocating
+        /// the nodes straight from the pool. Returns the number of bytes read, so
+        /// encodings can be packed back to back.
+        /// Throws std::runtime_error if the bytes are truncated or malformed.
+        usize decode(std::span<const u8> bytes)
+        {
+            clear();
+            Reader reader{ bytes.data(), bytes.data() + bytes.size() };
+            root_ = decode_from(reader, max_depth);
+            return static_cast<usize>(reader.at - bytes.data());
+        }
+
+        /// Clear the entire tree to empty, releasing the node pool without walking it
         void clear()
         {
-            destroy_node(root_);
-            root_ = nullptr;
+            pool_.clear();
+            root_           = k_null;
+            internal_nodes_ = 0;
+            leaf_nodes_     = 0;
         }
 
         /// Returns approximate node count (for debugging)
         size_t node_count() const { return count_nodes(root_); }
 
+        /// Node counts and memory overhead, kept up to date on every set. The octree
+        /// has no bricks, so every leaf is reported as a uniform node
+        VoxelStoreStats stats() const
+        {
+            VoxelStoreStats stats{};
+            stats.interior_nodes = internal_nodes_;
+            stats.uniform_nodes  = leaf_nodes_;
+            stats.pointer_bytes  = internal_nodes_ * sizeof(u32) * 8;
+            stats.reserved_bytes = pool_.capacity() * sizeof(Node);
+            stats.collapses      = collapses_;
+            stats.expansions     = expansions_;
+            return stats;
+        }
+
         /// Returns true if tree is empty or entirely empty voxels
         bool is_empty() const
         {
-            if (!root_)
+            if (root_ == k_null)
                 return true;
-            if (root_->is_leaf)
-                return root_->leaf() == 0;
+            if (pool_[root_].is_leaf)
+                return pool_[root_].leaf() == 0;
             return false;
         }
 
     private:
+        /// Index standing for no node. The pool never hands it out
+        static constexpr u32 k_null = 0;
+
         struct Node {
-            bool is_leaf;
-            union {
-                voxel_t leaf_value; // valid if is_leaf == true
-                struct {
-                    u8    child_mask; // bit i set if children[i] exists
-                    Node* children[8]; // valid if is_leaf == false
-                } internal;
-            } data{};
+            bool    is_leaf;
+            u8      child_mask; // bit i set if children[i] exists
+            voxel_t leaf_value; // valid if is_leaf == true
+            /// pool indices of the children, k_null if missing. Valid if is_leaf ==
+            /// false. children[0] links the free list once the node is released
+            u32 children[8];
 
             // helpers for convenience
-            voxel_t&       leaf() { return data.leaf_value; }
-            const voxel_t& leaf() const { return data.leaf_value; }
-            u8&            mask() { return data.internal.child_mask; }
-            const u8&      mask() const { return data.internal.child_mask; }
-            Node**         kids() { return data.internal.children; }
-            Node* const*   kids() const { return data.internal.children; }
+            voxel_t&       leaf() { return leaf_value; }
+            const voxel_t& leaf() const { return leaf_value; }
+            u8&            mask() { return child_mask; }
+            const u8&      mask() const { return child_mask; }
+            u32*           kids() { return children; }
+            const u32*     kids() const { return children; }
+        };
+        static_assert(sizeof(Node) == 36);
+
+        /// The nodes of a tree, in one array addressed by 32-bit index. Released nodes
+        /// are reused through a free list threaded through them, and clearing frees the
+        /// array at once. Allocating may move the array: hold on to indices, not to
+        /// references, across it.
+        class NodePool {
+        public:
+            FORCEINLINE Node&       operator[](u32 idx) { return nodes_[idx]; }
+            FORCEINLINE const Node& operator[](u32 idx) const { return nodes_[idx]; }
+
+            /// Returns a node to initialize
+            u32 alloc()
+            {
+                if (free_ != k_null)
+                {
+                    const u32 idx = free_;
+                    free_         = nodes_[idx].children[0];
+                    return idx;
+                }
+                // index 0 is k_null
+                if (nodes_.empty())
+                    nodes_.emplace_back();
+                nodes_.emplace_back();
+                return static_cast<u32>(nodes_.size() - 1);
+            }
+
+            void release(u32 idx)
+            {
+                nodes_[idx].children[0] = free_;
+                free_                   = idx;
+            }
+
+            /// Releases every node at once
+            void clear()
+            {
+                std::vector<Node>().swap(nodes_);
+                free_ = k_null;
+            }
+
+            /// Nodes there is room for, used or not
+            FORCEINLINE usize capacity() const { return nodes_.capacity(); }
+
+        private:
+            std::vector<Node> nodes_;
+            u32               free_ = k_null;
         };
 
-        static Node* new_leaf(voxel_t v)
+        u32 new_leaf(voxel_t v)
         {
-            Node* n    = new Node();
-            n->is_leaf = true;
-            n->leaf()  = v;
-            return n;
+            ++leaf_nodes_;
+            const u32 idx = pool_.alloc();
+            Node&     n   = pool_[idx];
+            n.is_leaf     = true;
+            n.mask()      = 0;
+            n.leaf()      = v;
+            return idx;
         }
 
-        static Node* new_internal()
+        u32 new_internal()
         {
-            Node* n    = new Node();
-            n->is_leaf = false;
-            n->mask()  = 0;
+            ++internal_nodes_;
+            const u32 idx = pool_.alloc();
+            Node&     n   = pool_[idx];
+            n.is_leaf     = false;
+            n.mask()      = 0;
+            n.leaf()      = 0;
             for (int i = 0; i < 8; ++i)
-                n->kids()[i] = nullptr;
-            return n;
+                n.kids()[i] = k_null;
+            return idx;
         }
 
-        static void destroy_node(Node* n)
+        void destroy_node(u32 idx)
         {
-            if (!n)
+            if (idx == k_null)
                 return;
-            if (!n->is_leaf)
+            Node& n = pool_[idx];
+            if (!n.is_leaf)
             {
                 for (int i = 0; i < 8; ++i)
                 {
-                    if (n->kids()[i])
-                        destroy_node(n->kids()[i]);
+                    if (n.kids()[i] != k_null)
+                        destroy_node(n.kids()[i]);
                 }
+                --internal_nodes_;
             }
-            delete n;
+            else
+                --leaf_nodes_;
+            pool_.release(idx);
         }
 
-        static size_t count_nodes(const Node* n)
+        /// Returns a node holding v everywhere: a leaf, or no node at all for empty
+        u32 uniform_node(voxel_t v) { return v != 0 ? new_leaf(v) : k_null; }
+
+        /// Turns leaf n into an internal node reading back the same. Returns the new
+        /// node, n is released
+        u32 expand_leaf(u32 n)
         {
-            if (!n)
-                return 0;
-            if (n->is_leaf)
-                return 1;
-            size_t c = 1; // internal node itself
+            const voxel_t prev = pool_[n].leaf();
+            destroy_node(n);
+            const u32 internal = new_internal();
+            ++expansions_;
+
+            // missing children read back as empty, so only a non empty leaf needs
+            // children. this is less memory-efficient than tracking an implicit
+            // uniform value, but simple, correct, and cheap out of the pool.
+            if (prev != 0)
+            {
+                for (int i = 0; i < 8; ++i)
+                {
+                    const u32 leaf            = new_leaf(prev);
+                    pool_[internal].kids()[i] = leaf;
+                    pool_[internal].mask() |= static_cast<u8>(1u << i);
+                }
+            }
+            return internal;
+        }
+
+        /// Points child ci of node n at child, keeping the mask in step
+        void link_child(u32 n, int ci, u32 child)
+        {
+            Node& node      = pool_[n];
+            node.kids()[ci] = child;
+            if (child != k_null)
+                node.mask() |= static_cast<u8>(1u << ci);
+            else
+                node.mask() &= static_cast<u8>(~(1u << ci));
+        }
+
+        /// A box of local coordinates, min inclusive, max exclusive
+        struct Box {
+            i32 x0, y0, z0;
+            i32 x1, y1, z1;
+        };
+
+        // Fills the part of box inside node n, whose region starts at (x, y, z);
+        // returns possibly new node index
+        u32 fill_at_node(u32 n, i32 depth, i32 x, i32 y, i32 z, const Box& box, voxel_t v)
+        {
+            const i32 extent = 1 << depth;
+            if (box.x1 <= x || box.y1 <= y || box.z1 <= z || box.x0 >= x + extent ||
+                box.y0 >= y + extent || box.z0 >= z + extent)
+                return n;
+
+            if (box.x0 <= x && box.y0 <= y && box.z0 <= z && box.x1 >= x + extent &&
+                box.y1 >= y + extent && box.z1 >= z + extent)
+            {
+                destroy_node(n);
+                return uniform_node(v);
+            }
+
+            // only partly covered, so depth > 0
+            if (n == k_null)
+            {
+                if (v == 0)
+                    return k_null;
+                n = new_internal();
+            }
+            else if (pool_[n].is_leaf)
+            {
+                if (pool_[n].leaf() == v)
+                    return n;
+                n = expand_leaf(n);
+            }
+
+            const i32 half = extent / 2;
             for (int i = 0; i < 8; ++i)
             {
-                c += count_nodes(n->kids()[i]);
+                const u32 child = fill_at_node(
+                    pool_[n].kids()[i], depth - 1, x + (i & 1) * half,
+                    y + ((i >> 1) & 1) * half, z + (i >> 2) * half, box, v);
+                link_child(n, i, child);
             }
-            return c;
+
+            try_collapse(n);
+            return n;
         }
 
-        static FORCEINLINE i32 child_index(i32 x, i32 y, i32 z, i32 depth)
+        /// A subtree built by fill_from_dense: uniformly value, or the node idx
+        struct Built {
+            u32     idx;
+            bool    uniform;
+            voxel_t value;
+        };
+
+        Built build_dense(const voxel_t* voxels, i32 depth, i32 x, i32 y, i32 z)
         {
-            const i32 bit = 1 << (depth - 1);
-            const i32 xi  = (x & bit) ? 1 : 0;
-            const i32 yi  = (y & bit) ? 1 : 0;
-            const i32 zi  = (z & bit) ? 1 : 0;
-            return (xi) | (yi << 1) | (zi << 2);
+            if (depth == 0)
+                return { k_null, true, voxels[x + size * (z + size * y)] };
+
+            const i32            half = 1 << (depth - 1);
+            std::array<Built, 8> kids;
+            bool                 uniform = true;
+            for (int i = 0; i < 8; ++i)
+            {
+                kids[i] = build_dense(
+                    voxels, depth - 1, x + (i & 1) * half, y + ((i >> 1) & 1) * half,
+                    z + (i >> 2) * half);
+                uniform &= kids[i].uniform && kids[i].value == kids[0].value;
+            }
+            if (uniform)
+                return { k_null, true, kids[0].value };
+
+            const u32 n = new_internal();
+            for (int i = 0; i < 8; ++i)
+                link_child(
+                    n, i, kids[i].uniform ? uniform_node(kids[i].value) : kids[i].idx);
+            return { n, false, 0 };
         }
 
-        static voxel_t get_at_node(const Node* n, i32 depth, i32 x, i32 y, i32 z)
+        void decode_node(u32 n, i32 depth, i32 x, i32 y, i32 z, voxel_t* out) const
         {
-            if (!n)
-                return 0;
-            if (n->is_leaf || depth == 0)
-                return n->leaf();
-            const int   ci    = child_index(x, y, z, depth);
-            const Node* child = n->kids()[ci];
-            if (!child)
-                return 0;
-            return get_at_node(child, depth - 1, x, y, z);
+            if (n == k_null || pool_[n].is_leaf)
+            {
+                const voxel_t v      = n == k_null ? 0 : pool_[n].leaf();
+                const i32     extent = 1 << depth;
+                for (i32 dy = 0; dy < extent; ++dy)
+                    for (i32 dz = 0; dz < extent; ++dz)
+                    {
+                        voxel_t* row = out + x + size * (z + dz + size * (y + dy));
+                        std::fill_n(row, extent, v);
+                    }
+                return;
+            }
+
+            const i32 half = 1 << (depth - 1);
+            for (int i = 0; i < 8; ++i)
+                decode_node(
+                    pool_[n].kids()[i], depth - 1, x + (i & 1) * half,
+                    y + ((i >> 1) & 1) * half, z + (i >> 2) * half, out);
         }
 
-        // Sets voxel; returns possibly new node pointer (due to collapses)
-        static Node* set_at_node(Node* n, i32 depth, i32 x, i32 y, i32 z, voxel_t v)
+        template <typename Fn>
+        void for_each_leaf_at(u32 n, i32 depth, i32 x, i32 y, i32 z, Fn& fn) const
         {
-            if (!n)
+            if (n == k_null)
+                return;
+            const Node& node = pool_[n];
+            if (node.is_leaf)
             {
-                // Creating a subtree. If depth==0 we create a leaf, otherwise create
-                // internal or leaf according to v
-                if (depth == 0)
-                    return new_leaf(v);
-                if (v == 0)
-                    return nullptr; // writing empty into empty: still nothing
-                // create a leaf root first so we have correct default; then descend to
-                // set
-                n = new_leaf(0);
+                if (node.leaf() != 0)
+                    fn(x, y, z, 1 << depth, node.leaf());
+                return;
             }
 
-            if (n->is_leaf)
+            const i32 half = 1 << (depth - 1);
+            for (int i = 0; i < 8; ++i)
+                for_each_leaf_at(
+                    node.kids()[i], depth - 1, x + (i & 1) * half,
+                    y + ((i >> 1) & 1) * half, z + (i >> 2) * half, fn);
+        }
+
+        static void put_varint(std::vector<u8>& out, u32 val)
+        {
+            while (val >= 0x80)
             {
-                if (depth == 0)
-                {
-                    n->leaf() = v;
-                    return n;
-                }
+                out.push_back(static_cast<u8>(val) | 0x80);
+                val >>= 7;
+            }
+            out.push_back(static_cast<u8>(val));
+        }
 
-                // Expand leaf if we need to write a different value somewhere in subtree
-                if (n->leaf() == v)
-                {
-                    // Setting same value under this leaf: nothing changes
-                    return n;
-                }
+        void encode_node(u32 n, i32 depth, std::vector<u8>& out) const
+        {
+            if (depth == 0)
+            {
+                put_varint(out, n == k_null ? 0 : pool_[n].leaf());
+                return;
+            }
+            if (n == k_null || pool_[n].is_leaf)
+            {
+                put_varint(out, (n == k_null ? 0u : pool_[n].leaf()) + 1u);
+                return;
+            }
+
+            const Node& node = pool_[n];
+            out.push_back(0);
+            out.push_back(node.mask());
+            for (int i = 0; i < 8; ++i)
+                if (node.mask() & (1u << i))
+                    encode_node(node.kids()[i], depth - 1, out);
+        }
+
+        /// Bounds checked reads of an encoding
+        struct Reader {
+            const u8* at;
+            const u8* end;
 
-                // Expand to internal
-                const voxel_t prev     = n->leaf();
-                Node*         internal = new_internal();
-
-                // If previous leaf value was non-zero, populate children with it lazily
-                // on-demand. We won’t pre-create all children to keep it sparse. We'll
-                // only create a child when needed.
-                delete n;
-                n = internal;
-
-                // Set the prior value at the target child implicitly by creating a child
-                // leaf with the previous value only when we are about to diverge. We
-                // fall-through to descend and mix values correctly.
-                (void)prev; // kept for potential future eager propagation
-                // For correctness, we only need to ensure that non-touched areas read
-                // back as `prev`. We'll encode this by storing a single optional uniform
-                // child and only materialize different areas. To achieve that, we
-                // temporarily set an implicit_uniform_ value on internal nodes. Simpler
-                // approach: create 8 child leaves with prev if prev != 0. This is less
-                // memory-efficient but is simple and correct.
-                if (prev != 0)
+            u8 get_u8()
+            {
+                if (at == end)
+                    throw std::runtime_error("Truncated SVO128 encoding");
+                return *at++;
+            }
+
+            u32 get_varint()
+            {
+                u32 val = 0;
+                for (u32 shift = 0; shift < 35; shift += 7)
                 {
-                    for (int i = 0; i < 8; ++i)
-                    {
-                        n->kids()[i] = new_leaf(prev);
-                        n->mask() |= static_cast<u8>(1u << i);
-                    }
+                    const u8 byte = get_u8();
+                    val |= static_cast<u32>(byte & 0x7f) << shift;
+                    if (!(byte & 0x80))
+                        return val;
                 }
+                throw std::runtime_error("Malformed varint in SVO128 encoding");
             }
+        };
 
+        u32 decode_from(Reader& reader, i32 depth)
+        {
+            // leaf values are stored + 1, except at the bottom where there's no tag
+            const u32 tag = reader.get_varint();
+            if (tag > 0xFFFFu + (depth != 0))
+                throw std::runtime_error("SVO128 encoding holds a value out of range");
             if (depth == 0)
-            {
-                // leaf node at correct depth
-                n->leaf() = v;
+                return uniform_node(static_cast<voxel_t>(tag));
+            if (tag != 0)
+                return uniform_node(static_cast<voxel_t>(tag - 1));
+
+            const u8  mask = reader.get_u8();
+            const u32 n    = new_internal();
+            for (int i = 0; i < 8; ++i)
+                if (mask & (1u << i))
+                    link_child(n, i, decode_from(reader, depth - 1));
+
+            // an encoder other than ours may leave mergeable children behind
+            if (!try_collapse(n) || pool_[n].leaf() != 0)
                 return n;
+            destroy_node(n);
+            return k_null;
+        }
+
+        size_t count_nodes(u32 idx) const
+        {
+            if (idx == k_null)
+                return 0;
+            const Node& n = pool_[idx];
+            if (n.is_leaf)
+                return 1;
+            size_t c = 1; // internal node itself
+            for (int i = 0; i < 8; ++i)
+            {
+                c += count_nodes(n.kids()[i]);
             }
+            return c;
+        }
 
-            // Internal node: descend to child
-            const int ci    = child_index(x, y, z, depth);
-            Node*     child = n->kids()[ci];
-            child           = set_at_node(child, depth - 1, x, y, z, v);
+        static FORCEINLINE i32 child_index(i32 x, i32 y, i32 z, i32 depth)
+        {
+            const i32 bit = 1 << (depth - 1);
+            const i32 xi  = (x & bit) ? 1 : 0;
+            const i32 yi  = (y & bit) ? 1 : 0;
+            const i32 zi  = (z & bit) ? 1 : 0;
+            return (xi) | (yi << 1) | (zi << 2);
+        }
 
-            // Update child pointer and mask
-            n->kids()[ci] = child;
-            if (child)
-                n->mask() |= static_cast<u8>(1u << ci);
-            else
-                n->mask() &= static_cast<u8>(~(1u << ci));
+        voxel_t get_at_node(u32 idx, i32 depth, i32 x, i32 y, i32 z) const
+        {
+            while (true)
+            {
+                const Node& n = pool_[idx];
+                if (n.is_leaf || depth == 0)
+                    return n.leaf();
+                idx = n.kids()[child_index(x, y, z, depth--)];
+                if (idx == k_null)
+                    return 0;
+            }
+        }
 
-            // Try to collapse if all children are leaves with the same value or all null
+        // Collapses an internal node into a leaf if all children are leaves with the
+        // same value or all null. Returns true if it did
+        bool try_collapse(u32 idx)
+        {
+            Node&   n = pool_[idx];
             voxel_t collapse_value{};
             bool    can_collapse = true;
-            bool    any_child    = false;
             bool    first_set    = false;
 
             for (int i = 0; i < 8; ++i)
             {
-                Node* c = n->kids()[i];
-                if (!c)
+                if (n.kids()[i] == k_null)
                 {
                     // Treat missing child as empty leaf (0)
                     if (!first_set)
@@ -259,18 +598,18 @@ namespace v {
                     }
                     continue;
                 }
-                any_child = true;
-                if (!c->is_leaf)
+                const Node& c = pool_[n.kids()[i]];
+                if (!c.is_leaf)
                 {
                     can_collapse = false;
                     break;
                 }
                 if (!first_set)
                 {
-                    collapse_value = c->leaf();
+                    collapse_value = c.leaf();
                     first_set      = true;
                 }
-                else if (collapse_value != c->leaf())
+                else if (collapse_value != c.leaf())
                 {
                     can_collapse = false;
                     break;
@@ -282,20 +621,74 @@ namespace v {
                 // Delete all children and become a single leaf with collapse_value
                 for (int i = 0; i < 8; ++i)
                 {
-                    if (n->kids()[i])
+                    if (n.kids()[i] != k_null)
                     {
-                        destroy_node(n->kids()[i]);
-                        n->kids()[i] = nullptr;
+                        destroy_node(n.kids()[i]);
+                        n.kids()[i] = k_null;
                     }
                 }
-                n->is_leaf = true;
-                n->leaf()  = first_set ? collapse_value : 0;
+                n.is_leaf = true;
+                n.leaf()  = first_set ? collapse_value : 0;
                 // mask not used for leaves
+                --internal_nodes_;
+                ++leaf_nodes_;
+                ++collapses_;
+            }
+            return can_collapse;
+        }
+
+        // Sets voxel; returns possibly new node index (due to collapses)
+        u32 set_at_node(u32 n, i32 depth, i32 x, i32 y, i32 z, voxel_t v)
+        {
+            if (n == k_null)
+            {
+                // Creating a subtree. If depth==0 we create a leaf, otherwise create
+                // internal or leaf according to v
+                if (depth == 0)
+                    return new_leaf(v);
+                if (v == 0)
+                    return k_null; // writing empty into empty: still nothing
+                // an empty internal node reads back as 0 everywhere, same as an empty
+                // leaf would after expanding; descend to set
+                n = new_internal();
+            }
+
+            if (pool_[n].is_leaf)
+            {
+                if (depth == 0)
+                {
+                    pool_[n].leaf() = v;
+                    return n;
+                }
+
+                // Expand leaf if we need to write a different value somewhere in subtree
+                if (pool_[n].leaf() == v)
+                {
+                    // Setting same value under this leaf: nothing changes
+                    return n;
+                }
+
+                // Expand to internal, then descend to mix values
+                n = expand_leaf(n);
             }
 
+            if (depth == 0)
+            {
+                // leaf node at correct depth
+                pool_[n].leaf() = v;
+                return n;
+            }
+
+            // Internal node: descend to child
+            const int ci    = child_index(x, y, z, depth);
+            const u32 child = set_at_node(pool_[n].kids()[ci], depth - 1, x, y, z, v);
+            link_child(n, ci, child);
+
+            try_collapse(n);
+
             // If no child exists and collapse_value is 0, the entire subtree is empty; we
-            // can return nullptr
-            if (n->is_leaf && n->leaf() == 0 && depth == max_depth)
+            // can return k_null
+            if (pool_[n].is_leaf && pool_[n].leaf() == 0 && depth == max_depth)
             {
                 // only prune root when it becomes empty leaf
                 // for internal recursive nodes, we always return the node to allow
@@ -305,6 +698,121 @@ namespace v {
             return n;
         }
 
-        Node* root_{ nullptr };
+        NodePool pool_{};
+        u32      root_{ k_null };
+        size_t   internal_nodes_{};
+        size_t   leaf_nodes_{};
+        u64      collapses_{};
+        u64      expansions_{};
+
+    public:
+        /// Reads and writes voxels close to each other (neighbors, scanlines) without
+        /// walking down from the root every time. Keeps the path to the last voxel it
+        /// touched, and only walks down from the lowest node that also holds the next
+        /// one. Voxels outside the tree read as empty.
+        /// Invalidated by any edit of the tree not made through the cursor.
+        class Cursor {
+        public:
+            explicit Cursor(SparseVoxelOctree128& tree) : tree_(&tree)
+            {
+                path_[0] = tree.root_;
+            }
+
+            voxel_t get(i32 x, i32 y, i32 z)
+            {
+                if (static_cast<u32>(x | y | z) >= static_cast<u32>(size))
+                    return 0;
+                descend(x, y, z);
+                const u32 n = path_[level_];
+                if (n == k_null)
+                    return 0;
+                const Node& node = tree_->pool_[n];
+                return node.is_leaf ? node.leaf() : 0;
+            }
+
+            /// Writes a voxel like SparseVoxelOctree128::set. Writes outside the tree
+            /// are ignored.
+            void set(i32 x, i32 y, i32 z, voxel_t v)
+            {
+                if (static_cast<u32>(x | y | z) >= static_cast<u32>(size))
+                    return;
+
+                i32 level = shared_level(x, y, z);
+                x_        = x;
+                y_        = y;
+                z_        = z;
+
+                const u32 n =
+                    tree_->set_at_node(path_[level], max_depth - level, x, y, z, v);
+                path_[level] = n;
+                if (level == 0)
+                    tree_->root_ = n;
+                else
+                    tree_->link_child(
+                        path_[level - 1], child_index(x, y, z, max_depth - level + 1), n);
+
+                // set_at_node already collapsed everything below n. the ancestors
+                // above it can only collapse if it turned into a leaf
+                while (level > 0 &&
+                       (path_[level] == k_null || tree_->pool_[path_[level]].is_leaf) &&
+                       tree_->try_collapse(path_[level - 1]))
+                    --level;
+                level_ = level;
+                walk_down();
+            }
+
+        private:
+            /// Returns the deepest level of the path that also holds (x, y, z)
+            FORCEINLINE i32 shared_level(i32 x, i32 y, i32 z) const
+            {
+                const u32 diff = static_cast<u32>((x ^ x_) | (y ^ y_) | (z ^ z_));
+                if (!diff)
+                    return level_;
+                // a node at level l spans the lowest max_depth - l bits
+                return std::min(level_, max_depth - 1 - static_cast<i32>(31 - CLZ(diff)));
+            }
+
+            FORCEINLINE void descend(i32 x, i32 y, i32 z)
+            {
+                level_ = shared_level(x, y, z);
+                x_     = x;
+                y_     = y;
+                z_     = z;
+                walk_down();
+            }
+
+            /// Extends the path from level_ down to the node holding the last voxel
+            FORCEINLINE void walk_down()
+            {
+                u32 n = path_[level_];
+                while (n != k_null && !tree_->pool_[n].is_leaf)
+                {
+                    const int ci    = child_index(x_, y_, z_, max_depth - level_);
+                    n               = tree_->pool_[n].kids()[ci];
+                    path_[++level_] = n;
+                }
+            }
+
+            SparseVoxelOctree128* tree_;
+            /// the nodes from the root (path_[0]) down to the one holding the last
+            /// voxel touched. The last one is k_null if that voxel has no node.
+            std::array<u32, max_depth + 1> path_{};
+            i32                            level_ = 0;
+            i32                            x_     = 0;
+            i32                            y_     = 0;
+            i32                            z_     = 0;
+        };
     };
+
+    /// Decodes the octree into a 128^3 grid, narrowing each voxel with voxel_to.
+    /// Defined in convert.cpp, like the Sparse64Tree conversions.
+    template <>
+    DenseGrid
+    VolumeOpImpl::to<SparseVoxelOctree128, DenseGrid>(const SparseVoxelOctree128& f);
+
+    /// Builds the octree from the part of the grid inside it, in one pass with
+    /// SparseVoxelOctree128::fill_from_dense.
+    template <>
+    SparseVoxelOctree128
+    VolumeOpImpl::to<DenseGrid, SparseVoxelOctree128>(const DenseGrid& f);
 } // namespace v
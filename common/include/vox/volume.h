@@ -5,7 +5,11 @@
 #pragma once
 
 #include <defs.h>
+#include <algorithm>
 #include <glm/glm.hpp>
+#include <limits>
+#include <optional>
+#include <type_traits>
 #include <vox/aabb.h>
 
 namespace v {
@@ -19,23 +23,148 @@ namespace v {
     concept DerivedFromVV = requires { typename T::VoxelType; } &&
         std::is_base_of_v<VoxelVolume<T, typename T::VoxelType>, T>;
 
+    /// Boolean operations between two volumes. A voxel is solid if it isn't the
+    /// default (air) value.
+    enum class CsgOp : u8 {
+        /// Keeps the voxels of the first volume where the second one is air
+        Subtract,
+        /// Keeps the voxels of the first volume where the second one is solid
+        Intersect,
+        /// Keeps the voxels of the first volume, and fills its air with the second one
+        Join,
+    };
+
     // all volume conversions/operations should be overwritten here
     class VolumeOpImpl {
     public:
-        // TODO! impl the other csg stuff and defaults for all
-
         // Implements a conversion function from one voxel type to another, if needed.
-        // TODO! provide default specialization for Type a == b
+        // Integer types convert by value, saturating types too large for the target,
+        // so a solid voxel never turns into air.
         template <typename VoxelTypeA, typename VoxelTypeB>
-        static VoxelTypeB voxel_to(const VoxelTypeA& a) {
-            TODO()
+        static VoxelTypeB voxel_to(const VoxelTypeA& a)
+        {
+            if constexpr (std::is_same_v<VoxelTypeA, VoxelTypeB>)
+                return a;
+            else if constexpr (
+                std::is_integral_v<VoxelTypeA> && std::is_integral_v<VoxelTypeB>)
+            {
+                static_assert(
+                    std::is_unsigned_v<VoxelTypeA> && std::is_unsigned_v<VoxelTypeB>);
+                constexpr auto max = std::numeric_limits<VoxelTypeB>::max();
+                if constexpr (std::numeric_limits<VoxelTypeA>::max() > max)
+                    return static_cast<VoxelTypeB>(std::min<VoxelTypeA>(a, max));
+                else
+                    return static_cast<VoxelTypeB>(a);
+            }
+            else
+                static_assert(
+                    sizeof(VoxelTypeA) == 0,
+                    "no conversion between these voxel types, specialize voxel_to");
         }
 
-        template <DerivedFromVV From, DerivedFromVV To>
-        static To to(const From& f) {
-            To ret{};
+        /// Combines two volumes into a new one. Specialize this for pairs of stores
+        /// that can do better than the voxel by voxel default.
+        template <DerivedFromVV Ret, DerivedFromVV A, DerivedFromVV B>
+        static Ret csg(CsgOp op, const A& a, const B& b)
+        {
+            return csg_voxelwise<Ret>(op, a, b);
+        }
 
-            TODO()
+        /// Slow CSG that works for any volumes, reading every voxel of a (and of b for
+        /// a join) once. Volumes must have bounding_box(), get() and set(), and Ret
+        /// must be constructible from the bounding box it should cover.
+        template <DerivedFromVV Ret, DerivedFromVV A, DerivedFromVV B>
+        static Ret csg_voxelwise(CsgOp op, const A& a, const B& b)
+        {
+            using OutT = typename Ret::VoxelType;
+
+            AABB box = a.bounding_box();
+            if (op == CsgOp::Join)
+            {
+                box.min = glm::min(box.min, b.bounding_box().min);
+                box.max = glm::max(box.max, b.bounding_box().max);
+            }
+
+            Ret         ret(box);
+            const Coord lo(glm::floor(box.min));
+            const Coord hi(glm::ceil(box.max));
+            for (i32 y = lo.y; y < hi.y; ++y)
+                for (i32 z = lo.z; z < hi.z; ++z)
+                    for (i32 x = lo.x; x < hi.x; ++x)
+                    {
+                        const Coord pos(x, y, z);
+                        const auto  va = a.get(pos);
+                        const auto  vb = b.get(pos);
+                        const bool  a_solid = va && *va != typename A::VoxelType{};
+                        const bool  b_solid = vb && *vb != typename B::VoxelType{};
+
+                        OutT out{};
+                        switch (op)
+                        {
+                        case CsgOp::Subtract:
+                            if (a_solid && !b_solid)
+                                out = voxel_to<typename A::VoxelType, OutT>(*va);
+                            break;
+                        case CsgOp::Intersect:
+                            if (a_solid && b_solid)
+                                out = voxel_to<typename A::VoxelType, OutT>(*va);
+                            break;
+                        case CsgOp::Join:
+                            if (a_solid)
+                                out = voxel_to<typename A::VoxelType, OutT>(*va);
+                            else if (b_solid)
+                                out = voxel_to<typename B::VoxelType, OutT>(*vb);
+                            break;
+                        }
+
+                        if (out != OutT{})
+                            ret.set(pos, out);
+                    }
+            return ret;
+        }
+
+        /// Converts a volume to another store. Specialize this for pairs of stores that
+        /// can copy whole nodes or bricks instead of the voxel by voxel default. The
+        /// built in stores declare their specializations in their own headers, against
+        /// forward declarations of the other stores, so a caller can't miss one. That
+        /// is why From and To are left unconstrained here, to_voxelwise checks them.
+        template <typename From, typename To>
+        static To to(const From& f)
+        {
+            return to_voxelwise<From, To>(f);
+        }
+
+        /// Slow conversion that works for any volumes, reading every voxel of f once.
+        /// Volumes must have bounding_box(), get() and set(). To is constructed from
+        /// the bounding box of f if it can be, and default constructed otherwise.
+        template <DerivedFromVV From, DerivedFromVV To>
+        static To to_voxelwise(const From& f)
+        {
+            using InT  = typename From::VoxelType;
+            using OutT = typename To::VoxelType;
+
+            const AABB box = f.bounding_box();
+            auto       make = [&]()
+            {
+                if constexpr (std::is_constructible_v<To, const AABB&>)
+                    return To(box);
+                else
+                    return To{};
+            };
+
+            To          ret = make();
+            const Coord lo(glm::floor(box.min));
+            const Coord hi(glm::ceil(box.max));
+            for (i32 y = lo.y; y < hi.y; ++y)
+                for (i32 z = lo.z; z < hi.z; ++z)
+                    for (i32 x = lo.x; x < hi.x; ++x)
+                    {
+                        const Coord pos(x, y, z);
+                        const auto  v = f.get(pos);
+                        if (v && *v != InT{})
+                            ret.set(pos, voxel_to<InT, OutT>(*v));
+                    }
+            return ret;
         }
     };
 
@@ -59,26 +188,38 @@ namespace v {
             // TODO! well actually each type should implement
         };
 
-        // example of derivedfrom voxel volume usage w/ CSG igs
         // Ret is the first param so we can specificy it for the return type,
-        // the Other type can/should be inferred from the passed in type
-        // TODO! implement default SLOOW voxel by voxel csg
+        // the Other type can/should be inferred from the passed in type.
+        // See VolumeOpImpl::csg for how each pair of volumes is combined.
         template <DerivedFromVV Ret = Derived, DerivedFromVV Other = Derived>
-        Ret subtract(const Other&);
+        Ret subtract(const Other& o) const
+        {
+            return VolumeOpImpl::csg<Ret, Derived, Other>(
+                CsgOp::Subtract, static_cast<const Derived&>(*this), o);
+        }
 
         template <DerivedFromVV Ret = Derived, DerivedFromVV Other = Derived>
-        Ret intersect(const Other&);
+        Ret intersect(const Other& o) const
+        {
+            return VolumeOpImpl::csg<Ret, Derived, Other>(
+                CsgOp::Intersect, static_cast<const Derived&>(*this), o);
+        }
 
         /// This is actually a 'union' operation, however you can't name a member function
         /// a keyword.
         template <DerivedFromVV Ret = Derived, DerivedFromVV Other = Derived>
-        Ret join(const Other&);
+        Ret join(const Other& o) const
+        {
+            return VolumeOpImpl::csg<Ret, Derived, Other>(
+                CsgOp::Join, static_cast<const Derived&>(*this), o);
+        }
 
-        /// Convert the volume to another volume type
+        /// Convert the volume to another volume type. See VolumeOpImpl::to for which
+        /// pairs of stores convert node by node.
         template <DerivedFromVV T>
-        T to()
+        T to() const
         {
-            return VolumeOpImpl::to<Derived, T>(*this);
+            return VolumeOpImpl::to<Derived, T>(static_cast<const Derived&>(*this));
         }
     };
 } // namespace v
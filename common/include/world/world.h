@@ -7,6 +7,7 @@
 #include <containers/ud_map.h>
 #include <cstdint>
 #include <defs.h>
+#include <span>
 #include <engine/domain.h>
 #include <vox/store/svo.h>
 
@@ -72,16 +73,37 @@ namespace v {
         void set(VoxelPos lp, u16 v)
         {
             svo_.set(lp.x, lp.y, lp.z, v);
-            dirty_ = true;
+            ++epoch_;
         }
 
-        FORCEINLINE bool dirty() const { return dirty_; }
-        FORCEINLINE void clear_dirty() { dirty_ = false; }
+        /// Fills the box [min, max) of local coordinates, clipped to the chunk
+        void fill_box(VoxelPos min, VoxelPos max, u16 v)
+        {
+            svo_.fill_box(min.x, min.y, min.z, max.x, max.y, max.z, v);
+            ++epoch_;
+        }
+
+        /// Replaces the whole chunk, e.g. with generated or loaded voxels. See
+        /// SparseVoxelOctree128::fill_from_dense for the layout.
+        void fill_from_dense(std::span<const u16> voxels)
+        {
+            svo_.fill_from_dense(voxels);
+            ++epoch_;
+        }
+
+        /// Edit epoch of the chunk, advanced by every edit. Consumers remember the
+        /// epoch they last processed and compare against it.
+        FORCEINLINE u32 epoch() const { return epoch_; }
+
+        FORCEINLINE bool dirty() const { return epoch_ != clean_epoch_; }
+        FORCEINLINE void clear_dirty() { clean_epoch_ = epoch_; }
 
     private:
         ChunkPos             pos_{};
         SparseVoxelOctree128 svo_{};
-        bool                 dirty_{ false };
+        u32                  epoch_{};
+        /// epoch at the last clear_dirty()
+        u32                  clean_epoch_{};
     };
 
     /// World state shared by client and server (no server-only logic here)
@@ -117,9 +139,22 @@ namespace v {
         /// Set voxel at world coordinate
         void set_voxel(WorldPos wp, u16 value);
 
+        /// Fills the box [min, max) of world coordinates, chunk by chunk. Creates the
+        /// chunks it touches unless it fills with empty.
+        void fill_box(WorldPos min, WorldPos max, u16 value);
+
         /// Iterate loaded chunks count
         size_t chunk_count() const { return chunks_.size(); }
 
+        /// Store stats summed over every loaded chunk
+        VoxelStoreStats chunk_stats() const
+        {
+            VoxelStoreStats stats{};
+            for (const auto& [pos, chunk] : chunks_)
+                stats += chunk->svo().stats();
+            return stats;
+        }
+
     private:
         using ChunkMap = ud_map<ChunkPos, ChunkDomain*, ChunkPosHash, ChunkPosEq>;
         ChunkMap chunks_{};
@@ -0,0 +1,325 @@
+#include <algorithm>
+#include <vox/mesh/greedy.h>
+#include "taskflow/algorithm/for_each.hpp"
+#include "taskflow/taskflow.hpp"
+
+namespace v {
+    using Type = S64Node::Type;
+
+    namespace {
+        /// bits of a brick's mask at x == 0, z == 0 and y == 0
+        constexpr u64 k_x0 = 0x1111111111111111ull;
+        constexpr u64 k_z0 = 0x000F000F000F000Full;
+        constexpr u64 k_y0 = 0xFFFFull;
+
+        /// Returns which of the 4 layers of a brick along an axis hold any bits. layer0
+        /// selects the first layer, and stride bits apart come the others
+        FORCEINLINE u64 layers(u64 bits, u64 layer0, u32 stride)
+        {
+            return static_cast<u64>((bits & layer0) != 0) |
+                static_cast<u64>((bits & (layer0 << stride)) != 0) << 1 |
+                static_cast<u64>((bits & (layer0 << stride * 2)) != 0) << 2 |
+                static_cast<u64>((bits & (layer0 << stride * 3)) != 0) << 3;
+        }
+
+        /// Maps a position in a slice of faces along axis (slice a, row v, bit u) to
+        /// x, y, z. Rows run along z for faces along x, along x otherwise
+        FORCEINLINE glm::uvec3 slice_to_xyz(u32 axis, u32 a, u32 u, u32 v)
+        {
+            switch (axis)
+            {
+            case 0:
+                return glm::uvec3(a, v, u);
+            case 1:
+                return glm::uvec3(u, a, v);
+            default:
+                return glm::uvec3(u, v, a);
+            }
+        }
+
+        /// Returns the 4 bits of a brick mask on row v of layer a, along axis, in the
+        /// order of slice_to_xyz
+        FORCEINLINE u64 brick_row(u64 bits, u32 axis, u32 a, u32 v)
+        {
+            switch (axis)
+            {
+            case 0:
+                {
+                    // x = a, y = v, the row runs along z: every 4th bit
+                    const u64 t = bits >> (a + 16 * v);
+                    return (t & 1) | ((t >> 3) & 2) | ((t >> 6) & 4) | ((t >> 9) & 8);
+                }
+            case 1:
+                return (bits >> (4 * v + 16 * a)) & 0xF;
+            default:
+                return (bits >> (4 * a + 16 * v)) & 0xF;
+            }
+        }
+
+        /// Adds the chunks under a node that may hold visible faces
+        void collect_chunks(
+            const S64Node& node, const glm::uvec3& pos, u32 extent,
+            std::vector<glm::uvec3>& out)
+        {
+            constexpr u32 chunk = S64Mesher::k_chunk_size;
+            if (node.type == Type::Empty)
+                return;
+
+            if (extent <= chunk)
+            {
+                out.push_back(pos);
+                return;
+            }
+
+            if (node.type == Type::SingleTypeLeaf)
+            {
+                // every neighbor of a chunk inside the node is solid too, so only the
+                // chunks along its surface show
+                const u32 n = extent / chunk;
+                for (u32 y = 0; y < n; ++y)
+                    for (u32 z = 0; z < n; ++z)
+                        for (u32 x = 0; x < n; ++x)
+                        {
+                            const bool inner = x > 0 && y > 0 && z > 0 && x < n - 1 &&
+                                y < n - 1 && z < n - 1;
+                            if (!inner)
+                                out.push_back(pos + glm::uvec3(x, y, z) * chunk);
+                        }
+                return;
+            }
+
+            const u32 child_extent = extent / 4;
+            for (u32 idx : node.child_indices())
+                collect_chunks(
+                    node.child(idx),
+                    pos + glm::uvec3(idx & 3, idx >> 4, (idx >> 2) & 3) * child_extent,
+                    child_extent, out);
+        }
+    } // namespace
+
+    S64Mesher::S64Mesher() : grid_(k_grid * k_grid * k_grid)
+    {
+        for (std::vector<u64>& faces : faces_)
+            faces.resize(k_bricks * k_bricks * k_bricks);
+    }
+
+    void S64Mesher::mesh_chunk(
+        const Sparse64Tree& tree, const glm::uvec3& origin, S64ChunkMesh& out)
+    {
+        out.origin = origin;
+        out.vertices.clear();
+
+        std::fill(grid_.begin(), grid_.end(), Brick{});
+        grid_min_   = glm::ivec3(origin / 4u) - 1;
+        type_count_ = 0;
+        mixed_      = false;
+        const u32 tree_bricks = static_cast<u32>(tree.bounding_box().max.x) / 4;
+        gather(tree.root(), glm::ivec3(0), tree_bricks);
+        if (type_count_ == 0)
+            return;
+
+        // a face shows where the voxel is solid and its neighbor isn't. shifting a mask
+        // by one voxel along an axis lines each voxel up with its neighbor, except on
+        // the brick's far side, whose neighbors come from the next brick
+        slices_.fill(0);
+        for (u32 by = 0; by < k_bricks; ++by)
+            for (u32 bz = 0; bz < k_bricks; ++bz)
+                for (u32 bx = 0; bx < k_bricks; ++bx)
+                {
+                    const u64 m = grid(bx + 1, by + 1, bz + 1).mask;
+                    if (!m)
+                        continue;
+
+                    const u64 px = grid(bx + 2, by + 1, bz + 1).mask;
+                    const u64 nx = grid(bx, by + 1, bz + 1).mask;
+                    const u64 py = grid(bx + 1, by + 2, bz + 1).mask;
+                    const u64 ny = grid(bx + 1, by, bz + 1).mask;
+                    const u64 pz = grid(bx + 1, by + 1, bz + 2).mask;
+                    const u64 nz = grid(bx + 1, by + 1, bz).mask;
+
+                    const std::array<u64, 6> visible = {
+                        m & ~(((m >> 1) & ~(k_x0 << 3)) | ((px & k_x0) << 3)),
+                        m & ~(((m << 1) & ~k_x0) | ((nx & (k_x0 << 3)) >> 3)),
+                        m & ~((m >> 16) | ((py & k_y0) << 48)),
+                        m & ~((m << 16) | ((ny & (k_y0 << 48)) >> 48)),
+                        m & ~(((m >> 4) & ~(k_z0 << 12)) | ((pz & k_z0) << 12)),
+                        m & ~(((m << 4) & ~k_z0) | ((nz & (k_z0 << 12)) >> 12)),
+                    };
+
+                    const u32 i = bx + k_bricks * (bz + k_bricks * by);
+                    for (u32 f = 0; f < 6; ++f)
+                        faces_[f][i] = visible[f];
+
+                    slices_[0] |= layers(visible[0], k_x0, 1) << (bx * 4);
+                    slices_[1] |= layers(visible[1], k_x0, 1) << (bx * 4);
+                    slices_[2] |= layers(visible[2], k_y0, 16) << (by * 4);
+                    slices_[3] |= layers(visible[3], k_y0, 16) << (by * 4);
+                    slices_[4] |= layers(visible[4], k_z0, 4) << (bz * 4);
+                    slices_[5] |= layers(visible[5], k_z0, 4) << (bz * 4);
+                }
+
+        for (u32 f = 0; f < 6; ++f)
+            for (u64 slices = slices_[f]; slices; slices &= slices - 1)
+                merge_slice(static_cast<S64Face>(f), CTZ64(slices), out);
+    }
+
+    void S64Mesher::gather(const S64Node& node, const glm::ivec3& pos, u32 size)
+    {
+        const glm::ivec3 lo = glm::max(pos, grid_min_);
+        const glm::ivec3 hi =
+            glm::min(pos + static_cast<i32>(size), grid_min_ + static_cast<i32>(k_grid));
+        if (lo.x >= hi.x || lo.y >= hi.y || lo.z >= hi.z)
+            return;
+
+        switch (node.type)
+        {
+        case Type::Empty:
+            return;
+        case Type::SingleTypeLeaf:
+            {
+                see_type(node.voxels[0]);
+                const glm::ivec3 a = lo - grid_min_, b = hi - grid_min_;
+                for (i32 y = a.y; y < b.y; ++y)
+                    for (i32 z = a.z; z < b.z; ++z)
+                        for (i32 x = a.x; x < b.x; ++x)
+                            grid(x, y, z) = { ~0ull, nullptr, node.voxels[0] };
+                return;
+            }
+        case Type::Leaf:
+            {
+                for (u64 m = node.child_mask; m && !mixed_; m &= m - 1)
+                    see_type(node.voxels[CTZ64(m)]);
+                const glm::ivec3 a = pos - grid_min_;
+                grid(a.x, a.y, a.z) = { node.child_mask, node.voxels, 0 };
+                return;
+            }
+        default:
+            {
+                const u32 child_size = size / 4;
+                for (u32 idx : node.child_indices())
+                {
+                    const glm::ivec3 offset(idx & 3, idx >> 4, (idx >> 2) & 3);
+                    gather(
+                        node.child(idx), pos + offset * static_cast<i32>(child_size),
+                        child_size);
+                }
+            }
+        }
+    }
+
+    VoxelType S64Mesher::type_at(const glm::uvec3& pos)
+    {
+        const Brick& brick = grid((pos.x >> 2) + 1, (pos.y >> 2) + 1, (pos.z >> 2) + 1);
+        if (!brick.voxels)
+            return brick.type;
+        return brick.voxels[S64Node::get_idx(pos.x & 3, pos.y & 3, pos.z & 3)];
+    }
+
+    void S64Mesher::merge_slice(S64Face face, u32 slice, S64ChunkMesh& out)
+    {
+        const u32  axis     = static_cast<u32>(face) / 2;
+        const bool positive = (static_cast<u32>(face) & 1) == 0;
+
+        // one row of 64 faces per line of the slice, 4 at a time from each brick
+        std::array<u64, k_chunk_size> rows{};
+        const std::vector<u64>&       faces = faces_[static_cast<u32>(face)];
+        const u32                     ba = slice / 4, la = slice % 4;
+        for (u32 bv = 0; bv < k_bricks; ++bv)
+            for (u32 bu = 0; bu < k_bricks; ++bu)
+            {
+                const glm::uvec3 b = slice_to_xyz(axis, ba, bu, bv);
+                if (!grid(b.x + 1, b.y + 1, b.z + 1).mask)
+                    continue;
+
+                const u64 bits = faces[b.x + k_bricks * (b.z + k_bricks * b.y)];
+                if (!bits)
+                    continue;
+                for (u32 lv = 0; lv < 4; ++lv)
+                    rows[bv * 4 + lv] |= brick_row(bits, axis, la, lv) << (bu * 4);
+            }
+
+        // in a chunk of a single type every run of faces merges, so only a mixed one
+        // looks at the types
+        auto same_type = [&](u32 u0, u32 w, u32 v, VoxelType type)
+        {
+            for (u32 u = u0; u < u0 + w; ++u)
+                if (type_at(slice_to_xyz(axis, slice, u, v)) != type)
+                    return false;
+            return true;
+        };
+
+        // faces on the positive side lie on the far plane of their voxels, and the
+        // winding flips where the row and line axes make a left handed pair with the
+        // face's normal
+        const u32  plane = slice + positive;
+        const bool flip =
+            face == S64Face::PosX || face == S64Face::PosY || face == S64Face::NegZ;
+        for (u32 v = 0; v < k_chunk_size; ++v)
+        {
+            while (rows[v])
+            {
+                const u32       u0 = CTZ64(rows[v]);
+                const VoxelType type =
+                    mixed_ ? type_at(slice_to_xyz(axis, slice, u0, v)) : first_type_;
+
+                // widest run of faces from u0, then as many lines up as hold all of it
+                const u64 rest = ~(rows[v] >> u0);
+                u32       w    = rest ? CTZ64(rest) : k_chunk_size - u0;
+                if (mixed_)
+                    for (u32 i = 1; i < w; ++i)
+                        if (type_at(slice_to_xyz(axis, slice, u0 + i, v)) != type)
+                        {
+                            w = i;
+                            break;
+                        }
+
+                const u64 run = (w == 64 ? ~0ull : (1ull << w) - 1) << u0;
+                rows[v] &= ~run;
+
+                u32 h = 1;
+                while (v + h < k_chunk_size && (rows[v + h] & run) == run &&
+                       (!mixed_ || same_type(u0, w, v + h, type)))
+                    rows[v + h++] &= ~run;
+
+                std::array<glm::uvec2, 4> corners = {
+                    glm::uvec2(u0, v), glm::uvec2(u0 + w, v), glm::uvec2(u0 + w, v + h),
+                    glm::uvec2(u0, v + h)
+                };
+                if (flip)
+                    std::swap(corners[1], corners[3]);
+
+                for (const glm::uvec2& c : corners)
+                {
+                    const glm::uvec3 pos = slice_to_xyz(axis, plane, c.x, c.y);
+                    out.vertices.push_back(S64MeshVertex::pack(pos, face, type));
+                }
+            }
+        }
+    }
+
+    std::vector<S64ChunkMesh>
+    S64Mesher::mesh_tree(const Sparse64Tree& tree, tf::Executor& executor)
+    {
+        std::vector<glm::uvec3> origins;
+        collect_chunks(
+            tree.root(), glm::uvec3(0), static_cast<u32>(tree.bounding_box().max.x),
+            origins);
+
+        // a mesher per worker, so the scratch buffers are never shared
+        std::vector<S64Mesher>    meshers(executor.num_workers());
+        std::vector<S64ChunkMesh> meshes(origins.size());
+
+        tf::Taskflow taskflow;
+        taskflow.for_each_index(
+            usize(0), origins.size(), usize(1),
+            [&](usize i)
+            {
+                S64Mesher& mesher = meshers[executor.this_worker_id()];
+                mesher.mesh_chunk(tree, origins[i], meshes[i]);
+            });
+        executor.run(taskflow).wait();
+
+        std::erase_if(meshes, [](const S64ChunkMesh& m) { return m.vertices.empty(); });
+        return meshes;
+    }
+} // namespace v
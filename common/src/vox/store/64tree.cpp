@@ -2,42 +2,1723 @@
 // Created by niooi on 10/7/2025.
 //
 
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <immintrin.h>
+#include <stdexcept>
 #include <vox/store/64tree.h>
+#include <vox/store/64tree_file.h>
+#include <vox/store/64tree_journal.h>
+#include "taskflow/algorithm/for_each.hpp"
+#include "taskflow/taskflow.hpp"
 
 namespace v {
     using Type = S64Node::Type;
 
-    void Sparse64Tree::clear_node(S64Node_UP& node)
+    namespace {
+        /// How a node's region relates to the volume being filled
+        enum class Overlap : u8 {
+            /// the node is completely outside the volume
+            None,
+            /// the node straddles the surface of the volume
+            Partial,
+            /// the node is completely inside the volume
+            Contains
+        };
+
+        bool aabb_contains_aabb(const AABB& outer, const AABB& inner)
+        {
+            return outer.min.x <= inner.min.x && outer.max.x >= inner.max.x &&
+                outer.min.y <= inner.min.y && outer.max.y >= inner.max.y &&
+                outer.min.z <= inner.min.z && outer.max.z >= inner.max.z;
+        }
+
+        bool aabb_intersects_aabb(const AABB& a, const AABB& b)
+        {
+            return a.min.x < b.max.x && a.max.x > b.min.x && a.min.y < b.max.y &&
+                a.max.y > b.min.y && a.min.z < b.max.z && a.max.z > b.min.z;
+        }
+
+        bool aabb_inside_sphere(const AABB& box, const glm::vec3& center, f32 radius)
+        {
+            f32 r_sq = radius * radius;
+            for (u32 i = 0; i < 8; ++i)
+            {
+                glm::vec3 corner(
+                    (i & 1) ? box.max.x : box.min.x, (i & 2) ? box.max.y : box.min.y,
+                    (i & 4) ? box.max.z : box.min.z);
+                glm::vec3 diff = corner - center;
+                if (glm::dot(diff, diff) > r_sq)
+                    return false;
+            }
+            return true;
+        }
+
+        bool aabb_intersects_sphere(const AABB& box, const glm::vec3& center, f32 radius)
+        {
+            glm::vec3 closest = glm::clamp(center, box.min, box.max);
+            glm::vec3 diff    = center - closest;
+            return glm::dot(diff, diff) <= radius * radius;
+        }
+
+        bool aabb_inside_cylinder(
+            const AABB& box, const glm::vec3& p0, f32 radius, const glm::vec3& axis,
+            f32 length)
+        {
+            f32 r_sq = radius * radius;
+            for (u32 i = 0; i < 8; ++i)
+            {
+                glm::vec3 corner(
+                    (i & 1) ? box.max.x : box.min.x, (i & 2) ? box.max.y : box.min.y,
+                    (i & 4) ? box.max.z : box.min.z);
+                glm::vec3 to_corner = corner - p0;
+                f32       t         = glm::dot(to_corner, axis);
+                if (t < 0.0f || t > length)
+                    return false;
+                glm::vec3 closest = p0 + axis * t;
+                glm::vec3 diff    = corner - closest;
+                if (glm::dot(diff, diff) > r_sq)
+                    return false;
+            }
+            return true;
+        }
+
+        /// Conservative: tests the box's bounding sphere against the capsule around the
+        /// cylinder's axis segment. May report boxes that only graze the end caps, which
+        /// the per voxel test in brick_mask() resolves exactly.
+        bool aabb_intersects_cylinder(
+            const AABB& box, const glm::vec3& p0, f32 radius, const glm::vec3& axis,
+            f32 length)
+        {
+            glm::vec3 center      = (box.min + box.max) * 0.5f;
+            f32       half_diag   = glm::length(box.max - box.min) * 0.5f;
+            f32       t           = glm::clamp(glm::dot(center - p0, axis), 0.0f, length);
+            glm::vec3 diff        = center - (p0 + axis * t);
+            f32       reach       = radius + half_diag;
+            return glm::dot(diff, diff) <= reach * reach;
+        }
+
+#ifdef __AVX2__
+        // The brick kernels evaluate 8 voxels per pass. Pass k covers brick indices
+        // 8k..8k+7, so with idx = x | z << 2 | y << 4 a lane holds x = lane & 3 and
+        // z = (k & 1) * 2 + (lane >> 2), while y = k >> 1 is the same for all lanes.
+
+        /// x offset of each lane
+        FORCEINLINE __m256 lane_x() { return _mm256_setr_ps(0, 1, 2, 3, 0, 1, 2, 3); }
+
+        /// z offset of each lane, for even passes
+        FORCEINLINE __m256 lane_z() { return _mm256_setr_ps(0, 0, 0, 0, 1, 1, 1, 1); }
+
+        /// Bit mask of the lanes that are set in cmp
+        FORCEINLINE u64 lane_bits(__m256 cmp)
+        {
+            return static_cast<u32>(_mm256_movemask_ps(cmp));
+        }
+#endif
+
+        /// Returns which of the 4 voxels starting at pos lie in [lo, hi) along an axis
+        FORCEINLINE u32 axis_bits(u32 pos, f32 lo, f32 hi)
+        {
+            u32 bits = 0;
+            for (u32 i = 0; i < 4; ++i)
+            {
+                const f32 p = static_cast<f32>(pos + i);
+                bits |= static_cast<u32>(p >= lo && p < hi) << i;
+            }
+            return bits;
+        }
+
+        /// Moves bit i of bits (4 bits) to bit i * stride
+        FORCEINLINE u64 spread_bits(u32 bits, u32 stride)
+        {
+            u64 spread = 0;
+            for (u32 i = 0; i < 4; ++i)
+                spread |= static_cast<u64>((bits >> i) & 1) << (i * stride);
+            return spread;
+        }
+
+        // Shapes for fill_recursive. overlap() classifies a node's bounds, brick_mask()
+        // returns which voxels of the leaf brick at pos are covered by the shape.
+
+        struct AabbShape {
+            AABB region;
+
+            FORCEINLINE Overlap overlap(const AABB& box) const
+            {
+                if (!aabb_intersects_aabb(box, region))
+                    return Overlap::None;
+                if (aabb_contains_aabb(region, box))
+                    return Overlap::Contains;
+                return Overlap::Partial;
+            }
+
+            u64 brick_mask(const glm::uvec3& pos) const
+            {
+                // the box is separable: a voxel is inside if it is inside along each
+                // axis, so only 12 voxel coordinates need testing
+                const u32 x = axis_bits(pos.x, region.min.x, region.max.x);
+                const u32 y = axis_bits(pos.y, region.min.y, region.max.y);
+                const u32 z = axis_bits(pos.z, region.min.z, region.max.z);
+
+                // replicate the x row into every selected z row (4 bits apart), then
+                // the xz slice into every selected y slice (16 bits apart). no carries,
+                // since every row or slice fits in its own bits
+                const u64 xz = x * spread_bits(z, 4);
+                return xz * spread_bits(y, 16);
+            }
+        };
+
+        struct SphereShape {
+            glm::vec3 center;
+            f32       radius;
+
+            FORCEINLINE Overlap overlap(const AABB& box) const
+            {
+                if (!aabb_intersects_sphere(box, center, radius))
+                    return Overlap::None;
+                if (aabb_inside_sphere(box, center, radius))
+                    return Overlap::Contains;
+                return Overlap::Partial;
+            }
+
+            u64 brick_mask(const glm::uvec3& pos) const
+            {
+                // center of the brick's first voxel, exact for any coordinate below 2^22
+                const glm::vec3 first = glm::vec3(pos) + glm::vec3(0.5f);
+                const f32       r_sq  = radius * radius;
+#ifdef __AVX2__
+                auto offset = [](__m256 lanes, f32 voxel, f32 origin)
+                {
+                    return _mm256_sub_ps(
+                        _mm256_add_ps(lanes, _mm256_set1_ps(voxel)),
+                        _mm256_set1_ps(origin));
+                };
+                const __m256 dx    = offset(lane_x(), first.x, center.x);
+                const __m256 dz    = offset(lane_z(), first.z, center.z);
+                const __m256 dz_hi = offset(lane_z(), first.z + 2.0f, center.z);
+                const __m256 dx_sq = _mm256_mul_ps(dx, dx);
+                // x^2 + z^2 for even and odd passes
+                const __m256 xz[2] = {
+                    _mm256_add_ps(dx_sq, _mm256_mul_ps(dz, dz)),
+                    _mm256_add_ps(dx_sq, _mm256_mul_ps(dz_hi, dz_hi)),
+                };
+                const __m256 limit = _mm256_set1_ps(r_sq);
+
+                u64 mask = 0;
+                for (u32 y = 0; y < 4; ++y)
+                {
+                    const f32    dy    = first.y + static_cast<f32>(y) - center.y;
+                    const __m256 dy_sq = _mm256_set1_ps(dy * dy);
+                    for (u32 half = 0; half < 2; ++half)
+                    {
+                        const __m256 d_sq = _mm256_add_ps(xz[half], dy_sq);
+                        mask |= lane_bits(_mm256_cmp_ps(d_sq, limit, _CMP_LE_OQ))
+                            << ((y * 2 + half) * 8);
+                    }
+                }
+                return mask;
+#else
+                u64 mask = 0;
+                for (u32 x = 0; x < 4; ++x)
+                    for (u32 y = 0; y < 4; ++y)
+                        for (u32 z = 0; z < 4; ++z)
+                        {
+                            glm::vec3 diff = first + glm::vec3(x, y, z) - center;
+                            if (glm::dot(diff, diff) <= r_sq)
+                                mask |= 1ull << S64Node::get_idx(x, y, z);
+                        }
+                return mask;
+#endif
+            }
+        };
+
+        struct CylinderShape {
+            glm::vec3 p0;
+            glm::vec3 axis;
+            f32       radius;
+            f32       length;
+
+            FORCEINLINE Overlap overlap(const AABB& box) const
+            {
+                if (!aabb_intersects_cylinder(box, p0, radius, axis, length))
+                    return Overlap::None;
+                if (aabb_inside_cylinder(box, p0, radius, axis, length))
+                    return Overlap::Contains;
+                return Overlap::Partial;
+            }
+
+            u64 brick_mask(const glm::uvec3& pos) const
+            {
+                // center of the brick's first voxel, exact for any coordinate below 2^22
+                const glm::vec3 first = glm::vec3(pos) + glm::vec3(0.5f);
+                const f32       r_sq  = radius * radius;
+#ifdef __AVX2__
+                auto offset = [](__m256 lanes, f32 voxel, f32 origin)
+                {
+                    return _mm256_sub_ps(
+                        _mm256_add_ps(lanes, _mm256_set1_ps(voxel)),
+                        _mm256_set1_ps(origin));
+                };
+                // voxel centers relative to p0
+                const __m256 ax    = _mm256_set1_ps(axis.x);
+                const __m256 ay    = _mm256_set1_ps(axis.y);
+                const __m256 az    = _mm256_set1_ps(axis.z);
+                const __m256 wx    = offset(lane_x(), first.x, p0.x);
+                const __m256 wz[2] = { offset(lane_z(), first.z, p0.z),
+                                       offset(lane_z(), first.z + 2.0f, p0.z) };
+                // the part of the projection onto the axis that doesn't depend on y
+                const __m256 t_xz[2] = {
+                    _mm256_add_ps(_mm256_mul_ps(wx, ax), _mm256_mul_ps(wz[0], az)),
+                    _mm256_add_ps(_mm256_mul_ps(wx, ax), _mm256_mul_ps(wz[1], az))
+                };
+                const __m256 zero  = _mm256_setzero_ps();
+                const __m256 len   = _mm256_set1_ps(length);
+                const __m256 limit = _mm256_set1_ps(r_sq);
+
+                u64 mask = 0;
+                for (u32 y = 0; y < 4; ++y)
+                {
+                    const __m256 wy =
+                        _mm256_set1_ps(first.y + static_cast<f32>(y) - p0.y);
+                    for (u32 half = 0; half < 2; ++half)
+                    {
+                        const __m256 t =
+                            _mm256_add_ps(t_xz[half], _mm256_mul_ps(wy, ay));
+                        const __m256 dx = _mm256_sub_ps(wx, _mm256_mul_ps(ax, t));
+                        const __m256 dy = _mm256_sub_ps(wy, _mm256_mul_ps(ay, t));
+                        const __m256 dz = _mm256_sub_ps(wz[half], _mm256_mul_ps(az, t));
+                        const __m256 d_sq = _mm256_add_ps(
+                            _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)),
+                            _mm256_mul_ps(dz, dz));
+
+                        __m256 in = _mm256_cmp_ps(d_sq, limit, _CMP_LE_OQ);
+                        in = _mm256_and_ps(in, _mm256_cmp_ps(t, zero, _CMP_GE_OQ));
+                        in = _mm256_and_ps(in, _mm256_cmp_ps(t, len, _CMP_LE_OQ));
+                        mask |= lane_bits(in) << ((y * 2 + half) * 8);
+                    }
+                }
+                return mask;
+#else
+                u64 mask = 0;
+                for (u32 x = 0; x < 4; ++x)
+                    for (u32 y = 0; y < 4; ++y)
+                        for (u32 z = 0; z < 4; ++z)
+                        {
+                            glm::vec3 to_voxel = first + glm::vec3(x, y, z) - p0;
+                            f32       t        = glm::dot(to_voxel, axis);
+                            if (t < 0.0f || t > length)
+                                continue;
+                            glm::vec3 diff = to_voxel - axis * t;
+                            if (glm::dot(diff, diff) <= r_sq)
+                                mask |= 1ull << S64Node::get_idx(x, y, z);
+                        }
+                return mask;
+#endif
+            }
+        };
+
+        struct SdfShape {
+            const S64Sdf& sdf;
+
+            FORCEINLINE Overlap overlap(const AABB& box) const
+            {
+                // the voxel centers of the box all lie within reach of its center, so
+                // the distance there can only move by lipschitz * reach across them
+                const glm::vec3 center = (box.min + box.max) * 0.5f;
+                const f32       reach  = glm::length(box.max - box.min - 1.0f) * 0.5f;
+                f32             d;
+                sdf.eval(sdf.ctx, &center, &d, 1);
+
+                const f32 bound = sdf.lipschitz * reach;
+                if (d > bound)
+                    return Overlap::None;
+                if (d <= -bound)
+                    return Overlap::Contains;
+                return Overlap::Partial;
+            }
+
+            u64 brick_mask(const glm::uvec3& pos) const
+            {
+                // voxel centers in brick order, evaluated in one batch
+                const glm::vec3          first = glm::vec3(pos) + glm::vec3(0.5f);
+                std::array<glm::vec3, 64> points;
+                for (u32 i = 0; i < 64; ++i)
+                    points[i] = first + glm::vec3(i & 3, i >> 4, (i >> 2) & 3);
+
+                alignas(32) std::array<f32, 64> d;
+                sdf.eval(sdf.ctx, points.data(), d.data(), 64);
+
+                u64 mask = 0;
+#ifdef __AVX2__
+                const __m256 zero = _mm256_setzero_ps();
+                for (u32 k = 0; k < 8; ++k)
+                {
+                    const __m256 in =
+                        _mm256_cmp_ps(_mm256_load_ps(d.data() + k * 8), zero, _CMP_LE_OQ);
+                    mask |= lane_bits(in) << (k * 8);
+                }
+#else
+                for (u32 i = 0; i < 64; ++i)
+                    mask |= static_cast<u64>(d[i] <= 0.0f) << i;
+#endif
+                return mask;
+            }
+        };
+
+        /// Stable LSD radix sort of items by the key_bits bits starting at bit lo.
+        void radix_sort(std::vector<u64>& items, u32 lo, u32 key_bits)
+        {
+            constexpr u32 digit_bits = 12;
+            constexpr u32 buckets    = 1u << digit_bits;
+            const u32     passes     = (key_bits + digit_bits - 1) / digit_bits;
+            auto          digit      = [&](u64 item, u32 pass)
+            { return (item >> (lo + pass * digit_bits)) & (buckets - 1); };
+
+            // histograms of every digit in one go
+            std::vector<usize> offsets(passes * buckets);
+            for (u64 item : items)
+                for (u32 p = 0; p < passes; ++p)
+                    ++offsets[p * buckets + digit(item, p)];
+
+            std::vector<u64> scratch;
+            for (u32 p = 0; p < passes; ++p)
+            {
+                usize* o = offsets.data() + p * buckets;
+                // every item has the same digit, the pass wouldn't move anything
+                if (o[digit(items[0], p)] == items.size())
+                    continue;
+
+                usize sum = 0;
+                for (u32 b = 0; b < buckets; ++b)
+                    sum += std::exchange(o[b], sum);
+
+                scratch.resize(items.size());
+                for (u64 item : items)
+                    scratch[o[digit(item, p)]++] = item;
+                items.swap(scratch);
+            }
+        }
+
+        /// Returns the child indices taken on the way down to pos, 6 bits per level
+        /// with the leaf level in the lowest bits.
+        FORCEINLINE u64 path_key(const glm::uvec3& pos, u8 levels)
+        {
+#ifdef __BMI2__
+            // spreads the 2 bits per level of each axis into their slot of the index
+            // x | z << 2 | y << 4
+            constexpr u64 lanes = 0x30C30C30C30C3ull;
+            (void)levels;
+            return _pdep_u64(pos.x, lanes) | _pdep_u64(pos.z, lanes << 2) |
+                _pdep_u64(pos.y, lanes << 4);
+#else
+            u64 key = 0;
+            for (u32 l = 0; l < levels; ++l)
+            {
+                const u32 s = l * 2;
+                key |= static_cast<u64>(S64Node::get_idx(
+                           (pos.x >> s) & 3, (pos.y >> s) & 3, (pos.z >> s) & 3))
+                    << (l * 6);
+            }
+            return key;
+#endif
+        }
+
+        usize count_nodes(const S64Node& node)
+        {
+            if (node.type != Type::Regular)
+                return 1;
+            usize c = 1;
+            for (u32 i = 0, n = POPCOUNT64(node.child_mask); i < n; ++i)
+                c += count_nodes(node.children[i]);
+            return c;
+        }
+
+        /// Sizes of the flattened range of a subtree
+        struct FlatSize {
+            /// nodes below the subtree's root
+            u32 nodes = 0;
+            /// bricks in the subtree, including the root's
+            u32 bricks = 0;
+        };
+
+        void measure_subtree(const S64Node& node, FlatSize& size)
+        {
+            if (node.type == Type::Leaf)
+                ++size.bricks;
+            if (node.type != Type::Regular)
+                return;
+
+            const u32 count = POPCOUNT64(node.child_mask);
+            size.nodes += count;
+            for (u32 i = 0; i < count; ++i)
+                measure_subtree(node.children[i], size);
+        }
+
+        /// Writes a single node, reserving the ranges for its children or brick.
+        void write_flat_node(
+            const S64Node& node, GS64Node& out, u32& next_node, u32& next_brick,
+            VoxelType* bricks)
+        {
+            out.child_mask  = 0;
+            out.first_child = 0;
+            out.payload     = static_cast<u32>(node.type);
+            switch (node.type)
+            {
+            case Type::Regular:
+                out.child_mask  = node.child_mask;
+                out.first_child = next_node;
+                next_node += POPCOUNT64(node.child_mask);
+                break;
+            case Type::Leaf:
+                out.child_mask  = node.child_mask;
+                out.first_child = next_brick;
+                std::memcpy(bricks + next_brick * 64ull, node.voxels, 64);
+                ++next_brick;
+                break;
+            case Type::SingleTypeLeaf:
+                out.payload |= static_cast<u32>(node.voxels[0]) << 8;
+                break;
+            case Type::Empty:
+                break;
+            }
+        }
+
+        /// Flattens the subtree under top (already placed at nodes[top_idx]) breadth
+        /// first into the ranges starting at next_node and next_brick.
+        void flatten_subtree(
+            const S64Node& top, u32 top_idx, u32 next_node, u32 next_brick,
+            GS64Node* nodes, VoxelType* bricks)
+        {
+            // nodes are written in the order their slots were reserved, so the queue
+            // holds the cpu nodes of nodes[top_idx], nodes[first], nodes[first + 1]...
+            std::vector<const S64Node*> queue{ &top };
+            const u32                   first = next_node;
+            for (usize q = 0; q < queue.size(); ++q)
+            {
+                const S64Node& node = *queue[q];
+                const u32      idx  = q == 0 ? top_idx : first + static_cast<u32>(q - 1);
+                write_flat_node(node, nodes[idx], next_node, next_brick, bricks);
+
+                if (node.type == Type::Regular)
+                {
+                    for (u32 i = 0, n = POPCOUNT64(node.child_mask); i < n; ++i)
+                        queue.push_back(&node.children[i]);
+                }
+            }
+        }
+
+        /// A ray prepared for traversal. dir is normalized, so t is a distance
+        struct RayState {
+            glm::vec3  origin;
+            glm::vec3  dir;
+            glm::vec3  inv_dir;
+            glm::ivec3 step;
+            f32        max_t;
+        };
+
+        FORCEINLINE RayState
+        make_ray(const glm::vec3& origin, glm::vec3 dir, f32 max_dist)
+        {
+            dir /= glm::length(dir);
+
+            RayState ray{ origin, dir, {}, {}, max_dist };
+            for (i32 a = 0; a < 3; ++a)
+            {
+                ray.step[a] = dir[a] < 0.f ? -1 : 1;
+                // -ffast-math assumes no infinities, so axis aligned rays get a huge but
+                // finite inverse instead
+                ray.inv_dir[a] = std::fabs(dir[a]) > 1e-20f
+                    ? 1.f / dir[a]
+                    : static_cast<f32>(ray.step[a]) * 1e30f;
+            }
+            return ray;
+        }
+
+        /// Intersects the ray with the box [lo, hi), clipped to [0, max_t].
+        /// Returns false on a miss. axis is the axis of the face the ray entered
+        /// through, or -1 if the ray starts inside the box.
+        FORCEINLINE bool ray_box(
+            const RayState& ray, const glm::vec3& lo, const glm::vec3& hi, f32& t_enter,
+            f32& t_exit, i32& axis)
+        {
+            const glm::vec3 t0 = (lo - ray.origin) * ray.inv_dir;
+            const glm::vec3 t1 = (hi - ray.origin) * ray.inv_dir;
+            const glm::vec3 t_near = glm::min(t0, t1);
+            const glm::vec3 t_far  = glm::max(t0, t1);
+
+            axis = t_near.x > t_near.y ? (t_near.x > t_near.z ? 0 : 2)
+                                       : (t_near.y > t_near.z ? 1 : 2);
+            t_enter = t_near[axis];
+            t_exit  = std::min(std::min(t_far.x, t_far.y), std::min(t_far.z, ray.max_t));
+            if (t_enter <= 0.f)
+            {
+                t_enter = 0.f;
+                axis    = -1;
+            }
+            return t_enter <= t_exit;
+        }
+
+        FORCEINLINE glm::ivec3 entry_normal(const RayState& ray, i32 axis)
+        {
+            glm::ivec3 normal(0);
+            if (axis >= 0)
+                normal[axis] = -ray.step[axis];
+            return normal;
+        }
+
+        /// Fills in a hit on the cell [cell_min, cell_min + cell_size) at distance t
+        FORCEINLINE void make_hit(
+            const RayState& ray, f32 t, const glm::uvec3& cell_min, u32 cell_size,
+            const glm::ivec3& normal, VoxelType type, S64RayHit& hit)
+        {
+            hit.pos    = ray.origin + ray.dir * t;
+            hit.normal = normal;
+            hit.dist   = t;
+            hit.type   = type;
+            if (cell_size == 1)
+            {
+                hit.voxel = cell_min;
+                return;
+            }
+
+            // a large cell was entered, the voxel is the one under the entry point.
+            // the point lies on the cell's boundary, so keep it inside the cell
+            const glm::ivec3 lo(cell_min);
+            const glm::ivec3 hi = lo + glm::ivec3(static_cast<i32>(cell_size) - 1);
+            hit.voxel = glm::uvec3(glm::clamp(glm::ivec3(glm::floor(hit.pos)), lo, hi));
+        }
+
+        /// DDA over the 4x4x4 cells of a node
+        struct CellWalk {
+            glm::ivec3 cell;
+            /// t at which the ray crosses into the next cell along each axis
+            glm::vec3 t_max;
+            glm::vec3 t_delta;
+
+            CellWalk(
+                const RayState& ray, const glm::uvec3& node_pos, u8 shift_amt,
+                f32 t_enter)
+            {
+                const f32       size = static_cast<f32>(1u << shift_amt);
+                const glm::vec3 local =
+                    ray.origin + ray.dir * t_enter - glm::vec3(node_pos);
+                cell = glm::clamp(glm::ivec3(glm::floor(local / size)), 0, 3);
+
+                for (i32 a = 0; a < 3; ++a)
+                {
+                    const f32 bound = static_cast<f32>(node_pos[a]) +
+                        static_cast<f32>(cell[a] + (ray.step[a] > 0)) * size;
+                    t_max[a]   = (bound - ray.origin[a]) * ray.inv_dir[a];
+                    t_delta[a] = size * std::fabs(ray.inv_dir[a]);
+                }
+            }
+
+            FORCEINLINE u32 idx() const
+            {
+                return S64Node::get_idx(cell.x, cell.y, cell.z);
+            }
+
+            /// The axis along which the ray leaves the current cell
+            FORCEINLINE i32 next_axis() const
+            {
+                return t_max.x < t_max.y ? (t_max.x < t_max.z ? 0 : 2)
+                                         : (t_max.y < t_max.z ? 1 : 2);
+            }
+
+            /// Moves into the next cell along axis. Returns false if that leaves the node
+            FORCEINLINE bool step(const RayState& ray, i32 axis)
+            {
+                cell[axis] += ray.step[axis];
+                t_max[axis] += t_delta[axis];
+                return cell[axis] >= 0 && cell[axis] <= 3;
+            }
+        };
+
+        /// Walks the 4x4x4 cells of node front to back, between t_enter (where the ray
+        /// entered the node through the face with normal normal) and t_exit.
+        /// Recurses into the children that exist.
+        bool raycast_node(
+            const S64Node& node, const glm::uvec3& node_pos, u8 shift_amt,
+            const RayState& ray, f32 t_enter, f32 t_exit, glm::ivec3 normal,
+            S64RayHit& hit)
+        {
+            if (node.type == Type::SingleTypeLeaf)
+            {
+                make_hit(
+                    ray, t_enter, node_pos, 1u << (shift_amt + 2), normal, node.voxels[0],
+                    hit);
+                return true;
+            }
+
+            const u32 cell_size = 1u << shift_amt;
+            CellWalk  walk(ray, node_pos, shift_amt, t_enter);
+            f32       t = t_enter;
+            while (true)
+            {
+                const u32        idx  = walk.idx();
+                const i32        axis = walk.next_axis();
+                const glm::uvec3 cell_pos = node_pos + glm::uvec3(walk.cell) * cell_size;
+
+                if (node.type == Type::Leaf)
+                {
+                    if (node.voxels[idx] != 0)
+                    {
+                        make_hit(
+                            ray, t, cell_pos, cell_size, normal, node.voxels[idx], hit);
+                        return true;
+                    }
+                }
+                else if (node.has_child(idx) &&
+                         raycast_node(
+                             node.child(idx), cell_pos, shift_amt - 2, ray, t,
+                             std::min(walk.t_max[axis], t_exit), normal, hit))
+                    return true;
+
+                if (walk.t_max[axis] >= t_exit)
+                    return false;
+
+                t            = std::max(t, walk.t_max[axis]);
+                normal       = glm::ivec3(0);
+                normal[axis] = -ray.step[axis];
+                if (!walk.step(ray, axis))
+                    return false;
+            }
+        }
+
+#ifdef __AVX2__
+        /// Up to 8 rays traced together. All of them point into the same octant
+        struct RayPacket {
+            const RayState* rays[8];
+            S64RayHit*      hits[8];
+            /// Step direction along each axis, shared by every ray of the packet
+            glm::ivec3 step;
+            /// idx ^ flip visits the children of a node in front to back order for
+            /// every ray of the packet
+            u32 flip;
+            /// The rays again, one per lane
+            __m256 origin[3];
+            __m256 dir[3];
+            __m256 inv_dir[3];
+            __m256 max_t;
+        };
+
+        /// Where each ray of a packet enters and leaves a node
+        struct PacketSpan {
+            alignas(32) f32 t_enter[8];
+            alignas(32) f32 t_exit[8];
+            alignas(32) i32 axis[8];
+        };
+
+        /// Sets up a packet from its first n rays
+        void load_packet(RayPacket& packet, u32 n)
+        {
+            for (u32 r = n; r < 8; ++r)
+                packet.rays[r] = packet.rays[0];
+
+            const glm::ivec3& step = packet.rays[0]->step;
+            packet.step            = step;
+            packet.flip = (step.x < 0 ? 3u : 0u) | (step.z < 0 ? 3u << 2 : 0u) |
+                (step.y < 0 ? 3u << 4 : 0u);
+
+            alignas(32) f32 lanes[10][8];
+            for (u32 r = 0; r < 8; ++r)
+            {
+                const RayState& ray = *packet.rays[r];
+                for (i32 a = 0; a < 3; ++a)
+                {
+                    lanes[a][r]     = ray.origin[a];
+                    lanes[3 + a][r] = ray.dir[a];
+                    lanes[6 + a][r] = ray.inv_dir[a];
+                }
+                lanes[9][r] = ray.max_t;
+            }
+            for (i32 a = 0; a < 3; ++a)
+            {
+                packet.origin[a]  = _mm256_load_ps(lanes[a]);
+                packet.dir[a]     = _mm256_load_ps(lanes[3 + a]);
+                packet.inv_dir[a] = _mm256_load_ps(lanes[6 + a]);
+            }
+            packet.max_t = _mm256_load_ps(lanes[9]);
+        }
+
+        /// Intersects the active rays of the packet with the box [lo, hi), like
+        /// ray_box. Returns the rays that hit it.
+        u32 packet_box(
+            const RayPacket& packet, const glm::vec3& lo, const glm::vec3& hi, u32 active,
+            PacketSpan& span)
+        {
+            __m256 t_near[3], t_far[3];
+            for (i32 a = 0; a < 3; ++a)
+            {
+                const __m256 t0 = _mm256_mul_ps(
+                    _mm256_sub_ps(_mm256_set1_ps(lo[a]), packet.origin[a]),
+                    packet.inv_dir[a]);
+                const __m256 t1 = _mm256_mul_ps(
+                    _mm256_sub_ps(_mm256_set1_ps(hi[a]), packet.origin[a]),
+                    packet.inv_dir[a]);
+                t_near[a] = _mm256_min_ps(t0, t1);
+                t_far[a]  = _mm256_max_ps(t0, t1);
+            }
+
+            // same axis choice as ray_box
+            const __m256 x_gt_y = _mm256_cmp_ps(t_near[0], t_near[1], _CMP_GT_OQ);
+            const __m256 x_gt_z = _mm256_cmp_ps(t_near[0], t_near[2], _CMP_GT_OQ);
+            const __m256 y_gt_z = _mm256_cmp_ps(t_near[1], t_near[2], _CMP_GT_OQ);
+            const __m256 is_x   = _mm256_and_ps(x_gt_y, x_gt_z);
+            const __m256 is_y   = _mm256_andnot_ps(x_gt_y, y_gt_z);
+
+            __m256 t_enter =
+                _mm256_max_ps(_mm256_max_ps(t_near[0], t_near[1]), t_near[2]);
+            const __m256 t_exit = _mm256_min_ps(
+                _mm256_min_ps(t_far[0], t_far[1]), _mm256_min_ps(t_far[2], packet.max_t));
+
+            __m256i axis = _mm256_set1_epi32(2);
+            axis         = _mm256_blendv_epi8(
+                axis, _mm256_set1_epi32(1), _mm256_castps_si256(is_y));
+            axis = _mm256_blendv_epi8(
+                axis, _mm256_setzero_si256(), _mm256_castps_si256(is_x));
+
+            const __m256 inside = _mm256_cmp_ps(t_enter, _mm256_setzero_ps(), _CMP_LE_OQ);
+            t_enter             = _mm256_andnot_ps(inside, t_enter);
+            axis                = _mm256_or_si256(axis, _mm256_castps_si256(inside));
+
+            _mm256_store_ps(span.t_enter, t_enter);
+            _mm256_store_ps(span.t_exit, t_exit);
+            _mm256_store_si256(reinterpret_cast<__m256i*>(span.axis), axis);
+            return active &
+                static_cast<u32>(
+                       _mm256_movemask_ps(_mm256_cmp_ps(t_enter, t_exit, _CMP_LE_OQ)));
+        }
+
+        /// Returns the cells of the node (as masks of child indices) each active ray of
+        /// the packet passes through, walking them like CellWalk does
+        void packet_cells(
+            const RayPacket& packet, const glm::uvec3& node_pos, u8 shift_amt, u32 active,
+            const PacketSpan& span, u64 (&cells)[8])
+        {
+            const f32    size     = static_cast<f32>(1u << shift_amt);
+            const __m256 v_size   = _mm256_set1_ps(size);
+            const __m256 inv_size = _mm256_set1_ps(1.f / size);
+            const __m256 t_enter  = _mm256_load_ps(span.t_enter);
+            const __m256 t_exit   = _mm256_load_ps(span.t_exit);
+            const __m256 abs_mask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+
+            // every lane runs the DDA of CellWalk, for as long as any is still inside
+            __m256i cell[3], step[3];
+            __m256  t_max[3], t_delta[3];
+            for (i32 a = 0; a < 3; ++a)
+            {
+                const __m256 node_min = _mm256_set1_ps(static_cast<f32>(node_pos[a]));
+                const __m256 local    = _mm256_sub_ps(
+                    _mm256_fmadd_ps(packet.dir[a], t_enter, packet.origin[a]), node_min);
+                cell[a] = _mm256_cvttps_epi32(
+                    _mm256_floor_ps(_mm256_mul_ps(local, inv_size)));
+                cell[a] = _mm256_max_epi32(
+                    _mm256_min_epi32(cell[a], _mm256_set1_epi32(3)),
+                    _mm256_setzero_si256());
+                step[a] = _mm256_set1_epi32(packet.step[a]);
+
+                const __m256i far_side = _mm256_add_epi32(
+                    cell[a], _mm256_set1_epi32(packet.step[a] > 0 ? 1 : 0));
+                const __m256 bound =
+                    _mm256_fmadd_ps(_mm256_cvtepi32_ps(far_side), v_size, node_min);
+                t_max[a] = _mm256_mul_ps(
+                    _mm256_sub_ps(bound, packet.origin[a]), packet.inv_dir[a]);
+                t_delta[a] =
+                    _mm256_mul_ps(v_size, _mm256_and_ps(packet.inv_dir[a], abs_mask));
+            }
+
+            const __m256i lane_bit = _mm256_setr_epi32(1, 2, 4, 8, 16, 32, 64, 128);
+            __m256i       live     = _mm256_cmpeq_epi32(
+                _mm256_and_si256(_mm256_set1_epi32(static_cast<i32>(active)), lane_bit),
+                lane_bit);
+            const __m256i one = _mm256_set1_epi32(1);
+            __m256i       lo  = _mm256_setzero_si256();
+            __m256i       hi  = _mm256_setzero_si256();
+            while (!_mm256_testz_si256(live, live))
+            {
+                const __m256i idx = _mm256_or_si256(
+                    _mm256_or_si256(cell[0], _mm256_slli_epi32(cell[2], 2)),
+                    _mm256_slli_epi32(cell[1], 4));
+                // shifts of 32 or more (and negative ones) give zero
+                const __m256i idx_hi = _mm256_sub_epi32(idx, _mm256_set1_epi32(32));
+                lo = _mm256_or_si256(
+                    lo, _mm256_and_si256(_mm256_sllv_epi32(one, idx), live));
+                hi = _mm256_or_si256(
+                    hi, _mm256_and_si256(_mm256_sllv_epi32(one, idx_hi), live));
+
+                const __m256 x_lt_y = _mm256_cmp_ps(t_max[0], t_max[1], _CMP_LT_OQ);
+                const __m256 x_lt_z = _mm256_cmp_ps(t_max[0], t_max[2], _CMP_LT_OQ);
+                const __m256 y_lt_z = _mm256_cmp_ps(t_max[1], t_max[2], _CMP_LT_OQ);
+                __m256       along[3];
+                along[0] = _mm256_and_ps(x_lt_y, x_lt_z);
+                along[1] = _mm256_andnot_ps(x_lt_y, y_lt_z);
+                along[2] = _mm256_andnot_ps(_mm256_or_ps(along[0], along[1]), abs_mask);
+                along[2] = _mm256_cmp_ps(along[2], _mm256_setzero_ps(), _CMP_NEQ_UQ);
+
+                const __m256 t_next = _mm256_blendv_ps(
+                    _mm256_blendv_ps(t_max[2], t_max[1], along[1]), t_max[0], along[0]);
+                live = _mm256_andnot_si256(
+                    _mm256_castps_si256(_mm256_cmp_ps(t_next, t_exit, _CMP_GE_OQ)), live);
+
+                for (i32 a = 0; a < 3; ++a)
+                {
+                    const __m256i moved = _mm256_castps_si256(along[a]);
+                    cell[a] =
+                        _mm256_add_epi32(cell[a], _mm256_and_si256(step[a], moved));
+                    t_max[a] =
+                        _mm256_add_ps(t_max[a], _mm256_and_ps(t_delta[a], along[a]));
+
+                    const __m256i outside = _mm256_or_si256(
+                        _mm256_cmpgt_epi32(cell[a], _mm256_set1_epi32(3)),
+                        _mm256_cmpgt_epi32(_mm256_setzero_si256(), cell[a]));
+                    live = _mm256_andnot_si256(outside, live);
+                }
+            }
+
+            alignas(32) u32 lo_bits[8], hi_bits[8];
+            _mm256_store_si256(reinterpret_cast<__m256i*>(lo_bits), lo);
+            _mm256_store_si256(reinterpret_cast<__m256i*>(hi_bits), hi);
+            for (u32 r = 0; r < 8; ++r)
+                cells[r] = lo_bits[r] | static_cast<u64>(hi_bits[r]) << 32;
+        }
+
+        /// Moves bit idx of mask to bit idx ^ flip
+        FORCEINLINE u64 flip_bits(u64 mask, u32 flip)
+        {
+            constexpr u64 lower[6] = { 0x5555555555555555ull, 0x3333333333333333ull,
+                                       0x0f0f0f0f0f0f0f0full, 0x00ff00ff00ff00ffull,
+                                       0x0000ffff0000ffffull, 0x00000000ffffffffull };
+            for (u32 k = 0; k < 6; ++k)
+                if (flip & (1u << k))
+                {
+                    const u32 width = 1u << k;
+                    mask = (mask & lower[k]) << width | ((mask >> width) & lower[k]);
+                }
+            return mask;
+        }
+
+        /// Traces the active rays of the packet through node. Returns the rays that hit
+        /// something.
+        u32 raycast_packet(
+            const S64Node& node, const glm::uvec3& node_pos, u8 shift_amt,
+            const RayPacket& packet, u32 active)
+        {
+            const glm::vec3 lo(node_pos);
+            const glm::vec3 hi = lo + glm::vec3(static_cast<f32>(1u << (shift_amt + 2)));
+
+            PacketSpan span;
+            active = packet_box(packet, lo, hi, active, span);
+            if (!active)
+                return 0;
+
+            u32 hit = 0;
+            if (node.type != Type::Regular)
+            {
+                // SingleTypeLeaf stops every ray, bricks are walked ray by ray
+                for (u32 m = active; m; m &= m - 1)
+                {
+                    const u32       r   = CTZ(m);
+                    const RayState& ray = *packet.rays[r];
+                    if (raycast_node(
+                            node, node_pos, shift_amt, ray, span.t_enter[r],
+                            span.t_exit[r], entry_normal(ray, span.axis[r]),
+                            *packet.hits[r]))
+                        hit |= 1u << r;
+                }
+                return hit;
+            }
+
+            // only the children some ray of the packet passes through get visited, by
+            // the rays that pass through them
+            u64 cells[8];
+            packet_cells(packet, node_pos, shift_amt, active, span, cells);
+
+            u8  child_rays[64];
+            u64 visit = 0;
+            for (u32 m = active; m; m &= m - 1)
+            {
+                const u32 r     = CTZ(m);
+                const u64 touch = cells[r] & node.child_mask;
+                for (u64 c = touch & ~visit; c; c &= c - 1)
+                    child_rays[CTZ64(c)] = 0;
+                for (u64 c = touch; c; c &= c - 1)
+                    child_rays[CTZ64(c)] |= static_cast<u8>(1u << r);
+                visit |= touch;
+            }
+
+            // ascending flipped index is a valid front to back order for every ray: a
+            // ray only ever moves to cells with larger flipped coordinates
+            const u32 child_size = 1u << shift_amt;
+            for (u64 m = flip_bits(visit, packet.flip); m && active; m &= m - 1)
+            {
+                const u32 idx          = static_cast<u32>(CTZ64(m)) ^ packet.flip;
+                const u32 child_active = child_rays[idx] & active;
+                if (!child_active)
+                    continue;
+
+                const glm::uvec3 child_pos =
+                    node_pos + glm::uvec3(idx & 3, idx >> 4, (idx >> 2) & 3) * child_size;
+                const u32 child_hit = raycast_packet(
+                    node.child(idx), child_pos, shift_amt - 2, packet, child_active);
+                hit |= child_hit;
+                active &= ~child_hit;
+            }
+            return hit;
+        }
+#endif
+
+        /// A dense box of voxels, laid out like extract_region's output
+        struct DenseRegion {
+            VoxelType* data;
+            glm::ivec3 min;
+            glm::ivec3 max;
+            /// distance between consecutive z rows and y layers
+            usize z_stride;
+            usize y_stride;
+
+            FORCEINLINE VoxelType* at(i32 x, i32 y, i32 z) const
+            {
+                return data + (x - min.x) + (z - min.z) * z_stride +
+                    (y - min.y) * y_stride;
+            }
+
+            /// Sets the voxels of [lo, hi) (already clipped to the region) to type
+            void fill(const glm::ivec3& lo, const glm::ivec3& hi, VoxelType type) const
+            {
+                const usize width = static_cast<usize>(hi.x - lo.x);
+                for (i32 y = lo.y; y < hi.y; ++y)
+                    for (i32 z = lo.z; z < hi.z; ++z)
+                        std::memset(at(lo.x, y, z), type, width);
+            }
+        };
+
+        /// Writes the non air parts of node into the region. The region was cleared
+        /// to air beforehand, so Empty nodes and missing children are skipped.
+        void extract_recursive(
+            const S64Node& node, const glm::ivec3& node_pos, u8 shift_amt,
+            const DenseRegion& region)
+        {
+            const i32        node_size = 1 << (shift_amt + 2);
+            const glm::ivec3 lo        = glm::max(node_pos, region.min);
+            const glm::ivec3 hi        = glm::min(node_pos + node_size, region.max);
+            if (lo.x >= hi.x || lo.y >= hi.y || lo.z >= hi.z)
+                return;
+
+            const i32 cell_size = 1 << shift_amt;
+            switch (node.type)
+            {
+            case Type::SingleTypeLeaf:
+                region.fill(lo, hi, node.voxels[0]);
+                return;
+            case Type::Leaf:
+                if (cell_size == 1)
+                {
+                    // a row of the brick is 4 consecutive voxels along x
+                    const glm::ivec3 b0    = lo - node_pos;
+                    const usize      width = static_cast<usize>(hi.x - lo.x);
+                    for (i32 y = lo.y; y < hi.y; ++y)
+                        for (i32 z = lo.z; z < hi.z; ++z)
+                            std::memcpy(
+                                region.at(lo.x, y, z),
+                                &node.voxels[S64Node::get_idx(
+                                    b0.x, y - node_pos.y, z - node_pos.z)],
+                                width);
+                    return;
+                }
+                break;
+            case Type::Empty:
+                return;
+            default:
+                break;
+            }
+
+            // the children (or the cells of a leaf above the bottom level) that overlap
+            // the region
+            const glm::ivec3 c0 = (lo - node_pos) / cell_size;
+            const glm::ivec3 c1 = (hi - node_pos + cell_size - 1) / cell_size;
+            for (i32 y = c0.y; y < c1.y; ++y)
+                for (i32 z = c0.z; z < c1.z; ++z)
+                    for (i32 x = c0.x; x < c1.x; ++x)
+                    {
+                        const u32        idx = S64Node::get_idx(x, y, z);
+                        const glm::ivec3 cell_pos =
+                            node_pos + glm::ivec3(x, y, z) * cell_size;
+
+                        if (node.type == Type::Leaf)
+                        {
+                            if (node.voxels[idx] != 0)
+                                region.fill(
+                                    glm::max(cell_pos, lo),
+                                    glm::min(cell_pos + cell_size, hi), node.voxels[idx]);
+                        }
+                        else if (node.has_child(idx))
+                            extract_recursive(
+                                node.child(idx), cell_pos, shift_amt - 2, region);
+                    }
+        }
+
+        /// Sums up how much of a node each type covers, over its children or the
+        /// voxels of its brick (at most 64 different types either way)
+        struct LodTally {
+            std::array<VoxelType, 64> types;
+            std::array<u32, 64>       weights;
+            u32                       count = 0;
+            u32                       best  = 0;
+
+            FORCEINLINE void add(VoxelType type, u32 weight)
+            {
+                u32 i = 0;
+                while (i < count && types[i] != type)
+                    ++i;
+                if (i == count)
+                {
+                    types[count]     = type;
+                    weights[count++] = 0;
+                }
+
+                weights[i] += weight;
+                if (weights[i] > weights[best])
+                    best = i;
+            }
+
+            FORCEINLINE VoxelType type() const { return count ? types[best] : 0; }
+        };
+
+        /// Stands in for a missing child when diffing against a snapshot. Newer than
+        /// any edit, so it's never skipped as unchanged
+        const S64Node k_air = []
+        {
+            S64Node node{};
+            node.epoch = std::numeric_limits<u32>::max();
+            return node;
+        }();
+
+        /// Returns voxel idx of a leaf level node
+        FORCEINLINE VoxelType brick_voxel(const S64Node& node, u32 idx)
+        {
+            if (node.type == Type::Leaf)
+                return node.voxels[idx];
+            return node.type == Type::SingleTypeLeaf ? node.voxels[0] : 0;
+        }
+    } // namespace
+
+    S64NodePool::S64NodePool(S64NodePool&& o) noexcept :
+        slabs_(std::move(o.slabs_)), slab_used_(std::exchange(o.slab_used_, slab_nodes)),
+        free_(std::exchange(o.free_, {})),
+        slots_in_use_(std::exchange(o.slots_in_use_, 0))
+    {}
+
+    S64NodePool& S64NodePool::operator=(S64NodePool&& o) noexcept
+    {
+        if (this != &o)
+        {
+            slabs_        = std::move(o.slabs_);
+            slab_used_    = std::exchange(o.slab_used_, slab_nodes);
+            free_         = std::exchange(o.free_, {});
+            slots_in_use_ = std::exchange(o.slots_in_use_, 0);
+        }
+        return *this;
+    }
+
+    S64Node* S64NodePool::alloc(u8 cap)
     {
-        u64 m = node->child_mask;
+        const u32 n = 1u << cap;
+        slots_in_use_ += n;
+
+        // reuse the smallest free block that fits, handing the unused halves of a
+        // larger one back to the smaller free lists
+        for (u8 c = cap; c < size_classes; ++c)
+        {
+            S64Node* block = free_[c];
+            if (!block)
+                continue;
+
+            free_[c] = block->children;
+            for (; c > cap; --c)
+            {
+                S64Node* half   = block + (1u << (c - 1));
+                half->children  = free_[c - 1];
+                free_[c - 1]    = half;
+            }
+            std::fill_n(block, n, S64Node{});
+            return block;
+        }
+
+        if (slab_used_ + n > slab_nodes)
+        {
+            retire_tail();
+            slabs_.push_back(std::make_unique<S64Node[]>(slab_nodes));
+            slab_used_ = 0;
+        }
+
+        S64Node* block = slabs_.back().get() + slab_used_;
+        slab_used_ += n;
+        return block;
+    }
+
+    void S64NodePool::retire_tail()
+    {
+        u32 rest = slab_nodes - slab_used_;
+        while (rest)
+        {
+            const u8 c      = std::min<u8>(31 - CLZ(rest), size_classes - 1);
+            S64Node* block  = slabs_.back().get() + slab_used_;
+            block->children = free_[c];
+            free_[c]        = block;
+            slab_used_ += 1u << c;
+            rest -= 1u << c;
+        }
+    }
+
+    void S64NodePool::absorb(S64NodePool&& other)
+    {
+        // other may hold no slabs of its own but still have blocks of ours on its
+        // free lists, so there is no early out here
+
+        // the other pool's slabs go in front, so the bump allocation from our current
+        // slab carries on unaffected
+        other.retire_tail();
+        slabs_.insert(
+            slabs_.begin(), std::make_move_iterator(other.slabs_.begin()),
+            std::make_move_iterator(other.slabs_.end()));
+
+        for (u32 c = 0; c < size_classes; ++c)
+        {
+            S64Node* head = std::exchange(other.free_[c], nullptr);
+            while (head)
+            {
+                S64Node* next  = head->children;
+                head->children = free_[c];
+                free_[c]       = head;
+                head           = next;
+            }
+        }
+
+        slots_in_use_ += std::exchange(other.slots_in_use_, 0);
+        other.slabs_.clear();
+        other.slab_used_ = slab_nodes;
+    }
+
+    void S64NodePool::free(S64Node* block, u8 cap)
+    {
+        slots_in_use_ -= 1u << cap;
+        block->children = free_[cap];
+        free_[cap]      = block;
+    }
+
+    void S64NodePool::reset()
+    {
+        slabs_.clear();
+        slab_used_    = slab_nodes;
+        free_         = {};
+        slots_in_use_ = 0;
+    }
+
+    Sparse64Tree::Sparse64Tree(Sparse64Tree&& o) noexcept :
+        pool_(std::move(o.pool_)), root_(std::exchange(o.root_, {})), bounds_(o.bounds_),
+        depth_(o.depth_), epoch_(o.epoch_), flat_epoch_(o.flat_epoch_),
+        g_nodes_(std::move(o.g_nodes_)), g_bricks_(std::move(o.g_bricks_)),
+        type_counts_(std::exchange(o.type_counts_, {})), collapses_(o.collapses_),
+        expansions_(o.expansions_), lod_tracking_(o.lod_tracking_),
+        lod_epoch_(o.lod_epoch_), snapshots_(std::move(o.snapshots_)),
+        frozen_epoch_(std::exchange(o.frozen_epoch_, 0)),
+        retired_(std::move(o.retired_)), retired_pools_(std::move(o.retired_pools_)),
+        journal_(std::exchange(o.journal_, nullptr))
+    {}
+
+    Sparse64Tree::Sparse64Tree(const S64TreeView& view) : Sparse64Tree(view.depth())
+    {
+        // everything in the loaded tree is new
+        ++epoch_;
+        load_node(root_, view, 0);
+    }
+
+    void Sparse64Tree::load_node(S64Node& node, const S64TreeView& view, u32 idx)
+    {
+        const GS64Node& flat = view.nodes()[idx];
+        const auto      type = static_cast<Type>(flat.payload & 0xff);
+
+        ++type_counts_[static_cast<u8>(type)];
+        node.type  = type;
+        node.epoch = epoch_;
+        switch (type)
+        {
+        case Type::Regular:
+            {
+                const u32 count = POPCOUNT64(flat.child_mask);
+                const u8  cap   = count <= 1 ? 0 : static_cast<u8>(32 - CLZ(count - 1));
+                node.child_mask  = flat.child_mask;
+                node.children    = pool_.alloc(cap);
+                node.child_cap   = cap;
+                node.erase_epoch = epoch_;
+                node.block_epoch = epoch_;
+                for (u32 i = 0; i < count; ++i)
+                    load_node(node.children[i], view, flat.first_child + i);
+                break;
+            }
+        case Type::Leaf:
+            node.child_mask = flat.child_mask;
+            std::memcpy(
+                node.voxels, view.bricks().data() + flat.first_child * 64ull,
+                sizeof(node.voxels));
+            break;
+        case Type::SingleTypeLeaf:
+            node.child_mask = 0b1;
+            node.voxels[0]  = static_cast<VoxelType>(flat.payload >> 8);
+            break;
+        case Type::Empty:
+            break;
+        }
+    }
+
+    template <typename Edit, typename Put>
+    void Sparse64Tree::journaled(S64JournalOp op, Edit&& edit, Put&& put)
+    {
+        S64Journal& journal = *std::exchange(journal_, nullptr);
+        const Snapshot before = snapshot();
+        const u32      since  = epoch_;
+        edit();
+        journal_ = &journal;
+
+        const usize entry = journal.begin_entry(op);
+        put(journal);
+        write_changes(op, *before, since);
+        journal.end_entry(entry);
+    }
+
+    void Sparse64Tree::write_changes(
+        S64JournalOp op, const Sparse64Tree& before, u32 since)
+    {
+        const u8 shift_amt = init_shift_amt();
+        if (op == S64JournalOp::Restore)
+        {
+            const usize size = journal_->begin_size();
+            journal_->begin_records();
+            write_diff(root_, before.root_, true, glm::uvec3(0), shift_amt, since);
+            journal_->end_size(size);
+        }
+
+        journal_->begin_records();
+        write_diff(before.root_, root_, false, glm::uvec3(0), shift_amt, since);
+    }
+
+    void Sparse64Tree::write_diff(
+        const S64Node& want, const S64Node& have, bool want_current,
+        const glm::uvec3& pos, u8 shift_amt, u32 since) const
+    {
+        // blocks still shared with the snapshot, or nodes no edit touched
+        if (&want == &have || (want_current ? want : have).epoch <= since)
+            return;
+
+        const bool want_uniform = want.type != Type::Regular && want.type != Type::Leaf;
+        const bool have_uniform = have.type != Type::Regular && have.type != Type::Leaf;
+        if (want_uniform && have_uniform && brick_voxel(want, 0) == brick_voxel(have, 0))
+            return;
+
+        if (shift_amt == 0)
+        {
+            std::array<VoxelType, 64> voxels;
+            u64                       mask = 0;
+            for (u32 i = 0; i < 64; ++i)
+            {
+                voxels[i] = brick_voxel(want, i);
+                if (voxels[i] != brick_voxel(have, i))
+                    mask |= 1ull << i;
+            }
+            if (mask)
+                journal_->put_brick(pos, mask, voxels.data());
+            return;
+        }
+
+        if (want_uniform)
+        {
+            journal_->put_run(pos, shift_amt, brick_voxel(want, 0));
+            return;
+        }
+
+        // a uniform have stands in for each of its children
+        u64 cells = want.child_mask;
+        if (have.type == Type::Regular)
+            cells |= have.child_mask;
+        else if (have.type == Type::SingleTypeLeaf)
+            cells = ~0ull;
+
+        const u32 child_size = 1u << shift_amt;
+        for (u64 m = cells; m; m &= m - 1)
+        {
+            const u32      idx = CTZ64(m);
+            const S64Node& w   = want.has_child(idx) ? want.child(idx) : k_air;
+            const S64Node& h   = have.type != Type::Regular ? have
+                  : have.has_child(idx)                     ? have.child(idx)
+                                                            : k_air;
+            write_diff(
+                w, h, want_current,
+                pos + glm::uvec3(idx & 3, idx >> 4, (idx >> 2) & 3) * child_size,
+                shift_amt - 2, since);
+        }
+    }
+
+    void Sparse64Tree::clear()
+    {
+        if (journal_)
+            return journaled(S64JournalOp::Clear, [&] { clear(); }, [](S64Journal&) {});
+
+        retire_pool();
+        root_       = {};
+        root_.epoch = ++epoch_;
+        type_counts_.fill(0);
+    }
+
+    void Sparse64Tree::clone_node(S64Node& node, const S64Node& src)
+    {
+        ++type_counts_[static_cast<u8>(src.type)];
+        node.type       = src.type;
+        node.child_mask = src.child_mask;
+        node.epoch      = epoch_;
+        if (src.type != Type::Regular)
+        {
+            std::memcpy(node.voxels, src.voxels, sizeof(node.voxels));
+            return;
+        }
+
+        const u32 count  = POPCOUNT64(src.child_mask);
+        const u8  cap    = count <= 1 ? 0 : static_cast<u8>(32 - CLZ(count - 1));
+        node.children    = pool_.alloc(cap);
+        node.child_cap   = cap;
+        node.erase_epoch = epoch_;
+        node.block_epoch = epoch_;
+        for (u32 i = 0; i < count; ++i)
+        {
+            node.children[i] = {};
+            clone_node(node.children[i], src.children[i]);
+        }
+    }
+
+    Sparse64Tree& Sparse64Tree::operator=(Sparse64Tree&& o) noexcept
+    {
+        if (this != &o)
+        {
+            pool_          = std::move(o.pool_);
+            root_          = std::exchange(o.root_, {});
+            bounds_        = o.bounds_;
+            depth_         = o.depth_;
+            epoch_         = o.epoch_;
+            flat_epoch_    = o.flat_epoch_;
+            g_nodes_       = std::move(o.g_nodes_);
+            g_bricks_      = std::move(o.g_bricks_);
+            type_counts_   = std::exchange(o.type_counts_, {});
+            collapses_     = o.collapses_;
+            expansions_    = o.expansions_;
+            lod_tracking_  = o.lod_tracking_;
+            lod_epoch_     = o.lod_epoch_;
+            snapshots_     = std::move(o.snapshots_);
+            frozen_epoch_  = std::exchange(o.frozen_epoch_, 0);
+            retired_       = std::move(o.retired_);
+            retired_pools_ = std::move(o.retired_pools_);
+            journal_       = std::exchange(o.journal_, nullptr);
+        }
+        return *this;
+    }
+
+    void Sparse64Tree::clear_node(S64Node& node)
+    {
+        release_children(node);
+
+        --type_counts_[static_cast<u8>(node.type)];
+        node       = {};
+        node.epoch = epoch_;
+    }
+
+    void Sparse64Tree::release_children(const S64Node& node)
+    {
+        if (node.type != Type::Regular || !node.children)
+            return;
+
+        for (u32 i = 0, n = POPCOUNT64(node.child_mask); i < n; ++i)
+        {
+            release_children(node.children[i]);
+            --type_counts_[static_cast<u8>(node.children[i].type)];
+        }
+
+        free_block(node.children, node.child_cap, node.block_epoch);
+    }
+
+    void Sparse64Tree::make_writable(S64Node& node)
+    {
+        if (node.type != Type::Regular || !node.children ||
+            node.block_epoch > frozen_epoch_)
+            return;
+
+        // the copies still point at the shared grandchildren, which get copied in turn
+        // only if the edit goes down to them
+        S64Node* block = pool_.alloc(node.child_cap);
+        std::copy_n(node.children, POPCOUNT64(node.child_mask), block);
+        free_block(node.children, node.child_cap, node.block_epoch);
+        node.children    = block;
+        node.block_epoch = epoch_;
+    }
+
+    Sparse64Tree::Snapshot Sparse64Tree::snapshot()
+    {
+        collect_snapshots();
+
+        // a tree without a pool of its own, reading the blocks of this one
+        auto snap          = std::make_shared<Sparse64Tree>(depth_);
+        snap->root_        = root_;
+        snap->epoch_       = epoch_;
+        snap->type_counts_ = type_counts_;
+        snap->collapses_   = collapses_;
+        snap->expansions_  = expansions_;
+        // the nodes carry their LOD along
+        snap->lod_tracking_ = lod_tracking_;
+
+        frozen_epoch_ = epoch_;
+        snapshots_.push_back(snap);
+        return snap;
+    }
+
+    void Sparse64Tree::collect_snapshots()
+    {
+        if (snapshots_.empty())
+            return;
+
+        u32 oldest = std::numeric_limits<u32>::max();
+        u32 newest = 0;
+        std::erase_if(
+            snapshots_,
+            [&](const std::weak_ptr<const Sparse64Tree>& weak)
+            {
+                const Snapshot snap = weak.lock();
+                if (!snap)
+                    return true;
+                oldest = std::min(oldest, snap->epoch_);
+                newest = std::max(newest, snap->epoch_);
+                return false;
+            });
+
+        frozen_epoch_ = newest;
+
+        // a snapshot only reads blocks that were dropped after it was taken
+        usize released = 0;
+        while (released < retired_.size() && retired_[released].epoch < oldest)
+        {
+            pool_.free(retired_[released].block, retired_[released].cap);
+            ++released;
+        }
+        retired_.erase(retired_.begin(), retired_.begin() + released);
+
+        std::erase_if(
+            retired_pools_, [&](const RetiredPool& p) { return p.epoch < oldest; });
+    }
+
+    void Sparse64Tree::retire_pool()
+    {
+        collect_snapshots();
+        if (snapshots_.empty())
+        {
+            pool_.reset();
+            return;
+        }
+
+        // the retired blocks live in the pool's slabs, and go away along with them
+        retired_pools_.push_back({ std::move(pool_), epoch_ });
+        retired_.clear();
+    }
+
+    void Sparse64Tree::repack_node(S64Node& node, S64NodePool& pool, u32 epoch)
+    {
+        if (node.type != Type::Regular || !node.children)
+            return;
+
+        const u32 count = POPCOUNT64(node.child_mask);
+        const u8  cap   = count <= 1 ? 0 : static_cast<u8>(32 - CLZ(count - 1));
+        S64Node*  block = pool.alloc(cap);
+        std::copy_n(node.children, count, block);
+        for (u32 i = 0; i < count; ++i)
+            repack_node(block[i], pool, epoch);
+
+        node.children    = block;
+        node.child_cap   = cap;
+        node.block_epoch = epoch;
+    }
+
+    void Sparse64Tree::compact()
+    {
+        // the old slabs stay alive until every node has been copied out of them
+        S64NodePool pool;
+        repack_node(root_, pool, epoch_);
+        retire_pool();
+        pool_ = std::move(pool);
+    }
+
+    void Sparse64Tree::fill_node(S64Node& node, VoxelType t)
+    {
+        // destroy all children and current voxel info
+        clear_node(node);
+
+        set_type(node, Type::SingleTypeLeaf);
+        node.voxels[0]  = t;
+        node.child_mask = 0b1;
+    }
+
+    void Sparse64Tree::expand_node(S64Node& node, u8 shift_amt)
+    {
+        const VoxelType t = node.voxels[0];
+        ++expansions_;
+
+        if (shift_amt == 0)
+        {
+            set_type(node, Type::Leaf);
+            std::memset(node.voxels, t, sizeof(node.voxels));
+            node.child_mask = ~0ull;
+            return;
+        }
+
+        // the children hold exactly what the node did, so their contents changed when
+        // the node's did
+        S64Node* block = pool_.alloc(6);
+        for (u32 i = 0; i < 64; ++i)
+        {
+            block[i].type       = Type::SingleTypeLeaf;
+            block[i].voxels[0]  = t;
+            block[i].child_mask = 0b1;
+            block[i].epoch      = node.epoch;
+        }
+
+        type_counts_[static_cast<u8>(Type::SingleTypeLeaf)] += 64;
+        set_type(node, Type::Regular);
+        node.children    = block;
+        node.child_cap   = 6;
+        node.erase_epoch = node.epoch;
+        node.block_epoch = epoch_;
+        node.child_mask  = ~0ull;
+    }
+
+    void Sparse64Tree::make_regular(S64Node& node)
+    {
+        set_type(node, Type::Regular);
+        node.children  = nullptr;
+        node.child_cap = 0;
+        // whatever the node held before it emptied is gone
+        node.erase_epoch = node.epoch;
+    }
+
+    S64Node& Sparse64Tree::insert_child(S64Node& node, u32 idx)
+    {
+        const u32 count = POPCOUNT64(node.child_mask);
+        const u32 slot  = node.child_slot(idx);
+
+        const bool full = count == (1u << node.child_cap);
+        if (!node.children || full || node.block_epoch <= frozen_epoch_)
+        {
+            // block is full (or shared with a snapshot), move everything over to one
+            // twice the size
+            const u8 cap   = !node.children ? 0 : node.child_cap + full;
+            S64Node* block = pool_.alloc(cap);
+            if (node.children)
+            {
+                std::copy_n(node.children, slot, block);
+                std::copy_n(node.children + slot, count - slot, block + slot + 1);
+                free_block(node.children, node.child_cap, node.block_epoch);
+            }
+            node.children    = block;
+            node.child_cap   = cap;
+            node.block_epoch = epoch_;
+        }
+        else
+        {
+            std::copy_backward(
+                node.children + slot, node.children + count, node.children + count + 1);
+        }
+
+        node.child_mask |= 1ull << idx;
+        node.children[slot] = {};
+        return node.children[slot];
+    }
+
+    void Sparse64Tree::erase_child(S64Node& node, u32 idx)
+    {
+        make_writable(node);
+
+        const u32 count = POPCOUNT64(node.child_mask);
+        const u32 slot  = node.child_slot(idx);
 
-        for (auto i : node->child_indices())
+        clear_node(node.children[slot]);
+        std::copy(node.children + slot + 1, node.children + count, node.children + slot);
+        node.child_mask &= ~(1ull << idx);
+        node.erase_epoch = epoch_;
+
+        if (!node.child_mask)
         {
-            clear_node(node->children[i]);
+            free_block(node.children, node.child_cap, node.block_epoch);
+            node.children  = nullptr;
+            node.child_cap = 0;
         }
-
-        node.reset();
     }
 
-    void Sparse64Tree::fill_node(S64Node_UP& node, VoxelType t)
+    bool Sparse64Tree::write_brick(S64Node& node, u64 mask, VoxelType type)
     {
-        node->type = Type::SingleTypeLeaf;
+        if (!mask)
+            return false;
+
+        if (type == 0)
+        {
+            if (node.type == Type::Empty)
+                return false;
+            if (node.type == Type::SingleTypeLeaf)
+                expand_node(node, 0);
+            else if (!(node.child_mask & mask))
+                return false;
+
+            node.child_mask &= ~mask;
+            for (u64 m = mask; m; m &= m - 1)
+                node.voxels[CTZ64(m)] = 0;
+
+            if (!node.child_mask)
+                clear_node(node);
+            node.epoch = epoch_;
+            return true;
+        }
 
-        // destroy all children
-        std::vector<S64Node_UP>().swap(node->children);
+        if (node.type == Type::SingleTypeLeaf)
+        {
+            if (node.voxels[0] == type)
+                return false;
+            expand_node(node, 0);
+        }
+        else if (node.type == Type::Empty)
+        {
+            set_type(node, Type::Leaf);
+            std::memset(node.voxels, 0, sizeof(node.voxels));
+            node.child_mask = 0;
+        }
+        else
+        {
+            bool changed = (node.child_mask & mask) != mask;
+            for (u64 m = mask; m && !changed; m &= m - 1)
+                changed = node.voxels[CTZ64(m)] != type;
+            if (!changed)
+                return false;
+        }
 
-        // destroy all current voxel info
-        node->voxels = { t };
+        for (u64 m = mask; m; m &= m - 1)
+            node.voxels[CTZ64(m)] = type;
+        node.child_mask |= mask;
+        node.epoch = epoch_;
 
-        node->child_mask = 0b1;
+        try_collapse(node);
+        return true;
     }
 
     VoxelType Sparse64Tree::voxel_at(const glm::vec3& pos) const
     {
-        if (!root_)
+        if (root_.type == Type::Empty)
             return 0;
 
-        S64Node_P curr = root_.get();
+        const S64Node* curr = &root_;
         // all fields of max are the same, and max.x y or z contains the per-axis extent
         // of our tree along each axis.
         //
@@ -50,7 +1731,7 @@ namespace v {
         // == 16. then shift_amt -= 2, so on the next iteration we divide by 16, and then
         // mod 16. when shift_amt == 0, we are on a leaf, if the tree is not malformed.
         // then u_pos / (1 << 0) is a no-op.
-        u8         shift_amt = CTZ(static_cast<u32>(bounds_.max.x) >> 2);
+        u8         shift_amt = init_shift_amt();
         glm::uvec3 u_pos{ pos };
 
         // TODO! assert any component of pos is not >= the extent.
@@ -61,8 +1742,8 @@ namespace v {
         {
             // TODO! just use the lowest 3 bits?? or am i stupid
             // is that the same as shifting and doing trhis every time
-            u8 idx = static_cast<u8>(curr->get_idx(
-                u_pos.x >> shift_amt, u_pos.y >> shift_amt, u_pos.z >> shift_amt));
+            u32 idx = S64Node::get_idx(
+                u_pos.x >> shift_amt, u_pos.y >> shift_amt, u_pos.z >> shift_amt);
 
             switch (curr->type)
             {
@@ -70,14 +1751,19 @@ namespace v {
                 return curr->voxels[0];
             case Type::Leaf:
                 return curr->voxels[idx];
+            case Type::Empty:
+                return 0;
             default:
+                break;
             }
 
-            if ((curr->child_mask & (1ull << idx)) == 0)
+            if (!curr->has_child(idx))
                 // child don't exist. kill (implicit air, or whatever 0 means)
                 return 0;
 
-            curr = curr->children[idx].get();
+            // the child lives in the packed block, at the number of existing children
+            // before it
+            curr = &curr->child(idx);
 
             // transform the coordinates into local coordinates for the next node
 
@@ -97,6 +1783,107 @@ namespace v {
         return 0;
     }
 
+    S64LodSample Sparse64Tree::voxel_at_lod(const glm::uvec3& pos, u32 level) const
+    {
+        const u32 extent = static_cast<u32>(bounds_.max.x);
+        if (pos.x >= extent || pos.y >= extent || pos.z >= extent)
+            return {};
+
+        // nodes at depth d of the tree span 4^(depth_ - d) voxels
+        const u32      stop  = level >= depth_ ? 0 : depth_ - level;
+        const S64Node* node  = &root_;
+        u32            depth = 0;
+        u8             shift = init_shift_amt();
+        for (; depth < stop; ++depth, shift -= 2)
+        {
+            const u32 idx = S64Node::get_idx(
+                (pos.x >> shift) & 3, (pos.y >> shift) & 3, (pos.z >> shift) & 3);
+            if (node->type == Type::Leaf)
+            {
+                // only a single voxel is smaller than a brick
+                if (!node->has_child(idx))
+                    return {};
+                return { node->voxels[idx], 1.f };
+            }
+            if (node->type != Type::Regular)
+                break;
+            if (!node->has_child(idx))
+                return {};
+            node = &node->child(idx);
+        }
+
+        const auto [type, coverage] = node_lod(*node);
+        return { type, static_cast<f32>(coverage) / S64Node::k_full_coverage };
+    }
+
+    void Sparse64Tree::set_lod_tracking(bool enabled)
+    {
+        if (enabled && !lod_tracking_ && root_.type == Type::Regular)
+        {
+            // the nodes were left alone while nothing tracked them. refreshed children
+            // are read back on the way up
+            lod_tracking_ = true;
+            refresh_lod(root_, true);
+        }
+        lod_tracking_ = enabled;
+        lod_epoch_    = epoch_;
+    }
+
+    std::pair<VoxelType, u32> Sparse64Tree::node_lod(const S64Node& node) const
+    {
+        constexpr u32 voxel_coverage = S64Node::k_full_coverage / 64;
+
+        switch (node.type)
+        {
+        case Type::SingleTypeLeaf:
+            return { node.voxels[0], S64Node::k_full_coverage };
+        case Type::Leaf:
+            {
+                LodTally tally;
+                for (u64 m = node.child_mask; m; m &= m - 1)
+                    tally.add(node.voxels[CTZ64(m)], voxel_coverage);
+                return { tally.type(), POPCOUNT64(node.child_mask) * voxel_coverage };
+            }
+        case Type::Regular:
+            {
+                if (lod_tracking_)
+                    return { node.lod_type, node.lod_coverage };
+
+                LodTally tally;
+                u32      coverage = 0;
+                for (u32 i = 0, n = POPCOUNT64(node.child_mask); i < n; ++i)
+                {
+                    const auto [child_type, child_coverage] = node_lod(node.children[i]);
+                    tally.add(child_type, child_coverage);
+                    coverage += child_coverage;
+                }
+                return { tally.type(), coverage / 64 };
+            }
+        default:
+            return { 0, 0 };
+        }
+    }
+
+    void Sparse64Tree::refresh_lod(S64Node& node, bool all)
+    {
+        LodTally tally;
+        u32      coverage = 0;
+        for (u32 i = 0, n = POPCOUNT64(node.child_mask); i < n; ++i)
+        {
+            S64Node& child = node.children[i];
+            if (child.type == Type::Regular && (all || child.epoch > lod_epoch_))
+                refresh_lod(child, all);
+
+            // the children are up to date now, so they can be read back while tracking
+            const auto [child_type, child_coverage] = node_lod(child);
+            tally.add(child_type, child_coverage);
+            coverage += child_coverage;
+        }
+
+        node.lod_type     = tally.type();
+        node.lod_coverage = static_cast<u16>(coverage / 64);
+    }
+
     VoxelType Sparse64Tree::get_voxel(u32 x, u32 y, u32 z) const
     {
         return voxel_at(glm::vec3(x, y, z));
@@ -107,384 +1894,752 @@ namespace v {
         return voxel_at(glm::vec3(pos));
     }
 
-    bool Sparse64Tree::is_node_empty(const S64Node& node) const
+    std::optional<S64RayHit> Sparse64Tree::raycast(
+        const glm::vec3& origin, const glm::vec3& dir, f32 max_dist) const
     {
-        return node.child_mask == 0;
+        if (root_.type == Type::Empty || glm::dot(dir, dir) == 0.f)
+            return std::nullopt;
+
+        const RayState ray = make_ray(origin, dir, max_dist);
+        f32            t_enter, t_exit;
+        i32            axis;
+        if (!ray_box(ray, bounds_.min, bounds_.max, t_enter, t_exit, axis))
+            return std::nullopt;
+
+        S64RayHit hit;
+        if (!raycast_node(
+                root_, glm::uvec3(0), init_shift_amt(), ray, t_enter, t_exit,
+                entry_normal(ray, axis), hit))
+            return std::nullopt;
+
+        return hit;
     }
 
-    void Sparse64Tree::try_collapse_to_single_type(S64Node_UP& node)
+    void Sparse64Tree::raycast(
+        std::span<const S64Ray> rays, std::span<S64RayHit> hits) const
     {
-        if (node->type != Type::Leaf)
-            return;
+        for (usize i = 0; i < rays.size(); ++i)
+            hits[i] = {};
 
-        // if all 64 bits are not 1s
-        if (node->child_mask != ~(0ull))
+        if (root_.type == Type::Empty)
             return;
 
-        if (node->child_mask == 0)
+#ifdef __AVX2__
+        // bucket the rays by the octant they point into
+        std::vector<RayState> states(rays.size());
+        std::vector<u32>      order(rays.size());
+        u32                   offsets[9]{};
+        for (usize i = 0; i < rays.size(); ++i)
         {
-            node->type = Type::Empty;
-            return;
+            const S64Ray& r = rays[i];
+            if (glm::dot(r.dir, r.dir) == 0.f)
+                continue;
+
+            states[i] = make_ray(r.origin, r.dir, r.max_dist);
+            const glm::ivec3& step = states[i].step;
+            ++offsets[(step.x < 0) | (step.y < 0) << 1 | (step.z < 0) << 2];
         }
+        for (u32 o = 0, sum = 0; o < 9; ++o)
+            sum += std::exchange(offsets[o], sum);
+        for (usize i = 0; i < rays.size(); ++i)
+        {
+            if (glm::dot(rays[i].dir, rays[i].dir) == 0.f)
+                continue;
 
-        VoxelType first_type  = 0;
-        bool      found_first = false;
+            const glm::ivec3& step = states[i].step;
+            order[offsets[(step.x < 0) | (step.y < 0) << 1 | (step.z < 0) << 2]++] =
+                static_cast<u32>(i);
+        }
 
-        for (u32 i = 0; i < 64; ++i)
+        // offsets[o] now holds the end of octant o's range
+        RayPacket packet;
+        for (u32 o = 0, begin = 0; o < 8; begin = offsets[o++])
         {
-            if (node->child_mask & (1ull << i))
+            for (u32 first = begin; first < offsets[o]; first += 8)
             {
-                if (!found_first)
+                const u32 n = std::min(offsets[o] - first, 8u);
+                for (u32 r = 0; r < n; ++r)
                 {
-                    first_type  = node->voxels[i];
-                    found_first = true;
+                    packet.rays[r] = &states[order[first + r]];
+                    packet.hits[r] = &hits[order[first + r]];
                 }
-                else if (node->voxels[i] != first_type)
-                    return;
+                load_packet(packet, n);
+                raycast_packet(
+                    root_, glm::uvec3(0), init_shift_amt(), packet, (1u << n) - 1);
             }
         }
-
-        if (found_first)
-            fill_node(node, first_type);
+#else
+        // packets only pay for their bookkeeping with the vectorized cell walk
+        for (usize i = 0; i < rays.size(); ++i)
+        {
+            const auto hit = raycast(rays[i].origin, rays[i].dir, rays[i].max_dist);
+            if (hit)
+                hits[i] = *hit;
+        }
+#endif
     }
 
-    bool Sparse64Tree::should_collapse_regular(S64Node_UP& node)
+    void Sparse64Tree::extract_region(const AABB& region, std::span<VoxelType> out) const
     {
-        return node->type == Type::Regular && node->child_mask == 0;
+        const glm::ivec3 min(glm::floor(region.min));
+        const glm::ivec3 max(glm::ceil(region.max));
+        if (min.x >= max.x || min.y >= max.y || min.z >= max.z)
+            return;
+
+        const glm::uvec3 size(max - min);
+        const usize      volume = static_cast<usize>(size.x) * size.y * size.z;
+        if (out.size() < volume)
+        {
+            LOG_ERROR(
+                "extract_region: buffer holds {} voxels, need {}", out.size(), volume);
+            return;
+        }
+
+        std::memset(out.data(), 0, volume);
+        if (root_.type == Type::Empty)
+            return;
+
+        const DenseRegion dense{ out.data(), min, max, size.x,
+                                 static_cast<usize>(size.x) * size.z };
+        extract_recursive(root_, glm::ivec3(0), init_shift_amt(), dense);
     }
 
-    void Sparse64Tree::set_voxel(u32 x, u32 y, u32 z, VoxelType type)
+    Sparse64Tree::RunIterator::RunIterator(const Sparse64Tree& tree)
     {
-        glm::uvec3 u_pos(x, y, z);
-        u8         shift_amt = init_shift_amt();
+        const S64Node& root = tree.root_;
+        switch (root.type)
+        {
+        case Type::SingleTypeLeaf:
+            run_ = { glm::uvec3(0), 4u << tree.init_shift_amt(), root.voxels[0] };
+            return;
+        case Type::Empty:
+            return;
+        default:
+            break;
+        }
 
-        if (!root_)
+        stack_[0] = { &root, root.children, root.child_mask, glm::uvec3(0),
+                      tree.init_shift_amt() };
+        depth_    = 1;
+        advance();
+    }
+
+    void Sparse64Tree::RunIterator::advance()
+    {
+        while (depth_)
         {
-            if (type == 0)
+            Frame& frame = stack_[depth_ - 1];
+            if (!frame.remaining)
+            {
+                --depth_;
+                continue;
+            }
+
+            const u32 idx = static_cast<u32>(CTZ64(frame.remaining));
+            frame.remaining &= frame.remaining - 1;
+
+            const glm::uvec3 cell =
+                glm::uvec3(idx & 3, idx >> 4, (idx >> 2) & 3) << frame.shift_amt;
+            const glm::uvec3 cell_pos = frame.pos + cell;
+            const u32 cell_size = 1u << frame.shift_amt;
+
+            // leaf bricks only keep solid voxels in their mask
+            if (frame.node->type == Type::Leaf)
+            {
+                run_ = { cell_pos, cell_size, frame.node->voxels[idx] };
+                return;
+            }
+
+            const S64Node& child = *frame.next++;
+            switch (child.type)
+            {
+            case Type::SingleTypeLeaf:
+                run_ = { cell_pos, cell_size, child.voxels[0] };
                 return;
-            root_       = std::make_unique<S64Node>();
-            root_->type = Type::Regular;
-            root_->children.resize(64);
+            case Type::Regular:
+            case Type::Leaf:
+                stack_[depth_++] = {
+                    &child, child.type == Type::Regular ? child.children : nullptr,
+                    child.child_mask, cell_pos, static_cast<u8>(frame.shift_amt - 2)
+                };
+                break;
+            case Type::Empty:
+                break;
+            }
         }
 
-        S64Node_P              curr = root_.get();
-        std::vector<S64Node_P> path;
-        std::vector<u8>        indices;
+        run_ = {};
+    }
+
+    VoxelStoreStats Sparse64Tree::stats() const
+    {
+        VoxelStoreStats stats{};
+        stats.interior_nodes = type_counts_[static_cast<u8>(Type::Regular)];
+        stats.brick_nodes    = type_counts_[static_cast<u8>(Type::Leaf)];
+        stats.uniform_nodes  = type_counts_[static_cast<u8>(Type::SingleTypeLeaf)];
+        stats.brick_bytes    = stats.brick_nodes * sizeof(S64Node::voxels);
+
+        // every node but the root lives in a children block, whose unused slots are as
+        // much overhead as the pointer to it
+        const usize pooled  = stats.node_count() - (root_.type != Type::Empty);
+        stats.pointer_bytes = stats.interior_nodes * sizeof(S64Node*) +
+            (pool_.slots_in_use() - pooled) * sizeof(S64Node);
+
+        stats.reserved_bytes = memory_usage();
+        stats.collapses      = collapses_;
+        stats.expansions     = expansions_;
+        return stats;
+    }
 
-        while (1)
+    usize Sparse64Tree::node_count() const
+    {
+        if (root_.type == Type::Empty)
+            return 0;
+        return count_nodes(root_);
+    }
+
+    bool Sparse64Tree::is_node_empty(const S64Node& node) const
+    {
+        return node.child_mask == 0;
+    }
+
+    bool Sparse64Tree::try_collapse(S64Node& node)
+    {
+        switch (node.type)
         {
-            u8 idx = static_cast<u8>(curr->get_idx(
-                u_pos.x >> shift_amt, u_pos.y >> shift_amt, u_pos.z >> shift_amt));
+        case Type::Leaf:
+            {
+                // if all 64 bits are not 1s
+                if (node.child_mask != ~0ull)
+                    return false;
+
+                const VoxelType first_type = node.voxels[0];
+                for (u32 i = 1; i < 64; ++i)
+                {
+                    if (node.voxels[i] != first_type)
+                        return false;
+                }
 
-            if (shift_amt == 0)
+                fill_node(node, first_type);
+                ++collapses_;
+                return true;
+            }
+        case Type::Regular:
             {
-                switch (curr->type)
+                if (is_node_empty(node))
                 {
-                case Type::SingleTypeLeaf:
-                    {
-                        VoxelType existing = curr->voxels[0];
-                        if (type == existing)
-                            return;
+                    clear_node(node);
+                    return true;
+                }
 
-                        if (type == 0)
-                        {
-                            curr->type = Type::Leaf;
-                            curr->voxels.resize(64, existing);
-                            curr->child_mask  = ~0ull;
-                            curr->voxels[idx] = 0;
-                            curr->child_mask &= ~(1ull << idx);
-                        }
-                        else
-                        {
-                            curr->voxels.resize(64, existing);
-                            curr->voxels[idx] = type;
-                            curr->type        = Type::Leaf;
-                            curr->child_mask  = ~0ull;
-                        }
-                        break;
-                    }
-                case Type::Leaf:
-                    {
-                        VoxelType existing =
-                            (curr->child_mask & (1ull << idx)) ? curr->voxels[idx] : 0;
-                        if (existing == type)
-                            return;
+                if (node.child_mask != ~0ull)
+                    return false;
 
-                        if (type == 0)
-                        {
-                            curr->child_mask &= ~(1ull << idx);
-                            curr->voxels[idx] = 0;
-                        }
-                        else
-                        {
-                            curr->child_mask |= (1ull << idx);
-                            curr->voxels[idx] = type;
-                        }
-                        break;
-                    }
-                default:
-                    {
-                        if (type == 0)
-                            return;
-
-                        curr->type = Type::Leaf;
-                        curr->voxels.resize(64, 0);
-                        curr->voxels[idx] = type;
-                        curr->child_mask  = (1ull << idx);
-                        break;
-                    }
+                const VoxelType first_type = node.children[0].voxels[0];
+                for (u32 i = 0; i < 64; ++i)
+                {
+                    const S64Node& c = node.children[i];
+                    if (c.type != Type::SingleTypeLeaf || c.voxels[0] != first_type)
+                        return false;
                 }
 
-                break;
+                fill_node(node, first_type);
+                ++collapses_;
+                return true;
             }
+        default:
+            return false;
+        }
+    }
+
+    void Sparse64Tree::set_voxel(u32 x, u32 y, u32 z, VoxelType type)
+    {
+        std::array<S64Node*, 16> path;
+        path[0] = &root_;
+        write_voxel(path.data(), 0, glm::uvec3(x, y, z), type);
+    }
+
+    u32 Sparse64Tree::write_voxel(
+        S64Node** path, u32 start, const glm::uvec3& pos, VoxelType type)
+    {
+        if (path[start]->type == Type::Empty && type == 0)
+            return start;
+
+        if (journal_)
+        {
+            const VoxelType old = get_voxel(pos.x, pos.y, pos.z);
+            if (old != type)
+                journal_->record_point(pos, type, old);
+        }
+
+        collect_snapshots();
+        ++epoch_;
+        const u32 valid = write_path(path, 0, start, pos, type);
+        update_lod();
+        return valid;
+    }
+
+    u32 Sparse64Tree::write_path(
+        S64Node** path, u32 top, u32 start, const glm::uvec3& pos, VoxelType type)
+    {
+        if (path[start]->type == Type::Empty && type == 0)
+            return start;
 
-            path.push_back(curr);
-            indices.push_back(idx);
+        // index of the child below the node at a level, on the way to pos
+        const u8 root_shift = init_shift_amt();
+        auto     index_at   = [&](u32 level)
+        {
+            const u32 shift = root_shift - level * 2;
+            return S64Node::get_idx(
+                (pos.x >> shift) & 3, (pos.y >> shift) & 3, (pos.z >> shift) & 3);
+        };
+
+        // a u32 extent allows at most 15 levels
+        u32      level = start;
+        S64Node* curr  = path[start];
+        while (1)
+        {
+            const u32 idx = index_at(level);
 
-            if (curr->type == Type::SingleTypeLeaf)
+            if (level * 2 == root_shift)
             {
-                VoxelType fill_type = curr->voxels[0];
-                curr->type          = Type::Regular;
-                curr->children.resize(64);
-                curr->child_mask = 0;
+                VoxelType existing = 0;
+                if (curr->type == Type::SingleTypeLeaf)
+                    existing = curr->voxels[0];
+                else if (curr->type == Type::Leaf)
+                    existing = curr->voxels[idx];
+
+                if (existing == type)
+                    return level;
 
-                S64Node_UP new_child  = std::make_unique<S64Node>();
-                new_child->parent     = curr;
-                new_child->type       = Type::SingleTypeLeaf;
-                new_child->voxels     = { fill_type };
-                new_child->child_mask = 0b1;
+                write_brick(*curr, 1ull << idx, type);
+                break;
+            }
 
-                curr->children[idx] = std::move(new_child);
-                curr->child_mask |= (1ull << idx);
+            switch (curr->type)
+            {
+            case Type::SingleTypeLeaf:
+                // the write lands inside a uniform region, so split it up first
+                if (curr->voxels[0] == type)
+                    return level;
+                expand_node(*curr, root_shift - level * 2);
+                break;
+            case Type::Empty:
+                make_regular(*curr);
+                break;
+            default:
+                break;
             }
-            else if (!(curr->child_mask & (1ull << idx)))
+
+            make_writable(*curr);
+            if (curr->has_child(idx))
+                curr = &curr->child(idx);
+            else
             {
                 if (type == 0)
-                    return;
+                    return level;
+                curr = &insert_child(*curr, idx);
+            }
+            path[++level] = curr;
+        }
 
-                S64Node_UP new_child = std::make_unique<S64Node>();
-                new_child->parent    = curr;
-                new_child->type      = Type::Regular;
-                new_child->children.resize(64);
+        for (u32 i = top; i < level; ++i)
+            path[i]->epoch = epoch_;
 
-                curr->children[idx] = std::move(new_child);
-                curr->child_mask |= (1ull << idx);
+        // walk back up, pruning emptied nodes and collapsing uniform ones. a parent can
+        // only change if the node below it emptied or collapsed, so stop at the first
+        // node that did neither
+        u32      valid = level;
+        S64Node* node  = curr;
+        for (u32 i = level; i-- > top;)
+        {
+            S64Node& parent = *path[i];
+
+            if (node->type == Type::Empty)
+            {
+                erase_child(parent, index_at(i));
+                valid = i;
             }
+            else if (node->type != Type::SingleTypeLeaf)
+                break;
 
-            curr = curr->children[idx].get();
-            to_local_coords(u_pos, shift_amt);
-            shift_amt -= 2;
+            if (!try_collapse(parent))
+                break;
+
+            valid = i;
+            node  = &parent;
+        }
+
+        return valid;
+    }
+
+    void Sparse64Tree::set_voxel(const glm::ivec3& pos, VoxelType type)
+    {
+        set_voxel(pos.x, pos.y, pos.z, type);
+    }
+
+    void Sparse64Tree::apply_csg(CsgOp op, const Sparse64Tree& other)
+    {
+        if (other.depth_ != depth_)
+            throw std::runtime_error("CSG between Sparse64Trees of different depths");
+
+        if (journal_)
+            return journaled(
+                S64JournalOp::Restore, [&] { apply_csg(op, other); },
+                [](S64Journal&) {});
+
+        collect_snapshots();
+        ++epoch_;
+
+        if (&other == this)
+        {
+            // the tree would be read while it's being edited, and the result is trivial
+            if (op == CsgOp::Subtract && root_.type != Type::Empty)
+                clear_node(root_);
+            return;
         }
 
-        for (i32 i = static_cast<i32>(path.size()) - 1; i >= 0; --i)
+        csg_recursive(root_, other.root_, init_shift_amt(), op);
+        update_lod();
+    }
+
+    bool Sparse64Tree::csg_recursive(
+        S64Node& node, const S64Node& other, u8 shift_amt, CsgOp op)
+    {
+        // a missing or uniform side decides the whole node without looking further
+        if (other.type == Type::Empty)
         {
-            S64Node_P   parent    = path[i];
-            u8          child_idx = indices[i];
-            S64Node_UP& child     = parent->children[child_idx];
+            if (op != CsgOp::Intersect || node.type == Type::Empty)
+                return false;
+            clear_node(node);
+            return true;
+        }
 
-            if (child->type == Type::Leaf)
+        if (other.type == Type::SingleTypeLeaf)
+        {
+            switch (op)
             {
-                try_collapse_to_single_type(child);
+            case CsgOp::Subtract:
+                if (node.type == Type::Empty)
+                    return false;
+                clear_node(node);
+                return true;
+            case CsgOp::Intersect:
+                return false;
+            case CsgOp::Join:
+                if (node.type == Type::SingleTypeLeaf)
+                    return false;
+                if (node.type == Type::Empty)
+                {
+                    fill_node(node, other.voxels[0]);
+                    return true;
+                }
+                // the air between the node's voxels gets filled below
+                break;
             }
+        }
+
+        switch (node.type)
+        {
+        case Type::Empty:
+            if (op != CsgOp::Join)
+                return false;
+            clone_node(node, other);
+            return true;
+        case Type::SingleTypeLeaf:
+            // nothing of other shows through a full node
+            if (op == CsgOp::Join)
+                return false;
+            expand_node(node, shift_amt);
+            break;
+        default:
+            make_writable(node);
+            break;
+        }
 
-            if (is_node_empty(*child) || child->type == Type::Empty)
+        // a uniform other reads the same in every child, so it stands in for them
+        const bool uniform    = other.type == Type::SingleTypeLeaf;
+        const u64  other_mask = uniform ? ~0ull : other.child_mask;
+
+        if (shift_amt == 0)
+        {
+            switch (op)
             {
-                child.reset();
-                parent->child_mask &= ~(1ull << child_idx);
+            case CsgOp::Subtract:
+                return write_brick(node, other_mask, 0);
+            case CsgOp::Intersect:
+                {
+                    // a brick expanded above may have been kept whole
+                    const bool changed = write_brick(node, ~other_mask, 0);
+                    try_collapse(node);
+                    return changed;
+                }
+            case CsgOp::Join:
+                {
+                    const u64 gaps = other_mask & ~node.child_mask;
+                    if (uniform || !gaps)
+                        return write_brick(node, gaps, other.voxels[0]);
+
+                    for (u64 m = gaps; m; m &= m - 1)
+                        node.voxels[CTZ64(m)] = other.voxels[CTZ64(m)];
+                    node.child_mask |= gaps;
+                    node.epoch = epoch_;
+                    try_collapse(node);
+                    return true;
+                }
             }
         }
 
-        if (root_->type == Type::Regular && root_->child_mask == 0)
+        const u32 prev_epoch  = node.epoch;
+        const u8  child_shift = shift_amt - 2;
+        bool      changed     = false;
+
+        if (op == CsgOp::Intersect)
         {
-            root_.reset();
+            // children other doesn't have are all outside of it
+            const u64 outside = node.child_mask & ~other_mask;
+            for (u64 m = outside; m; m &= m - 1)
+                erase_child(node, CTZ64(m));
+            changed = outside != 0;
         }
-        else if (root_->type == Type::Leaf)
+
+        const u64 visit = op == CsgOp::Join ? other_mask : node.child_mask & other_mask;
+        for (u64 m = visit; m; m &= m - 1)
         {
-            try_collapse_to_single_type(root_);
+            const u32      idx         = CTZ64(m);
+            const S64Node& other_child = uniform ? other : other.child(idx);
+            if (node.has_child(idx))
+            {
+                S64Node& child = node.child(idx);
+                changed |= csg_recursive(child, other_child, child_shift, op);
+                if (child.type == Type::Empty)
+                    erase_child(node, idx);
+            }
+            else
+            {
+                // only a join reaches children the node doesn't have yet
+                S64Node child{};
+                csg_recursive(child, other_child, child_shift, op);
+                insert_child(node, idx) = child;
+                changed                 = true;
+            }
         }
 
-        dirty_ = true;
+        try_collapse(node);
+        node.epoch = changed ? epoch_ : prev_epoch;
+        return changed;
     }
 
-    void Sparse64Tree::set_voxel(const glm::ivec3& pos, VoxelType type)
-    {
-        set_voxel(pos.x, pos.y, pos.z, type);
+    template <>
+    Sparse64Tree VolumeOpImpl::csg<Sparse64Tree, Sparse64Tree, Sparse64Tree>(
+        CsgOp op, const Sparse64Tree& a, const Sparse64Tree& b)
+    {
+        if (a.bounding_box().max != b.bounding_box().max)
+            return csg_voxelwise<Sparse64Tree>(op, a, b);
+
+        // joining into an empty tree copies a
+        Sparse64Tree ret(a.bounding_box());
+        ret.apply_csg(CsgOp::Join, a);
+        ret.apply_csg(op, b);
+        return ret;
+    }
+
+    bool Sparse64Tree::set_voxels_recursive(
+        S64Node& node, u8 shift_amt, std::span<const u64> edits)
+    {
+        // nothing to do if every edit writes what the node is already filled with
+        const VoxelType filled = node.type == Type::SingleTypeLeaf ? node.voxels[0] : 0;
+        if ((node.type == Type::Empty || node.type == Type::SingleTypeLeaf) &&
+            std::ranges::all_of(
+                edits, [&](u64 e) { return static_cast<VoxelType>(e) == filled; }))
+            return false;
+
+        const u32 prev_epoch = node.epoch;
+        bool      changed    = false;
+
+        if (shift_amt == 0)
+        {
+            if (node.type == Type::SingleTypeLeaf)
+                expand_node(node, 0);
+            else if (node.type == Type::Empty)
+            {
+                set_type(node, Type::Leaf);
+                std::memset(node.voxels, 0, sizeof(node.voxels));
+                node.child_mask = 0;
+            }
+
+            // edits are in the order they were given, so the last write to a voxel wins
+            for (u64 e : edits)
+            {
+                const u32       idx  = (e >> 8) & 63;
+                const u64       bit  = 1ull << idx;
+                const VoxelType type = static_cast<VoxelType>(e);
+                if ((node.child_mask & bit ? node.voxels[idx] : 0) == type)
+                    continue;
+
+                changed          = true;
+                node.voxels[idx] = type;
+                if (type)
+                    node.child_mask |= bit;
+                else
+                    node.child_mask &= ~bit;
+            }
+
+            if (!node.child_mask)
+                clear_node(node);
+            else
+                try_collapse(node);
+            node.epoch = changed ? epoch_ : prev_epoch;
+            return changed;
+        }
+
+        switch (node.type)
+        {
+        case Type::Empty:
+            make_regular(node);
+            break;
+        case Type::SingleTypeLeaf:
+            expand_node(node, shift_amt);
+            break;
+        default:
+            make_writable(node);
+            break;
+        }
+
+        // edits are sorted by brick, so the ones landing in the same child are
+        // contiguous
+        const u32 key_shift = 8 + shift_amt * 3;
+        for (usize begin = 0; begin < edits.size();)
+        {
+            const u32 idx = (edits[begin] >> key_shift) & 63;
+            usize     end = begin + 1;
+            while (end < edits.size() && ((edits[end] >> key_shift) & 63) == idx)
+                ++end;
+
+            auto group = edits.subspan(begin, end - begin);
+            begin      = end;
+
+            if (node.has_child(idx))
+            {
+                S64Node& child = node.child(idx);
+                changed |= set_voxels_recursive(child, shift_amt - 2, group);
+                if (child.type == Type::Empty)
+                    erase_child(node, idx);
+            }
+            else
+            {
+                // build the new child off to the side, and only give it a slot in the
+                // packed block if anything ended up inside it
+                S64Node child{};
+                set_voxels_recursive(child, shift_amt - 2, group);
+                if (child.type != Type::Empty)
+                {
+                    insert_child(node, idx) = child;
+                    changed                 = true;
+                }
+            }
+        }
+
+        try_collapse(node);
+        node.epoch = changed ? epoch_ : prev_epoch;
+        return changed;
     }
 
-    bool Sparse64Tree::aabb_contains_aabb(const AABB& outer, const AABB& inner)
+    void Sparse64Tree::set_voxels(std::span<const S64VoxelEdit> edits)
     {
-        return outer.min.x <= inner.min.x && outer.max.x >= inner.max.x &&
-            outer.min.y <= inner.min.y && outer.max.y >= inner.max.y &&
-            outer.min.z <= inner.min.z && outer.max.z >= inner.max.z;
-    }
+        if (journal_)
+            return journaled(
+                S64JournalOp::Restore, [&] { set_voxels(edits); }, [](S64Journal&) {});
 
-    bool Sparse64Tree::aabb_intersects_aabb(const AABB& a, const AABB& b)
-    {
-        return a.min.x < b.max.x && a.max.x > b.min.x && a.min.y < b.max.y &&
-            a.max.y > b.min.y && a.min.z < b.max.z && a.max.z > b.min.z;
-    }
+        const u32 extent = static_cast<u32>(bounds_.max.x);
+        const u8  levels = depth_;
 
-    bool
-    Sparse64Tree::aabb_inside_sphere(const AABB& box, const glm::vec3& center, f32 radius)
-    {
-        f32 r_sq = radius * radius;
-        for (u32 i = 0; i < 8; ++i)
+        // the packed edits hold 6 bits of path per level and 8 bits of type
+        if (levels > 9)
         {
-            glm::vec3 corner(
-                (i & 1) ? box.max.x : box.min.x, (i & 2) ? box.max.y : box.min.y,
-                (i & 4) ? box.max.z : box.min.z);
-            glm::vec3 diff = corner - center;
-            if (glm::dot(diff, diff) > r_sq)
-                return false;
+            for (const S64VoxelEdit& e : edits)
+                set_voxel(e.pos.x, e.pos.y, e.pos.z, e.type);
+            return;
         }
-        return true;
-    }
-
-    bool Sparse64Tree::aabb_intersects_sphere(
-        const AABB& box, const glm::vec3& center, f32 radius)
-    {
-        glm::vec3 closest = glm::clamp(center, box.min, box.max);
-        glm::vec3 diff    = center - closest;
-        return glm::dot(diff, diff) <= radius * radius;
-    }
 
-    bool Sparse64Tree::aabb_inside_cylinder(
-        const AABB& box, const glm::vec3& p0, const glm::vec3& p1, f32 radius,
-        const glm::vec3& axis, f32 length)
-    {
-        f32 r_sq = radius * radius;
-        for (u32 i = 0; i < 8; ++i)
+        std::vector<u64> packed;
+        packed.reserve(edits.size());
+        for (const S64VoxelEdit& e : edits)
         {
-            glm::vec3 corner(
-                (i & 1) ? box.max.x : box.min.x, (i & 2) ? box.max.y : box.min.y,
-                (i & 4) ? box.max.z : box.min.z);
-            glm::vec3 to_corner = corner - p0;
-            f32       t         = glm::dot(to_corner, axis);
-            if (t < 0.0f || t > length)
-                return false;
-            glm::vec3 closest = p0 + axis * t;
-            glm::vec3 diff    = corner - closest;
-            if (glm::dot(diff, diff) > r_sq)
-                return false;
+            const glm::uvec3& p = e.pos;
+            if (p.x >= extent || p.y >= extent || p.z >= extent)
+                continue;
+            packed.push_back(path_key(p, levels) << 8 | e.type);
         }
-        return true;
-    }
 
-    bool Sparse64Tree::aabb_intersects_cylinder(
-        const AABB& box, const glm::vec3& p0, const glm::vec3& p1, f32 radius,
-        const glm::vec3& axis, f32 length)
-    {
-        glm::vec3 closest_box     = glm::clamp(p0, box.min, box.max);
-        glm::vec3 to_box          = closest_box - p0;
-        f32       t               = glm::clamp(glm::dot(to_box, axis), 0.0f, length);
-        glm::vec3 point_on_axis   = p0 + axis * t;
-        glm::vec3 closest_to_axis = glm::clamp(point_on_axis, box.min, box.max);
-        glm::vec3 diff            = point_on_axis - closest_to_axis;
-        return glm::dot(diff, diff) <= radius * radius;
+        if (packed.empty())
+            return;
+
+        // only the bricks need to be in order. stable, so edits to the same voxel stay
+        // in the order they were given
+        radix_sort(packed, 8 + 6, (levels - 1) * 6u);
+
+        collect_snapshots();
+        ++epoch_;
+        set_voxels_recursive(root_, init_shift_amt(), packed);
+        update_lod();
     }
 
-    void Sparse64Tree::fill_aabb_recursive(
-        S64Node_UP& node, const glm::uvec3& node_pos, u8 shift_amt, const AABB& region,
+    template <typename Shape>
+    bool Sparse64Tree::fill_recursive(
+        S64Node& node, const glm::uvec3& node_pos, u8 shift_amt, const Shape& shape,
         VoxelType type)
     {
         u32  node_size = 1u << (shift_amt + 2);
-        AABB node_bounds(
-            glm::vec3(node_pos),
-            glm::vec3(node_pos) + glm::vec3(static_cast<f32>(node_size)));
-
-        if (!aabb_intersects_aabb(node_bounds, region))
-        {
-            if (type == 0 && node)
-            {
-                node.reset();
-            }
-            return;
-        }
+        AABB node_bounds{ glm::vec3(node_pos),
+                          glm::vec3(node_pos) + glm::vec3(static_cast<f32>(node_size)) };
 
-        if (aabb_contains_aabb(region, node_bounds))
+        switch (shape.overlap(node_bounds))
         {
+        case Overlap::None:
+            return false;
+        case Overlap::Contains:
             if (type == 0)
             {
-                node.reset();
+                if (node.type == Type::Empty)
+                    return false;
+                clear_node(node);
             }
             else
             {
-                if (!node)
-                    node = std::make_unique<S64Node>();
+                if (node.type == Type::SingleTypeLeaf && node.voxels[0] == type)
+                    return false;
                 fill_node(node, type);
             }
-            return;
+            return true;
+        default:
+            break;
         }
 
         if (shift_amt == 0)
-        {
-            if (!node && type == 0)
-                return;
+            return write_brick(node, shape.brick_mask(node_pos), type);
 
-            for (u32 x = 0; x < 4; ++x)
-                for (u32 y = 0; y < 4; ++y)
-                    for (u32 z = 0; z < 4; ++z)
-                    {
-                        glm::vec3 voxel_pos = glm::vec3(node_pos) + glm::vec3(x, y, z);
-                        if (voxel_pos.x >= region.min.x && voxel_pos.x < region.max.x &&
-                            voxel_pos.y >= region.min.y && voxel_pos.y < region.max.y &&
-                            voxel_pos.z >= region.min.z && voxel_pos.z < region.max.z)
-                        {
-                            if (!node)
-                                node = std::make_unique<S64Node>();
-
-                            if (node->type != Type::Leaf)
-                            {
-                                node->type = Type::Leaf;
-                                node->voxels.resize(64, 0);
-                                node->child_mask = 0;
-                            }
-
-                            u32 idx = node->get_idx(x, y, z);
-                            if (type == 0)
-                            {
-                                node->child_mask &= ~(1ull << idx);
-                                node->voxels[idx] = 0;
-                            }
-                            else
-                            {
-                                node->child_mask |= (1ull << idx);
-                                node->voxels[idx] = type;
-                            }
-                        }
-                    }
-            if (node && node->child_mask == 0)
-                node.reset();
-            return;
-        }
-
-        if (!node)
-            node = std::make_unique<S64Node>();
-
-        if (node->type == Type::SingleTypeLeaf)
-        {
-            VoxelType existing = node->voxels[0];
-            node->type         = Type::Regular;
-            node->children.resize(64);
-            node->child_mask = 0;
-            node->voxels.clear();
-            if (existing != 0)
-            {
-                for (u32 i = 0; i < 64; ++i)
-                {
-                    node->children[i] = std::make_unique<S64Node>();
-                    fill_node(node->children[i], existing);
-                    node->child_mask |= (1ull << i);
-                }
-            }
-        }
-        else if (node->type != Type::Regular)
+        const u32 prev_epoch = node.epoch;
+        switch (node.type)
         {
-            node->type = Type::Regular;
-            node->children.resize(64);
-            node->child_mask = 0;
+        case Type::Empty:
+            // carving air out of air
+            if (type == 0)
+                return false;
+            make_regular(node);
+            break;
+        case Type::SingleTypeLeaf:
+            if (node.voxels[0] == type)
+                return false;
+            expand_node(node, shift_amt);
+            break;
+        default:
+            make_writable(node);
+            break;
         }
 
+        bool changed = false;
+
         u8  child_shift = shift_amt - 2;
         u32 child_size  = 1u << (child_shift + 2);
 
@@ -492,305 +2647,368 @@ namespace v {
             for (u32 y = 0; y < 4; ++y)
                 for (u32 z = 0; z < 4; ++z)
                 {
-                    u32        idx       = node->get_idx(x, y, z);
+                    u32        idx       = S64Node::get_idx(x, y, z);
                     glm::uvec3 child_pos = node_pos + glm::uvec3(x, y, z) * child_size;
-                    fill_aabb_recursive(
-                        node->children[idx], child_pos, child_shift, region, type);
-                    if (node->children[idx])
-                        node->child_mask |= (1ull << idx);
-                    else
-                        node->child_mask &= ~(1ull << idx);
+
+                    if (node.has_child(idx))
+                    {
+                        S64Node& child = node.child(idx);
+                        changed |=
+                            fill_recursive(child, child_pos, child_shift, shape, type);
+                        if (child.type == Type::Empty)
+                            erase_child(node, idx);
+                    }
+                    else if (type != 0)
+                    {
+                        // build the new child off to the side, and only give it a slot
+                        // in the packed block if anything ended up inside it
+                        S64Node child{};
+                        fill_recursive(child, child_pos, child_shift, shape, type);
+                        if (child.type != Type::Empty)
+                        {
+                            insert_child(node, idx) = child;
+                            changed                 = true;
+                        }
+                    }
                 }
 
-        if (node->child_mask == 0)
-            node.reset();
+        // a node that was expanded for nothing collapses back into what it was, which
+        // isn't a change
+        try_collapse(node);
+        node.epoch = changed ? epoch_ : prev_epoch;
+        return changed;
     }
 
-    void Sparse64Tree::fill_aabb(const AABB& region, VoxelType type)
+    template <typename Shape>
+    void Sparse64Tree::fill_root(
+        const Shape& shape, VoxelType type, tf::Executor* executor)
     {
-        AABB clipped(
-            glm::max(region.min, bounds_.min), glm::min(region.max, bounds_.max));
-
-        if (clipped.min.x >= clipped.max.x || clipped.min.y >= clipped.max.y ||
-            clipped.min.z >= clipped.max.z)
+        collect_snapshots();
+        ++epoch_;
+        const u8 shift_amt = init_shift_amt();
+
+        // only worth fanning out if the root gets split into children
+        const AABB root_bounds{ bounds_.min, bounds_.max };
+        if (!executor || shift_amt == 0 ||
+            shape.overlap(root_bounds) != Overlap::Partial ||
+            (root_.type == Type::Empty && type == 0) ||
+            (root_.type == Type::SingleTypeLeaf && root_.voxels[0] == type))
+        {
+            fill_recursive(root_, glm::uvec3(0), shift_amt, shape, type);
+            update_lod();
             return;
+        }
+
+        const u32 prev_epoch = root_.epoch;
+        split_root();
+
+        // every worker edits through a scratch tree of its own, so the node pools are
+        // never shared between threads. existing children are filled in place, as the
+        // root's children block doesn't move until the merge below. missing children
+        // are built off to the side like fill_recursive does
+        std::vector<Sparse64Tree> scratch;
+        scratch.reserve(executor->num_workers());
+        for (usize i = 0; i < executor->num_workers(); ++i)
+            scratch.push_back(make_scratch());
+
+        std::array<S64Node, 64> added{};
+        std::array<u8, 64>      changed{};
+        const u8                child_shift = shift_amt - 2;
+        const u32               child_size  = 1u << shift_amt;
+
+        tf::Taskflow taskflow;
+        taskflow.for_each_index(
+            0u, 64u, 1u,
+            [&](u32 idx)
+            {
+                Sparse64Tree& ctx = scratch[executor->this_worker_id()];
+                S64Node& child    = root_.has_child(idx) ? root_.child(idx) : added[idx];
+                if (!root_.has_child(idx) && type == 0)
+                    return;
+
+                const glm::uvec3 child_pos =
+                    glm::uvec3(idx & 3, idx >> 4, (idx >> 2) & 3) * child_size;
+                changed[idx] =
+                    ctx.fill_recursive(child, child_pos, child_shift, shape, type);
+            });
+        executor->run(taskflow).wait();
+
+        for (Sparse64Tree& ctx : scratch)
+            absorb_scratch(ctx);
 
-        u8 shift_amt = init_shift_amt();
-        fill_aabb_recursive(root_, glm::uvec3(0), shift_amt, clipped, type);
-        dirty_ = true;
+        merge_root(added, changed, prev_epoch);
     }
 
-    void Sparse64Tree::fill_sphere_recursive(
-        S64Node_UP& node, const glm::uvec3& node_pos, u8 shift_amt,
-        const glm::vec3& center, f32 radius, VoxelType type)
+    void Sparse64Tree::split_root()
     {
-        u32  node_size = 1u << (shift_amt + 2);
-        AABB node_bounds(
-            glm::vec3(node_pos),
-            glm::vec3(node_pos) + glm::vec3(static_cast<f32>(node_size)));
+        if (root_.type == Type::Empty)
+            make_regular(root_);
+        else if (root_.type == Type::SingleTypeLeaf)
+            expand_node(root_, init_shift_amt());
+        else
+            make_writable(root_);
+    }
 
-        if (!aabb_intersects_sphere(node_bounds, center, radius))
-        {
-            if (type == 0 && node)
-            {
-                node.reset();
-            }
-            return;
-        }
+    Sparse64Tree Sparse64Tree::make_scratch() const
+    {
+        Sparse64Tree ctx(depth_);
+        ctx.epoch_        = epoch_;
+        ctx.frozen_epoch_ = frozen_epoch_;
+        return ctx;
+    }
+
+    void Sparse64Tree::absorb_scratch(Sparse64Tree& ctx)
+    {
+        pool_.absorb(std::move(ctx.pool_));
+        // the scratch tree retyped nodes of this tree too, so its counts are deltas
+        // that may have wrapped around
+        for (usize t = 0; t < type_counts_.size(); ++t)
+            type_counts_[t] += ctx.type_counts_[t];
+        collapses_ += ctx.collapses_;
+        expansions_ += ctx.expansions_;
+        retired_.insert(retired_.end(), ctx.retired_.begin(), ctx.retired_.end());
+        ctx.retired_.clear();
+    }
 
-        if (aabb_inside_sphere(node_bounds, center, radius))
+    void Sparse64Tree::merge_root(
+        std::array<S64Node, 64>& added, const std::array<u8, 64>& changed,
+        u32 prev_epoch)
+    {
+        // merge the child masks back, in the same order a serial edit would
+        bool any_changed = false;
+        for (u32 idx = 0; idx < 64; ++idx)
         {
-            if (type == 0)
+            if (root_.has_child(idx))
             {
-                node.reset();
+                any_changed |= changed[idx] != 0;
+                if (root_.child(idx).type == Type::Empty)
+                    erase_child(root_, idx);
             }
-            else
+            else if (added[idx].type != Type::Empty)
             {
-                if (!node)
-                    node = std::make_unique<S64Node>();
-                fill_node(node, type);
+                insert_child(root_, idx) = added[idx];
+                any_changed              = true;
             }
-            return;
         }
 
-        if (shift_amt == 0)
+        try_collapse(root_);
+        root_.epoch = any_changed ? epoch_ : prev_epoch;
+        update_lod();
+    }
+
+    Sparse64Tree::ConcurrentEdit::ConcurrentEdit(Sparse64Tree& tree) :
+        tree_(&tree), root_shift_(tree.init_shift_amt()),
+        extent_(static_cast<u32>(tree.bounds_.max.x))
+    {
+        // recorded as a whole at commit()
+        if (tree.journal_)
         {
-            if (!node && type == 0)
-                return;
+            journal_ = std::exchange(tree.journal_, nullptr);
+            before_  = tree.snapshot();
+            since_   = tree.epoch_;
+        }
 
-            f32 r_sq = radius * radius;
-            for (u32 x = 0; x < 4; ++x)
-                for (u32 y = 0; y < 4; ++y)
-                    for (u32 z = 0; z < 4; ++z)
-                    {
-                        glm::vec3 voxel_center =
-                            glm::vec3(node_pos) + glm::vec3(x, y, z) + glm::vec3(0.5f);
-                        glm::vec3 diff = voxel_center - center;
-                        if (glm::dot(diff, diff) <= r_sq)
-                        {
-                            if (!node)
-                                node = std::make_unique<S64Node>();
-
-                            if (node->type != Type::Leaf)
-                            {
-                                node->type = Type::Leaf;
-                                node->voxels.resize(64, 0);
-                                node->child_mask = 0;
-                            }
-
-                            u32 idx = node->get_idx(x, y, z);
-                            if (type == 0)
-                            {
-                                node->child_mask &= ~(1ull << idx);
-                                node->voxels[idx] = 0;
-                            }
-                            else
-                            {
-                                node->child_mask |= (1ull << idx);
-                                node->voxels[idx] = type;
-                            }
-                        }
-                    }
-            if (node && node->child_mask == 0)
-                node.reset();
+        // a tree of a single brick has no subtrees, so its writes all share a lock
+        if (root_shift_ == 0)
+        {
+            subtrees_ = std::make_unique<Subtree[]>(1);
             return;
         }
 
-        if (!node)
-            node = std::make_unique<S64Node>();
-
-        if (node->type == Type::SingleTypeLeaf)
+        // the whole session is one edit
+        tree.collect_snapshots();
+        ++tree.epoch_;
+        prev_epoch_ = tree.root_.epoch;
+        tree.split_root();
+
+        // the root's children block doesn't move until commit(), so the children can
+        // be edited in place
+        subtrees_ = std::make_unique<Subtree[]>(64);
+        scratch_.reserve(64);
+        for (u32 idx = 0; idx < 64; ++idx)
         {
-            VoxelType existing = node->voxels[0];
-            node->type         = Type::Regular;
-            node->children.resize(64);
-            node->child_mask = 0;
-            node->voxels.clear();
-            if (existing != 0)
-            {
-                for (u32 i = 0; i < 64; ++i)
-                {
-                    node->children[i] = std::make_unique<S64Node>();
-                    fill_node(node->children[i], existing);
-                    node->child_mask |= (1ull << i);
-                }
-            }
+            subtrees_[idx].node =
+                tree.root_.has_child(idx) ? &tree.root_.child(idx) : &added_[idx];
+            scratch_.push_back(tree.make_scratch());
         }
-        else if (node->type != Type::Regular)
+    }
+
+    VoxelType Sparse64Tree::ConcurrentEdit::get_voxel(u32 x, u32 y, u32 z)
+    {
+        if ((x | y | z) >= extent_)
+            return 0;
+
+        if (root_shift_ == 0)
         {
-            node->type = Type::Regular;
-            node->children.resize(64);
-            node->child_mask = 0;
+            std::lock_guard lock(subtrees_[0].mutex);
+            return tree_->get_voxel(x, y, z);
         }
 
-        u8  child_shift = shift_amt - 2;
-        u32 child_size  = 1u << (child_shift + 2);
+        Subtree& sub = subtrees_[S64Node::get_idx(
+            x >> root_shift_, y >> root_shift_, z >> root_shift_)];
+        std::lock_guard lock(sub.mutex);
 
-        for (u32 x = 0; x < 4; ++x)
-            for (u32 y = 0; y < 4; ++y)
-                for (u32 z = 0; z < 4; ++z)
-                {
-                    u32        idx       = node->get_idx(x, y, z);
-                    glm::uvec3 child_pos = node_pos + glm::uvec3(x, y, z) * child_size;
-                    fill_sphere_recursive(
-                        node->children[idx], child_pos, child_shift, center, radius,
-                        type);
-                    if (node->children[idx])
-                        node->child_mask |= (1ull << idx);
-                    else
-                        node->child_mask &= ~(1ull << idx);
-                }
+        const S64Node* curr      = sub.node;
+        u8             shift_amt = root_shift_ - 2;
+        while (1)
+        {
+            const u32 idx = S64Node::get_idx(
+                (x >> shift_amt) & 3, (y >> shift_amt) & 3, (z >> shift_amt) & 3);
 
-        if (node->child_mask == 0)
-            node.reset();
+            switch (curr->type)
+            {
+            case Type::SingleTypeLeaf:
+                return curr->voxels[0];
+            case Type::Leaf:
+                return curr->voxels[idx];
+            case Type::Empty:
+                return 0;
+            default:
+                if (!curr->has_child(idx))
+                    return 0;
+                curr = &curr->child(idx);
+                shift_amt -= 2;
+            }
+        }
     }
 
-    void Sparse64Tree::fill_sphere(const glm::vec3& center, f32 radius, VoxelType type)
+    void Sparse64Tree::ConcurrentEdit::set_voxel(u32 x, u32 y, u32 z, VoxelType type)
     {
-        AABB sphere_bounds(center - glm::vec3(radius), center + glm::vec3(radius));
+        if ((x | y | z) >= extent_)
+            return;
 
-        if (!aabb_intersects_aabb(sphere_bounds, bounds_))
+        if (root_shift_ == 0)
+        {
+            std::lock_guard lock(subtrees_[0].mutex);
+            tree_->set_voxel(x, y, z, type);
             return;
+        }
+
+        const u32 idx =
+            S64Node::get_idx(x >> root_shift_, y >> root_shift_, z >> root_shift_);
+        Subtree& sub = subtrees_[idx];
+        std::lock_guard lock(sub.mutex);
 
-        u8 shift_amt = init_shift_amt();
-        fill_sphere_recursive(root_, glm::uvec3(0), shift_amt, center, radius, type);
-        dirty_ = true;
+        // the root stays as it is until commit(), the write starts below it
+        std::array<S64Node*, 16> path;
+        path[0] = &tree_->root_;
+        path[1] = sub.node;
+        scratch_[idx].write_path(path.data(), 1, 1, glm::uvec3(x, y, z), type);
     }
 
-    void Sparse64Tree::fill_cylinder_recursive(
-        S64Node_UP& node, const glm::uvec3& node_pos, u8 shift_amt, const glm::vec3& p0,
-        const glm::vec3& p1, f32 radius, const glm::vec3& axis, f32 length,
-        VoxelType type)
+    void Sparse64Tree::ConcurrentEdit::commit()
     {
-        u32  node_size = 1u << (shift_amt + 2);
-        AABB node_bounds(
-            glm::vec3(node_pos),
-            glm::vec3(node_pos) + glm::vec3(static_cast<f32>(node_size)));
+        if (!open_)
+            return;
+        open_ = false;
 
-        if (!aabb_intersects_cylinder(node_bounds, p0, p1, radius, axis, length))
+        if (root_shift_ != 0)
         {
-            if (type == 0 && node)
-            {
-                node.reset();
-            }
-            return;
+            // the session's epoch is new, so only the subtrees written to carry it
+            std::array<u8, 64> changed{};
+            for (u32 idx = 0; idx < 64; ++idx)
+                changed[idx] = subtrees_[idx].node->epoch == tree_->epoch_;
+
+            for (Sparse64Tree& ctx : scratch_)
+                tree_->absorb_scratch(ctx);
+            scratch_.clear();
+
+            tree_->merge_root(added_, changed, prev_epoch_);
         }
 
-        if (aabb_inside_cylinder(node_bounds, p0, p1, radius, axis, length))
+        if (journal_)
         {
-            if (type == 0)
-            {
-                node.reset();
-            }
-            else
-            {
-                if (!node)
-                    node = std::make_unique<S64Node>();
-                fill_node(node, type);
-            }
-            return;
+            tree_->journal_   = journal_;
+            const usize entry = journal_->begin_entry(S64JournalOp::Restore);
+            tree_->write_changes(S64JournalOp::Restore, *before_, since_);
+            journal_->end_entry(entry);
+            before_.reset();
         }
+    }
 
-        if (shift_amt == 0)
-        {
-            if (!node && type == 0)
-                return;
+    void Sparse64Tree::fill_aabb(const AABB& region, VoxelType type)
+    {
+        fill_aabb_impl(region, type, nullptr);
+    }
 
-            f32 r_sq = radius * radius;
-            for (u32 x = 0; x < 4; ++x)
-                for (u32 y = 0; y < 4; ++y)
-                    for (u32 z = 0; z < 4; ++z)
-                    {
-                        glm::vec3 voxel_center =
-                            glm::vec3(node_pos) + glm::vec3(x, y, z) + glm::vec3(0.5f);
-                        glm::vec3 to_voxel = voxel_center - p0;
-                        f32       t        = glm::dot(to_voxel, axis);
-                        if (t >= 0.0f && t <= length)
-                        {
-                            glm::vec3 closest = p0 + axis * t;
-                            glm::vec3 diff    = voxel_center - closest;
-                            if (glm::dot(diff, diff) <= r_sq)
-                            {
-                                if (!node)
-                                    node = std::make_unique<S64Node>();
-
-                                if (node->type != Type::Leaf)
-                                {
-                                    node->type = Type::Leaf;
-                                    node->voxels.resize(64, 0);
-                                    node->child_mask = 0;
-                                }
-
-                                u32 idx = node->get_idx(x, y, z);
-                                if (type == 0)
-                                {
-                                    node->child_mask &= ~(1ull << idx);
-                                    node->voxels[idx] = 0;
-                                }
-                                else
-                                {
-                                    node->child_mask |= (1ull << idx);
-                                    node->voxels[idx] = type;
-                                }
-                            }
-                        }
-                    }
-            if (node && node->child_mask == 0)
-                node.reset();
-            return;
-        }
+    void Sparse64Tree::fill_aabb(
+        const AABB& region, VoxelType type, tf::Executor& executor)
+    {
+        fill_aabb_impl(region, type, &executor);
+    }
+
+    void Sparse64Tree::fill_sphere(const glm::vec3& center, f32 radius, VoxelType type)
+    {
+        fill_sphere_impl(center, radius, type, nullptr);
+    }
 
-        if (!node)
-            node = std::make_unique<S64Node>();
+    void Sparse64Tree::fill_sphere(
+        const glm::vec3& center, f32 radius, VoxelType type, tf::Executor& executor)
+    {
+        fill_sphere_impl(center, radius, type, &executor);
+    }
 
-        if (node->type == Type::SingleTypeLeaf)
-        {
-            VoxelType existing = node->voxels[0];
-            node->type         = Type::Regular;
-            node->children.resize(64);
-            node->child_mask = 0;
-            node->voxels.clear();
-            if (existing != 0)
-            {
-                for (u32 i = 0; i < 64; ++i)
+    void Sparse64Tree::fill_cylinder(
+        const glm::vec3& p0, const glm::vec3& p1, f32 radius, VoxelType type)
+    {
+        fill_cylinder_impl(p0, p1, radius, type, nullptr);
+    }
+
+    void Sparse64Tree::fill_cylinder(
+        const glm::vec3& p0, const glm::vec3& p1, f32 radius, VoxelType type,
+        tf::Executor& executor)
+    {
+        fill_cylinder_impl(p0, p1, radius, type, &executor);
+    }
+
+    void Sparse64Tree::fill_aabb_impl(
+        const AABB& region, VoxelType type, tf::Executor* executor)
+    {
+        AABB clipped(
+            glm::max(region.min, bounds_.min), glm::min(region.max, bounds_.max));
+
+        if (clipped.min.x >= clipped.max.x || clipped.min.y >= clipped.max.y ||
+            clipped.min.z >= clipped.max.z)
+            return;
+
+        if (journal_)
+            return journaled(
+                S64JournalOp::FillAabb, [&] { fill_aabb_impl(clipped, type, executor); },
+                [&](S64Journal& journal)
                 {
-                    node->children[i] = std::make_unique<S64Node>();
-                    fill_node(node->children[i], existing);
-                    node->child_mask |= (1ull << i);
-                }
-            }
-        }
-        else if (node->type != Type::Regular)
-        {
-            node->type = Type::Regular;
-            node->children.resize(64);
-            node->child_mask = 0;
-        }
+                    journal.put_vec3(clipped.min);
+                    journal.put_vec3(clipped.max);
+                    journal.put_u8(type);
+                });
 
-        u8  child_shift = shift_amt - 2;
-        u32 child_size  = 1u << (child_shift + 2);
+        fill_root(AabbShape{ clipped }, type, executor);
+    }
 
-        for (u32 x = 0; x < 4; ++x)
-            for (u32 y = 0; y < 4; ++y)
-                for (u32 z = 0; z < 4; ++z)
+    void Sparse64Tree::fill_sphere_impl(
+        const glm::vec3& center, f32 radius, VoxelType type, tf::Executor* executor)
+    {
+        AABB sphere_bounds(center - glm::vec3(radius), center + glm::vec3(radius));
+
+        if (!aabb_intersects_aabb(sphere_bounds, bounds_))
+            return;
+
+        if (journal_)
+            return journaled(
+                S64JournalOp::FillSphere,
+                [&] { fill_sphere_impl(center, radius, type, executor); },
+                [&](S64Journal& journal)
                 {
-                    u32        idx       = node->get_idx(x, y, z);
-                    glm::uvec3 child_pos = node_pos + glm::uvec3(x, y, z) * child_size;
-                    fill_cylinder_recursive(
-                        node->children[idx], child_pos, child_shift, p0, p1, radius, axis,
-                        length, type);
-                    if (node->children[idx])
-                        node->child_mask |= (1ull << idx);
-                    else
-                        node->child_mask &= ~(1ull << idx);
-                }
+                    journal.put_vec3(center);
+                    journal.put_f32(radius);
+                    journal.put_u8(type);
+                });
 
-        if (node->child_mask == 0)
-            node.reset();
+        fill_root(SphereShape{ center, radius }, type, executor);
     }
 
-    void Sparse64Tree::fill_cylinder(
-        const glm::vec3& p0, const glm::vec3& p1, f32 radius, VoxelType type)
+    void Sparse64Tree::fill_cylinder_impl(
+        const glm::vec3& p0, const glm::vec3& p1, f32 radius, VoxelType type,
+        tf::Executor* executor)
     {
         glm::vec3 axis   = p1 - p0;
         f32       length = glm::length(axis);
@@ -805,9 +3023,172 @@ namespace v {
         if (!aabb_intersects_aabb(cyl_bounds, bounds_))
             return;
 
-        u8 shift_amt = init_shift_amt();
-        fill_cylinder_recursive(
-            root_, glm::uvec3(0), shift_amt, p0, p1, radius, axis, length, type);
-        dirty_ = true;
+        if (journal_)
+            return journaled(
+                S64JournalOp::FillCylinder,
+                [&] { fill_cylinder_impl(p0, p1, radius, type, executor); },
+                [&](S64Journal& journal)
+                {
+                    journal.put_vec3(p0);
+                    journal.put_vec3(p1);
+                    journal.put_f32(radius);
+                    journal.put_u8(type);
+                });
+
+        fill_root(CylinderShape{ p0, axis, radius, length }, type, executor);
+    }
+
+    void Sparse64Tree::fill_erased_sdf(
+        const S64Sdf& sdf, VoxelType type, tf::Executor* executor)
+    {
+        // the sdf itself can't be recorded, only the voxels it filled
+        if (journal_)
+            return journaled(
+                S64JournalOp::Restore, [&] { fill_erased_sdf(sdf, type, executor); },
+                [](S64Journal&) {});
+
+        fill_root(SdfShape{ sdf }, type, executor);
+    }
+
+    void Sparse64Tree::flatten(tf::Executor& executor)
+    {
+        if (!g_nodes_.empty() && flat_epoch_ == root_.epoch)
+            return;
+        flat_epoch_ = root_.epoch;
+
+        if (root_.type != Type::Regular)
+        {
+            // nothing to parallelize: the root is the only node
+            u32 next_node = 1, next_brick = 0;
+            g_nodes_.resize(1);
+            g_bricks_.resize(root_.type == Type::Leaf ? 64 : 0);
+            write_flat_node(root_, g_nodes_[0], next_node, next_brick, g_bricks_.data());
+            return;
+        }
+
+        // the root's children sit right after it, each followed later by the range
+        // holding the rest of its subtree
+        const u32 top_count = POPCOUNT64(root_.child_mask);
+        // subtree i's ranges start at node_offsets[i]/brick_offsets[i], the last entry
+        // holds the totals
+        std::vector<FlatSize> sizes(top_count);
+        std::vector<u32>      node_offsets(top_count + 1), brick_offsets(top_count + 1);
+
+        tf::Taskflow taskflow;
+        tf::Task     measure = taskflow.for_each_index(
+            0u, top_count, 1u,
+            [&](u32 i) { measure_subtree(root_.children[i], sizes[i]); });
+
+        tf::Task allocate = taskflow.emplace(
+            [&]
+            {
+                node_offsets[0]  = 1 + top_count;
+                brick_offsets[0] = 0;
+                for (u32 i = 0; i < top_count; ++i)
+                {
+                    node_offsets[i + 1]  = node_offsets[i] + sizes[i].nodes;
+                    brick_offsets[i + 1] = brick_offsets[i] + sizes[i].bricks;
+                }
+                g_nodes_.resize(node_offsets[top_count]);
+                g_bricks_.resize(brick_offsets[top_count] * 64ull);
+
+                u32 next_node = 1, next_brick = 0;
+                write_flat_node(
+                    root_, g_nodes_[0], next_node, next_brick, g_bricks_.data());
+            });
+
+        tf::Task write = taskflow.for_each_index(
+            0u, top_count, 1u,
+            [&](u32 i)
+            {
+                flatten_subtree(
+                    root_.children[i], 1 + i, node_offsets[i], brick_offsets[i],
+                    g_nodes_.data(), g_bricks_.data());
+            });
+
+        measure.precede(allocate);
+        allocate.precede(write);
+        executor.run(taskflow).wait();
+    }
+
+    void Sparse64Tree::save(const std::filesystem::path& path) const
+    {
+        FlatSize size{};
+        measure_subtree(root_, size);
+
+        S64FileHeader header{};
+        header.magic         = S64FileHeader::k_magic;
+        header.version       = S64FileHeader::k_version;
+        header.depth         = depth_;
+        header.node_count    = 1ull + size.nodes;
+        header.brick_count   = size.bricks;
+        header.nodes_offset  = sizeof(S64FileHeader);
+        header.bricks_offset = header.nodes_offset + header.node_count * sizeof(GS64Node);
+
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        if (!file)
+            throw std::runtime_error("Failed to open " + path.string());
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+        // one breadth first order over the whole tree, unlike flatten which gives each
+        // of the root's children its own range. Nodes and bricks are written out every
+        // batch_nodes nodes, and the queue only keeps the nodes not written yet
+        constexpr usize             batch_nodes = 16384;
+        std::vector<const S64Node*> queue{ &root_ };
+        std::vector<GS64Node>       nodes;
+        std::vector<VoxelType>      bricks;
+        u64                         node_pos   = header.nodes_offset;
+        u64                         brick_pos  = header.bricks_offset;
+        u32                         next_node  = 1;
+        u32                         next_brick = 0;
+
+        auto flush = [&]
+        {
+            file.seekp(static_cast<std::streamoff>(node_pos));
+            file.write(
+                reinterpret_cast<const char*>(nodes.data()),
+                static_cast<std::streamsize>(nodes.size() * sizeof(GS64Node)));
+            node_pos += nodes.size() * sizeof(GS64Node);
+            nodes.clear();
+
+            file.seekp(static_cast<std::streamoff>(brick_pos));
+            file.write(
+                reinterpret_cast<const char*>(bricks.data()),
+                static_cast<std::streamsize>(bricks.size()));
+            brick_pos += bricks.size();
+            bricks.clear();
+        };
+
+        for (usize q = 0; q < queue.size();)
+        {
+            const S64Node& node = *queue[q++];
+
+            // the brick goes to the end of this batch's bricks, but is numbered across
+            // the whole file
+            u32 batch_brick = static_cast<u32>(bricks.size() / 64);
+            if (node.type == Type::Leaf)
+                bricks.resize(bricks.size() + 64);
+            GS64Node& out = nodes.emplace_back();
+            write_flat_node(node, out, next_node, batch_brick, bricks.data());
+            if (node.type == Type::Leaf)
+                out.first_child = next_brick++;
+
+            if (node.type == Type::Regular)
+            {
+                for (u32 i = 0, n = POPCOUNT64(node.child_mask); i < n; ++i)
+                    queue.push_back(&node.children[i]);
+            }
+
+            if (nodes.size() == batch_nodes)
+            {
+                flush();
+                queue.erase(queue.begin(), queue.begin() + q);
+                q = 0;
+            }
+        }
+        flush();
+
+        if (!file)
+            throw std::runtime_error("Failed to write " + path.string());
     }
 } // namespace v
@@ -0,0 +1,166 @@
+#include <bit>
+#include <stdexcept>
+#include <vox/store/64tree_file.h>
+
+#ifdef _WIN32
+    #include <windows.h>
+#else
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+namespace v {
+    static_assert(
+        std::endian::native == std::endian::little,
+        "Sparse64Tree files are read in place, and are little endian");
+
+    S64TreeView::S64TreeView(const std::filesystem::path& path)
+    {
+#ifdef _WIN32
+        HANDLE file = CreateFileW(
+            path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+            FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            throw std::runtime_error("Failed to open " + path.string());
+        file_ = file;
+
+        LARGE_INTEGER file_size{};
+        if (!GetFileSizeEx(file, &file_size))
+        {
+            unmap();
+            throw std::runtime_error("Failed to read the size of " + path.string());
+        }
+        size_ = static_cast<usize>(file_size.QuadPart);
+
+        if (size_ >= sizeof(S64FileHeader))
+        {
+            mapping_ = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mapping_)
+                data_ = static_cast<const std::byte*>(
+                    MapViewOfFile(mapping_, FILE_MAP_READ, 0, 0, 0));
+        }
+#else
+        const int fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            throw std::runtime_error("Failed to open " + path.string());
+
+        struct stat st{};
+        if (fstat(fd, &st) != 0)
+        {
+            close(fd);
+            throw std::runtime_error("Failed to read the size of " + path.string());
+        }
+        size_ = static_cast<usize>(st.st_size);
+
+        if (size_ >= sizeof(S64FileHeader))
+        {
+            void* data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (data != MAP_FAILED)
+                data_ = static_cast<const std::byte*>(data);
+        }
+        // the mapping keeps the file alive on its own
+        close(fd);
+#endif
+
+        if (!data_)
+        {
+            unmap();
+            throw std::runtime_error("Failed to map " + path.string());
+        }
+
+        // every check only subtracts from the file size, so a corrupt header can't
+        // wrap a sum around and pass
+        const S64FileHeader& h = header();
+        const bool           valid = h.magic == S64FileHeader::k_magic &&
+            h.version == S64FileHeader::k_version && h.depth >= 1 && h.depth <= 15 &&
+            h.nodes_offset % 16 == 0 && h.nodes_offset >= sizeof(S64FileHeader) &&
+            h.nodes_offset <= size_ && h.node_count >= 1 &&
+            h.node_count <= (size_ - h.nodes_offset) / sizeof(GS64Node) &&
+            h.bricks_offset >= h.nodes_offset + h.node_count * sizeof(GS64Node) &&
+            h.bricks_offset <= size_ && h.brick_count <= (size_ - h.bricks_offset) / 64;
+        if (!valid)
+        {
+            unmap();
+            throw std::runtime_error(path.string() + " is not a Sparse64Tree file");
+        }
+    }
+
+    S64TreeView::~S64TreeView() { unmap(); }
+
+    S64TreeView::S64TreeView(S64TreeView&& o) noexcept :
+        data_(std::exchange(o.data_, nullptr)), size_(std::exchange(o.size_, 0))
+#ifdef _WIN32
+        ,
+        file_(std::exchange(o.file_, nullptr)),
+        mapping_(std::exchange(o.mapping_, nullptr))
+#endif
+    {}
+
+    S64TreeView& S64TreeView::operator=(S64TreeView&& o) noexcept
+    {
+        if (this != &o)
+        {
+            unmap();
+            data_ = std::exchange(o.data_, nullptr);
+            size_ = std::exchange(o.size_, 0);
+#ifdef _WIN32
+            file_    = std::exchange(o.file_, nullptr);
+            mapping_ = std::exchange(o.mapping_, nullptr);
+#endif
+        }
+        return *this;
+    }
+
+    void S64TreeView::unmap()
+    {
+#ifdef _WIN32
+        if (data_)
+            UnmapViewOfFile(data_);
+        if (mapping_)
+            CloseHandle(mapping_);
+        if (file_)
+            CloseHandle(file_);
+        file_    = nullptr;
+        mapping_ = nullptr;
+#else
+        if (data_)
+            munmap(const_cast<std::byte*>(data_), size_);
+#endif
+        data_ = nullptr;
+        size_ = 0;
+    }
+
+    VoxelType S64TreeView::get_voxel(u32 x, u32 y, u32 z) const
+    {
+        const u32 extent = 1u << (depth() * 2);
+        if (x >= extent || y >= extent || z >= extent)
+            return 0;
+
+        const std::span<const GS64Node>  nodes  = this->nodes();
+        const std::span<const VoxelType> bricks = this->bricks();
+
+        u32             shift = (depth() - 1) * 2;
+        const GS64Node* node  = &nodes[0];
+        while (true)
+        {
+            const auto type = static_cast<S64Node::Type>(node->payload & 0xff);
+            if (type == S64Node::Type::Empty)
+                return 0;
+            if (type == S64Node::Type::SingleTypeLeaf)
+                return static_cast<VoxelType>(node->payload >> 8);
+
+            const u32 idx =
+                S64Node::get_idx((x >> shift) & 3, (y >> shift) & 3, (z >> shift) & 3);
+            if (!(node->child_mask & (1ull << idx)))
+                return 0;
+            if (type == S64Node::Type::Leaf)
+                return bricks[node->first_child * 64ull + idx];
+
+            node = &nodes
+                [node->first_child + POPCOUNT64(node->child_mask & ((1ull << idx) - 1))];
+            shift -= 2;
+        }
+    }
+} // namespace v
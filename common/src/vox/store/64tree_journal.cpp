@@ -0,0 +1,409 @@
+#include <bit>
+#include <cstring>
+#include <stdexcept>
+#include <vox/store/64tree_journal.h>
+
+namespace v {
+    static_assert(
+        std::endian::native == std::endian::little, "S64Journals are little endian");
+
+    namespace {
+        /// record kinds, in front of every record
+        constexpr u8 k_run   = 0;
+        constexpr u8 k_brick = 1;
+
+        /// Bounds checked reads of an entry's payload
+        struct Reader {
+            const u8* at;
+            const u8* end;
+
+            FORCEINLINE bool done() const { return at == end; }
+
+            void need(usize bytes) const
+            {
+                if (static_cast<usize>(end - at) < bytes)
+                    throw std::runtime_error("Truncated S64Journal entry");
+            }
+
+            u8 get_u8()
+            {
+                need(1);
+                return *at++;
+            }
+
+            template <typename T>
+            T get()
+            {
+                need(sizeof(T));
+                T val;
+                std::memcpy(&val, at, sizeof(T));
+                at += sizeof(T);
+                return val;
+            }
+
+            glm::vec3 get_vec3()
+            {
+                const f32 x = get<f32>();
+                const f32 y = get<f32>();
+                const f32 z = get<f32>();
+                return glm::vec3(x, y, z);
+            }
+
+            u32 get_varint()
+            {
+                u32 val = 0;
+                for (u32 shift = 0; shift < 35; shift += 7)
+                {
+                    const u8 byte = get_u8();
+                    val |= static_cast<u32>(byte & 0x7f) << shift;
+                    if (!(byte & 0x80))
+                        return val;
+                }
+                throw std::runtime_error("Malformed varint in S64Journal");
+            }
+
+            /// Reads a position delta coded by S64Journal::put_delta
+            glm::uvec3 get_delta(glm::uvec3& last)
+            {
+                for (u32 axis = 0; axis < 3; ++axis)
+                {
+                    const u32 zigzag = get_varint();
+                    last[axis] += (zigzag >> 1) ^ (0u - (zigzag & 1));
+                }
+                return last;
+            }
+
+            Reader split(usize bytes)
+            {
+                need(bytes);
+                Reader head{ at, at + bytes };
+                at += bytes;
+                return head;
+            }
+        };
+
+        struct Entry {
+            u8     op;
+            Reader payload;
+        };
+
+        /// Returns the entries from the checkpoint on, in order
+        std::vector<Entry> parse(const std::vector<u8>& bytes, usize from)
+        {
+            if (from > bytes.size())
+                throw std::runtime_error("S64Journal checkpoint past its end");
+
+            std::vector<Entry> entries;
+            Reader             reader{ bytes.data() + from, bytes.data() + bytes.size() };
+            while (!reader.done())
+            {
+                const u8  op   = reader.get_u8();
+                const u32 size = reader.get<u32>();
+                entries.push_back({ op, reader.split(size) });
+            }
+            return entries;
+        }
+
+        /// Size of the parameters in front of the undo records of a fill or clear
+        usize param_size(S64JournalOp op)
+        {
+            switch (op)
+            {
+            case S64JournalOp::FillAabb:
+                return 6 * sizeof(f32) + 1;
+            case S64JournalOp::FillSphere:
+                return 4 * sizeof(f32) + 1;
+            case S64JournalOp::FillCylinder:
+                return 7 * sizeof(f32) + 1;
+            case S64JournalOp::Clear:
+                return 0;
+            default:
+                throw std::runtime_error("Unknown S64Journal op");
+            }
+        }
+
+        struct Point {
+            glm::uvec3 pos;
+            VoxelType  type;
+            VoxelType  old;
+        };
+
+        std::vector<Point> read_points(Reader payload, bool with_undo)
+        {
+            std::vector<Point> points;
+            glm::uvec3         last(0);
+            while (!payload.done())
+            {
+                Point& p = points.emplace_back();
+                p.pos    = payload.get_delta(last);
+                p.type   = payload.get_u8();
+                p.old    = with_undo ? payload.get_u8() : 0;
+            }
+            return points;
+        }
+
+        /// Writes the contents held by a list of records into tree
+        void apply_records(Sparse64Tree& tree, Reader records)
+        {
+            glm::uvec3 last(0);
+            while (!records.done())
+            {
+                const u8         kind = records.get_u8();
+                const glm::uvec3 pos  = records.get_delta(last);
+                if (kind == k_run)
+                {
+                    const u8        shift_amt = records.get_u8();
+                    const VoxelType type      = records.get_u8();
+                    const glm::vec3 min(pos);
+                    tree.fill_aabb(
+                        AABB(min, min + glm::vec3(4u << shift_amt)), type);
+                    continue;
+                }
+                if (kind != k_brick)
+                    throw std::runtime_error("Unknown S64Journal record");
+
+                // idx = x | z << 2 | y << 4
+                for (u64 mask = records.get<u64>(); mask; mask &= mask - 1)
+                {
+                    const u32 idx = CTZ64(mask);
+                    tree.set_voxel(
+                        pos.x + (idx & 3), pos.y + (idx >> 4), pos.z + ((idx >> 2) & 3),
+                        records.get_u8());
+                }
+            }
+        }
+    } // namespace
+
+    usize S64Journal::checkpoint()
+    {
+        points_entry_ = k_no_entry;
+        return bytes_.size();
+    }
+
+    void S64Journal::truncate(usize checkpoint)
+    {
+        if (checkpoint > bytes_.size())
+            throw std::runtime_error("S64Journal checkpoint past its end");
+        bytes_.resize(checkpoint);
+        points_entry_ = k_no_entry;
+    }
+
+    void S64Journal::replay(Sparse64Tree& tree, usize from) const
+    {
+        for (Entry& entry : parse(bytes_, from))
+        {
+            Reader&    in = entry.payload;
+            const auto op = static_cast<S64JournalOp>(entry.op & ~k_no_undo);
+            switch (op)
+            {
+            case S64JournalOp::Points:
+                for (const Point& p : read_points(in, !(entry.op & k_no_undo)))
+                    tree.set_voxel(p.pos.x, p.pos.y, p.pos.z, p.type);
+                break;
+            case S64JournalOp::FillAabb:
+                {
+                    const glm::vec3 min = in.get_vec3();
+                    const glm::vec3 max = in.get_vec3();
+                    tree.fill_aabb(AABB(min, max), in.get_u8());
+                    break;
+                }
+            case S64JournalOp::FillSphere:
+                {
+                    const glm::vec3 center = in.get_vec3();
+                    const f32       radius = in.get<f32>();
+                    tree.fill_sphere(center, radius, in.get_u8());
+                    break;
+                }
+            case S64JournalOp::FillCylinder:
+                {
+                    const glm::vec3 p0     = in.get_vec3();
+                    const glm::vec3 p1     = in.get_vec3();
+                    const f32       radius = in.get<f32>();
+                    tree.fill_cylinder(p0, p1, radius, in.get_u8());
+                    break;
+                }
+            case S64JournalOp::Clear:
+                tree.clear();
+                break;
+            case S64JournalOp::Restore:
+                apply_records(tree, in.split(in.get<u32>()));
+                break;
+            default:
+                throw std::runtime_error("Unknown S64Journal op");
+            }
+        }
+    }
+
+    S64Journal S64Journal::inverse(usize from) const
+    {
+        std::vector<Entry> entries = parse(bytes_, from);
+
+        S64Journal inv;
+        for (auto it = entries.rbegin(); it != entries.rend(); ++it)
+        {
+            if (it->op & k_no_undo)
+                throw std::runtime_error("S64Journal entry without undo data");
+
+            Reader&    in = it->payload;
+            const auto op = static_cast<S64JournalOp>(it->op);
+            if (op == S64JournalOp::Points)
+            {
+                // newest first, swapping the written and overwritten types
+                const std::vector<Point> points = read_points(in, true);
+                for (auto p = points.rbegin(); p != points.rend(); ++p)
+                    inv.record_point(p->pos, p->old, p->type);
+                continue;
+            }
+
+            Reader after{};
+            if (op == S64JournalOp::Restore)
+                after = in.split(in.get<u32>());
+            else
+                in.split(param_size(op));
+
+            // the records are delta coded from the origin, so they copy over as is
+            const usize entry = inv.begin_entry(
+                S64JournalOp::Restore, op == S64JournalOp::Restore ? 0 : k_no_undo);
+            const usize size = inv.begin_size();
+            inv.bytes_.insert(inv.bytes_.end(), in.at, in.end);
+            inv.end_size(size);
+            inv.bytes_.insert(inv.bytes_.end(), after.at, after.end);
+            inv.end_entry(entry);
+        }
+
+        inv.checkpoint();
+        return inv;
+    }
+
+    S64Journal S64Journal::without_undo(usize from) const
+    {
+        S64Journal fwd;
+        for (Entry& entry : parse(bytes_, from))
+        {
+            Reader&    in = entry.payload;
+            const auto op = static_cast<S64JournalOp>(entry.op & ~k_no_undo);
+            const usize out = fwd.begin_entry(op, k_no_undo);
+            if (op == S64JournalOp::Points)
+            {
+                glm::uvec3 last(0);
+                for (const Point& p : read_points(in, !(entry.op & k_no_undo)))
+                {
+                    fwd.put_delta(p.pos, last);
+                    fwd.put_u8(p.type);
+                }
+            }
+            else
+            {
+                Reader params = op == S64JournalOp::Restore
+                    ? in.split(sizeof(u32) + Reader{ in.at, in.end }.get<u32>())
+                    : in.split(param_size(op));
+                fwd.bytes_.insert(fwd.bytes_.end(), params.at, params.end);
+            }
+            fwd.end_entry(out);
+        }
+        return fwd;
+    }
+
+    void S64Journal::undo(Sparse64Tree& tree, usize checkpoint)
+    {
+        const S64Journal reverting = inverse(checkpoint);
+
+        S64Journal* recording = tree.journal();
+        if (recording == this)
+            tree.set_journal(nullptr);
+        reverting.replay(tree);
+        tree.set_journal(recording);
+
+        truncate(checkpoint);
+    }
+
+    void S64Journal::record_point(const glm::uvec3& pos, VoxelType type, VoxelType old)
+    {
+        if (points_entry_ == k_no_entry)
+        {
+            points_entry_ = begin_entry(S64JournalOp::Points);
+            last_point_   = glm::uvec3(0);
+        }
+
+        put_delta(pos, last_point_);
+        put_u8(type);
+        put_u8(old);
+        end_entry(points_entry_);
+    }
+
+    usize S64Journal::begin_entry(S64JournalOp op, u8 flags)
+    {
+        points_entry_     = k_no_entry;
+        const usize entry = bytes_.size();
+        put_u8(static_cast<u8>(op) | flags);
+        begin_size();
+        return entry;
+    }
+
+    usize S64Journal::begin_size()
+    {
+        const usize at = bytes_.size();
+        bytes_.resize(at + sizeof(u32));
+        return at;
+    }
+
+    void S64Journal::end_size(usize at)
+    {
+        const u32 size = static_cast<u32>(bytes_.size() - at - sizeof(u32));
+        std::memcpy(bytes_.data() + at, &size, sizeof(u32));
+    }
+
+    void S64Journal::put_run(const glm::uvec3& pos, u8 shift_amt, VoxelType type)
+    {
+        put_u8(k_run);
+        put_delta(pos, last_record_);
+        put_u8(shift_amt);
+        put_u8(type);
+    }
+
+    void S64Journal::put_brick(const glm::uvec3& pos, u64 mask, const VoxelType* voxels)
+    {
+        put_u8(k_brick);
+        put_delta(pos, last_record_);
+        const usize at = bytes_.size();
+        bytes_.resize(at + sizeof(u64));
+        std::memcpy(bytes_.data() + at, &mask, sizeof(u64));
+        for (; mask; mask &= mask - 1)
+            put_u8(voxels[CTZ64(mask)]);
+    }
+
+    void S64Journal::put_f32(f32 val)
+    {
+        const usize at = bytes_.size();
+        bytes_.resize(at + sizeof(f32));
+        std::memcpy(bytes_.data() + at, &val, sizeof(f32));
+    }
+
+    void S64Journal::put_vec3(const glm::vec3& val)
+    {
+        put_f32(val.x);
+        put_f32(val.y);
+        put_f32(val.z);
+    }
+
+    void S64Journal::put_varint(u32 val)
+    {
+        while (val >= 0x80)
+        {
+            put_u8(static_cast<u8>(val) | 0x80);
+            val >>= 7;
+        }
+        put_u8(static_cast<u8>(val));
+    }
+
+    void S64Journal::put_delta(const glm::uvec3& pos, glm::uvec3& last)
+    {
+        // zigzag, so small steps either way take a byte
+        for (u32 axis = 0; axis < 3; ++axis)
+        {
+            const i32 delta = static_cast<i32>(pos[axis] - last[axis]);
+            put_varint(static_cast<u32>(delta << 1) ^ static_cast<u32>(delta >> 31));
+        }
+        last = pos;
+    }
+} // namespace v
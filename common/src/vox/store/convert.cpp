@@ -0,0 +1,208 @@
+#include <algorithm>
+#include <vector>
+#include <vox/store/64tree.h>
+#include <vox/store/dense_grid.h>
+#include <vox/store/svo.h>
+
+namespace v {
+    using Type = S64Node::Type;
+
+    namespace {
+        using SVO = SparseVoxelOctree128;
+
+        /// A brick of a Sparse64Tree, waiting to be written into an octree
+        struct PendingBrick {
+            glm::uvec3     pos;
+            const S64Node* node;
+        };
+
+        /// Copies the uniform parts of node into out, and queues its bricks
+        void copy_to_svo(
+            const S64Node& node, const glm::uvec3& pos, u32 extent, SVO& out,
+            std::vector<PendingBrick>& bricks)
+        {
+            if (pos.x >= SVO::size || pos.y >= SVO::size || pos.z >= SVO::size)
+                return;
+
+            switch (node.type)
+            {
+            case Type::Empty:
+                return;
+            case Type::SingleTypeLeaf:
+            {
+                const glm::uvec3 max = pos + extent;
+                out.fill_box(
+                    pos.x, pos.y, pos.z, max.x, max.y, max.z,
+                    VolumeOpImpl::voxel_to<VoxelType, SVO::voxel_t>(node.voxels[0]));
+                return;
+            }
+            case Type::Leaf:
+                bricks.push_back({ pos, &node });
+                return;
+            case Type::Regular:
+            {
+                const u32 child_extent = extent / 4;
+                for (u64 m = node.child_mask; m; m &= m - 1)
+                {
+                    const u32        idx = CTZ64(m);
+                    const glm::uvec3 offset(idx & 3, idx >> 4, (idx >> 2) & 3);
+                    copy_to_svo(
+                        node.child(idx), pos + offset * child_extent, child_extent, out,
+                        bricks);
+                }
+                return;
+            }
+            }
+        }
+    } // namespace
+
+    template <>
+    DenseGrid
+    VolumeOpImpl::to<SparseVoxelOctree128, DenseGrid>(const SparseVoxelOctree128& f)
+    {
+        using voxel_t = SparseVoxelOctree128::voxel_t;
+
+        std::vector<voxel_t> wide(SparseVoxelOctree128::dense_size);
+        f.decode_to_dense(wide);
+
+        DenseGrid ret(glm::uvec3(SparseVoxelOctree128::size));
+        auto      out = ret.voxels();
+        for (usize i = 0; i < wide.size(); ++i)
+            out[i] = voxel_to<voxel_t, DenseGrid::VoxelType>(wide[i]);
+        return ret;
+    }
+
+    template <>
+    SparseVoxelOctree128
+    VolumeOpImpl::to<DenseGrid, SparseVoxelOctree128>(const DenseGrid& f)
+    {
+        using voxel_t    = SparseVoxelOctree128::voxel_t;
+        constexpr u32 sz = SparseVoxelOctree128::size;
+
+        // the grid's rows, clipped and widened into the octree's layout
+        std::vector<voxel_t> wide(SparseVoxelOctree128::dense_size, 0);
+        const glm::uvec3     clip = glm::min(f.size(), glm::uvec3(sz));
+        for (u32 y = 0; y < clip.y; ++y)
+            for (u32 z = 0; z < clip.z; ++z)
+            {
+                const DenseGrid::VoxelType* row = &f.voxels()[f.index(0, y, z)];
+                std::copy(row, row + clip.x, wide.begin() + (z + sz * y) * sz);
+            }
+
+        SparseVoxelOctree128 ret;
+        ret.fill_from_dense(wide);
+        return ret;
+    }
+
+    template <>
+    SparseVoxelOctree128
+    VolumeOpImpl::to<Sparse64Tree, SparseVoxelOctree128>(const Sparse64Tree& f)
+    {
+        SVO                       ret;
+        std::vector<PendingBrick> bricks;
+        const u32 extent = static_cast<u32>(f.bounding_box().max.x);
+        copy_to_svo(f.root(), glm::uvec3(0), extent, ret, bricks);
+
+        // fills invalidate cursors, so the bricks go in after every fill. they come in
+        // traversal order, which keeps most of the cursor's path between voxels
+        SVO::Cursor cursor(ret);
+        for (const PendingBrick& brick : bricks)
+            for (u64 m = brick.node->child_mask; m; m &= m - 1)
+            {
+                const u32 i = CTZ64(m);
+                cursor.set(
+                    brick.pos.x + (i & 3), brick.pos.y + (i >> 4),
+                    brick.pos.z + ((i >> 2) & 3),
+                    voxel_to<VoxelType, SVO::voxel_t>(brick.node->voxels[i]));
+            }
+        return ret;
+    }
+
+    template <>
+    Sparse64Tree
+    VolumeOpImpl::to<SparseVoxelOctree128, Sparse64Tree>(const SparseVoxelOctree128& f)
+    {
+        Sparse64Tree              ret(f.bounding_box());
+        std::vector<S64VoxelEdit> edits;
+        f.for_each_leaf(
+            [&](i32 x, i32 y, i32 z, i32 extent, SVO::voxel_t value)
+            {
+                const VoxelType type = voxel_to<SVO::voxel_t, VoxelType>(value);
+                if (extent >= 4)
+                {
+                    const glm::vec3 min(x, y, z);
+                    ret.fill_aabb(AABB(min, min + static_cast<f32>(extent)), type);
+                    return;
+                }
+                for (i32 dy = 0; dy < extent; ++dy)
+                    for (i32 dz = 0; dz < extent; ++dz)
+                        for (i32 dx = 0; dx < extent; ++dx)
+                            edits.push_back({ glm::uvec3(x + dx, y + dy, z + dz), type });
+            });
+        ret.set_voxels(edits);
+        return ret;
+    }
+
+    template <>
+    DenseGrid VolumeOpImpl::to<Sparse64Tree, DenseGrid>(const Sparse64Tree& f)
+    {
+        DenseGrid ret(f.bounding_box());
+        f.extract_region(f.bounding_box(), ret.voxels());
+        return ret;
+    }
+
+    template <>
+    Sparse64Tree VolumeOpImpl::to<DenseGrid, Sparse64Tree>(const DenseGrid& f)
+    {
+        // blocks of this many voxels along each axis are checked for a single type
+        constexpr u32 block = 16;
+        // edits buffered before they're flushed into the tree
+        constexpr usize max_edits = 1 << 20;
+
+        Sparse64Tree              ret(f.bounding_box());
+        std::vector<S64VoxelEdit> edits;
+        const glm::uvec3          size   = f.size();
+        const auto                voxels = f.voxels();
+
+        for (u32 by = 0; by < size.y; by += block)
+            for (u32 bz = 0; bz < size.z; bz += block)
+                for (u32 bx = 0; bx < size.x; bx += block)
+                {
+                    const glm::uvec3 lo(bx, by, bz);
+                    const glm::uvec3 hi = glm::min(lo + block, size);
+
+                    const VoxelType first   = voxels[f.index(bx, by, bz)];
+                    bool            uniform = true;
+                    for (u32 y = lo.y; y < hi.y && uniform; ++y)
+                        for (u32 z = lo.z; z < hi.z && uniform; ++z)
+                        {
+                            const VoxelType* row = &voxels[f.index(lo.x, y, z)];
+                            uniform = std::all_of(
+                                row, row + (hi.x - lo.x),
+                                [&](VoxelType v) { return v == first; });
+                        }
+
+                    if (uniform)
+                    {
+                        if (first)
+                            ret.fill_aabb(AABB(glm::vec3(lo), glm::vec3(hi)), first);
+                        continue;
+                    }
+
+                    for (u32 y = lo.y; y < hi.y; ++y)
+                        for (u32 z = lo.z; z < hi.z; ++z)
+                            for (u32 x = lo.x; x < hi.x; ++x)
+                                if (const VoxelType v = voxels[f.index(x, y, z)])
+                                    edits.push_back({ glm::uvec3(x, y, z), v });
+
+                    if (edits.size() >= max_edits)
+                    {
+                        ret.set_voxels(edits);
+                        edits.clear();
+                    }
+                }
+
+        ret.set_voxels(edits);
+        return ret;
+    }
+} // namespace v
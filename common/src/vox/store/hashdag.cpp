@@ -0,0 +1,418 @@
+#include <algorithm>
+#include <numeric>
+#include <stdexcept>
+#include <vox/store/hashdag.h>
+#include "taskflow/algorithm/for_each.hpp"
+#include "taskflow/taskflow.hpp"
+
+namespace v {
+    namespace {
+        FORCEINLINE u32 hash_node(std::span<const u32> words)
+        {
+            u64 h = words.size();
+            for (u32 w : words)
+            {
+                h = (h ^ w) * 0x9E3779B97F4A7C15ull;
+                h ^= h >> 29;
+            }
+            return static_cast<u32>(h ^ (h >> 32));
+        }
+
+        /// Calls fn(i) for i in [0, count), on the executor if there is one
+        template <typename Fn>
+        void for_each_index(tf::Executor* executor, usize count, Fn&& fn)
+        {
+            if (!executor)
+            {
+                for (usize i = 0; i < count; ++i)
+                    fn(i);
+                return;
+            }
+            tf::Taskflow taskflow;
+            taskflow.for_each_index(usize(0), count, usize(1), fn);
+            executor->run(taskflow).wait();
+        }
+    } // namespace
+
+    HDAGNodes::HDAGNodes(u8 depth) : depth_(depth)
+    {
+        if (depth < 2 || depth > k_max_depth)
+            throw std::runtime_error("HDAG depth must be between 2 and 21");
+        levels_.resize(depth - 1);
+        full_.assign(depth - 1, k_empty);
+        for (u32 l = 0; l < levels_.size(); ++l)
+            levels_[l].buckets.resize(1u << std::min(3 * l + 6, k_max_bucket_bits));
+    }
+
+    u32 HDAGNodes::make_leaf(u64 mask)
+    {
+        if (!mask)
+            return k_empty;
+        const std::array<u32, 2> words{ static_cast<u32>(mask),
+                                        static_cast<u32>(mask >> 32) };
+        return find_or_add(leaf_level(), words);
+    }
+
+    u32 HDAGNodes::make_interior(u32 level, const std::array<u32, 8>& kids)
+    {
+        std::array<u32, 11> words;
+        const u32           first = 1 + count_words(level);
+        u32                 size  = first;
+        u32                 mask  = 0;
+        u64                 count = 0;
+        for (u32 i = 0; i < 8; ++i)
+            if (kids[i] != k_empty)
+            {
+                mask |= 1u << i;
+                count += voxel_count(level + 1, kids[i]);
+                words[size++] = kids[i];
+            }
+        if (!mask)
+            return k_empty;
+
+        words[0] = mask;
+        words[1] = static_cast<u32>(count);
+        if (first == 3)
+            words[2] = static_cast<u32>(count >> 32);
+        return find_or_add(level, std::span(words.data(), size));
+    }
+
+    u32 HDAGNodes::full(u32 level)
+    {
+        if (full_[level] != k_empty)
+        {
+            // not a root of collections, so a running one has to see it being reused
+            if (gc_.running)
+                shade(level, full_[level]);
+            return full_[level];
+        }
+        if (level == leaf_level())
+            return full_[level] = make_leaf(~0ull);
+        std::array<u32, 8> kids;
+        kids.fill(full(level + 1));
+        return full_[level] = make_interior(level, kids);
+    }
+
+    u32 HDAGNodes::find_or_add(u32 level, std::span<const u32> words)
+    {
+        Level&    lv     = levels_[level];
+        Bucket&   bucket = lv.buckets[hash_node(words) & (lv.buckets.size() - 1)];
+        const u32 size   = static_cast<u32>(words.size());
+
+        u32 ptr = k_empty;
+        for_each_in_bucket(
+            level, bucket,
+            [&](u32 at)
+            {
+                if (ptr == k_empty && node_words(level, lv.words[at]) == size &&
+                    std::equal(words.begin(), words.end(), lv.words.begin() + at))
+                    ptr = at;
+            });
+
+        if (ptr == k_empty)
+        {
+            if (bucket.last == k_empty || bucket.used + size > k_page_words)
+            {
+                const usize page = lv.words.size();
+                if (page + k_page_words >= k_empty)
+                    throw std::runtime_error("HDAG level is out of pointers");
+                lv.words.resize(page + k_page_words, 0);
+                lv.words[page] = k_empty;
+                if (bucket.last == k_empty)
+                    bucket.first = static_cast<u32>(page);
+                else
+                    lv.words[bucket.last] = static_cast<u32>(page);
+                bucket.last = static_cast<u32>(page);
+                bucket.used = 1;
+            }
+
+            ptr = bucket.last + bucket.used;
+            std::ranges::copy(words, lv.words.begin() + ptr);
+            bucket.used += size;
+            ++lv.nodes;
+            ++added_;
+            if (level != leaf_level())
+                lv.pointer_words += size - 1 - count_words(level);
+        }
+
+        // an old node an edit finds again while a collection runs is live, and so is
+        // everything below it, even if the root it was marked from no longer leads there
+        if (gc_.running)
+            shade(level, ptr);
+        return ptr;
+    }
+
+    void HDAGNodes::clear()
+    {
+        for (Level& level : levels_)
+        {
+            std::vector<u32>().swap(level.words);
+            std::ranges::fill(level.buckets, Bucket{});
+            level.nodes         = 0;
+            level.pointer_words = 0;
+        }
+        std::ranges::fill(full_, k_empty);
+        gc_            = {};
+        live_after_gc_ = 0;
+        root_          = k_empty;
+    }
+
+    usize HDAGNodes::node_count() const
+    {
+        usize count = 0;
+        for (const Level& level : levels_)
+            count += level.nodes;
+        return count;
+    }
+
+    usize HDAGNodes::live_node_count() const
+    {
+        std::vector<std::vector<bool>> seen(levels_.size());
+        for (u32 l = 0; l < levels_.size(); ++l)
+            seen[l].resize(levels_[l].words.size());
+
+        usize            count = 0;
+        std::vector<u32> level_nodes;
+        std::vector<u32> next{ root_ };
+        for (u32 l = 0; l < levels_.size(); ++l)
+        {
+            level_nodes.swap(next);
+            next.clear();
+            for (u32 ptr : level_nodes)
+            {
+                if (ptr == k_empty || seen[l][ptr])
+                    continue;
+                seen[l][ptr] = true;
+                ++count;
+                if (l != leaf_level())
+                    for (u32 kid : children(l, ptr))
+                        next.push_back(kid);
+            }
+        }
+        return count;
+    }
+
+    VoxelStoreStats HDAGNodes::stats() const
+    {
+        VoxelStoreStats stats{};
+        for (u32 l = 0; l < levels_.size(); ++l)
+        {
+            const Level& level = levels_[l];
+            (l == leaf_level() ? stats.brick_nodes : stats.interior_nodes) += level.nodes;
+            stats.pointer_bytes += level.pointer_words * sizeof(u32);
+            stats.reserved_bytes += level.words.capacity() * sizeof(u32) +
+                level.buckets.capacity() * sizeof(Bucket);
+        }
+        stats.brick_bytes = stats.brick_nodes * sizeof(u64);
+        return stats;
+    }
+
+    void HDAGNodes::gc_start()
+    {
+        if (gc_.running)
+            return;
+
+        gc_.running = true;
+        gc_.snapshot.resize(levels_.size());
+        gc_.marks.resize(levels_.size());
+        gc_.pending.resize(levels_.size());
+        for (u32 l = 0; l < levels_.size(); ++l)
+        {
+            gc_.snapshot[l] = levels_[l].words.size();
+            gc_.marks[l].assign(gc_.snapshot[l] / 64 + 1, 0);
+            gc_.pending[l].clear();
+        }
+
+        shade(0, root_);
+    }
+
+    void HDAGNodes::shade(u32 level, u32 ptr)
+    {
+        if (ptr == k_empty || ptr >= gc_.snapshot[level])
+            return;
+        u64&      word = gc_.marks[level][ptr >> 6];
+        const u64 bit  = 1ull << (ptr & 63);
+        if (word & bit)
+            return;
+        word |= bit;
+        if (level != leaf_level())
+            gc_.pending[level].push_back(ptr);
+    }
+
+    bool HDAGNodes::gc_step(usize budget, tf::Executor* executor)
+    {
+        if (!gc_.running)
+            return false;
+
+        // children of pending nodes are one level down, so a pass from the root
+        // reaches every pending node of this step
+        for (u32 l = 0; l < leaf_level() && budget; ++l)
+        {
+            std::vector<u32>& pending = gc_.pending[l];
+            for (; !pending.empty() && budget; --budget)
+            {
+                const u32 ptr = pending.back();
+                pending.pop_back();
+                for (u32 kid : children(l, ptr))
+                    shade(l + 1, kid);
+            }
+        }
+
+        if (std::ranges::any_of(gc_.pending, [](const auto& p) { return !p.empty(); }))
+            return true;
+
+        compact(executor);
+        gc_            = {};
+        live_after_gc_ = node_count();
+        return false;
+    }
+
+    bool HDAGNodes::pace_gc()
+    {
+        const usize added = added_ - paced_;
+        paced_            = added_;
+        if (!auto_gc_)
+            return false;
+
+        if (!gc_.running)
+        {
+            if (node_count() < std::max(k_gc_min_nodes, k_gc_growth * live_after_gc_))
+                return false;
+            gc_start();
+        }
+        return !gc_step(k_gc_work * added + 1, nullptr);
+    }
+
+    void HDAGNodes::compact(tf::Executor* executor)
+    {
+        // new pointer of each live node of the level below, indexed by its old one
+        std::vector<u32> below;
+
+        for (u32 l = leaf_level() + 1; l-- > 0;)
+        {
+            Level&    old     = levels_[l];
+            const u32 first   = l == leaf_level() ? 0 : 1 + count_words(l);
+            auto      is_live = [&](u32 ptr)
+            {
+                return ptr >= gc_.snapshot[l] ||
+                    ((gc_.marks[l][ptr >> 6] >> (ptr & 63)) & 1);
+            };
+
+            // live nodes, with the words they will have once their children moved
+            std::vector<u32> live;
+            live.reserve(old.nodes);
+            for (const Bucket& bucket : old.buckets)
+                for_each_in_bucket(
+                    l, bucket,
+                    [&](u32 ptr)
+                    {
+                        if (is_live(ptr))
+                            live.push_back(ptr);
+                    });
+
+            Level fresh;
+            fresh.buckets.resize(old.buckets.size());
+            const u32 bucket_mask = static_cast<u32>(fresh.buckets.size() - 1);
+
+            auto new_words = [&](u32 ptr, std::array<u32, 11>& words)
+            {
+                const u32 size = node_words(l, old.words[ptr]);
+                std::copy_n(old.words.begin() + ptr, size, words.begin());
+                for (u32 w = first; l != leaf_level() && w < size; ++w)
+                    words[w] = below[words[w]];
+                return size;
+            };
+
+            // group the live nodes by the bucket they hash to
+            std::vector<u32> bucket_of(live.size());
+            for_each_index(
+                executor, live.size(),
+                [&](usize i)
+                {
+                    std::array<u32, 11> words;
+                    const u32           size = new_words(live[i], words);
+                    bucket_of[i] = hash_node(std::span(words.data(), size)) & bucket_mask;
+                });
+
+            std::vector<u32> bucket_start(fresh.buckets.size() + 1, 0);
+            for (u32 b : bucket_of)
+                ++bucket_start[b + 1];
+            std::partial_sum(
+                bucket_start.begin(), bucket_start.end(), bucket_start.begin());
+            std::vector<u32> order(live.size());
+            {
+                std::vector<u32> cursor(bucket_start.begin(), bucket_start.end() - 1);
+                for (u32 i = 0; i < live.size(); ++i)
+                    order[cursor[bucket_of[i]]++] = i;
+            }
+
+            // pages each bucket needs, packing its nodes the way find_or_add does
+            std::vector<u32> pages(fresh.buckets.size() + 1, 0);
+            for_each_index(
+                executor, fresh.buckets.size(),
+                [&](usize b)
+                {
+                    u32 used = k_page_words;
+                    for (u32 o = bucket_start[b]; o < bucket_start[b + 1]; ++o)
+                    {
+                        const u32 size = node_words(l, old.words[live[order[o]]]);
+                        if (used + size > k_page_words)
+                        {
+                            ++pages[b + 1];
+                            used = 1;
+                        }
+                        used += size;
+                    }
+                });
+            std::partial_sum(pages.begin(), pages.end(), pages.begin());
+
+            fresh.words.resize(static_cast<usize>(pages.back()) * k_page_words, 0);
+            std::vector<u32> remap(old.words.size());
+
+            for_each_index(
+                executor, fresh.buckets.size(),
+                [&](usize b)
+                {
+                    Bucket& bucket = fresh.buckets[b];
+                    for (u32 o = bucket_start[b]; o < bucket_start[b + 1]; ++o)
+                    {
+                        std::array<u32, 11> words;
+                        const u32           ptr  = live[order[o]];
+                        const u32           size = new_words(ptr, words);
+                        if (bucket.last == k_empty || bucket.used + size > k_page_words)
+                        {
+                            const u32 page =
+                                bucket.last == k_empty ? pages[b] * k_page_words
+                                                       : bucket.last + k_page_words;
+                            fresh.words[page] = k_empty;
+                            if (bucket.last == k_empty)
+                                bucket.first = page;
+                            else
+                                fresh.words[bucket.last] = page;
+                            bucket.last = page;
+                            bucket.used = 1;
+                        }
+                        const u32 at = bucket.last + bucket.used;
+                        std::copy_n(words.begin(), size, fresh.words.begin() + at);
+                        bucket.used += size;
+                        remap[ptr] = at;
+                    }
+                });
+
+            fresh.nodes         = live.size();
+            fresh.pointer_words = 0;
+            if (l != leaf_level())
+                for (u32 ptr : live)
+                    fresh.pointer_words += std::popcount(old.words[ptr]);
+
+            // full nodes nothing uses anymore are dropped like any other
+            if (full_[l] != k_empty)
+                full_[l] = is_live(full_[l]) ? remap[full_[l]] : k_empty;
+            if (l == 0 && root_ != k_empty)
+                root_ = remap[root_];
+
+            old   = std::move(fresh);
+            below = std::move(remap);
+        }
+    }
+} // namespace v
@@ -103,4 +103,30 @@ namespace v {
         auto& chunk   = const_cast<WorldDomain*>(this)->get_or_create_chunk(cp);
         chunk.set(lp, value);
     }
+
+    void WorldDomain::fill_box(WorldPos min, WorldPos max, u16 value)
+    {
+        if (min.x >= max.x || min.y >= max.y || min.z >= max.z)
+            return;
+
+        const i32      cs = k_chunk_size;
+        const ChunkPos lo = world_to_chunk(min).first;
+        const ChunkPos hi = world_to_chunk({ max.x - 1, max.y - 1, max.z - 1 }).first;
+        for (i32 cy = lo.y; cy <= hi.y; ++cy)
+            for (i32 cz = lo.z; cz <= hi.z; ++cz)
+                for (i32 cx = lo.x; cx <= hi.x; ++cx)
+                {
+                    const ChunkPos cp{ cx, cy, cz };
+                    ChunkDomain*   chunk =
+                        value != 0 ? &get_or_create_chunk(cp) : try_get_chunk(cp);
+                    if (!chunk)
+                        continue;
+
+                    // the box relative to the chunk, which clips it
+                    const WorldPos o{ cx * cs, cy * cs, cz * cs };
+                    chunk->fill_box(
+                        { min.x - o.x, min.y - o.y, min.z - o.z },
+                        { max.x - o.x, max.y - o.y, max.z - o.z }, value);
+                }
+    }
 } // namespace v
@@ -0,0 +1,3 @@
+#pragma once
+
+#include <vox/mesh/greedy.h>
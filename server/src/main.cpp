@@ -63,6 +63,8 @@ int main(int argc, char** argv)
 
         engine.tick();
 
+        V_PROFILE_PLOT_STORE_STATS("world", world.chunk_stats());
+
         if (const auto sleep_time = stopwatch.until(SERVER_UPDATE_RATE); sleep_time > 0)
             time::sleep_ms(sleep_time * 1000);
     }
@@ -1,9 +1,68 @@
+#include <engine/contexts/async/async.h>
 #include <test.h>
 #include <time/stopwatch.h>
+#include <cmath>
+#include <fstream>
 #include <vox/store/64tree.h>
+#include <vox/store/64tree_file.h>
+#include <vox/store/64tree_journal.h>
 
 using namespace v;
 
+/// Looks up a voxel by walking the flattened gpu buffers of the tree
+static VoxelType flat_voxel(const Sparse64Tree& tree, u32 x, u32 y, u32 z)
+{
+    const auto& nodes  = tree.gpu_nodes();
+    const auto& bricks = tree.gpu_bricks();
+    u32         shift  = CTZ(static_cast<u32>(tree.bounding_box().max.x) >> 2);
+
+    const GS64Node* node = &nodes[0];
+    while (true)
+    {
+        const auto type = static_cast<S64Node::Type>(node->payload & 0xff);
+        if (type == S64Node::Type::Empty)
+            return 0;
+        if (type == S64Node::Type::SingleTypeLeaf)
+            return static_cast<VoxelType>(node->payload >> 8);
+
+        const u32 idx =
+            S64Node::get_idx((x >> shift) & 3, (y >> shift) & 3, (z >> shift) & 3);
+        if (!(node->child_mask & (1ull << idx)))
+            return 0;
+        if (type == S64Node::Type::Leaf)
+            return bricks[node->first_child * 64ull + idx];
+
+        node = &nodes
+            [node->first_child + POPCOUNT64(node->child_mask & ((1ull << idx) - 1))];
+        shift -= 2;
+    }
+}
+
+/// Compares the flattened gpu buffers of two trees
+static bool same_flat(const Sparse64Tree& a, const Sparse64Tree& b)
+{
+    const auto& an = a.gpu_nodes();
+    const auto& bn = b.gpu_nodes();
+    if (an.size() != bn.size() || a.gpu_bricks() != b.gpu_bricks())
+        return false;
+
+    for (usize i = 0; i < an.size(); ++i)
+        if (an[i].child_mask != bn[i].child_mask ||
+            an[i].first_child != bn[i].first_child || an[i].payload != bn[i].payload)
+            return false;
+
+    return true;
+}
+
+/// Returns every voxel of a tree, for comparing trees built in different ways
+static std::vector<VoxelType> dense_voxels(const Sparse64Tree& tree)
+{
+    const u32              extent = static_cast<u32>(tree.bounding_box().max.x);
+    std::vector<VoxelType> voxels(static_cast<usize>(extent) * extent * extent);
+    tree.extract_region(tree.bounding_box(), voxels);
+    return voxels;
+}
+
 int main()
 {
     auto [engine, tctx] = testing::init_test("64tree");
@@ -196,6 +255,1074 @@ int main()
         tctx.assert_now(tree.get_voxel(7, 7, 7) == 42, "corner of region unchanged");
     }
 
+    {
+        Sparse64Tree tree(3);
+        tree.fill_aabb(AABB(glm::vec3(0), glm::vec3(64)), 3);
+        tree.set_voxel(20, 30, 40, 8);
+        tctx.assert_now(
+            tree.get_voxel(20, 30, 40) == 8, "set_voxel inside filled upper node");
+        tctx.assert_now(
+            tree.get_voxel(21, 30, 40) == 3, "filled upper node keeps its siblings");
+        tctx.assert_now(tree.get_voxel(63, 0, 63) == 3, "filled upper node far corner");
+        tree.set_voxel(20, 30, 40, 3);
+        tctx.assert_now(tree.node_count() == 1, "uniform tree collapses into the root");
+    }
+
+    {
+        Sparse64Tree tree(4);
+        tree.fill_sphere(glm::vec3(128), 100.0f, 20);
+        tree.fill_sphere(glm::vec3(128), 40.0f, 0);
+        tctx.assert_now(tree.get_voxel(128, 128, 128) == 0, "carve clears the center");
+        tctx.assert_now(tree.get_voxel(128, 128, 218) == 20, "carve keeps the shell");
+        tctx.assert_now(tree.get_voxel(218, 128, 128) == 20, "carve keeps the shell x");
+
+        usize nodes = tree.node_count();
+        tree.compact();
+        tctx.assert_now(tree.node_count() == nodes, "compact keeps every node");
+        tctx.assert_now(tree.get_voxel(128, 128, 218) == 20, "compact keeps contents");
+    }
+
+    {
+        Sparse64Tree tree(3);
+        tree.fill_cylinder(glm::vec3(0, 32, 32), glm::vec3(64, 32, 32), 6.0f, 4);
+        tctx.assert_now(
+            tree.get_voxel(40, 32, 36) == 4, "cylinder fills off axis voxels");
+        tctx.assert_now(tree.get_voxel(40, 32, 40) == 0, "cylinder respects its radius");
+    }
+
+    {
+        Sparse64Tree tree(4);
+        tree.fill_sphere(glm::vec3(128), 60.0f, 4);
+        const u32 since = tree.epoch();
+
+        u32 regions = 0;
+        tree.for_each_changed(since, [&](const glm::uvec3&, u32) { ++regions; });
+        tctx.assert_now(regions == 0, "no changes reported after the last epoch");
+
+        tree.set_voxel(10, 20, 30, 1);
+        tree.set_voxel(128, 128, 128, 9);
+        tree.set_voxel(128, 128, 128, 9);
+
+        bool covers_first = false, covers_second = false;
+        u64  volume       = 0;
+        tree.for_each_changed(
+            since,
+            [&](const glm::uvec3& min, u32 extent)
+            {
+                auto covers = [&](glm::uvec3 p)
+                {
+                    return p.x >= min.x && p.y >= min.y && p.z >= min.z &&
+                        p.x < min.x + extent && p.y < min.y + extent &&
+                        p.z < min.z + extent;
+                };
+                covers_first |= covers(glm::uvec3(10, 20, 30));
+                covers_second |= covers(glm::uvec3(128));
+                volume += static_cast<u64>(extent) * extent * extent;
+            });
+        tctx.assert_now(covers_first && covers_second, "changed voxels are reported");
+        tctx.assert_now(volume == 2 * 64, "changes are reported as single bricks");
+
+        const u32 after_sets = tree.epoch();
+        tree.fill_sphere(glm::vec3(128), 20.0f, 0);
+        regions         = 0;
+        bool near_carve = true;
+        tree.for_each_changed(
+            after_sets,
+            [&](const glm::uvec3& min, u32 extent)
+            {
+                ++regions;
+                // the carve can't reach the corner bricks of the tree
+                near_carve &= min.x + extent > 64 && min.x < 192;
+            });
+        tctx.assert_now(regions > 0, "carving reports changes");
+        tctx.assert_now(near_carve, "carve reports stay near the carve");
+
+        tree.fill_sphere(glm::vec3(128), 60.0f, 4);
+        const u32 refilled = tree.epoch();
+        tree.fill_sphere(glm::vec3(128), 10.0f, 4);
+        regions = 0;
+        tree.for_each_changed(refilled, [&](const glm::uvec3&, u32) { ++regions; });
+        tctx.assert_now(regions == 0, "filling with the same type is not a change");
+    }
+
+    {
+        // off grid shapes, so every brick along the surface is partially covered
+        Sparse64Tree    tree(3);
+        const glm::vec3 center(23.3f, 30.7f, 27.1f);
+        const glm::vec3 p0(5.2f, 44.6f, 12.9f), p1(58.1f, 9.4f, 50.3f);
+        tree.fill_sphere(center, 13.6f, 1);
+        tree.fill_cylinder(p0, p1, 4.3f, 2);
+
+        const glm::vec3 axis   = glm::normalize(p1 - p0);
+        const f32       length = glm::length(p1 - p0);
+        u32             wrong  = 0;
+        for (u32 x = 0; x < 64; ++x)
+            for (u32 y = 0; y < 64; ++y)
+                for (u32 z = 0; z < 64; ++z)
+                {
+                    const glm::vec3 p = glm::vec3(x, y, z) + glm::vec3(0.5f);
+                    const f32       t = glm::dot(p - p0, axis);
+                    const glm::vec3 d = p - p0 - axis * t;
+                    const glm::vec3 c = p - center;
+
+                    VoxelType expected = 0;
+                    if (t >= 0 && t <= length && glm::dot(d, d) <= 4.3f * 4.3f)
+                        expected = 2;
+                    else if (glm::dot(c, c) <= 13.6f * 13.6f)
+                        expected = 1;
+                    wrong += tree.get_voxel(x, y, z) != expected;
+                }
+        tctx.assert_now(wrong == 0, "brick kernels match a per voxel test");
+    }
+
+    {
+        Sparse64Tree              tree(3);
+        std::vector<S64VoxelEdit> edits{
+            { { 5, 6, 7 }, 42 },  { { 63, 0, 63 }, 3 }, { { 5, 6, 7 }, 43 },
+            { { 64, 0, 0 }, 9 },  { { 1, 1, 1 }, 0 },   { { 20, 20, 20 }, 8 },
+            { { 20, 20, 20 }, 0 },
+        };
+        tree.set_voxels(edits);
+        tctx.assert_now(tree.get_voxel(5, 6, 7) == 43, "set_voxels: last edit wins");
+        tctx.assert_now(tree.get_voxel(63, 0, 63) == 3, "set_voxels: edits applied");
+        tctx.assert_now(tree.get_voxel(20, 20, 20) == 0, "set_voxels: later clear wins");
+        tctx.assert_now(
+            tree.node_count() == 5, "set_voxels: cleared voxels leave no nodes");
+
+        std::vector<S64VoxelEdit> block;
+        for (u32 x = 0; x < 16; ++x)
+            for (u32 y = 0; y < 16; ++y)
+                for (u32 z = 0; z < 16; ++z)
+                    block.push_back({ { x, y, z }, 7 });
+        tree.set_voxels(block);
+        tctx.assert_now(tree.get_voxel(15, 15, 15) == 7, "set_voxels: block filled");
+        tctx.assert_now(tree.node_count() == 4, "set_voxels: full block collapses");
+    }
+
+    {
+        Sparse64Tree tree(3);
+        tree.set_voxel(40, 10, 10, 6);
+        tree.fill_aabb(AABB(glm::vec3(16), glm::vec3(32)), 2);
+
+        auto hit = tree.raycast(glm::vec3(0.5f, 10.5f, 10.5f), glm::vec3(1, 0, 0));
+        tctx.assert_now(
+            hit && hit->type == 6 && hit->voxel == glm::uvec3(40, 10, 10),
+            "raycast: hits the voxel in its path");
+        tctx.assert_now(
+            hit && hit->normal == glm::ivec3(-1, 0, 0) &&
+                std::abs(hit->dist - 39.5f) < 1e-4f,
+            "raycast: reports the entry face and distance");
+
+        hit = tree.raycast(glm::vec3(24.5f, 100.f, 20.5f), glm::vec3(0, -1, 0));
+        tctx.assert_now(
+            hit && hit->type == 2 && hit->voxel == glm::uvec3(24, 31, 20) &&
+                hit->normal == glm::ivec3(0, 1, 0),
+            "raycast: stops on the face of a single type node");
+
+        tctx.assert_now(
+            !tree.raycast(glm::vec3(0.5f, 10.5f, 10.5f), glm::vec3(1, 0, 0), 30.f),
+            "raycast: respects max_dist");
+        tctx.assert_now(
+            !tree.raycast(glm::vec3(0.5f, 60.5f, 0.5f), glm::vec3(1, 0, 1)),
+            "raycast: misses through empty space");
+
+        hit = tree.raycast(glm::vec3(20.5f), glm::vec3(0, 0, 1));
+        tctx.assert_now(
+            hit && hit->dist == 0.f && hit->normal == glm::ivec3(0),
+            "raycast: starting inside a voxel hits it immediately");
+
+        std::vector<S64Ray> rays;
+        for (u32 i = 0; i < 200; ++i)
+        {
+            const f32 a = static_cast<f32>(i) * 0.37f;
+            rays.push_back(
+                { glm::vec3(-8.f, 24.f + 20.f * std::sin(a), 50.f * std::cos(a * 0.7f)),
+                  glm::vec3(1.f, std::cos(a), std::sin(a * 1.3f)), 200.f });
+        }
+        std::vector<S64RayHit> hits(rays.size());
+        tree.raycast(rays, hits);
+
+        bool matches = true;
+        u32  num_hits = 0;
+        for (usize i = 0; i < rays.size(); ++i)
+        {
+            auto single = tree.raycast(rays[i].origin, rays[i].dir, rays[i].max_dist);
+            matches &= single ? hits[i].type == single->type &&
+                    hits[i].voxel == single->voxel && hits[i].dist == single->dist
+                              : hits[i].type == 0;
+            num_hits += single.has_value();
+        }
+        tctx.assert_now(matches && num_hits > 0, "raycast: packets match single rays");
+    }
+
+    {
+        Sparse64Tree tree(3);
+        tree.fill_sphere(glm::vec3(30, 34, 28), 20.0f, 4);
+        tree.fill_aabb(AABB(glm::vec3(0), glm::vec3(16)), 9);
+        tree.fill_aabb(AABB(glm::vec3(3, 5, 7), glm::vec3(9, 11, 13)), 0);
+        for (u32 i = 0; i < 500; ++i)
+            tree.set_voxel((i * 37) % 64, (i * 11) % 64, (i * 23) % 64, i % 7);
+
+        // sticks out of the tree on both ends
+        const glm::ivec3       min(-5, 2, -3);
+        const glm::ivec3       max(40, 70, 66);
+        const glm::ivec3       size = max - min;
+        std::vector<VoxelType> dense(size.x * size.y * size.z, 0xff);
+        tree.extract_region(AABB(glm::vec3(min), glm::vec3(max)), dense);
+
+        bool matches = true;
+        for (i32 y = 0; y < size.y; ++y)
+            for (i32 z = 0; z < size.z; ++z)
+                for (i32 x = 0; x < size.x; ++x)
+                {
+                    const glm::ivec3 p      = min + glm::ivec3(x, y, z);
+                    const bool       inside = p.x >= 0 && p.y >= 0 && p.z >= 0 &&
+                        p.x < 64 && p.y < 64 && p.z < 64;
+                    const VoxelType expected = inside ? tree.get_voxel(p) : 0;
+                    matches &= dense[x + size.x * (z + size.z * y)] == expected;
+                }
+        tctx.assert_now(matches, "extract_region: matches get_voxel");
+
+        std::vector<VoxelType> small(8, 0xff);
+        tree.extract_region(AABB(glm::vec3(3.5f), glm::vec3(4.5f)), small);
+        tctx.assert_now(
+            small[0] == tree.get_voxel(3, 3, 3) && small[7] == tree.get_voxel(4, 4, 4),
+            "extract_region: snaps the region outwards to whole voxels");
+    }
+
+    {
+        Sparse64Tree tree(3);
+        tctx.assert_now(
+            tree.begin() == tree.end() && tree.runs().begin() == tree.runs().end(),
+            "iterators: empty tree has nothing to iterate");
+
+        tree.fill_aabb(AABB(glm::vec3(0), glm::vec3(64)), 2);
+        u32 runs = 0;
+        for (const S64Run& run : tree.runs())
+            runs += run.extent == 64 && run.type == 2;
+        tctx.assert_now(runs == 1, "iterators: a full tree is a single run");
+
+        tree.clear();
+        tree.fill_sphere(glm::vec3(30, 34, 28), 20.0f, 4);
+        tree.fill_aabb(AABB(glm::vec3(0), glm::vec3(16)), 9);
+        for (u32 i = 0; i < 500; ++i)
+            tree.set_voxel((i * 37) % 64, (i * 11) % 64, (i * 23) % 64, i % 7);
+
+        std::vector<u8> seen(64 * 64 * 64, 0);
+        bool            matches = true;
+        usize           visited = 0;
+        for (const auto& [pos, type] : tree)
+        {
+            const usize i = pos.x + 64 * (pos.y + 64 * pos.z);
+            matches &= type != 0 && tree.get_voxel(pos) == type && seen[i] == 0;
+            seen[i] = 1;
+            ++visited;
+        }
+
+        usize solid = 0;
+        for (u32 z = 0; z < 64; ++z)
+            for (u32 y = 0; y < 64; ++y)
+                for (u32 x = 0; x < 64; ++x)
+                    solid += tree.get_voxel(x, y, z) != 0;
+        tctx.assert_now(
+            matches && visited == solid, "iterators: every solid voxel exactly once");
+
+        usize run_volume = 0;
+        usize num_runs   = 0;
+        for (const S64Run& run : tree.runs())
+        {
+            run_volume += static_cast<usize>(run.extent) * run.extent * run.extent;
+            ++num_runs;
+        }
+        tctx.assert_now(
+            run_volume == solid && num_runs < solid,
+            "iterators: runs cover the solid voxels, with fewer runs than voxels");
+    }
+
+    auto* async_ctx = engine->add_ctx<AsyncContext>(4);
+
+    {
+        Sparse64Tree tree(3);
+        tree.flatten(async_ctx->executor());
+        tctx.assert_now(tree.gpu_nodes().size() == 1, "empty tree flattens to its root");
+        tctx.assert_now(flat_voxel(tree, 1, 2, 3) == 0, "flattened empty tree is air");
+    }
+
+    {
+        Sparse64Tree tree(4);
+        tree.fill_sphere(glm::vec3(128), 90.0f, 6);
+        tree.fill_aabb(AABB(glm::vec3(0), glm::vec3(64)), 2);
+        tree.set_voxel(200, 17, 3, 9);
+        tree.flatten(async_ctx->executor());
+
+        tctx.assert_now(
+            tree.gpu_nodes().size() == tree.node_count(),
+            "flattened buffer is sized to the node count");
+
+        bool matches = true;
+        for (u32 z = 0; z < 256; z += 3)
+            for (u32 y = 0; y < 256; y += 3)
+                for (u32 x = 0; x < 256; ++x)
+                    matches &= flat_voxel(tree, x, y, z) == tree.get_voxel(x, y, z);
+        matches &= flat_voxel(tree, 200, 17, 3) == 9;
+        tctx.assert_now(matches, "flattened tree matches the tree");
+
+        tree.set_voxel(200, 17, 3, 0);
+        tree.flatten(async_ctx->executor());
+        tctx.assert_now(
+            flat_voxel(tree, 200, 17, 3) == 0, "edits dirty the flat buffers");
+    }
+
+    {
+        tf::Executor& executor = async_ctx->executor();
+        Sparse64Tree  serial(5);
+        Sparse64Tree  parallel(5);
+
+        serial.fill_sphere(glm::vec3(500, 480, 510), 300.0f, 3);
+        parallel.fill_sphere(glm::vec3(500, 480, 510), 300.0f, 3, executor);
+        serial.fill_aabb(AABB(glm::vec3(10, 20, 30), glm::vec3(700, 90, 1000)), 4);
+        parallel.fill_aabb(
+            AABB(glm::vec3(10, 20, 30), glm::vec3(700, 90, 1000)), 4, executor);
+        serial.fill_cylinder(glm::vec3(0, 0, 0), glm::vec3(1000, 900, 800), 40.0f, 0);
+        parallel.fill_cylinder(
+            glm::vec3(0, 0, 0), glm::vec3(1000, 900, 800), 40.0f, 0, executor);
+        serial.fill_sphere(glm::vec3(512, 512, 512), 100.0f, 0);
+        parallel.fill_sphere(glm::vec3(512, 512, 512), 100.0f, 0, executor);
+
+        serial.flatten(executor);
+        parallel.flatten(executor);
+        tctx.assert_now(
+            serial.node_count() == parallel.node_count(),
+            "parallel fills build as many nodes as serial fills");
+        tctx.assert_now(
+            same_flat(serial, parallel), "parallel fills build the same tree");
+        tctx.assert_now(
+            parallel.get_voxel(512, 512, 512) == 0 &&
+                parallel.get_voxel(500, 60, 500) == 4,
+            "parallel fills land where they should");
+
+        // the root collapses back into a single type once everything is carved away
+        parallel.fill_aabb(AABB(glm::vec3(0), glm::vec3(1024)), 0, executor);
+        tctx.assert_now(
+            parallel.node_count() == 0 && parallel.get_voxel(500, 60, 500) == 0,
+            "parallel carve of everything empties the tree");
+    }
+
+    {
+        tf::Executor& executor = async_ctx->executor();
+        Sparse64Tree  tree(5);
+        tctx.assert_now(tree.stats().node_count() == 0, "new tree has no nodes in stats");
+
+        bool counts_match = true;
+        auto check_counts = [&]
+        {
+            const VoxelStoreStats stats = tree.stats();
+            counts_match &= stats.node_count() == tree.node_count();
+            counts_match &=
+                stats.brick_bytes == stats.brick_nodes * sizeof(VoxelType) * 64;
+        };
+
+        tree.fill_sphere(glm::vec3(500, 480, 510), 300.0f, 3);
+        check_counts();
+        tree.fill_aabb(
+            AABB(glm::vec3(10, 20, 30), glm::vec3(700, 90, 1000)), 4, executor);
+        check_counts();
+        tree.fill_cylinder(
+            glm::vec3(0, 0, 0), glm::vec3(1000, 900, 800), 40.0f, 0, executor);
+        check_counts();
+        for (u32 i = 0; i < 5000; ++i)
+            tree.set_voxel((i * 137) % 1024, (i * 149) % 1024, (i * 163) % 1024, i % 5);
+        check_counts();
+
+        std::vector<S64VoxelEdit> edits;
+        for (u32 i = 0; i < 5000; ++i)
+            edits.push_back({ glm::uvec3((i * 71) % 1024, (i * 31) % 1024, i % 1024),
+                              static_cast<VoxelType>(i % 3) });
+        tree.set_voxels(edits);
+        check_counts();
+
+        const VoxelStoreStats stats = tree.stats();
+        LOG_TRACE(
+            "stats: {} interior, {} brick, {} uniform nodes, {} brick bytes, {} pointer "
+            "bytes, {} reserved bytes, {} collapses, {} expansions",
+            stats.interior_nodes, stats.brick_nodes, stats.uniform_nodes,
+            stats.brick_bytes, stats.pointer_bytes, stats.reserved_bytes,
+            stats.collapses, stats.expansions);
+        tctx.assert_now(counts_match, "stats node counts follow the tree through edits");
+        tctx.assert_now(
+            stats.collapses > 0 && stats.expansions > 0,
+            "stats count collapses and expansions");
+        tctx.assert_now(
+            stats.reserved_bytes >= stats.brick_bytes + stats.pointer_bytes,
+            "stats bytes are consistent");
+
+        tree.fill_aabb(AABB(glm::vec3(0), glm::vec3(1024)), 0, executor);
+        check_counts();
+        tctx.assert_now(
+            counts_match && tree.stats().node_count() == 0,
+            "stats empty out with the tree");
+
+        tree.set_voxel(1, 2, 3, 9);
+        tree.clear();
+        tctx.assert_now(tree.stats().node_count() == 0, "clear resets the stats");
+    }
+
+    {
+        tf::Executor& executor = async_ctx->executor();
+        Sparse64Tree  tree(4);
+        tree.fill_sphere(glm::vec3(128, 128, 128), 90.0f, 2);
+        tree.fill_aabb(AABB(glm::vec3(0, 0, 0), glm::vec3(256, 40, 256)), 5);
+
+        const AABB             whole(glm::vec3(0), glm::vec3(256));
+        std::vector<VoxelType> before(256 * 256 * 256);
+        tree.extract_region(whole, before);
+        const usize nodes_before = tree.node_count();
+
+        Sparse64Tree::Snapshot snap = tree.snapshot();
+        tree.set_voxel(128, 128, 128, 7);
+        tree.fill_sphere(glm::vec3(60, 30, 60), 20.0f, 0, executor);
+        tree.set_voxels(std::vector<S64VoxelEdit>{ { glm::uvec3(1, 2, 3), 4 },
+                                                   { glm::uvec3(200, 200, 9), 1 } });
+        tree.fill_aabb(AABB(glm::vec3(100), glm::vec3(130)), 3);
+
+        std::vector<VoxelType> after(before.size());
+        snap->extract_region(whole, after);
+        tctx.assert_now(after == before, "edits don't show through a snapshot");
+        tctx.assert_now(
+            snap->node_count() == nodes_before, "snapshot keeps its nodes after edits");
+        tctx.assert_now(
+            tree.get_voxel(128, 128, 128) == 3 && tree.get_voxel(60, 30, 60) == 0 &&
+                tree.get_voxel(1, 2, 3) == 4 && snap->get_voxel(60, 30, 60) == 5,
+            "tree takes edits while a snapshot is alive");
+
+        Sparse64Tree::Snapshot cleared = tree.snapshot();
+        tree.clear();
+        tree.compact();
+        snap->extract_region(whole, after);
+        tctx.assert_now(
+            after == before && cleared->get_voxel(128, 128, 128) == 3,
+            "snapshots survive clear and compact");
+        snap.reset();
+        cleared.reset();
+
+        // released snapshots give their blocks back, so taking one per edit doesn't
+        // grow the tree
+        tree.fill_sphere(glm::vec3(128, 128, 128), 90.0f, 2);
+        tree.set_voxel(0, 0, 0, 1);
+        const usize reserved = tree.memory_usage();
+        for (u32 i = 0; i < 200; ++i)
+        {
+            Sparse64Tree::Snapshot frame = tree.snapshot();
+            tree.set_voxel((i * 37) % 256, (i * 53) % 256, (i * 11) % 256, i % 4);
+        }
+        tree.set_voxel(0, 0, 0, 2);
+        tctx.assert_now(
+            tree.memory_usage() == reserved, "released snapshots don't hold memory");
+        tctx.assert_now(
+            tree.stats().node_count() == tree.node_count(),
+            "copied blocks keep the stats in step");
+    }
+
+    {
+        // readers on the executor while the main thread keeps editing
+        tf::Executor& executor = async_ctx->executor();
+        Sparse64Tree  tree(4);
+        tree.fill_sphere(glm::vec3(128, 128, 128), 100.0f, 1);
+
+        auto solid_volume = [](const Sparse64Tree& t)
+        {
+            usize volume = 0;
+            for (const S64Run& run : t.runs())
+                volume += static_cast<usize>(run.extent) * run.extent * run.extent;
+            return volume;
+        };
+
+        // readers index into snaps, so it must never reallocate
+        std::vector<Sparse64Tree::Snapshot> snaps;
+        snaps.reserve(16);
+        std::vector<usize>             expected;
+        std::vector<usize>             counted(16);
+        std::vector<std::future<void>> readers;
+        for (u32 i = 0; i < 16; ++i)
+        {
+            snaps.push_back(tree.snapshot());
+            expected.push_back(solid_volume(*snaps.back()));
+            readers.push_back(
+                executor.async([&, i] { counted[i] = solid_volume(*snaps[i]); }));
+
+            tree.fill_sphere(
+                glm::vec3(i * 16, 128, 255 - i * 16), 30.0f, i % 2 ? 0 : 3, executor);
+            for (u32 j = 0; j < 500; ++j)
+                tree.set_voxel((i * 31 + j * 7) % 256, j % 256, (j * 13) % 256, 0);
+        }
+
+        for (auto& reader : readers)
+            reader.wait();
+        tctx.assert_now(
+            counted == expected, "readers see their snapshots while the tree is edited");
+    }
+
+    {
+        tf::Executor&               executor = async_ctx->executor();
+        const std::filesystem::path path =
+            std::filesystem::temp_directory_path() / "v_64tree_test.s64";
+
+        Sparse64Tree tree(4);
+        tree.fill_sphere(glm::vec3(128, 128, 128), 90.0f, 2);
+        tree.fill_aabb(AABB(glm::vec3(0, 0, 0), glm::vec3(256, 40, 256)), 5);
+        for (u32 i = 0; i < 3000; ++i)
+            tree.set_voxel((i * 137) % 256, (i * 149) % 256, (i * 163) % 256, i % 7);
+        tree.save(path);
+
+        bool view_matches = true;
+        {
+            S64TreeView view(path);
+            tctx.assert_now(
+                view.depth() == 4 && view.bounding_box().max == tree.bounding_box().max,
+                "view has the saved tree's bounds");
+            for (u32 i = 0; i < 20000; ++i)
+            {
+                const u32 x = (i * 7919) % 256;
+                const u32 y = (i * 104729) % 256;
+                const u32 z = (i * 31) % 256;
+                view_matches &= view.get_voxel(x, y, z) == tree.get_voxel(x, y, z);
+            }
+            tctx.assert_now(view_matches, "view reads the saved voxels in place");
+
+            Sparse64Tree loaded(view);
+            tree.flatten(executor);
+            loaded.flatten(executor);
+            tctx.assert_now(
+                loaded.stats().node_count() == tree.node_count() &&
+                    loaded.node_count() == tree.node_count(),
+                "loaded tree has as many nodes as the saved one");
+            tctx.assert_now(
+                view.nodes().size() == tree.gpu_nodes().size() &&
+                    view.bricks().size() == tree.gpu_bricks().size() &&
+                    same_flat(loaded, tree),
+                "loaded tree is the saved tree");
+
+            // loaded trees take edits like any other
+            loaded.set_voxel(128, 128, 128, 9);
+            loaded.fill_aabb(AABB(glm::vec3(0), glm::vec3(64)), 0);
+            tctx.assert_now(
+                loaded.get_voxel(128, 128, 128) == 9 &&
+                    loaded.get_voxel(10, 10, 10) == 0 &&
+                    loaded.get_voxel(100, 10, 100) == 5,
+                "loaded tree can be edited");
+        }
+
+        // a snapshot can be saved while the tree moves on
+        Sparse64Tree::Snapshot snap = tree.snapshot();
+        tree.fill_aabb(AABB(glm::vec3(0), glm::vec3(256)), 0);
+        snap->save(path);
+        {
+            S64TreeView view(path);
+            tctx.assert_now(
+                view.get_voxel(128, 128, 128) == snap->get_voxel(128, 128, 128) &&
+                    view.get_voxel(128, 128, 128) != 0,
+                "snapshots can be saved");
+        }
+
+        tree.save(path);
+        {
+            S64TreeView view(path);
+            tctx.assert_now(
+                view.nodes().size() == 1 && view.get_voxel(5, 5, 5) == 0,
+                "empty trees round trip");
+        }
+
+        {
+            std::ofstream file(path, std::ios::binary | std::ios::trunc);
+            file << "definitely not a tree, but long enough to hold a header";
+        }
+        bool threw = false;
+        try
+        {
+            S64TreeView view(path);
+        }
+        catch (const std::runtime_error&)
+        {
+            threw = true;
+        }
+        tctx.assert_now(threw, "views reject files that aren't trees");
+
+        // a brick count whose byte size wraps around to a small one
+        snap->save(path);
+        {
+            S64FileHeader header;
+            std::fstream  file(path, std::ios::binary | std::ios::in | std::ios::out);
+            file.read(reinterpret_cast<char*>(&header), sizeof(header));
+            header.brick_count = 1ull << 58;
+            file.seekp(0);
+            file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        }
+        threw = false;
+        try
+        {
+            S64TreeView view(path);
+        }
+        catch (const std::runtime_error&)
+        {
+            threw = true;
+        }
+        tctx.assert_now(threw, "views reject counts past the end of the file");
+        std::filesystem::remove(path);
+    }
+
+    {
+        Sparse64Tree tree(4);
+        tree.fill_sphere(glm::vec3(128, 128, 128), 90.0f, 2);
+        for (u32 i = 0; i < 3000; ++i)
+            tree.set_voxel((i * 137) % 256, (i * 149) % 256, (i * 163) % 256, i % 7);
+
+        // a scanline, then jumps all over the tree, then reads past the edges
+        Sparse64Tree::Cursor cursor(tree);
+        bool                 reads_match = true;
+        for (u32 x = 0; x < 256; ++x)
+            reads_match &= cursor.get(x, 128, 40) == tree.get_voxel(x, 128, 40);
+        for (u32 i = 0; i < 20000; ++i)
+        {
+            const glm::uvec3 pos((i * 7919) % 256, (i * 104729) % 256, (i * 31) % 256);
+            reads_match &= cursor.get(pos) == tree.get_voxel(pos.x, pos.y, pos.z);
+        }
+        reads_match &= cursor.get(256, 0, 0) == 0 && cursor.get(0, 0, ~0u) == 0;
+        tctx.assert_now(reads_match, "cursor reads match get_voxel");
+
+        // the same edits through a cursor and set_voxel, with snapshots taken in
+        // between, must build the same tree
+        Sparse64Tree twin(4);
+        twin.fill_sphere(glm::vec3(128, 128, 128), 90.0f, 2);
+        for (u32 i = 0; i < 3000; ++i)
+            twin.set_voxel((i * 137) % 256, (i * 149) % 256, (i * 163) % 256, i % 7);
+
+        std::vector<Sparse64Tree::Snapshot> snaps;
+        bool                                edits_match = true;
+        u32                                 state       = 7;
+        for (u32 round = 0; round < 8; ++round)
+        {
+            snaps.push_back(tree.snapshot());
+            Sparse64Tree::EditCursor edit(tree);
+            for (u32 i = 0; i < 4000; ++i)
+            {
+                state = state * 1664525u + 1013904223u;
+                // mostly small steps, so runs of edits share most of their path
+                const glm::uvec3 pos(
+                    (i / 256 * 17 + round * 40) % 256, (i / 16 + (state >> 28)) % 256,
+                    i % 16 + (state >> 30) * 60);
+                const VoxelType type = state >> 29 < 3 ? 0 : (state >> 24) % 3 + 1;
+                if (state >> 31)
+                    edits_match &= edit.get(pos) == twin.get_voxel(pos.x, pos.y, pos.z);
+                edit.set(pos, type);
+                twin.set_voxel(pos.x, pos.y, pos.z, type);
+            }
+        }
+        for (u32 i = 0; i < 20000; ++i)
+        {
+            const glm::uvec3 pos((i * 7919) % 256, (i * 104729) % 256, (i * 31) % 256);
+            edits_match &= tree.get_voxel(pos.x, pos.y, pos.z) ==
+                twin.get_voxel(pos.x, pos.y, pos.z);
+        }
+        tctx.assert_now(edits_match, "cursor edits match set_voxel");
+        tctx.assert_now(
+            tree.node_count() == twin.node_count() &&
+                tree.stats().node_count() == tree.node_count(),
+            "cursor edits prune and collapse like set_voxel");
+
+        // filling a brick voxel by voxel through a cursor collapses it
+        Sparse64Tree             small(2);
+        Sparse64Tree::EditCursor edit(small);
+        for (u32 z = 0; z < 16; ++z)
+            for (u32 y = 0; y < 16; ++y)
+                for (u32 x = 0; x < 16; ++x)
+                    edit.set(x, y, z, 4);
+        tctx.assert_now(
+            small.node_count() == 1 && edit.get(7, 7, 7) == 4,
+            "cursor writes collapse uniform nodes");
+    }
+
+    {
+        auto make_tree = [](u32 seed)
+        {
+            Sparse64Tree tree(3);
+            tree.fill_sphere(glm::vec3(20 + seed * 8, 30, 32), 18.0f, seed + 1);
+            tree.fill_aabb(AABB(glm::vec3(0, 0, 0), glm::vec3(64, 8 + seed * 4, 48)), 5);
+            tree.fill_aabb(AABB(glm::vec3(16, 16, 16), glm::vec3(32, 32, 32)), seed + 2);
+            u32 state = seed * 977 + 1;
+            for (u32 i = 0; i < 4000; ++i)
+            {
+                state = state * 1664525u + 1013904223u;
+                tree.set_voxel(
+                    (state >> 8) & 63, (state >> 14) & 63, (state >> 20) & 63,
+                    (state >> 26) % 4);
+            }
+            return tree;
+        };
+
+        const Sparse64Tree a = make_tree(1);
+        const Sparse64Tree b = make_tree(3);
+
+        const std::array<const char*, 3> names = { "subtract", "intersect", "join" };
+        for (CsgOp op : { CsgOp::Subtract, CsgOp::Intersect, CsgOp::Join })
+        {
+            const Sparse64Tree expected =
+                VolumeOpImpl::csg_voxelwise<Sparse64Tree>(op, a, b);
+            const Sparse64Tree result = op == CsgOp::Subtract ? a.subtract(b)
+                : op == CsgOp::Intersect                      ? a.intersect(b)
+                                                              : a.join(b);
+
+            bool matches = true;
+            for (u32 y = 0; y < 64; ++y)
+                for (u32 z = 0; z < 64; ++z)
+                    for (u32 x = 0; x < 64; ++x)
+                        matches &=
+                            result.get_voxel(x, y, z) == expected.get_voxel(x, y, z);
+            const char* name = names[static_cast<u8>(op)];
+            tctx.assert_now(matches, "csg {} matches the voxelwise result", name);
+            tctx.assert_now(
+                result.node_count() == expected.node_count() &&
+                    result.stats().node_count() == result.node_count(),
+                "csg {} leaves the tree collapsed", name);
+        }
+
+        // a snapshot joined back in restores what was carved out since
+        Sparse64Tree           tree = make_tree(2);
+        Sparse64Tree::Snapshot snap = tree.snapshot();
+        tree.fill_sphere(glm::vec3(32, 32, 32), 20.0f, 0);
+        tree.apply_csg(CsgOp::Join, *snap);
+        bool restored = true;
+        for (u32 i = 0; i < 20000; ++i)
+        {
+            const u32 x = (i * 7919) % 64, y = (i * 104729) % 64, z = (i * 31) % 64;
+            restored &= tree.get_voxel(x, y, z) == snap->get_voxel(x, y, z);
+        }
+        tctx.assert_now(
+            restored && tree.node_count() == snap->node_count(),
+            "csg joins a snapshot of the same tree");
+
+        tree.apply_csg(CsgOp::Subtract, tree);
+        tctx.assert_now(
+            tree.node_count() == 0, "subtracting a tree from itself empties it");
+
+        // trees of different depths go voxel by voxel
+        Sparse64Tree small(2);
+        small.fill_aabb(AABB(glm::vec3(0, 0, 0), glm::vec3(16, 16, 16)), 9);
+        const Sparse64Tree joined = small.join(a);
+        tctx.assert_now(
+            joined.bounding_box().max == a.bounding_box().max &&
+                joined.get_voxel(3, 3, 3) == 9 &&
+                joined.get_voxel(40, 2, 40) == a.get_voxel(40, 2, 40),
+            "csg between different depths falls back to voxels");
+
+        bool threw = false;
+        try
+        {
+            tree.apply_csg(CsgOp::Join, small);
+        }
+        catch (const std::runtime_error&)
+        {
+            threw = true;
+        }
+        tctx.assert_now(threw, "in place csg rejects trees of other depths");
+    }
+
+    {
+        Sparse64Tree tree(3);
+        tree.set_lod_tracking(true);
+        tree.fill_aabb(AABB(glm::vec3(0, 0, 0), glm::vec3(64, 32, 64)), 2);
+        tree.fill_aabb(AABB(glm::vec3(0, 0, 0), glm::vec3(64, 4, 64)), 3);
+        tree.set_voxel(1, 40, 1, 7);
+
+        const S64LodSample whole = tree.voxel_at_lod(glm::uvec3(5, 50, 5), 3);
+        tctx.assert_now(
+            whole.type == 2 && std::abs(whole.coverage - 0.5f) < 0.01f,
+            "lod of the whole tree is its majority type and coverage");
+        tctx.assert_now(
+            tree.voxel_at_lod(glm::uvec3(1, 2, 1), 1).type == 3 &&
+                tree.voxel_at_lod(glm::uvec3(1, 2, 1), 1).coverage == 1.f,
+            "lod of a full brick is its type");
+        const S64LodSample lone = tree.voxel_at_lod(glm::uvec3(0, 41, 0), 1);
+        tctx.assert_now(
+            lone.type == 7 && lone.coverage == 1.f / 64,
+            "lod of a brick with a single voxel");
+        tctx.assert_now(
+            tree.voxel_at_lod(glm::uvec3(1, 40, 1), 0).type == 7 &&
+                tree.voxel_at_lod(glm::uvec3(1, 41, 1), 0).type == 0,
+            "lod level 0 reads single voxels");
+
+        // tracked nodes agree with summing the tree up on the spot
+        Sparse64Tree twin(3);
+        for (Sparse64Tree* t : { &tree, &twin })
+        {
+            t->fill_sphere(glm::vec3(30, 30, 30), 20.0f, 4);
+            for (u32 i = 0; i < 3000; ++i)
+                t->set_voxel((i * 137) % 64, (i * 149) % 64, (i * 163) % 64, i % 5);
+            t->fill_sphere(glm::vec3(40, 20, 30), 10.0f, 0);
+        }
+        twin.fill_aabb(AABB(glm::vec3(0, 0, 0), glm::vec3(64, 32, 64)), 2);
+        tree.fill_aabb(AABB(glm::vec3(0, 0, 0), glm::vec3(64, 32, 64)), 2);
+        bool matches = true;
+        for (u32 i = 0; i < 5000; ++i)
+        {
+            const glm::uvec3   pos((i * 7919) % 64, (i * 104729) % 64, (i * 31) % 64);
+            const S64LodSample a = tree.voxel_at_lod(pos, i % 4);
+            const S64LodSample b = twin.voxel_at_lod(pos, i % 4);
+            matches &= a.type == b.type && a.coverage == b.coverage;
+        }
+        tctx.assert_now(matches, "tracked lod matches the lod summed on the spot");
+    }
+
+    {
+        const glm::vec3 center(30.3f, 31.7f, 29.1f);
+        auto            sphere = [&](const glm::vec3& p)
+        { return glm::length(p - center) - 17.3f; };
+
+        Sparse64Tree by_sdf(3);
+        Sparse64Tree by_shape(3);
+        by_sdf.fill_sdf(sphere, 6);
+        by_shape.fill_sphere(center, 17.3f, 6);
+        bool matches = by_sdf.node_count() == by_shape.node_count();
+        for (u32 i = 0; i < 20000; ++i)
+        {
+            const u32 x = (i * 7919) % 64, y = (i * 104729) % 64, z = (i * 31) % 64;
+            matches &= by_sdf.get_voxel(x, y, z) == by_shape.get_voxel(x, y, z);
+        }
+        tctx.assert_now(matches, "fill_sdf of a sphere matches fill_sphere");
+
+        // rolling terrain: a height field stretched vertically, so the distance can
+        // change faster than 1 per voxel
+        auto terrain = [](const glm::vec3& p)
+        {
+            return 2.0f *
+                (p.y - 24.0f - 8.0f * std::sin(p.x * 0.2f) * std::cos(p.z * 0.15f));
+        };
+        Sparse64Tree ground(3);
+        ground.fill_sdf(terrain, 3, 2.0f * 1.6f);
+        tctx.assert_now(
+            ground.stats().node_count() == ground.node_count(),
+            "sdf fill keeps the stats");
+
+        Sparse64Tree parallel(3);
+        parallel.fill_sdf(terrain, 3, async_ctx->executor(), 2.0f * 1.6f);
+
+        bool exact = parallel.node_count() == ground.node_count();
+        for (u32 y = 0; y < 64; ++y)
+            for (u32 z = 0; z < 64; ++z)
+                for (u32 x = 0; x < 64; ++x)
+                {
+                    const bool inside = terrain(glm::vec3(x, y, z) + 0.5f) <= 0.0f;
+                    exact &= ground.get_voxel(x, y, z) == (inside ? 3 : 0);
+                    exact &= parallel.get_voxel(x, y, z) == ground.get_voxel(x, y, z);
+                }
+        tctx.assert_now(exact, "fill_sdf fills exactly the voxels inside the sdf");
+
+        ground.fill_sdf(sphere, 0);
+        tctx.assert_now(
+            ground.get_voxel(30, 20, 29) == 0 && ground.get_voxel(30, 5, 60) == 3,
+            "fill_sdf carves with air");
+    }
+
+    {
+        // threads writing to their own slabs of the tree, some sharing a root child
+        tf::Executor& executor = async_ctx->executor();
+        auto          write_slab = [](auto&& set, u32 i)
+        {
+            for (u32 y = 100; y < 164; ++y)
+                for (u32 z = 100; z < 132; ++z)
+                    for (u32 x = i * 32; x < i * 32 + 32; ++x)
+                        set(x, y, z, (x * 7 + y * 3 + z) % 11 < 4 ? 0 : 1 + i % 3);
+            // a whole root child, which collapses
+            if (i == 7)
+                for (u32 y = 192; y < 256; ++y)
+                    for (u32 z = 192; z < 256; ++z)
+                        for (u32 x = 192; x < 256; ++x)
+                            set(x, y, z, 2);
+        };
+
+        Sparse64Tree serial(4);
+        Sparse64Tree concurrent(4);
+        serial.fill_sphere(glm::vec3(128, 128, 128), 100.0f, 1);
+        concurrent.fill_sphere(glm::vec3(128, 128, 128), 100.0f, 1);
+        for (u32 i = 0; i < 8; ++i)
+            write_slab(
+                [&](u32 x, u32 y, u32 z, u8 t) { serial.set_voxel(x, y, z, t); }, i);
+
+        Sparse64Tree::Snapshot before = concurrent.snapshot();
+        const usize            before_nodes = before->node_count();
+        const u32              since        = concurrent.epoch();
+        bool                   reads_back   = true;
+        {
+            Sparse64Tree::ConcurrentEdit edit(concurrent);
+            std::vector<std::future<void>> writers;
+            for (u32 i = 0; i < 8; ++i)
+                writers.push_back(executor.async(
+                    [&, i]
+                    {
+                        write_slab(
+                            [&](u32 x, u32 y, u32 z, u8 t)
+                            { edit.set_voxel(x, y, z, t); },
+                            i);
+                        write_slab(
+                            [&](u32 x, u32 y, u32 z, u8 t)
+                            {
+                                if (edit.get_voxel(x, y, z) != t)
+                                    reads_back = false;
+                            },
+                            i);
+                    }));
+            for (auto& writer : writers)
+                writer.wait();
+            edit.commit();
+        }
+        tctx.assert_now(reads_back, "concurrent edits read their own writes");
+
+        bool same_runs = serial.node_count() == concurrent.node_count();
+        auto a = serial.runs().begin(), b = concurrent.runs().begin();
+        for (; same_runs && a != serial.runs().end(); ++a, ++b)
+            same_runs &= b != concurrent.runs().end() && a->min == b->min &&
+                a->extent == b->extent && a->type == b->type;
+        tctx.assert_now(
+            same_runs && b == concurrent.runs().end(),
+            "concurrent edits build the same tree as serial ones");
+        tctx.assert_now(
+            concurrent.stats().node_count() == concurrent.node_count(),
+            "concurrent edits keep the stats");
+        tctx.assert_now(
+            before->node_count() == before_nodes && before->get_voxel(120, 120, 120) == 1,
+            "snapshots don't see concurrent edits");
+        tctx.assert_now(
+            concurrent.epoch() == since + 1, "a concurrent edit session is one edit");
+
+        // filling everything collapses the root once the session commits
+        Sparse64Tree small(2);
+        {
+            Sparse64Tree::ConcurrentEdit   edit(small);
+            std::vector<std::future<void>> writers;
+            for (u32 i = 0; i < 4; ++i)
+                writers.push_back(executor.async(
+                    [&, i]
+                    {
+                        for (u32 y = i * 4; y < i * 4 + 4; ++y)
+                            for (u32 z = 0; z < 16; ++z)
+                                for (u32 x = 0; x < 16; ++x)
+                                    edit.set_voxel(x, y, z, 4);
+                    }));
+            for (auto& writer : writers)
+                writer.wait();
+        }
+        tctx.assert_now(
+            small.node_count() == 1 && small.get_voxel(3, 15, 9) == 4,
+            "concurrent edits collapse the root on commit");
+
+        Sparse64Tree brick(1);
+        {
+            Sparse64Tree::ConcurrentEdit edit(brick);
+            edit.set_voxel(1, 2, 3, 5);
+            edit.set_voxel(9, 0, 0, 5);
+        }
+        tctx.assert_now(
+            brick.get_voxel(1, 2, 3) == 5 && brick.node_count() == 1,
+            "concurrent edits of a single brick tree");
+    }
+
+    {
+        tf::Executor& executor = async_ctx->executor();
+        auto          terrain  = [](const glm::vec3& p)
+        { return p.y - 20.0f - 6.0f * std::sin(p.x * 0.3f); };
+        auto base = [&](Sparse64Tree& t)
+        {
+            t.fill_sdf(terrain, 1, 1.0f + 6.0f * 0.3f);
+            t.fill_sphere(glm::vec3(40, 30, 20), 9.0f, 2);
+        };
+
+        Sparse64Tree tree(3);
+        base(tree);
+        S64Journal journal;
+        tree.set_journal(&journal);
+        const usize                  start    = journal.checkpoint();
+        const std::vector<VoxelType> original = dense_voxels(tree);
+
+        for (u32 i = 0; i < 300; ++i)
+            tree.set_voxel((i * 7) % 64, 10 + i % 30, (i * 13) % 64, i % 5);
+        Sparse64Tree::EditCursor cursor(tree);
+        for (u32 x = 10; x < 30; ++x)
+            cursor.set(x, 25, 30, 3);
+        tree.fill_sphere(glm::vec3(20, 20, 20), 12.0f, 4);
+        tree.fill_aabb(AABB(glm::vec3(50, 0, 0), glm::vec3(64, 40, 12)), 0, executor);
+
+        const usize                  middle  = journal.checkpoint();
+        const std::vector<VoxelType> halfway = dense_voxels(tree);
+
+        tree.fill_cylinder(glm::vec3(0, 32, 32), glm::vec3(64, 40, 20), 5.0f, 2);
+        std::vector<S64VoxelEdit> edits;
+        for (u32 i = 0; i < 500; ++i)
+            edits.push_back({ glm::uvec3((i * 31) % 64, (i * 17) % 64, i % 64), 6 });
+        tree.set_voxels(edits);
+        auto ball = [](const glm::vec3& p)
+        { return glm::length(p - glm::vec3(60, 60, 5)) - 7.0f; };
+        tree.fill_sdf(ball, 7);
+        Sparse64Tree tunnel(3);
+        tunnel.fill_cylinder(glm::vec3(0, 22, 40), glm::vec3(64, 22, 40), 3.0f, 1);
+        tree.apply_csg(CsgOp::Subtract, tunnel);
+        {
+            Sparse64Tree::ConcurrentEdit edit(tree);
+            for (u32 z = 0; z < 64; ++z)
+                edit.set_voxel(33, 33, z, 5);
+        }
+        const std::vector<VoxelType> final = dense_voxels(tree);
+
+        Sparse64Tree replica(3);
+        base(replica);
+        journal.replay(replica, start);
+        Sparse64Tree lean(3);
+        base(lean);
+        const S64Journal forward = journal.without_undo(start);
+        forward.replay(lean);
+        tctx.assert_now(
+            dense_voxels(replica) == final && dense_voxels(lean) == final &&
+                replica.node_count() == tree.node_count(),
+            "a replayed journal rebuilds the tree");
+        tctx.assert_now(
+            forward.bytes().size() < journal.bytes().size(),
+            "replicas get the journal without its undo data");
+
+        journal.inverse(middle).replay(replica);
+        tctx.assert_now(dense_voxels(replica) == halfway, "inverted journals undo");
+
+        journal.undo(tree, middle);
+        tctx.assert_now(
+            dense_voxels(tree) == halfway && journal.bytes().size() == middle,
+            "undo to a checkpoint");
+        journal.undo(tree, start);
+        tctx.assert_now(
+            dense_voxels(tree) == original && journal.empty() &&
+                tree.stats().node_count() == tree.node_count(),
+            "undo back to the start");
+
+        tree.clear();
+        tctx.assert_now(tree.node_count() == 0, "cleared");
+        journal.undo(tree, 0);
+        tctx.assert_now(dense_voxels(tree) == original, "undo a clear");
+
+        // shape fills cost their parameters, plus a run of air as their undo data
+        Sparse64Tree big(5);
+        S64Journal   fills;
+        big.set_journal(&fills);
+        big.fill_sphere(glm::vec3(512, 512, 512), 200.0f, 3);
+        tctx.assert_now(fills.bytes().size() < 32, "a sphere is journaled in bytes");
+
+        bool threw = false;
+        try
+        {
+            S64Journal({ 0, 9, 0, 0, 0, 1 }).replay(big);
+        }
+        catch (const std::runtime_error&)
+        {
+            threw = true;
+        }
+        tctx.assert_now(threw, "truncated journals are rejected");
+    }
+
     LOG_TRACE("--- Performance Benchmarks ---");
 
     {
@@ -214,9 +1341,29 @@ int main()
         tree.fill_sphere(glm::vec3(512, 512, 512), 200.0f, 10);
         f64 elapsed = sw.elapsed();
         LOG_TRACE("fill_sphere (radius 200): {:.3f}ms", elapsed * 1000.0);
+        LOG_TRACE(
+            "  {} nodes, {:.2f}MB reserved", tree.node_count(),
+            tree.memory_usage() / (1024.0 * 1024.0));
+
+        sw.reset();
+        tree.flatten(async_ctx->executor());
+        LOG_TRACE(
+            "  flatten: {:.3f}ms, {:.2f}MB", sw.elapsed() * 1000.0,
+            (tree.gpu_nodes().size() * sizeof(GS64Node) + tree.gpu_bricks().size()) /
+                (1024.0 * 1024.0));
         tctx.assert_now(tree.get_voxel(512, 512, 512) == 10, "benchmark: sphere filled");
     }
 
+    {
+        Sparse64Tree tree(6);
+        Stopwatch    sw;
+        tree.fill_sphere(glm::vec3(512, 512, 512), 200.0f, 10, async_ctx->executor());
+        f64 elapsed = sw.elapsed();
+        LOG_TRACE("fill_sphere (radius 200, parallel): {:.3f}ms", elapsed * 1000.0);
+        tctx.assert_now(
+            tree.get_voxel(512, 512, 512) == 10, "benchmark: parallel sphere filled");
+    }
+
     {
         Sparse64Tree tree(6);
         Stopwatch    sw;
@@ -240,6 +1387,51 @@ int main()
             tree.get_voxel(250, 122, 122) != 0, "benchmark: sparse voxels set");
     }
 
+    {
+        Sparse64Tree              tree(5);
+        std::vector<S64VoxelEdit> edits;
+        for (u32 i = 0; i < 500; ++i)
+            edits.push_back({ { i, i % 128, i % 128 }, static_cast<u8>(i % 255 + 1) });
+
+        Stopwatch sw;
+        tree.set_voxels(edits);
+        f64 elapsed = sw.elapsed();
+        LOG_TRACE("set_voxels x500 (sparse): {:.3f}ms", elapsed * 1000.0);
+        tctx.assert_now(
+            tree.get_voxel(250, 122, 122) != 0, "benchmark: sparse voxels set in batch");
+    }
+
+    {
+        // a bulk import: a million scattered writes into a 256^3 region
+        std::vector<S64VoxelEdit> edits;
+        u32                       state = 1;
+        for (u32 i = 0; i < 1000000; ++i)
+        {
+            state = state * 1664525u + 1013904223u;
+            edits.push_back(
+                { { (state >> 8) & 255, (state >> 16) & 255, (i * 7) & 255 },
+                  static_cast<u8>(state % 3 + 1) });
+        }
+
+        Sparse64Tree single(5);
+        Stopwatch    sw;
+        for (const S64VoxelEdit& e : edits)
+            single.set_voxel(e.pos.x, e.pos.y, e.pos.z, e.type);
+        f64 single_elapsed = sw.elapsed();
+
+        Sparse64Tree batched(5);
+        sw.reset();
+        batched.set_voxels(edits);
+        f64 batched_elapsed = sw.elapsed();
+
+        LOG_TRACE(
+            "1M scattered writes: set_voxel {:.3f}ms, set_voxels {:.3f}ms",
+            single_elapsed * 1000.0, batched_elapsed * 1000.0);
+        tctx.assert_now(
+            single.node_count() == batched.node_count(),
+            "benchmark: batched writes build the same tree");
+    }
+
     {
         Sparse64Tree tree(6);
         tree.fill_sphere(glm::vec3(512, 512, 512), 250.0f, 20);
@@ -260,6 +1452,12 @@ int main()
         }
         f64 elapsed = sw.elapsed();
         LOG_TRACE("20 concentric spheres (r=20-210): {:.3f}ms", elapsed * 1000.0);
+        LOG_TRACE("  {:.2f}MB reserved", tree.memory_usage() / (1024.0 * 1024.0));
+        sw.reset();
+        tree.compact();
+        LOG_TRACE(
+            "  compact: {:.3f}ms, {:.2f}MB reserved", sw.elapsed() * 1000.0,
+            tree.memory_usage() / (1024.0 * 1024.0));
         tctx.assert_now(
             tree.get_voxel(512, 512, 512) == 20, "benchmark: concentric spheres");
     }
@@ -280,6 +1478,528 @@ int main()
         LOG_TRACE("get_voxel x5000 (random access): {:.3f}ms", elapsed * 1000.0);
     }
 
+    {
+        Sparse64Tree tree(6);
+        tree.fill_sphere(glm::vec3(512, 512, 512), 200.0f, 10);
+        for (u32 i = 0; i < 20000; ++i)
+            tree.set_voxel((i * 137) % 1024, (i * 149) % 512, (i * 163) % 1024, 3);
+
+        // a 256x256 camera looking down onto the scene, in 8x8 pixel tiles
+        std::vector<S64Ray> rays;
+        for (u32 i = 0; i < 256 * 256; ++i)
+        {
+            const u32       x = (i >> 6) % 32 * 8 + (i & 7);
+            const u32       y = (i >> 6) / 32 * 8 + ((i >> 3) & 7);
+            const glm::vec3 target(x * 4.f, 0.f, y * 4.f);
+            const glm::vec3 eye(512.f, 1000.f, 512.f);
+            rays.push_back({ eye, target - eye, 4000.f });
+        }
+
+        Stopwatch sw;
+        u32       num_hits = 0;
+        for (const S64Ray& ray : rays)
+            num_hits += tree.raycast(ray.origin, ray.dir, ray.max_dist).has_value();
+        f64 single_elapsed = sw.elapsed();
+
+        std::vector<S64RayHit> hits(rays.size());
+        sw.reset();
+        tree.raycast(rays, hits);
+        f64 packet_elapsed = sw.elapsed();
+
+        LOG_TRACE(
+            "raycast x65536 ({} hits): single {:.3f}ms, packets {:.3f}ms", num_hits,
+            single_elapsed * 1000.0, packet_elapsed * 1000.0);
+        tctx.assert_now(num_hits > 0, "benchmark: rays hit the scene");
+    }
+
+    {
+        Sparse64Tree tree(5);
+        tree.fill_sphere(glm::vec3(512, 512, 512), 300.0f, 10);
+        for (u32 i = 0; i < 20000; ++i)
+            tree.set_voxel((i * 137) % 1024, (i * 149) % 1024, (i * 163) % 1024, 3);
+
+        // 32^3 chunks with a one voxel apron, across a slice through the sphere
+        std::vector<VoxelType> dense(34 * 34 * 34);
+        Stopwatch              sw;
+        u64                    sum = 0;
+        for (i32 cz = 0; cz < 32; ++cz)
+            for (i32 cx = 0; cx < 32; ++cx)
+            {
+                const glm::vec3 min(cx * 32 - 1, 512 - 1, cz * 32 - 1);
+                tree.extract_region(AABB(min, min + glm::vec3(34)), dense);
+                sum += dense[34 * 34 * 17 + 34 * 17 + 17];
+            }
+        f64 extract_elapsed = sw.elapsed();
+
+        sw.reset();
+        u64 slow_sum = 0;
+        for (i32 cz = 0; cz < 32; ++cz)
+            for (i32 cx = 0; cx < 32; ++cx)
+            {
+                const glm::ivec3 min(cx * 32 - 1, 512 - 1, cz * 32 - 1);
+                for (i32 y = 0; y < 34; ++y)
+                    for (i32 z = 0; z < 34; ++z)
+                        for (i32 x = 0; x < 34; ++x)
+                        {
+                            const glm::ivec3 p = min + glm::ivec3(x, y, z);
+                            const bool       inside = p.x >= 0 && p.z >= 0 &&
+                                p.x < 1024 && p.z < 1024;
+                            dense[x + 34 * (z + 34 * y)] = inside ? tree.get_voxel(p) : 0;
+                        }
+                slow_sum += dense[34 * 34 * 17 + 34 * 17 + 17];
+            }
+        f64 slow_elapsed = sw.elapsed();
+
+        LOG_TRACE(
+            "extract 1024 regions of 34^3: extract_region {:.3f}ms, get_voxel {:.3f}ms",
+            extract_elapsed * 1000.0, slow_elapsed * 1000.0);
+        tctx.assert_now(sum == slow_sum, "benchmark: extracted regions match");
+    }
+
+    {
+        Sparse64Tree tree(4);
+        tree.fill_sphere(glm::vec3(128, 128, 128), 100.0f, 10);
+        for (u32 i = 0; i < 20000; ++i)
+            tree.set_voxel((i * 137) % 256, (i * 149) % 256, (i * 163) % 256, 3);
+
+        Stopwatch sw;
+        usize     run_volume = 0;
+        for (const S64Run& run : tree.runs())
+            run_volume += static_cast<usize>(run.extent) * run.extent * run.extent;
+        f64 runs_elapsed = sw.elapsed();
+
+        sw.reset();
+        usize voxels = 0;
+        for (const auto& voxel : tree)
+            voxels += voxel.second != 0;
+        f64 voxels_elapsed = sw.elapsed();
+
+        sw.reset();
+        usize scanned = 0;
+        for (u32 z = 0; z < 256; ++z)
+            for (u32 y = 0; y < 256; ++y)
+                for (u32 x = 0; x < 256; ++x)
+                    scanned += tree.get_voxel(x, y, z) != 0;
+        f64 scan_elapsed = sw.elapsed();
+
+        LOG_TRACE(
+            "count {} solid voxels: runs {:.3f}ms, voxels {:.3f}ms, get_voxel scan "
+            "{:.3f}ms",
+            scanned, runs_elapsed * 1000.0, voxels_elapsed * 1000.0,
+            scan_elapsed * 1000.0);
+        tctx.assert_now(
+            run_volume == scanned && voxels == scanned, "benchmark: iterators count all");
+    }
+
+    {
+        Sparse64Tree tree(5);
+        tree.fill_sphere(glm::vec3(512, 512, 512), 400.0f, 1);
+        tree.fill_aabb(AABB(glm::vec3(0), glm::vec3(1024, 300, 1024)), 2);
+
+        std::vector<S64VoxelEdit> edits;
+        for (u32 i = 0; i < 1000; ++i)
+            edits.push_back({ glm::uvec3((i * 137) % 1024, (i * 149) % 1024,
+                                         (i * 163) % 1024),
+                              static_cast<VoxelType>(i % 4) });
+
+        Stopwatch sw;
+        for (const S64VoxelEdit& e : edits)
+            tree.set_voxel(e.pos.x, e.pos.y, e.pos.z, e.type);
+        f64 plain_elapsed = sw.elapsed();
+
+        // a reader holding on to a snapshot for every 10 edits
+        sw.reset();
+        Sparse64Tree::Snapshot snap;
+        f64                    snapshot_elapsed = 0.0;
+        for (u32 i = 0; i < edits.size(); ++i)
+        {
+            if (i % 10 == 0)
+            {
+                Stopwatch snap_sw;
+                snap = tree.snapshot();
+                snapshot_elapsed += snap_sw.elapsed();
+            }
+            const S64VoxelEdit& e = edits[i];
+            tree.set_voxel(e.pos.x, e.pos.z, e.pos.y, e.type);
+        }
+        f64        shared_elapsed = sw.elapsed();
+        const auto stats          = tree.stats();
+        snap.reset();
+
+        LOG_TRACE(
+            "1000 set_voxel: {:.3f}ms plain, {:.3f}ms with live snapshots (100 "
+            "snapshots {:.3f}ms), {:.2f}MB pointer overhead",
+            plain_elapsed * 1000.0, shared_elapsed * 1000.0, snapshot_elapsed * 1000.0,
+            stats.pointer_bytes / 1024.0 / 1024.0);
+        tctx.assert_now(
+            tree.stats().node_count() == tree.node_count(),
+            "benchmark: snapshots keep the tree consistent");
+    }
+
+    {
+        const std::filesystem::path path =
+            std::filesystem::temp_directory_path() / "v_64tree_bench.s64";
+
+        Sparse64Tree tree(5);
+        tree.fill_sphere(glm::vec3(512, 512, 512), 400.0f, 1);
+        tree.fill_sphere(glm::vec3(300, 700, 500), 250.0f, 0);
+        for (u32 i = 0; i < 200000; ++i)
+            tree.set_voxel((i * 137) % 1024, (i * 149) % 1024, (i * 163) % 1024, i % 5);
+
+        Stopwatch sw;
+        tree.save(path);
+        f64 save_elapsed = sw.elapsed();
+
+        {
+            sw.reset();
+            S64TreeView view(path);
+            f64         open_elapsed = sw.elapsed();
+
+            sw.reset();
+            usize solid = 0;
+            for (u32 i = 0; i < 100000; ++i)
+                solid += view.get_voxel(
+                             (i * 7919) % 1024, (i * 31) % 1024, (i * 131) % 1024) != 0;
+            f64 read_elapsed = sw.elapsed();
+
+            sw.reset();
+            Sparse64Tree loaded(view);
+            f64          load_elapsed = sw.elapsed();
+
+            LOG_TRACE(
+                "{} nodes, {:.2f}MB file: save {:.3f}ms, map {:.3f}ms, 100k reads in "
+                "place {:.3f}ms, load {:.3f}ms",
+                view.nodes().size(), std::filesystem::file_size(path) / 1024.0 / 1024.0,
+                save_elapsed * 1000.0, open_elapsed * 1000.0, read_elapsed * 1000.0,
+                load_elapsed * 1000.0);
+            tctx.assert_now(
+                loaded.node_count() == tree.node_count() && solid > 0,
+                "benchmark: saved tree loads back");
+        }
+        std::filesystem::remove(path);
+    }
+
+    {
+        // stencils over a patch of a sphere's surface, the access pattern of meshing,
+        // smoothing and lighting
+        Sparse64Tree tree(5);
+        tree.fill_sphere(glm::vec3(512, 512, 512), 300.0f, 1);
+        tree.fill_sphere(glm::vec3(400, 600, 512), 150.0f, 0);
+
+        auto stencil = [&](auto&& read, i32 radius_sq)
+        {
+            usize solid = 0;
+            for (u32 z = 480; z < 544; ++z)
+                for (u32 y = 480; y < 544; ++y)
+                    for (u32 x = 780; x < 844; ++x)
+                        for (i32 dz = -1; dz <= 1; ++dz)
+                            for (i32 dy = -1; dy <= 1; ++dy)
+                                for (i32 dx = -1; dx <= 1; ++dx)
+                                {
+                                    if (dx * dx + dy * dy + dz * dz > radius_sq)
+                                        continue;
+                                    solid += read(x + dx, y + dy, z + dz) != 0;
+                                }
+            return solid;
+        };
+
+        for (i32 radius_sq : { 1, 3 })
+        {
+            Stopwatch   sw;
+            const usize plain = stencil(
+                [&](u32 x, u32 y, u32 z) { return tree.get_voxel(x, y, z); }, radius_sq);
+            f64 plain_elapsed = sw.elapsed();
+
+            Sparse64Tree::Cursor cursor(tree);
+            sw.reset();
+            const usize cursored = stencil(
+                [&](u32 x, u32 y, u32 z) { return cursor.get(x, y, z); }, radius_sq);
+            f64 cursor_elapsed = sw.elapsed();
+
+            LOG_TRACE(
+                "{}-neighbor stencil over 64^3: get_voxel {:.3f}ms, cursor {:.3f}ms",
+                radius_sq == 1 ? 6 : 26, plain_elapsed * 1000.0,
+                cursor_elapsed * 1000.0);
+            tctx.assert_now(plain == cursored, "benchmark: cursor stencil matches");
+        }
+
+        // a smoothing pass writing a voxel wherever most of its 6 neighbors are solid
+        Sparse64Tree twin(5);
+        twin.fill_sphere(glm::vec3(512, 512, 512), 300.0f, 1);
+        twin.fill_sphere(glm::vec3(400, 600, 512), 150.0f, 0);
+
+        auto smooth = [](auto&& read, auto&& write)
+        {
+            for (u32 z = 480; z < 544; ++z)
+                for (u32 y = 480; y < 544; ++y)
+                    for (u32 x = 780; x < 844; ++x)
+                    {
+                        const u32 n =
+                            (read(x - 1, y, z) != 0) + (read(x + 1, y, z) != 0) +
+                            (read(x, y - 1, z) != 0) + (read(x, y + 1, z) != 0) +
+                            (read(x, y, z - 1) != 0) + (read(x, y, z + 1) != 0);
+                        write(x, y, z, n >= 4 ? 1 : 0);
+                    }
+        };
+
+        Stopwatch sw;
+        smooth(
+            [&](u32 x, u32 y, u32 z) { return twin.get_voxel(x, y, z); },
+            [&](u32 x, u32 y, u32 z, VoxelType t) { twin.set_voxel(x, y, z, t); });
+        f64 plain_elapsed = sw.elapsed();
+
+        Sparse64Tree::EditCursor edit(tree);
+        sw.reset();
+        smooth(
+            [&](u32 x, u32 y, u32 z) { return edit.get(x, y, z); },
+            [&](u32 x, u32 y, u32 z, VoxelType t) { edit.set(x, y, z, t); });
+        f64 cursor_elapsed = sw.elapsed();
+
+        LOG_TRACE(
+            "6-neighbor smoothing over 64^3: get/set_voxel {:.3f}ms, edit cursor "
+            "{:.3f}ms",
+            plain_elapsed * 1000.0, cursor_elapsed * 1000.0);
+        tctx.assert_now(
+            tree.node_count() == twin.node_count(),
+            "benchmark: cursor smoothing matches");
+    }
+
+    {
+        // carving a tunnel through solid ground
+        Sparse64Tree ground(6);
+        ground.fill_aabb(AABB(glm::vec3(0, 0, 0), glm::vec3(1024, 600, 1024)), 1);
+        ground.fill_sphere(glm::vec3(300, 600, 500), 200.0f, 2);
+        Sparse64Tree twin(6);
+        twin.fill_aabb(AABB(glm::vec3(0, 0, 0), glm::vec3(1024, 600, 1024)), 1);
+        twin.fill_sphere(glm::vec3(300, 600, 500), 200.0f, 2);
+
+        Sparse64Tree tunnel(6);
+        tunnel.fill_cylinder(glm::vec3(0, 300, 400), glm::vec3(1024, 350, 600), 40.0f, 1);
+
+        Stopwatch sw;
+        ground.apply_csg(CsgOp::Subtract, tunnel);
+        f64 csg_elapsed = sw.elapsed();
+
+        sw.reset();
+        twin.fill_cylinder(glm::vec3(0, 300, 400), glm::vec3(1024, 350, 600), 40.0f, 0);
+        f64 carve_elapsed = sw.elapsed();
+
+        sw.reset();
+        const Sparse64Tree joined = ground.join(tunnel);
+        f64                join_elapsed = sw.elapsed();
+
+        LOG_TRACE(
+            "tunnel through 1024^3 ground ({} tunnel nodes): subtract {:.3f}ms, "
+            "fill_cylinder carve {:.3f}ms, copying join {:.3f}ms",
+            tunnel.node_count(), csg_elapsed * 1000.0, carve_elapsed * 1000.0,
+            join_elapsed * 1000.0);
+        tctx.assert_now(
+            ground.node_count() == twin.node_count() && joined.get_voxel(512, 325, 500),
+            "benchmark: csg tunnel matches a carve");
+
+        Sparse64Tree small_ground(4);
+        small_ground.fill_aabb(AABB(glm::vec3(0, 0, 0), glm::vec3(256, 150, 256)), 1);
+        Sparse64Tree small_tunnel(4);
+        small_tunnel.fill_cylinder(
+            glm::vec3(0, 75, 100), glm::vec3(256, 90, 150), 10.0f, 1);
+
+        sw.reset();
+        const Sparse64Tree node_wise = small_ground.subtract(small_tunnel);
+        f64                node_elapsed = sw.elapsed();
+        sw.reset();
+        const Sparse64Tree voxel_wise =
+            VolumeOpImpl::csg_voxelwise<Sparse64Tree>(
+                CsgOp::Subtract, small_ground, small_tunnel);
+        f64 voxel_elapsed = sw.elapsed();
+        LOG_TRACE(
+            "subtract over 256^3: node by node {:.3f}ms, voxel by voxel {:.3f}ms",
+            node_elapsed * 1000.0, voxel_elapsed * 1000.0);
+        tctx.assert_now(
+            node_wise.node_count() == voxel_wise.node_count(),
+            "benchmark: csg strategies agree");
+    }
+
+    {
+        Sparse64Tree tracked(6);
+        Sparse64Tree plain(6);
+        tracked.set_lod_tracking(true);
+        for (Sparse64Tree* tree : { &tracked, &plain })
+        {
+            tree->fill_sphere(glm::vec3(512, 512, 512), 400.0f, 1);
+            tree->fill_aabb(AABB(glm::vec3(0, 0, 0), glm::vec3(1024, 300, 1024)), 2);
+            tree->fill_sphere(glm::vec3(300, 600, 500), 150.0f, 0);
+        }
+
+        // far field sampling: one sample per 64^3 region
+        u32       solid = 0;
+        Stopwatch sw;
+        for (u32 i = 0; i < 100000; ++i)
+        {
+            const glm::uvec3 pos((i * 7919) % 1024, (i * 104729) % 1024, (i * 31) % 1024);
+            solid += tracked.voxel_at_lod(pos, 3).coverage >= 0.5f;
+        }
+        f64 tracked_elapsed = sw.elapsed();
+
+        sw.reset();
+        for (u32 i = 0; i < 1000; ++i)
+        {
+            const glm::uvec3 pos((i * 7919) % 1024, (i * 104729) % 1024, (i * 31) % 1024);
+            solid += plain.voxel_at_lod(pos, 3).coverage >= 0.5f;
+        }
+        f64 plain_elapsed = sw.elapsed();
+
+        sw.reset();
+        for (u32 i = 0; i < 1000; ++i)
+            tracked.set_voxel((i * 137) % 1024, (i * 149) % 1024, (i * 163) % 1024, 3);
+        f64 tracked_edit_elapsed = sw.elapsed();
+        sw.reset();
+        for (u32 i = 0; i < 1000; ++i)
+            plain.set_voxel((i * 137) % 1024, (i * 149) % 1024, (i * 163) % 1024, 3);
+        f64 plain_edit_elapsed = sw.elapsed();
+
+        LOG_TRACE(
+            "voxel_at_lod over 64^3 regions: {:.3f}us tracked, {:.3f}us summed on the "
+            "spot; 1000 set_voxel: {:.3f}ms tracked, {:.3f}ms plain",
+            tracked_elapsed * 1e6 / 100000, plain_elapsed * 1e6 / 1000,
+            tracked_edit_elapsed * 1000.0, plain_edit_elapsed * 1000.0);
+        tctx.assert_now(solid > 0, "benchmark: lod samples hit the terrain");
+    }
+
+    {
+        const glm::vec3 center(512, 512, 512);
+        auto            sphere = [&](const glm::vec3& p)
+        { return glm::length(p - center) - 200.0f; };
+
+        Sparse64Tree by_shape(6);
+        Stopwatch    sw;
+        by_shape.fill_sphere(center, 200.0f, 10);
+        f64 shape_elapsed = sw.elapsed();
+
+        Sparse64Tree by_sdf(6);
+        sw.reset();
+        by_sdf.fill_sdf(sphere, 10);
+        f64 sdf_elapsed = sw.elapsed();
+
+        // a noisy height field over the whole tree
+        auto terrain = [](const glm::vec3& p)
+        {
+            return p.y - 400.0f - 60.0f * std::sin(p.x * 0.01f) * std::cos(p.z * 0.013f) -
+                8.0f * std::sin(p.x * 0.11f + p.z * 0.07f);
+        };
+        // the steepest the height field gets, plus one for y
+        const f32 lipschitz = 1.0f + 60.0f * 0.013f + 8.0f * 0.13f;
+
+        Sparse64Tree ground(5);
+        sw.reset();
+        ground.fill_sdf(terrain, 2, lipschitz);
+        f64 terrain_elapsed = sw.elapsed();
+
+        Sparse64Tree parallel_ground(5);
+        sw.reset();
+        parallel_ground.fill_sdf(terrain, 2, async_ctx->executor(), lipschitz);
+        f64 parallel_elapsed = sw.elapsed();
+
+        LOG_TRACE(
+            "sphere r=200: fill_sphere {:.3f}ms, fill_sdf {:.3f}ms; 1024^2 terrain: "
+            "fill_sdf {:.3f}ms, parallel {:.3f}ms",
+            shape_elapsed * 1000.0, sdf_elapsed * 1000.0, terrain_elapsed * 1000.0,
+            parallel_elapsed * 1000.0);
+        tctx.assert_now(
+            by_sdf.get_voxel(512, 512, 512) == 10 &&
+                parallel_ground.node_count() == ground.node_count(),
+            "benchmark: sdf fills");
+    }
+
+    {
+        // every task scatters writes over a root child of its own
+        tf::Executor& executor = async_ctx->executor();
+        auto          scatter  = [](auto&& set, u32 task)
+        {
+            const glm::uvec3 base(task % 4 * 256, 256, task / 4 * 256);
+            for (u32 i = 0; i < 200000; ++i)
+                set(base.x + (i * 7919) % 256, base.y + (i * 104729) % 256,
+                    base.z + (i * 31) % 256, 1 + i % 3);
+        };
+
+        Sparse64Tree serial(5);
+        Stopwatch    sw;
+        for (u32 task = 0; task < 16; ++task)
+            scatter(
+                [&](u32 x, u32 y, u32 z, u8 t) { serial.set_voxel(x, y, z, t); }, task);
+        f64 serial_elapsed = sw.elapsed();
+
+        Sparse64Tree concurrent(5);
+        sw.reset();
+        {
+            Sparse64Tree::ConcurrentEdit   edit(concurrent);
+            std::vector<std::future<void>> writers;
+            for (u32 task = 0; task < 16; ++task)
+                writers.push_back(executor.async(
+                    [&, task]
+                    {
+                        scatter(
+                            [&](u32 x, u32 y, u32 z, u8 t)
+                            { edit.set_voxel(x, y, z, t); },
+                            task);
+                    }));
+            for (auto& writer : writers)
+                writer.wait();
+        }
+        f64 concurrent_elapsed = sw.elapsed();
+
+        LOG_TRACE(
+            "3.2M scattered writes over 16 root children: serial {:.3f}ms, "
+            "concurrent on {} workers {:.3f}ms",
+            serial_elapsed * 1000.0, executor.num_workers(), concurrent_elapsed * 1000.0);
+        tctx.assert_now(
+            concurrent.node_count() == serial.node_count(),
+            "benchmark: concurrent edits");
+    }
+
+    {
+        // a brush stroke of point writes, then a few large fills
+        auto stroke = [](Sparse64Tree& t)
+        {
+            for (u32 i = 0; i < 100000; ++i)
+                t.set_voxel(300 + i % 100, 500 + (i / 100) % 10, 400 + i / 1000, 3);
+        };
+
+        Sparse64Tree plain(5);
+        plain.fill_sphere(glm::vec3(512, 512, 512), 200.0f, 1);
+        Stopwatch sw;
+        stroke(plain);
+        f64 plain_elapsed = sw.elapsed();
+
+        Sparse64Tree tree(5);
+        tree.fill_sphere(glm::vec3(512, 512, 512), 200.0f, 1);
+        S64Journal journal;
+        tree.set_journal(&journal);
+        sw.reset();
+        stroke(tree);
+        f64         journaled_elapsed = sw.elapsed();
+        const usize stroke_bytes      = journal.checkpoint();
+
+        sw.reset();
+        tree.fill_sphere(glm::vec3(300, 600, 500), 150.0f, 0);
+        tree.fill_aabb(AABB(glm::vec3(0, 0, 0), glm::vec3(1024, 320, 1024)), 2);
+        f64         fill_elapsed = sw.elapsed();
+        const usize fill_bytes   = journal.bytes().size() - stroke_bytes;
+        const usize lean_bytes   = journal.without_undo(stroke_bytes).bytes().size();
+
+        sw.reset();
+        journal.undo(tree, 0);
+        f64 undo_elapsed = sw.elapsed();
+
+        LOG_TRACE(
+            "100k set_voxel: {:.3f}ms plain, {:.3f}ms journaled, {} bytes; 2 fills "
+            "journaled {:.3f}ms, {} bytes with undo, {} without; undo all {:.3f}ms",
+            plain_elapsed * 1000.0, journaled_elapsed * 1000.0, stroke_bytes,
+            fill_elapsed * 1000.0, fill_bytes, lean_bytes, undo_elapsed * 1000.0);
+        tctx.assert_now(
+            tree.get_voxel(512, 512, 512) == 1 && tree.get_voxel(350, 505, 450) == 1,
+            "benchmark: journal undo");
+    }
+
     LOG_TRACE("--- End Benchmarks ---");
 
     return tctx.is_failure();
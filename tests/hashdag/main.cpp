@@ -0,0 +1,442 @@
+// Unit-like checks for the HashDAG store, and how well it deduplicates terrain
+
+#include <engine/contexts/async/async.h>
+#include <test.h>
+#include <time/stopwatch.h>
+#include <time/time.h>
+#include <cmath>
+#include <vector>
+#include <vox/store/64tree.h>
+#include <vox/store/hashdag.h>
+
+using namespace v;
+
+using Dag = HDAG<u8>;
+
+/// Returns whether two dags hold the same voxels, checking every one of them
+static bool same_voxels(const Dag& a, const Dag& b)
+{
+    for (u32 y = 0; y < a.extent(); ++y)
+        for (u32 z = 0; z < a.extent(); ++z)
+            for (u32 x = 0; x < a.extent(); ++x)
+                if (a.is_solid(x, y, z) != b.is_solid(x, y, z))
+                    return false;
+    return true;
+}
+
+/// Returns whether the dag holds exactly the types of a dense extent^3 grid,
+/// and one attribute per solid voxel
+static bool same_types(const Dag& dag, const std::vector<u8>& grid)
+{
+    const u32 extent = dag.extent();
+    u64       solid  = 0;
+    for (u32 y = 0; y < extent; ++y)
+        for (u32 z = 0; z < extent; ++z)
+            for (u32 x = 0; x < extent; ++x)
+            {
+                const u8 type = grid[x + extent * (z + extent * y)];
+                solid += type != 0;
+                if (dag.get(Coord(x, y, z)) != type)
+                    return false;
+            }
+    return dag.attributes().size() == solid;
+}
+
+/// Height of some rolling hills, repeating every 64 voxels like tiled terrain does
+static u32 hill_height(u32 x, u32 z)
+{
+    static const std::vector<u32> heights = []
+    {
+        constexpr f32    k = 6.2831853f / 64.f;
+        std::vector<u32> heights(64 * 64);
+        for (u32 z = 0; z < 64; ++z)
+            for (u32 x = 0; x < 64; ++x)
+                heights[x + 64 * z] =
+                    40 + static_cast<u32>(10.f * std::sin(x * k) * std::cos(z * k));
+        return heights;
+    }();
+    return heights[(x & 63) + 64 * (z & 63)];
+}
+
+int main()
+{
+    auto [engine, tctx] = testing::init_test("hashdag");
+
+    {
+        Dag dag(6);
+        tctx.assert_now(dag.extent() == 64, "depth 6 is 64 wide");
+        tctx.assert_now(dag.is_empty(), "new dag is empty");
+        tctx.assert_now(dag.get(Coord(1, 2, 3)) == 0, "air reads as zero");
+        tctx.assert_now(!dag.get(Coord(64, 0, 0)), "nothing outside");
+        tctx.assert_now(dag.set(Coord(0, -1, 0), 1) == 0, "writes outside ignored");
+
+        dag.set(Coord(5, 6, 7), 9);
+        tctx.assert_now(dag.get(Coord(5, 6, 7)) == 9, "solid voxel reads its type");
+        tctx.assert_now(dag.get(Coord(5, 6, 6)) == 0, "neighbor still air");
+        tctx.assert_now(dag.node_count() == 5, "one node per level");
+
+        const u32 root = dag.root();
+        dag.set(Coord(5, 6, 7), 3);
+        tctx.assert_now(dag.root() == root, "retyping a voxel keeps the geometry");
+        tctx.assert_now(dag.node_count() == 5, "no nodes added for a retype");
+        tctx.assert_now(dag.get(Coord(5, 6, 7)) == 3, "retyped voxel reads its new type");
+
+        dag.set(Coord(5, 6, 7), 0);
+        tctx.assert_now(dag.is_empty(), "clearing the last voxel empties the dag");
+        tctx.assert_now(dag.live_node_count() == 0, "nothing reachable");
+        tctx.assert_now(dag.node_count() == 5, "replaced nodes stay stored");
+
+        // writing back the same voxel finds the nodes it had before
+        dag.set(Coord(5, 6, 7), 1);
+        tctx.assert_now(dag.root() == root, "same contents, same root");
+        tctx.assert_now(dag.node_count() == 5, "nodes are shared across time");
+    }
+
+    {
+        // identical bricks anywhere in the tree are stored once
+        Dag dag(8);
+        for (u32 i = 0; i < 8; ++i)
+            for (const glm::uvec3& p : { glm::uvec3(1, 0, 2), glm::uvec3(3, 3, 3) })
+                dag.set(Coord(glm::uvec3(i * 32, 100, 250 - i * 16) + p), 1);
+        tctx.assert_now(
+            dag.stats().brick_nodes == 1 + 1, "bricks deduplicated ({} stored)",
+            dag.stats().brick_nodes);
+    }
+
+    {
+        // every way of building the same voxels builds the same dag
+        Dag by_set(7);
+        Dag by_fill(7);
+        Dag by_batch(7);
+        by_set.set_auto_gc(false);
+
+        auto inside = [](const Coord& p)
+        {
+            return p.x >= 3 && p.x < 90 && p.y >= 10 && p.y < 17 && p.z >= 0 && p.z < 65;
+        };
+
+        std::vector<Dag::Edit> edits;
+        for (i32 y = 0; y < 128; ++y)
+            for (i32 z = 0; z < 128; ++z)
+                for (i32 x = 0; x < 128; ++x)
+                    if (inside(Coord(x, y, z)))
+                    {
+                        by_set.set(Coord(x, y, z), 1);
+                        edits.push_back({ glm::uvec3(x, y, z), 1 });
+                    }
+        // overwritten by the edits after it, out of order on purpose
+        edits.insert(edits.begin(), { glm::uvec3(5, 12, 7), 0 });
+        edits.push_back({ glm::uvec3(200, 0, 0), 1 });
+        by_batch.set_voxels(edits);
+        by_fill.fill_aabb(AABB(glm::vec3(3, 10, 0), glm::vec3(90, 17, 65)), 4);
+
+        Dag reference(7);
+        reference.fill([&](const Coord& p) { return u8(inside(p)); });
+        tctx.assert_now(same_voxels(by_set, reference), "set matches");
+        tctx.assert_now(same_voxels(by_batch, reference), "set_voxels matches");
+        tctx.assert_now(same_voxels(by_fill, reference), "fill_aabb matches");
+        tctx.assert_now(
+            by_set.live_node_count() == reference.live_node_count(),
+            "equal voxels, equal live nodes");
+        tctx.assert_now(
+            by_batch.node_count() < by_set.node_count() / 10,
+            "batched edits copy each path once ({} vs {} nodes)", by_batch.node_count(),
+            by_set.node_count());
+
+        // within one dag, equal contents are an equal root
+        Dag dag(7);
+        dag.fill([&](const Coord& p) { return u8(inside(p)); });
+        const u32 root = dag.root();
+        dag.fill_aabb(AABB(glm::vec3(0), glm::vec3(128)), 0);
+        tctx.assert_now(dag.is_empty(), "clearing the whole box empties it");
+        dag.set_voxels(edits);
+        tctx.assert_now(dag.root() == root, "set_voxels finds the filled nodes");
+        dag.fill_aabb(AABB(glm::vec3(40, 12, 20), glm::vec3(50, 14, 30)), 0);
+        dag.fill_aabb(AABB(glm::vec3(40, 12, 20), glm::vec3(50, 14, 30)), 1);
+        tctx.assert_now(dag.root() == root, "carving and refilling restores the root");
+
+        dag.clear();
+        tctx.assert_now(dag.is_empty() && dag.node_count() == 0, "clear drops nodes");
+    }
+
+    {
+        // a fill over the whole dag is the shared full node of every level
+        Dag dag(10);
+        dag.fill_aabb(AABB(glm::vec3(-5), glm::vec3(2000)), 1);
+        tctx.assert_now(dag.node_count() == 9, "full dag is one node per level");
+        tctx.assert_now(dag.get(Coord(1023, 0, 511)) == 1, "full dag reads solid");
+    }
+
+    {
+        // tiled terrain, against the same terrain in a Sparse64Tree
+        constexpr u32 extent  = 256;
+        auto          terrain = [](const Coord& p)
+        { return u8(static_cast<u32>(p.y) < hill_height(p.x, p.z)); };
+
+        Stopwatch sw;
+        Dag       dag(8);
+        dag.set_auto_gc(false);
+        dag.fill(terrain);
+        const f64 dag_elapsed = sw.elapsed();
+
+        sw.reset();
+        Sparse64Tree tree(4);
+        for (u32 z = 0; z < extent; ++z)
+            for (u32 x = 0; x < extent; ++x)
+            {
+                const glm::vec3 min(x, 0, z);
+                tree.fill_aabb(AABB(min, min + glm::vec3(1, hill_height(x, z), 1)), 1);
+            }
+        const f64 tree_elapsed = sw.elapsed();
+
+        bool matches = true;
+        for (u32 z = 0; z < extent; z += 7)
+            for (u32 x = 0; x < extent; x += 5)
+                for (u32 y = 20; y < 60; ++y)
+                    matches &= dag.is_solid(x, y, z) == (tree.get_voxel(x, y, z) != 0);
+        tctx.assert_now(matches, "dag holds the terrain");
+        tctx.assert_now(
+            dag.node_count() == dag.live_node_count(), "fill leaves nothing behind");
+
+        const auto dag_stats  = dag.stats();
+        const auto tree_stats = tree.stats();
+        LOG_TRACE(
+            "256^3 terrain: dag {} nodes, {:.2f}MB reserved, built in {:.3f}ms",
+            dag_stats.node_count(), dag_stats.reserved_bytes / 1e6, dag_elapsed * 1000.0);
+        LOG_TRACE(
+            "256^3 terrain: 64tree {} nodes, {:.2f}MB reserved, built in {:.3f}ms",
+            tree_stats.node_count(), tree_stats.reserved_bytes / 1e6,
+            tree_elapsed * 1000.0);
+        tctx.assert_now(
+            dag_stats.node_count() * 10 < tree_stats.node_count(),
+            "dag deduplicates tiled terrain");
+
+        // editing it: craters, one voxel at a time and batched
+        std::vector<Dag::Edit> edits;
+        for (u32 i = 0; i < 64; ++i)
+        {
+            const glm::ivec3 c(17 + i * 3, 33, 230 - i * 3);
+            for (i32 y = -4; y <= 4; ++y)
+                for (i32 z = -4; z <= 4; ++z)
+                    for (i32 x = -4; x <= 4; ++x)
+                        if (x * x + y * y + z * z <= 16)
+                            edits.push_back({ glm::uvec3(c + glm::ivec3(x, y, z)), 0 });
+        }
+
+        const usize before = dag.node_count();
+        sw.reset();
+        for (const Dag::Edit& e : edits)
+            dag.set(Coord(e.pos), e.type);
+        const f64   set_elapsed = sw.elapsed();
+        const usize set_nodes   = dag.node_count() - before;
+
+        Dag batched(8);
+        batched.set_auto_gc(false);
+        batched.fill(terrain);
+        const usize batch_before = batched.node_count();
+        sw.reset();
+        batched.set_voxels(edits);
+        const f64 batch_elapsed = sw.elapsed();
+
+        LOG_TRACE(
+            "{} crater edits: set {:.3f}ms ({} nodes added), "
+            "set_voxels {:.3f}ms ({} nodes added)",
+            edits.size(), set_elapsed * 1000.0, set_nodes, batch_elapsed * 1000.0,
+            batched.node_count() - batch_before);
+        tctx.assert_now(
+            dag.live_node_count() == batched.live_node_count(), "edits agree");
+        tctx.assert_now(
+            std::ranges::none_of(
+                edits,
+                [&](const Dag::Edit& e)
+                {
+                    return dag.is_solid(e.pos.x, e.pos.y, e.pos.z) ||
+                        batched.is_solid(e.pos.x, e.pos.y, e.pos.z);
+                }),
+            "craters carved");
+    }
+
+    {
+        // types survive every kind of edit, checked against a dense grid
+        constexpr u32   extent = 64;
+        Dag             dag(6);
+        std::vector<u8> grid(extent * extent * extent, 0);
+        auto            cell = [&](u32 x, u32 y, u32 z) -> u8&
+        { return grid[x + extent * (z + extent * y)]; };
+
+        u32  seed = 12345;
+        auto next = [&](u32 bound)
+        {
+            seed = seed * 1664525u + 1013904223u;
+            return (seed >> 8) % bound;
+        };
+
+        auto layers = [](const Coord& p) { return u8(p.y < 20 ? 1 + p.y / 5 : 0); };
+        dag.fill(layers);
+        for (u32 y = 0; y < extent; ++y)
+            for (u32 z = 0; z < extent; ++z)
+                for (u32 x = 0; x < extent; ++x)
+                    cell(x, y, z) = layers(Coord(x, y, z));
+        tctx.assert_now(same_types(dag, grid), "fill keeps types");
+        tctx.assert_now(
+            dag.attributes().run_count() * 32 < dag.attributes().size(),
+            "layers compress ({} runs for {} voxels)", dag.attributes().run_count(),
+            dag.attributes().size());
+
+        for (u32 i = 0; i < 300; ++i)
+        {
+            const u32 x = next(extent), y = next(extent), z = next(extent);
+            const u8  type = static_cast<u8>(next(4));
+            dag.set(Coord(x, y, z), type);
+            cell(x, y, z) = type;
+        }
+        tctx.assert_now(same_types(dag, grid), "set keeps types");
+
+        std::vector<Dag::Edit> edits;
+        for (u32 i = 0; i < 3000; ++i)
+        {
+            const glm::uvec3 p(next(extent), next(32), next(extent));
+            const u8         type = static_cast<u8>(next(6));
+            edits.push_back({ p, type });
+            cell(p.x, p.y, p.z) = type;
+        }
+        dag.set_voxels(edits);
+        tctx.assert_now(same_types(dag, grid), "set_voxels keeps types");
+
+        for (u32 i = 0; i < 40; ++i)
+        {
+            const glm::uvec3 lo(next(extent), next(extent), next(extent));
+            const glm::uvec3 hi =
+                glm::min(lo + glm::uvec3(1 + next(40)), glm::uvec3(extent));
+            const u8         type = static_cast<u8>(next(3) ? 1 + next(5) : 0);
+            dag.fill_aabb(AABB(glm::vec3(lo), glm::vec3(hi)), type);
+            for (u32 y = lo.y; y < hi.y; ++y)
+                for (u32 z = lo.z; z < hi.z; ++z)
+                    for (u32 x = lo.x; x < hi.x; ++x)
+                        cell(x, y, z) = type;
+        }
+        tctx.assert_now(same_types(dag, grid), "fill_aabb keeps types");
+
+        dag.collect();
+        tctx.assert_now(same_types(dag, grid), "collecting keeps types");
+        tctx.assert_now(
+            dag.node_count() == dag.live_node_count(), "collecting drops replaced nodes");
+    }
+
+    auto* async_ctx = engine->add_ctx<AsyncContext>(4);
+
+    {
+        // continuous editing: craters walking over typed terrain. with automatic
+        // collections the tables stay a small multiple of what is live, without them
+        // they keep every path ever copied
+        auto terrain = [](const Coord& p)
+        {
+            const u32 height = hill_height(p.x, p.z);
+            return u8(static_cast<u32>(p.y) < height ? 1 + p.y * 4 / height : 0);
+        };
+
+        Dag collected(8);
+        Dag kept(8);
+        kept.set_auto_gc(false);
+        collected.fill(terrain);
+        kept.fill(terrain);
+
+        usize                  peak      = 0;
+        usize                  peak_live = 0;
+        std::vector<Dag::Edit> edits;
+        Stopwatch              sw;
+        for (u32 i = 0; i < 400; ++i)
+        {
+            // a crater, filled back in with another type every other step
+            const glm::ivec3 c((i * 37) % 248 + 4, 28 + i % 16, (i * 91) % 248 + 4);
+            const u8         type = i % 2 ? static_cast<u8>(5 + i % 3) : 0;
+            edits.clear();
+            for (i32 y = -3; y <= 3; ++y)
+                for (i32 z = -3; z <= 3; ++z)
+                    for (i32 x = -3; x <= 3; ++x)
+                        if (x * x + y * y + z * z <= 9)
+                            edits.push_back(
+                                { glm::uvec3(c + glm::ivec3(x, y, z)), type });
+
+            for (const Dag::Edit& e : edits)
+            {
+                collected.set(Coord(e.pos), e.type);
+                kept.set(Coord(e.pos), e.type);
+            }
+            if (i % 50 == 0)
+                peak_live = std::max(peak_live, collected.live_node_count());
+            peak = std::max(peak, collected.node_count());
+        }
+        const f64 elapsed = sw.elapsed();
+
+        bool matches = true;
+        for (u32 z = 0; z < 256; z += 3)
+            for (u32 x = 0; x < 256; x += 3)
+                for (u32 y = 20; y < 52; ++y)
+                    matches &= collected.get(Coord(x, y, z)) == kept.get(Coord(x, y, z));
+        tctx.assert_now(matches, "collections keep voxels and types");
+
+        const usize bound = 4 * std::max(HDAGNodes::k_gc_min_nodes, peak_live);
+        LOG_TRACE(
+            "400 crater edits in {:.3f}ms: peak {} nodes with collections, {} without, "
+            "{} live",
+            elapsed * 1000.0, peak, kept.node_count(), collected.live_node_count());
+        tctx.assert_now(
+            peak < bound, "collections bound the tables ({} nodes, bound {})", peak,
+            bound);
+        tctx.assert_now(
+            kept.node_count() > bound, "without them the tables grow ({} nodes)",
+            kept.node_count());
+
+        // collecting every replaced path at once, serially and on the executor
+        Dag         serial = kept;
+        const usize stored = kept.node_count();
+        sw.reset();
+        serial.collect();
+        const f64 serial_elapsed = sw.elapsed();
+        sw.reset();
+        kept.collect(async_ctx->executor());
+        const f64 parallel_elapsed = sw.elapsed();
+        LOG_TRACE(
+            "collecting {} nodes down to {}: {:.3f}ms serial, {:.3f}ms on the executor",
+            stored, kept.node_count(), serial_elapsed * 1000.0,
+            parallel_elapsed * 1000.0);
+        tctx.assert_now(
+            kept.node_count() == kept.live_node_count() &&
+                serial.node_count() == kept.node_count(),
+            "collect leaves only live nodes");
+        tctx.assert_now(
+            kept.attributes().block_count() <=
+                2 * (kept.attributes().run_count() / 256 + 1),
+            "finished collections repack the attributes");
+
+        matches = true;
+        for (u32 z = 0; z < 256; z += 3)
+            for (u32 x = 0; x < 256; x += 3)
+                for (u32 y = 20; y < 52; ++y)
+                    matches &= serial.get(Coord(x, y, z)) == kept.get(Coord(x, y, z));
+        tctx.assert_now(matches, "parallel compaction keeps voxels and types");
+
+        // a collection stepped by hand between edits
+        kept.gc_start();
+        for (u32 i = 0; kept.gc_step(64, async_ctx->executor()); ++i)
+        {
+            const Coord p(i % 256, 40, (i * 7) % 256);
+            kept.set(p, 9);
+            collected.set(p, 9);
+        }
+        tctx.assert_now(!kept.gc_running(), "stepped collection finishes");
+        tctx.assert_now(
+            kept.live_node_count() == collected.live_node_count(),
+            "edits during a collection keep their nodes");
+
+        matches = true;
+        for (u32 z = 0; z < 256; z += 3)
+            for (u32 x = 0; x < 256; x += 3)
+                for (u32 y = 20; y < 52; ++y)
+                    matches &= collected.get(Coord(x, y, z)) == kept.get(Coord(x, y, z));
+        tctx.assert_now(matches, "stepped collection keeps voxels and types");
+    }
+
+    return tctx.is_failure();
+}
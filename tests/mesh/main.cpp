@@ -0,0 +1,312 @@
+#include <engine/contexts/async/async.h>
+#include <test.h>
+#include <time/stopwatch.h>
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <unordered_set>
+#include <vox/mesh/greedy.h>
+
+using namespace v;
+
+/// Unit normal of a face direction
+static glm::ivec3 face_normal(S64Face face)
+{
+    glm::ivec3 n(0);
+    n[static_cast<u32>(face) / 2] = (static_cast<u32>(face) & 1) ? -1 : 1;
+    return n;
+}
+
+static bool is_solid(const Sparse64Tree& tree, const glm::ivec3& pos)
+{
+    const i32 extent = static_cast<i32>(tree.bounding_box().max.x);
+    if (std::min({ pos.x, pos.y, pos.z }) < 0 ||
+        std::max({ pos.x, pos.y, pos.z }) >= extent)
+        return false;
+    return tree.get_voxel(pos) != 0;
+}
+
+/// Checks chunk meshes against get_voxel: every quad must be a flat rectangle
+/// winding counter clockwise seen from outside, over visible faces of its own
+/// type, and every visible face of the tree must be covered exactly once
+static bool
+matches_voxels(const Sparse64Tree& tree, const std::vector<S64ChunkMesh>& meshes)
+{
+    std::unordered_set<u64> covered;
+    for (const S64ChunkMesh& mesh : meshes)
+    {
+        if (mesh.vertices.size() % 4)
+            return false;
+
+        for (usize q = 0; q < mesh.vertices.size(); q += 4)
+        {
+            const S64MeshVertex* quad = &mesh.vertices[q];
+            const S64Face        face = quad[0].face();
+            const VoxelType      type = quad[0].type();
+            const glm::ivec3     n    = face_normal(face);
+
+            glm::ivec3 lo(INT32_MAX), hi(INT32_MIN);
+            for (u32 i = 0; i < 4; ++i)
+            {
+                if (quad[i].face() != face || quad[i].type() != type)
+                    return false;
+                const glm::ivec3 p = glm::ivec3(quad[i].pos() + mesh.origin);
+                lo                 = glm::min(lo, p);
+                hi                 = glm::max(hi, p);
+            }
+
+            const glm::ivec3 e1 = glm::ivec3(quad[1].pos()) - glm::ivec3(quad[0].pos());
+            const glm::ivec3 e2 = glm::ivec3(quad[2].pos()) - glm::ivec3(quad[0].pos());
+            if (glm::dot(glm::vec3(glm::cross(glm::vec3(e1), glm::vec3(e2))),
+                         glm::vec3(n)) <= 0.0f)
+                return false;
+
+            // the plane of the quad, then the voxels behind it
+            const u32 axis = static_cast<u32>(face) / 2;
+            if (lo[axis] != hi[axis])
+                return false;
+            if (n[axis] > 0)
+                --lo[axis];
+            hi[axis] = lo[axis] + 1;
+
+            for (i32 y = lo.y; y < hi.y; ++y)
+                for (i32 z = lo.z; z < hi.z; ++z)
+                    for (i32 x = lo.x; x < hi.x; ++x)
+                    {
+                        const glm::ivec3 p(x, y, z);
+                        if (!is_solid(tree, p) || tree.get_voxel(p) != type ||
+                            is_solid(tree, p + n))
+                            return false;
+
+                        const u64 key = static_cast<u64>(x) | static_cast<u64>(y) << 20 |
+                            static_cast<u64>(z) << 40 | static_cast<u64>(face) << 60;
+                        if (!covered.insert(key).second)
+                            return false;
+                    }
+        }
+    }
+
+    usize visible = 0;
+    const i32 extent = static_cast<i32>(tree.bounding_box().max.x);
+    for (i32 y = 0; y < extent; ++y)
+        for (i32 z = 0; z < extent; ++z)
+            for (i32 x = 0; x < extent; ++x)
+            {
+                if (!is_solid(tree, glm::ivec3(x, y, z)))
+                    continue;
+                for (u32 f = 0; f < 6; ++f)
+                    visible += !is_solid(
+                        tree, glm::ivec3(x, y, z) + face_normal(static_cast<S64Face>(f)));
+            }
+    return visible == covered.size();
+}
+
+/// Meshes every chunk of the tree on one thread, keeping the ones with faces
+static std::vector<S64ChunkMesh> mesh_serial(const Sparse64Tree& tree)
+{
+    const u32 extent = static_cast<u32>(tree.bounding_box().max.x);
+    const u32 chunks =
+        std::max(extent, S64Mesher::k_chunk_size) / S64Mesher::k_chunk_size;
+
+    S64Mesher                 mesher;
+    std::vector<S64ChunkMesh> meshes;
+    for (u32 y = 0; y < chunks; ++y)
+        for (u32 z = 0; z < chunks; ++z)
+            for (u32 x = 0; x < chunks; ++x)
+            {
+                S64ChunkMesh mesh;
+                mesher.mesh_chunk(
+                    tree, glm::uvec3(x, y, z) * S64Mesher::k_chunk_size, mesh);
+                if (!mesh.vertices.empty())
+                    meshes.push_back(std::move(mesh));
+            }
+    return meshes;
+}
+
+static usize total_quads(const std::vector<S64ChunkMesh>& meshes)
+{
+    usize quads = 0;
+    for (const S64ChunkMesh& mesh : meshes)
+        quads += mesh.quad_count();
+    return quads;
+}
+
+/// Compares meshes made in a different order, by chunk origin
+static bool same_meshes(std::vector<S64ChunkMesh> a, std::vector<S64ChunkMesh> b)
+{
+    auto by_origin = [](const S64ChunkMesh& l, const S64ChunkMesh& r)
+    {
+        return std::tie(l.origin.x, l.origin.y, l.origin.z) <
+            std::tie(r.origin.x, r.origin.y, r.origin.z);
+    };
+    std::sort(a.begin(), a.end(), by_origin);
+    std::sort(b.begin(), b.end(), by_origin);
+    if (a.size() != b.size())
+        return false;
+
+    for (usize i = 0; i < a.size(); ++i)
+        if (a[i].origin != b[i].origin || a[i].vertices.size() != b[i].vertices.size() ||
+            !std::equal(
+                a[i].vertices.begin(), a[i].vertices.end(), b[i].vertices.begin(),
+                [](S64MeshVertex l, S64MeshVertex r) { return l.bits == r.bits; }))
+            return false;
+    return true;
+}
+
+int main()
+{
+    auto [engine, tctx] = testing::init_test("mesh");
+    auto* async_ctx     = engine->add_ctx<AsyncContext>(4);
+
+    {
+        const S64MeshVertex vert =
+            S64MeshVertex::pack(glm::uvec3(64, 0, 37), S64Face::NegZ, 255);
+        tctx.assert_now(
+            vert.pos() == glm::uvec3(64, 0, 37) && vert.face() == S64Face::NegZ &&
+                vert.type() == 255,
+            "Mesh vertex packing round trips");
+    }
+
+    {
+        Sparse64Tree tree(3);
+        tree.set_voxel(5, 6, 7, 3);
+        const std::vector<S64ChunkMesh> meshes = mesh_serial(tree);
+        tctx.assert_now(
+            meshes.size() == 1 && total_quads(meshes) == 6,
+            "Single voxel meshes into 6 quads, got {}", total_quads(meshes));
+        tctx.assert_now(matches_voxels(tree, meshes), "Single voxel mesh covers it");
+    }
+
+    {
+        Sparse64Tree tree(3);
+        tree.fill_aabb(AABB(glm::vec3(0), glm::vec3(64)), 1);
+        const std::vector<S64ChunkMesh> meshes = mesh_serial(tree);
+        tctx.assert_now(
+            total_quads(meshes) == 6, "Full chunk meshes into 6 quads, got {}",
+            total_quads(meshes));
+        tctx.assert_now(matches_voxels(tree, meshes), "Full chunk mesh covers it");
+    }
+
+    {
+        // two halves of a box, of different types, only merge within each half
+        Sparse64Tree tree(3);
+        tree.fill_aabb(AABB(glm::vec3(8), glm::vec3(16, 24, 24)), 1);
+        tree.fill_aabb(AABB(glm::vec3(16, 8, 8), glm::vec3(24, 24, 24)), 2);
+        const std::vector<S64ChunkMesh> meshes = mesh_serial(tree);
+        tctx.assert_now(
+            total_quads(meshes) == 10, "Two typed halves mesh into 10 quads, got {}",
+            total_quads(meshes));
+        tctx.assert_now(
+            matches_voxels(tree, meshes), "Two typed halves mesh covers them");
+    }
+
+    {
+        // smaller than a chunk, with voxels against every side of the tree
+        Sparse64Tree tree(2);
+        tree.fill_aabb(AABB(glm::vec3(0), glm::vec3(16, 1, 16)), 1);
+        tree.set_voxel(15, 15, 15, 2);
+        tree.set_voxel(0, 9, 15, 3);
+        const std::vector<S64ChunkMesh> meshes = mesh_serial(tree);
+        tctx.assert_now(matches_voxels(tree, meshes), "Tree smaller than a chunk meshes");
+        tctx.assert_now(
+            same_meshes(meshes, S64Mesher::mesh_tree(tree, async_ctx->executor())),
+            "Tree smaller than a chunk meshes the same in parallel");
+    }
+
+    {
+        // shapes across chunk borders, mixed with scattered voxels of other types
+        Sparse64Tree tree(4);
+        tree.fill_sphere(glm::vec3(90, 100, 80), 50.0f, 1);
+        tree.fill_aabb(AABB(glm::vec3(40, 60, 120), glm::vec3(200, 70, 136)), 2);
+        tree.fill_aabb(AABB(glm::vec3(192), glm::vec3(256)), 4);
+
+        std::mt19937                       rng(19);
+        std::uniform_int_distribution<u32> coord(0, 255);
+        std::uniform_int_distribution<u32> type(0, 3);
+        for (u32 i = 0; i < 20000; ++i)
+            tree.set_voxel(coord(rng), coord(rng), coord(rng), type(rng));
+
+        const std::vector<S64ChunkMesh> meshes = mesh_serial(tree);
+        tctx.assert_now(
+            matches_voxels(tree, meshes), "Mixed tree mesh covers every face");
+
+        const std::vector<S64ChunkMesh> parallel =
+            S64Mesher::mesh_tree(tree, async_ctx->executor());
+        tctx.assert_now(
+            same_meshes(meshes, parallel), "Mixed tree meshes the same in parallel");
+    }
+
+    {
+        // the inside of a uniform node is never visited
+        Sparse64Tree tree(5);
+        tree.fill_aabb(tree.bounding_box(), 7);
+        const std::vector<S64ChunkMesh> meshes =
+            S64Mesher::mesh_tree(tree, async_ctx->executor());
+
+        bool full = true;
+        for (const S64ChunkMesh& mesh : meshes)
+            for (usize q = 0; q < mesh.vertices.size(); q += 4)
+            {
+                const glm::uvec3 span =
+                    mesh.vertices[q + 2].pos() - mesh.vertices[q].pos();
+                full &= mesh.vertices[q].type() == 7 &&
+                    span.x + span.y + span.z == 2 * S64Mesher::k_chunk_size;
+            }
+        tctx.assert_now(
+            meshes.size() == 16 * 16 * 6 - 12 * 16 + 8 && total_quads(meshes) == 6 * 256,
+            "Solid tree meshes only its surface, {} chunks, {} quads", meshes.size(),
+            total_quads(meshes));
+        tctx.assert_now(full, "Solid tree meshes into whole chunk faces");
+    }
+
+    LOG_TRACE("--- Performance Benchmarks ---");
+
+    {
+        auto terrain = [](const glm::vec3& p)
+        {
+            return p.y - 400.0f - 60.0f * std::sin(p.x * 0.01f) * std::cos(p.z * 0.013f) -
+                8.0f * std::sin(p.x * 0.11f + p.z * 0.07f);
+        };
+        const f32 lipschitz = 1.0f + 60.0f * 0.013f + 8.0f * 0.13f;
+
+        Sparse64Tree ground(5);
+        ground.fill_sdf(terrain, 2, async_ctx->executor(), lipschitz);
+        // a band of ore scattered through the ground, so chunks hold mixed types
+        ground.fill_cylinder(
+            glm::vec3(0, 380, 500), glm::vec3(1024, 380, 500), 40.0f, 5);
+
+        Stopwatch sw;
+        const std::vector<S64ChunkMesh> serial = mesh_serial(ground);
+        f64 serial_elapsed                     = sw.elapsed();
+
+        sw.reset();
+        const std::vector<S64ChunkMesh> parallel =
+            S64Mesher::mesh_tree(ground, async_ctx->executor());
+        f64 parallel_elapsed = sw.elapsed();
+
+        // faces a mesher without merging would emit
+        usize faces = 0;
+        for (const S64ChunkMesh& mesh : serial)
+            for (usize q = 0; q < mesh.vertices.size(); q += 4)
+            {
+                const glm::uvec3 lo = glm::min(
+                    mesh.vertices[q].pos(), mesh.vertices[q + 2].pos());
+                const glm::uvec3 hi = glm::max(
+                    mesh.vertices[q].pos(), mesh.vertices[q + 2].pos());
+                const glm::uvec3 size = glm::max(hi - lo, glm::uvec3(1));
+                faces += static_cast<usize>(size.x) * size.y * size.z;
+            }
+
+        LOG_TRACE(
+            "greedy mesh of 1024^3 terrain: {:.3f}ms serial, {:.3f}ms on the executor, "
+            "{} chunks, {} quads for {} faces ({:.1f}x fewer)",
+            serial_elapsed * 1000.0, parallel_elapsed * 1000.0, parallel.size(),
+            total_quads(parallel), faces,
+            static_cast<f64>(faces) / static_cast<f64>(total_quads(parallel)));
+        tctx.assert_now(same_meshes(serial, parallel), "benchmark: meshes match");
+    }
+
+    LOG_TRACE("--- End Benchmarks ---");
+
+    return tctx.is_failure();
+}
@@ -1,11 +1,31 @@
 // Unit-like checks for SparseVoxelOctree128
 
+#include <engine/serial/serde.h>
 #include <test.h>
+#include <time/stopwatch.h>
 #include <time/time.h>
+#include <cmath>
+#include <cstring>
+#include <vector>
 #include <vox/store/svo.h>
 
 using namespace v;
 
+/// A chunk shipped as a plain array of voxels through the serde layer
+struct DenseChunk {
+    std::vector<u16> voxels;
+
+    SERDE_IMPL(DenseChunk)
+};
+
+/// Returns every voxel of a tree
+static std::vector<u16> dense_voxels(const SparseVoxelOctree128& svo)
+{
+    std::vector<u16> voxels(SparseVoxelOctree128::dense_size);
+    svo.decode_to_dense(voxels);
+    return voxels;
+}
+
 int main()
 {
     auto [engine, tctx] = testing::init_test("svo");
@@ -44,5 +64,380 @@ int main()
     tctx.assert_now(svo.get(0, 0, 0) == 0, "block cleared");
     tctx.assert_now(svo.is_empty(), "tree empty after block clear");
 
+    // stats are kept in step with the nodes
+    svo.set(100, 20, 3, 5);
+    VoxelStoreStats stats = svo.stats();
+    tctx.assert_now(
+        stats.interior_nodes == 7 && stats.uniform_nodes == 1,
+        "single voxel builds one path of nodes");
+    tctx.assert_now(stats.node_count() == svo.node_count(), "stats match node count");
+
+    for (int i = 0; i < 2000; ++i)
+        svo.set((i * 37) % 128, (i * 11) % 128, (i * 5) % 128, i % 4);
+    stats = svo.stats();
+    tctx.assert_now(
+        stats.node_count() == svo.node_count(), "stats match node count after edits");
+    tctx.assert_now(
+        stats.collapses > 0 && stats.expansions > 0,
+        "stats count collapses and expansions");
+
+    svo.clear();
+    tctx.assert_now(svo.stats().node_count() == 0, "clear resets the stats");
+    tctx.assert_now(svo.stats().reserved_bytes == 0, "clear releases the node pool");
+
+    // released nodes are reused before the pool grows
+    svo.set(1, 2, 3, 9);
+    usize reserved = 0;
+    for (int i = 0; i < 2000; ++i)
+    {
+        if (i == 1000)
+            reserved = svo.stats().reserved_bytes;
+        svo.set((i * 37) % 128, (i * 11) % 128, (i * 5) % 128, 9);
+        svo.set((i * 37) % 128, (i * 11) % 128, (i * 5) % 128, 0);
+    }
+    tctx.assert_now(
+        svo.get(1, 2, 3) == 9 && svo.stats().reserved_bytes == reserved,
+        "node pool reuses released nodes, {} bytes reserved",
+        svo.stats().reserved_bytes);
+    svo.clear();
+
+    // the same edits through a cursor and set must build the same tree
+    SparseVoxelOctree128         twin;
+    SparseVoxelOctree128::Cursor cursor(svo);
+    bool                         cursor_matches = true;
+    u32                          state          = 3;
+    for (int i = 0; i < 20000; ++i)
+    {
+        state = state * 1664525u + 1013904223u;
+        // mostly neighbors, with the odd jump across the tree
+        const int x = (i / 64 * 3 + (state >> 30)) % 128;
+        const int y = (i / 8) % 128;
+        const int z = (state >> 29) < 7 ? i % 8 : (state >> 12) % 128;
+        const u16 v = (state >> 27) % 3;
+        if (state >> 31)
+            cursor_matches &= cursor.get(x, y, z) == twin.get(x, y, z);
+        cursor.set(x, y, z, v);
+        twin.set(x, y, z, v);
+    }
+    for (int i = 0; i < 20000; ++i)
+    {
+        const int x = (i * 37) % 128, y = (i * 11) % 128, z = (i * 5) % 128;
+        cursor_matches &= cursor.get(x, y, z) == svo.get(x, y, z) &&
+            svo.get(x, y, z) == twin.get(x, y, z);
+    }
+    cursor_matches &= cursor.get(128, 0, 0) == 0 && cursor.get(0, -1, 0) == 0;
+    tctx.assert_now(cursor_matches, "cursor reads and writes match get and set");
+    tctx.assert_now(
+        svo.node_count() == twin.node_count() &&
+            svo.stats().node_count() == svo.node_count(),
+        "cursor writes collapse like set");
+
+    {
+        // bulk fills and dense copies must match voxel by voxel writes
+        SparseVoxelOctree128 boxed;
+        SparseVoxelOctree128 voxelwise;
+        u32                  seed = 11;
+        auto                 next = [&](u32 range)
+        {
+            seed = seed * 1664525u + 1013904223u;
+            return static_cast<i32>((seed >> 8) % range);
+        };
+        for (int b = 0; b < 40; ++b)
+        {
+            const i32 x0 = next(150) - 10, y0 = next(150) - 10, z0 = next(150) - 10;
+            const i32 x1 = x0 + next(40), y1 = y0 + next(40), z1 = z0 + next(40);
+            const u16 v  = static_cast<u16>(next(4));
+            boxed.fill_box(x0, y0, z0, x1, y1, z1, v);
+            for (int x = std::max(x0, 0); x < std::min(x1, 128); ++x)
+                for (int y = std::max(y0, 0); y < std::min(y1, 128); ++y)
+                    for (int z = std::max(z0, 0); z < std::min(z1, 128); ++z)
+                        voxelwise.set(x, y, z, v);
+        }
+
+        std::vector<u16> dense(SparseVoxelOctree128::dense_size);
+        boxed.decode_to_dense(dense);
+        bool matches = true;
+        for (int y = 0; y < 128; ++y)
+            for (int z = 0; z < 128; ++z)
+                for (int x = 0; x < 128; ++x)
+                    matches &= dense[x + 128 * (z + 128 * y)] == voxelwise.get(x, y, z);
+        tctx.assert_now(matches, "fill_box matches set, decode_to_dense matches get");
+        tctx.assert_now(
+            boxed.stats().node_count() == boxed.node_count(),
+            "fill_box keeps the stats in step");
+
+        SparseVoxelOctree128 rebuilt;
+        rebuilt.set(3, 3, 3, 1);
+        rebuilt.fill_from_dense(dense);
+        std::vector<u16> round_trip(SparseVoxelOctree128::dense_size);
+        rebuilt.decode_to_dense(round_trip);
+        tctx.assert_now(round_trip == dense, "fill_from_dense round trips");
+        tctx.assert_now(
+            rebuilt.node_count() <= voxelwise.node_count() &&
+                rebuilt.stats().node_count() == rebuilt.node_count(),
+            "fill_from_dense collapses like set, {} nodes vs {}", rebuilt.node_count(),
+            voxelwise.node_count());
+
+        std::fill(dense.begin(), dense.end(), 3);
+        rebuilt.fill_from_dense(dense);
+        tctx.assert_now(
+            rebuilt.node_count() == 1 && rebuilt.get(127, 0, 64) == 3,
+            "uniform dense data collapses to one leaf");
+        std::fill(dense.begin(), dense.end(), 0);
+        rebuilt.fill_from_dense(dense);
+        tctx.assert_now(rebuilt.is_empty(), "empty dense data builds an empty tree");
+
+        boxed.fill_box(-5, -5, -5, 200, 200, 200, 0);
+        tctx.assert_now(
+            boxed.is_empty() && boxed.node_count() == 0, "clearing fill_box empties");
+    }
+
+    {
+        // encodings round trip, pack back to back, and reject truncated data
+        SparseVoxelOctree128 mixed;
+        mixed.fill_box(0, 0, 0, 128, 40, 128, 1);
+        mixed.fill_box(30, 20, 10, 90, 70, 50, 40000);
+        for (int i = 0; i < 5000; ++i)
+            mixed.set((i * 37) % 128, (i * 11) % 128, (i * 5) % 128, i % 300);
+
+        SparseVoxelOctree128 empty;
+        std::vector<u8>      bytes;
+        mixed.encode(bytes);
+        const usize mixed_size = bytes.size();
+        empty.encode(bytes);
+        tctx.assert_now(bytes.size() == mixed_size + 1, "empty tree encodes to a byte");
+
+        SparseVoxelOctree128 decoded;
+        SparseVoxelOctree128 decoded_empty;
+        decoded_empty.set(1, 1, 1, 1);
+        const usize read = decoded.decode(bytes);
+        decoded_empty.decode(std::span(bytes).subspan(read));
+        tctx.assert_now(
+            read == mixed_size && dense_voxels(decoded) == dense_voxels(mixed),
+            "decode reads back what encode wrote");
+        tctx.assert_now(
+            decoded.node_count() == mixed.node_count() &&
+                decoded.stats().node_count() == decoded.node_count(),
+            "decode rebuilds the same nodes");
+        tctx.assert_now(decoded_empty.is_empty(), "decode of an empty tree empties");
+
+        bool threw = false;
+        try
+        {
+            decoded.decode(std::span(bytes.data(), mixed_size - 1));
+        }
+        catch (const std::runtime_error&)
+        {
+            threw = true;
+        }
+        tctx.assert_now(threw, "decode rejects truncated data");
+    }
+
+    // 6 and 26 neighbor stencils over a sphere
+    svo.clear();
+    for (int x = 0; x < 128; ++x)
+        for (int y = 0; y < 128; ++y)
+            for (int z = 0; z < 128; ++z)
+                if ((x - 64) * (x - 64) + (y - 64) * (y - 64) + (z - 64) * (z - 64) <
+                    50 * 50)
+                    svo.set(x, y, z, 1);
+
+    auto stencil = [](auto&& read, int radius_sq)
+    {
+        usize solid = 0;
+        for (int z = 0; z < 128; ++z)
+            for (int y = 0; y < 128; ++y)
+                for (int x = 0; x < 128; ++x)
+                    for (int dz = -1; dz <= 1; ++dz)
+                        for (int dy = -1; dy <= 1; ++dy)
+                            for (int dx = -1; dx <= 1; ++dx)
+                                if (dx * dx + dy * dy + dz * dz <= radius_sq)
+                                    solid += read(x + dx, y + dy, z + dz) != 0;
+        return solid;
+    };
+
+    for (int radius_sq : { 1, 3 })
+    {
+        Stopwatch   sw;
+        const usize plain = stencil(
+            [&](int x, int y, int z)
+            {
+                if (static_cast<u32>(x | y | z) >= 128)
+                    return u16(0);
+                return svo.get(x, y, z);
+            },
+            radius_sq);
+        f64 plain_elapsed = sw.elapsed();
+
+        SparseVoxelOctree128::Cursor reader(svo);
+        sw.reset();
+        const usize cursored =
+            stencil([&](int x, int y, int z) { return reader.get(x, y, z); }, radius_sq);
+        f64 cursor_elapsed = sw.elapsed();
+
+        LOG_TRACE(
+            "{}-neighbor stencil over 128^3: get {:.3f}ms, cursor {:.3f}ms",
+            radius_sq == 1 ? 6 : 26, plain_elapsed * 1000.0, cursor_elapsed * 1000.0);
+        tctx.assert_now(plain == cursored, "cursor stencil matches get");
+    }
+
+    {
+        // generating and unloading chunks of rough terrain
+        std::vector<SparseVoxelOctree128> chunks(8);
+        Stopwatch                         sw;
+        for (usize c = 0; c < chunks.size(); ++c)
+        {
+            SparseVoxelOctree128::Cursor cursor(chunks[c]);
+            for (int z = 0; z < 128; ++z)
+                for (int y = 0; y < 128; ++y)
+                    for (int x = 0; x < 128; ++x)
+                    {
+                        const f32 wave = 20.0f * std::sin(x * 0.1f) * std::cos(z * 0.07f);
+                        const int height =
+                            60 + static_cast<int>(c) * 3 + static_cast<int>(wave);
+                        if (y < height)
+                            cursor.set(x, y, z, y < height - 3 ? 1 : 2 + (x ^ z) % 3);
+                    }
+        }
+        f64 build_elapsed = sw.elapsed();
+
+        VoxelStoreStats stats{};
+        for (const SparseVoxelOctree128& chunk : chunks)
+            stats += chunk.stats();
+
+        sw.reset();
+        for (SparseVoxelOctree128& chunk : chunks)
+            chunk.clear();
+        f64 clear_elapsed = sw.elapsed();
+
+        LOG_TRACE(
+            "{} terrain chunks: build {:.3f}ms, {} nodes in {:.2f}MB, clear {:.3f}ms",
+            chunks.size(), build_elapsed * 1000.0, stats.node_count(),
+            stats.reserved_bytes / (1024.0 * 1024.0), clear_elapsed * 1000.0);
+        tctx.assert_now(chunks[0].is_empty(), "cleared chunks are empty");
+    }
+
+    {
+        // generating a terrain chunk voxel by voxel, by columns and from dense data
+        std::vector<u16> dense(SparseVoxelOctree128::dense_size, 0);
+        std::vector<int> heights(128 * 128);
+        for (int z = 0; z < 128; ++z)
+            for (int x = 0; x < 128; ++x)
+            {
+                const f32 wave = 20.0f * std::sin(x * 0.1f) * std::cos(z * 0.07f);
+                const int height     = 60 + static_cast<int>(wave);
+                heights[x + 128 * z] = height;
+                for (int y = 0; y < height; ++y)
+                    dense[x + 128 * (z + 128 * y)] = y < height - 3 ? 1 : 2;
+            }
+
+        SparseVoxelOctree128 voxelwise;
+        Stopwatch            sw;
+        for (int z = 0; z < 128; ++z)
+            for (int y = 0; y < 128; ++y)
+                for (int x = 0; x < 128; ++x)
+                    voxelwise.set(x, y, z, dense[x + 128 * (z + 128 * y)]);
+        f64 set_elapsed = sw.elapsed();
+
+        SparseVoxelOctree128 columns;
+        sw.reset();
+        for (int z = 0; z < 128; ++z)
+            for (int x = 0; x < 128; ++x)
+            {
+                const int height = heights[x + 128 * z];
+                columns.fill_box(x, 0, z, x + 1, height - 3, z + 1, 1);
+                columns.fill_box(x, height - 3, z, x + 1, height, z + 1, 2);
+            }
+        f64 box_elapsed = sw.elapsed();
+
+        SparseVoxelOctree128 bulk;
+        sw.reset();
+        bulk.fill_from_dense(dense);
+        f64 dense_elapsed = sw.elapsed();
+
+        std::vector<u16> decoded(SparseVoxelOctree128::dense_size);
+        sw.reset();
+        bulk.decode_to_dense(decoded);
+        f64 decode_elapsed = sw.elapsed();
+
+        sw.reset();
+        usize solid = 0;
+        for (int y = 0; y < 128; ++y)
+            for (int z = 0; z < 128; ++z)
+                for (int x = 0; x < 128; ++x)
+                    solid += bulk.get(x, y, z) != 0;
+        f64 get_elapsed = sw.elapsed();
+
+        LOG_TRACE(
+            "terrain chunk: set {:.3f}ms, fill_box columns {:.3f}ms, fill_from_dense "
+            "{:.3f}ms; decode_to_dense {:.3f}ms, get every voxel {:.3f}ms",
+            set_elapsed * 1000.0, box_elapsed * 1000.0, dense_elapsed * 1000.0,
+            decode_elapsed * 1000.0, get_elapsed * 1000.0);
+
+        std::vector<u16> from_columns(SparseVoxelOctree128::dense_size);
+        columns.decode_to_dense(from_columns);
+        tctx.assert_now(
+            decoded == dense && from_columns == dense && solid > 0,
+            "bulk chunk builds match the dense data");
+    }
+
+    {
+        // shipping a terrain chunk: encoded, as a raw dump, and as CBOR
+        SparseVoxelOctree128 chunk;
+        for (int z = 0; z < 128; ++z)
+            for (int x = 0; x < 128; ++x)
+            {
+                const f32 wave = 20.0f * std::sin(x * 0.1f) * std::cos(z * 0.07f);
+                const int height = 60 + static_cast<int>(wave);
+                chunk.fill_box(x, 0, z, x + 1, height - 3, z + 1, 1);
+                chunk.fill_box(x, height - 3, z, x + 1, height, z + 1, 2 + (x ^ z) % 3);
+            }
+
+        Stopwatch       sw;
+        std::vector<u8> encoded;
+        chunk.encode(encoded);
+        f64 encode_elapsed = sw.elapsed();
+
+        SparseVoxelOctree128 decoded;
+        sw.reset();
+        decoded.decode(encoded);
+        f64 decode_elapsed = sw.elapsed();
+
+        sw.reset();
+        std::vector<u16> dump = dense_voxels(chunk);
+        std::vector<u8>  raw(dump.size() * sizeof(u16));
+        std::memcpy(raw.data(), dump.data(), raw.size());
+        f64 dump_elapsed = sw.elapsed();
+
+        SparseVoxelOctree128 from_dump;
+        sw.reset();
+        std::memcpy(dump.data(), raw.data(), raw.size());
+        from_dump.fill_from_dense(dump);
+        f64 load_elapsed = sw.elapsed();
+
+        sw.reset();
+        const std::vector<std::byte> cbor = DenseChunk{ dump }.serialize();
+        f64 cbor_write_elapsed            = sw.elapsed();
+
+        SparseVoxelOctree128 from_cbor;
+        sw.reset();
+        from_cbor.fill_from_dense(
+            DenseChunk::parse(reinterpret_cast<const u8*>(cbor.data()), cbor.size())
+                .voxels);
+        f64 cbor_read_elapsed = sw.elapsed();
+
+        LOG_TRACE(
+            "terrain chunk ({} nodes): encoded {} bytes in {:.3f}ms, decoded {:.3f}ms; "
+            "raw dump {} bytes {:.3f}ms, load {:.3f}ms; CBOR {} bytes {:.3f}ms, "
+            "load {:.3f}ms",
+            chunk.node_count(), encoded.size(), encode_elapsed * 1000.0,
+            decode_elapsed * 1000.0, raw.size(), dump_elapsed * 1000.0,
+            load_elapsed * 1000.0, cbor.size(), cbor_write_elapsed * 1000.0,
+            cbor_read_elapsed * 1000.0);
+        tctx.assert_now(
+            dense_voxels(decoded) == dump && dense_voxels(from_cbor) == dump,
+            "shipped chunks arrive intact");
+    }
+
     return tctx.is_failure();
 }
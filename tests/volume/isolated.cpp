@@ -0,0 +1,13 @@
+#include "isolated.h"
+
+namespace v {
+    DenseGrid isolated_tree_to_grid(const Sparse64Tree& tree)
+    {
+        return tree.to<DenseGrid>();
+    }
+
+    Sparse64Tree isolated_grid_to_tree(const DenseGrid& grid)
+    {
+        return grid.to<Sparse64Tree>();
+    }
+} // namespace v
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <vox/store/64tree.h>
+#include <vox/store/dense_grid.h>
+
+// Conversions compiled in a translation unit that includes only the tree and the grid,
+// so the checks see what a caller that never includes svo.h would get.
+
+namespace v {
+    DenseGrid    isolated_tree_to_grid(const Sparse64Tree& tree);
+    Sparse64Tree isolated_grid_to_tree(const DenseGrid& grid);
+} // namespace v
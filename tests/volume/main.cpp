@@ -0,0 +1,234 @@
+// Checks the specialized VolumeOpImpl::to conversions between voxel stores against the
+// voxel by voxel fallback, and times both
+
+#include <test.h>
+#include <time/stopwatch.h>
+#include <time/time.h>
+#include <cmath>
+#include <vector>
+#include <vox/store/64tree.h>
+#include <vox/store/dense_grid.h>
+#include <vox/store/svo.h>
+#include "isolated.h"
+
+using namespace v;
+
+/// Returns every voxel of a tree, laid out like extract_region
+static std::vector<VoxelType> dense_voxels(const Sparse64Tree& tree)
+{
+    const AABB             box = tree.bounding_box();
+    const usize            n   = static_cast<usize>(box.max.x);
+    std::vector<VoxelType> voxels(n * n * n);
+    tree.extract_region(box, voxels);
+    return voxels;
+}
+
+static std::vector<u16> dense_voxels(const SparseVoxelOctree128& svo)
+{
+    std::vector<u16> voxels(SparseVoxelOctree128::dense_size);
+    svo.decode_to_dense(voxels);
+    return voxels;
+}
+
+/// Rolling hills of a few materials, with a sphere of mixed voxels floating above them
+static Sparse64Tree make_terrain(u8 depth)
+{
+    Sparse64Tree tree(depth);
+    const u32    extent = static_cast<u32>(tree.bounding_box().max.x);
+
+    std::vector<S64VoxelEdit> edits;
+    for (u32 z = 0; z < extent; ++z)
+        for (u32 x = 0; x < extent; ++x)
+        {
+            const f32 h =
+                extent * 0.3f + 12.f * std::sin(x * 0.05f) * std::cos(z * 0.07f);
+            for (u32 y = 0; y < static_cast<u32>(h); ++y)
+                edits.push_back(
+                    { glm::uvec3(x, y, z), static_cast<VoxelType>(y < h - 4 ? 1 : 2) });
+        }
+    tree.set_voxels(edits);
+
+    const glm::vec3 c(extent * 0.5f, extent * 0.6f, extent * 0.4f);
+    tree.fill_sphere(c, extent * 0.15f, 3);
+    for (u32 i = 0; i < 5000; ++i)
+    {
+        const glm::vec3 p =
+            c + glm::vec3((i * 37) % 31, (i * 11) % 29, (i * 7) % 23) - 15.f;
+        tree.set_voxel(glm::ivec3(p), static_cast<VoxelType>(4 + i % 5));
+    }
+    return tree;
+}
+
+int main()
+{
+    auto [engine, tctx] = testing::init_test("volume");
+
+    {
+        // integer voxels convert by value, and never turn solid voxels into air
+        tctx.assert_now(VolumeOpImpl::voxel_to<u16, u8>(300) == 255, "u16 saturates");
+        tctx.assert_now(VolumeOpImpl::voxel_to<u16, u8>(17) == 17, "u16 keeps value");
+        tctx.assert_now(VolumeOpImpl::voxel_to<u8, u16>(255) == 255, "u8 widens");
+    }
+
+    {
+        DenseGrid grid(glm::uvec3(5, 3, 4));
+        tctx.assert_now(grid.voxels().size() == 60, "grid holds its volume");
+        tctx.assert_now(grid.set(Coord(4, 2, 3), 9) == 1, "grid set inside");
+        tctx.assert_now(grid.set(Coord(5, 0, 0), 9) == 0, "grid set outside");
+        tctx.assert_now(grid.get(Coord(4, 2, 3)) == 9, "grid get");
+        tctx.assert_now(!grid.get(Coord(0, -1, 0)), "grid get outside");
+        tctx.assert_now(grid.voxels()[grid.index(4, 2, 3)] == 9, "grid layout");
+    }
+
+    // 64^3 fits inside the octree, 256^3 gets clipped by it
+    for (u8 depth : { 3, 4 })
+    {
+        const Sparse64Tree tree   = make_terrain(depth);
+        const auto         voxels = dense_voxels(tree);
+        const u32          extent = static_cast<u32>(tree.bounding_box().max.x);
+
+        const auto svo = tree.to<SparseVoxelOctree128>();
+        const auto ref_svo =
+            VolumeOpImpl::to_voxelwise<Sparse64Tree, SparseVoxelOctree128>(tree);
+        tctx.assert_now(
+            dense_voxels(svo) == dense_voxels(ref_svo), "tree {} to octree matches",
+            extent);
+
+        const auto back = svo.to<Sparse64Tree>();
+        tctx.assert_now(
+            back.bounding_box().max.x == 256.f, "octree becomes a tree of extent 256");
+        tctx.assert_now(
+            dense_voxels(back) ==
+                dense_voxels(
+                    VolumeOpImpl::to_voxelwise<SparseVoxelOctree128, Sparse64Tree>(svo)),
+            "octree to tree {} matches", extent);
+
+        const auto grid = tree.to<DenseGrid>();
+        tctx.assert_now(grid.size() == glm::uvec3(extent), "grid of extent {}", extent);
+        tctx.assert_now(
+            std::ranges::equal(grid.voxels(), voxels), "tree {} to grid matches", extent);
+
+        const auto from_grid = grid.to<Sparse64Tree>();
+        tctx.assert_now(
+            dense_voxels(from_grid) == voxels, "grid to tree {} round trips", extent);
+        tctx.assert_now(
+            from_grid.node_count() == tree.node_count(),
+            "grid to tree {} collapses like the original", extent);
+    }
+
+    {
+        // uneven grids are covered by the smallest tree that holds them
+        DenseGrid grid(glm::uvec3(100, 37, 70));
+        for (u32 y = 0; y < 37; ++y)
+            for (u32 z = 0; z < 70; ++z)
+                for (u32 x = 0; x < 100; ++x)
+                    grid.set(
+                        Coord(x, y, z),
+                        static_cast<VoxelType>(
+                            y < 20 ? 1 : (x * z + y) % 7 == 0 ? 5 : 0));
+
+        const auto tree = grid.to<Sparse64Tree>();
+        const auto ref  = VolumeOpImpl::to_voxelwise<DenseGrid, Sparse64Tree>(grid);
+        tctx.assert_now(tree.bounding_box().max.x == 256.f, "uneven grid tree extent");
+        tctx.assert_now(dense_voxels(tree) == dense_voxels(ref), "uneven grid matches");
+    }
+
+    {
+        // types past the tree's range saturate on the way down, and are kept on the
+        // way back up
+        SparseVoxelOctree128 svo;
+        svo.fill_box(0, 0, 0, 16, 16, 16, 300);
+        svo.set(20, 1, 2, 1000);
+        svo.set(21, 1, 2, 7);
+
+        const auto tree = svo.to<Sparse64Tree>();
+        tctx.assert_now(tree.get_voxel(3, 3, 3) == 255, "filled type saturates");
+        tctx.assert_now(tree.get_voxel(20, 1, 2) == 255, "single type saturates");
+        tctx.assert_now(tree.get_voxel(21, 1, 2) == 7, "small type kept");
+
+        const auto up = tree.to<SparseVoxelOctree128>();
+        tctx.assert_now(up.get(15, 15, 15) == 255, "saturated type widens");
+        tctx.assert_now(up.get(21, 1, 2) == 7, "small type widens");
+        tctx.assert_now(up.get(16, 0, 0) == 0, "air stays air");
+    }
+
+    {
+        // a caller that includes only the tree and the grid still gets the specialized
+        // conversions. Tree to grid is tens of times faster than the voxel by voxel
+        // default and grid to tree about four times, so small factors tell them apart.
+        const Sparse64Tree tree = make_terrain(4);
+        const DenseGrid    grid = tree.to<DenseGrid>();
+
+        Stopwatch       sw;
+        const DenseGrid to_grid = isolated_tree_to_grid(tree);
+        const f64       fast    = sw.elapsed();
+        sw.reset();
+        const auto ref_grid = VolumeOpImpl::to_voxelwise<Sparse64Tree, DenseGrid>(tree);
+        const f64  slow     = sw.elapsed();
+        tctx.assert_now(
+            std::ranges::equal(to_grid.voxels(), ref_grid.voxels()),
+            "isolated tree to grid matches");
+        tctx.assert_now(
+            fast * 4.0 < slow,
+            "isolated tree to grid is specialized ({:.3f}ms, {:.3f}ms)", fast * 1000.0,
+            slow * 1000.0);
+
+        sw.reset();
+        const Sparse64Tree to_tree   = isolated_grid_to_tree(grid);
+        const f64          back_fast = sw.elapsed();
+        sw.reset();
+        const auto ref_tree  = VolumeOpImpl::to_voxelwise<DenseGrid, Sparse64Tree>(grid);
+        const f64  back_slow = sw.elapsed();
+        tctx.assert_now(
+            dense_voxels(to_tree) == dense_voxels(ref_tree),
+            "isolated grid to tree matches");
+        tctx.assert_now(
+            back_fast * 2.0 < back_slow,
+            "isolated grid to tree is specialized ({:.3f}ms, {:.3f}ms)",
+            back_fast * 1000.0, back_slow * 1000.0);
+    }
+
+    {
+        // specialized conversions against the voxel by voxel fallback
+        const Sparse64Tree tree = make_terrain(4);
+        const auto         svo  = tree.to<SparseVoxelOctree128>();
+        const auto         grid = tree.to<DenseGrid>();
+
+        auto bench = [&](const char* name, auto&& fast, auto&& slow)
+        {
+            Stopwatch sw;
+            fast();
+            const f64 fast_elapsed = sw.elapsed();
+            sw.reset();
+            slow();
+            const f64 slow_elapsed = sw.elapsed();
+            LOG_TRACE(
+                "{}: specialized {:.3f}ms, voxelwise {:.3f}ms ({:.1f}x)", name,
+                fast_elapsed * 1000.0, slow_elapsed * 1000.0,
+                slow_elapsed / fast_elapsed);
+        };
+
+        bench(
+            "tree 256 to octree", [&] { return tree.to<SparseVoxelOctree128>(); },
+            [&]
+            {
+                return VolumeOpImpl::to_voxelwise<Sparse64Tree, SparseVoxelOctree128>(
+                    tree);
+            });
+        bench(
+            "octree to tree", [&] { return svo.to<Sparse64Tree>(); },
+            [&]
+            {
+                return VolumeOpImpl::to_voxelwise<SparseVoxelOctree128, Sparse64Tree>(
+                    svo);
+            });
+        bench(
+            "tree 256 to grid", [&] { return tree.to<DenseGrid>(); },
+            [&] { return VolumeOpImpl::to_voxelwise<Sparse64Tree, DenseGrid>(tree); });
+        bench(
+            "grid 256 to tree", [&] { return grid.to<Sparse64Tree>(); },
+            [&] { return VolumeOpImpl::to_voxelwise<DenseGrid, Sparse64Tree>(grid); });
+    }
+
+    return tctx.is_failure();
+}